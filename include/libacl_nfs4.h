@@ -32,6 +32,7 @@
 #define LIBACL_NFS4_H 1
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <pwd.h>
 #include <grp.h>
 #include <stdlib.h>
@@ -48,6 +49,34 @@
 #define ACL_TEXT_VERBOSE		0x0000002
 #define ACL_TEXT_APPEND_ID		0x0000004
 
+/* buffer size for the text form of a single ACE, see _nfs4_ace_to_text() */
+#define NFS4_ACE_TEXT_MAX		512
+
+/* flags for nfs4_acl_set_*_if_changed() and nfs4_acl_strip_*() */
+#define NFS4_ACL_SET_EQUIVALENT		0x0000001	/* skip if nfs4_acl_equivalent() */
+#define NFS4_ACL_SET_DRY_RUN		0x0000002	/* compare only, do not write */
+
+/* flags for nfs4_acl_canonicalize() */
+#define NFS4_ACL_CANON_STRICT		0x0000001	/* refuse changes of meaning */
+
+/* flags for nfs4_acl_patch() */
+#define NFS4_ACL_PATCH_STRICT		0x0000001	/* entries must be at recorded index */
+
+/* nfs4_acl_ctx limits */
+#define NFS4_ACL_CTX_ERRBUF		1024	/* size of the last error message */
+#define NFS4_ACL_CTX_NAME_MAX		128	/* longer names are not cached */
+
+/* flags for nfs4_acl_walk() */
+#define NFS4_ACL_WALK_XDEV		0x0000001	/* stay on the filesystem of the root */
+#define NFS4_ACL_WALK_LOGICAL		0x0000002	/* follow symbolic links */
+#define NFS4_ACL_WALK_STAT		0x0000004	/* stat() every entry */
+#define NFS4_ACL_WALK_PER_FS		0x0000008	/* queue per filesystem */
+#define NFS4_ACL_WALK_ACL		0x0000010	/* read ACLs ahead into e->acl */
+
+/* return values of nfs4_acl_walk_fn other than 0 and -1 */
+#define NFS4_ACL_WALK_SKIP		1	/* do not descend into this directory */
+#define NFS4_ACL_WALK_STOP		2	/* end the walk */
+
 #if 0 /* see comment in nfs4_new_ace.c */
 /* flags used to simulate posix default ACLs */
 #define NFS4_ACE_MASK_IGNORE (NFS4_ACE_DELETE | NFS4_ACE_WRITE_OWNER \
@@ -129,6 +158,188 @@ struct ace_container {
 
 TAILQ_HEAD(ace_container_list_head, ace_container);
 
+/*
+ * Precomputed trivial ACL for a given set of POSIX permission bits.
+ * `acl` links the entries of `aces` and may be read with the usual
+ * accessors, but is shared and must never be modified or freed.
+ * aces[0 .. nprefix - 1] are the owner@/group@ entries that precede
+ * inherited entries in acl_nfs4_calculate_inherited_acl(). `xdr` holds
+ * the ACL already packed for setxattr.
+ */
+#define NFS4_TRIVIAL_MAXACES	6
+
+struct nfs4_trivial_acl {
+	struct nfs4_acl		acl;
+	u32			nprefix;
+	struct nfs4_ace_list	entries;
+	struct nfs4_ace		aces[NFS4_TRIVIAL_MAXACES];
+	size_t			xdrsize;
+	u32			xdr[ACES_2_XDRSIZE(NFS4_TRIVIAL_MAXACES) / sizeof (u32)];
+};
+
+/*
+ * What nfs4_acl_minimize() removed.
+ */
+struct nfs4_acl_minimize_report {
+	u32			empty;		/* entries with empty mask */
+	u32			merged;		/* merged into an earlier entry */
+	u32			shadowed;	/* fully decided by earlier entries */
+	u32			narrowed;	/* entries kept with fewer bits */
+};
+
+/*
+ * Edit script produced by nfs4_acl_diff() and applied by
+ * nfs4_acl_patch(). Each index refers to the ACL as left by the
+ * preceding edits.
+ */
+enum nfs4_acl_edit_op {
+	NFS4_ACL_EDIT_INSERT = 0,
+	NFS4_ACL_EDIT_DELETE,
+	NFS4_ACL_EDIT_MODIFY,
+};
+
+struct nfs4_acl_edit {
+	enum nfs4_acl_edit_op	op;
+	u32			index;
+	struct nfs4_ace		old_ace;	/* DELETE and MODIFY */
+	struct nfs4_ace		new_ace;	/* INSERT and MODIFY */
+};
+
+struct nfs4_acl_diff {
+	bool			set_aclflags;
+	nfs4_acl_aclflags_t	aclflags4;
+	u32			nedits;
+	struct nfs4_acl_edit	*edits;
+};
+
+/*
+ * Tree walk, see acl_nfs4_walk.c.
+ */
+enum nfs4_acl_walk_order {
+	NFS4_ACL_WALK_ORDER_NAME = 0,	/* strcoll() of names */
+	NFS4_ACL_WALK_ORDER_NONE,	/* as returned by the filesystem */
+	NFS4_ACL_WALK_ORDER_INODE,	/* inode number */
+};
+
+enum nfs4_acl_walk_type {
+	NFS4_ACL_WALK_DIR = 0,
+	NFS4_ACL_WALK_FILE,
+	NFS4_ACL_WALK_SYMLINK,
+	NFS4_ACL_WALK_OTHER,
+};
+
+/*
+ * An entry passed to nfs4_acl_walk_fn. ACL functions take it as
+ * (dirfd, accpath), e.g. nfs4_acl_get_at(e->dirfd, e->accpath). `accpath`
+ * is `name` except for the root and for symbolic links followed with
+ * NFS4_ACL_WALK_LOGICAL, whose resolved path is used with AT_FDCWD.
+ * `st` is only complete if `have_stat` is set; otherwise the entry was
+ * not stat()ed and only st_mode's file type, st_ino and st_dev (taken
+ * from the parent) are filled in.
+ *
+ * With NFS4_ACL_WALK_ACL, `acl` is the ACL of a file or directory read
+ * ahead with the other entries of its chunk, or NULL if it was not
+ * (the root, other types, the read failed, or the entry was replaced
+ * since its directory was read), in which case fn reads it itself. fn
+ * may keep it by setting e->acl to NULL; otherwise it is freed once fn
+ * returns.
+ */
+struct nfs4_acl_walk_entry {
+	struct nfs4_acl_walk_entry	*parent;	/* NULL for the root */
+	const char			*path;		/* for messages */
+	const char			*name;
+	const char			*accpath;
+	int				dirfd;
+	int				level;		/* 0 for the root */
+	enum nfs4_acl_walk_type		type;
+	bool				have_stat;
+	struct stat			st;
+	unsigned int			worker;		/* 0 .. jobs - 1 */
+	struct nfs4_acl_walk_fs		*fs;		/* NFS4_ACL_WALK_PER_FS only */
+	void				*data;		/* free for the caller */
+	struct nfs4_acl			*acl;		/* NFS4_ACL_WALK_ACL only */
+};
+
+/*
+ * A filesystem met by a NFS4_ACL_WALK_PER_FS walk. `path` is the first
+ * directory on it that was reached. nentries and elapsed, the time from
+ * the start of its first task to the end of its last, are filled in
+ * before nfs4_acl_walk_fs_fn is called at the end of the walk.
+ */
+struct nfs4_acl_walk_fs {
+	dev_t				dev;
+	const char			*path;
+	size_t				nentries;
+	double				elapsed;	/* seconds */
+	u_int64_t			counter;	/* free for the caller */
+};
+
+/*
+ * Called for every entry, from `jobs` threads at once if jobs > 1.
+ * Returns 0 to continue, NFS4_ACL_WALK_SKIP or NFS4_ACL_WALK_STOP, or
+ * -1 if processing the entry failed, which counts as an error and
+ * skips the entry if it is a directory.
+ */
+typedef int (*nfs4_acl_walk_fn)(struct nfs4_acl_walk_entry *e, void *arg);
+
+/*
+ * Called when the walk itself fails on `path`. May return
+ * NFS4_ACL_WALK_STOP to end the walk.
+ */
+typedef int (*nfs4_acl_walk_error_fn)(const char *path, int error, void *arg);
+
+typedef void (*nfs4_acl_walk_fs_fn)(const struct nfs4_acl_walk_fs *fs, void *arg);
+
+/*
+ * Called, from any thread, once directory `e` and everything below it
+ * has been walked without errors; not if the walk was stopped. Entries
+ * that fn skipped count as walked.
+ */
+typedef void (*nfs4_acl_walk_done_fn)(struct nfs4_acl_walk_entry *e, void *arg);
+
+struct nfs4_acl_walk {
+	int				flags;
+	enum nfs4_acl_walk_order	order;
+	unsigned int			jobs;		/* 0 and 1 both mean one thread */
+	nfs4_acl_walk_fn		fn;
+	nfs4_acl_walk_error_fn		error_fn;	/* may be NULL */
+	void				(*free_data)(struct nfs4_acl_walk_entry *e);
+	void				*arg;
+	size_t				max_mem;	/* 0, or stream within this many bytes */
+	unsigned int			fs_jobs;	/* per filesystem, 0 for `jobs` */
+	nfs4_acl_walk_fs_fn		fs_fn;		/* may be NULL */
+	nfs4_acl_walk_done_fn		done_fn;	/* may be NULL */
+	unsigned int			latency_target;	/* usec p99 of fn, 0 for fixed jobs */
+	unsigned int			max_ops;	/* fn calls per second, 0 unlimited */
+	unsigned int			uring_depth;	/* NFS4_ACL_WALK_ACL, per thread */
+	/* set by nfs4_acl_walk() */
+	size_t				nentries;
+	size_t				nerrors;
+	bool				stopped;
+	size_t				peak_mem;	/* if max_mem was set */
+	unsigned int			final_jobs;	/* fn calls allowed at once at the end */
+};
+
+/*
+ * Library context. Holds per-caller caches and error state so that
+ * several threads may use the library concurrently, one context each.
+ * A context must not be used by two threads at the same time.
+ */
+struct nfs4_acl_ctx;
+
+/* `priority` is a syslog(3) priority */
+typedef void (*nfs4_acl_log_fn)(void *arg, int priority, const char *msg);
+
+/*
+ * Allocator for memory owned by the context (caches, buffers). ACLs
+ * returned to the caller are always allocated with malloc() so that
+ * they can be released with nfs4_free_acl().
+ */
+struct nfs4_acl_allocator {
+	void			*(*malloc)(size_t size);
+	void			(*free)(void *ptr);
+};
+
 /**** Public functions ****/
 
 /** Manipulation functions **/
@@ -137,6 +348,7 @@ extern struct nfs4_acl *	acl_nfs4_copy_acl(struct nfs4_acl *);
 extern struct nfs4_acl *	acl_nfs4_xattr_load(char *, int, u32);
 extern struct nfs4_acl *	acl_nfs4_strip(struct nfs4_acl *);
 extern size_t			acl_nfs4_xattr_pack(struct nfs4_acl *, char**);
+extern size_t			acl_nfs4_xattr_pack_buf(struct nfs4_acl *, char *, size_t);
 
 extern void			nfs4_free_acl(struct nfs4_acl *);
 extern int			nfs4_acl_is_trivial_np(struct nfs4_acl *acl, int *trivialp);
@@ -149,9 +361,16 @@ extern struct nfs4_ace *	nfs4_new_ace(int is_directory, nfs4_acl_type_t type, nf
 					     nfs4_acl_perm_t access_mask, nfs4_acl_who_t whotype, nfs4_acl_id_t id);
 extern struct nfs4_acl *	nfs4_new_acl(u32);
 
+/** Reference counting **/
+extern struct nfs4_acl *	nfs4_acl_ref(struct nfs4_acl *acl);
+extern void			nfs4_acl_unref(struct nfs4_acl *acl);
+extern bool			acl_nfs4_detach(struct nfs4_acl *acl, struct nfs4_ace **acep);
+extern void			acl_nfs4_entries_unref(struct nfs4_ace_list *entries);
+
 extern int			nfs4_insert_file_aces(struct nfs4_acl *acl, FILE* fd, unsigned int index);
 extern int			nfs4_insert_string_aces(struct nfs4_acl *acl, const char *acl_spec, unsigned int index);
 extern int			nfs4_replace_ace(struct nfs4_acl *acl, struct nfs4_ace *old_ace, struct nfs4_ace *new_ace);
+extern int			nfs4_replace_ace_free(struct nfs4_acl *acl, struct nfs4_ace *old_ace, struct nfs4_ace *new_ace);
 extern int			nfs4_replace_ace_spec(struct nfs4_acl *acl, char *from_ace_spec, char *to_ace_spec);
 extern int			nfs4_remove_file_aces(struct nfs4_acl *acl, FILE *fd);
 extern int			nfs4_remove_string_aces(struct nfs4_acl *acl, char *string);
@@ -160,12 +379,160 @@ bool 				acl_nfs4_calculate_inherited_acl(struct nfs4_acl *parent_aclp,
 								 struct nfs4_acl *aclp,
 								 mode_t mode, bool skip_mode,
 								 int is_dir);
+bool				acl_nfs4_sync_mode_from_acl(mode_t *mode, struct nfs4_acl *aclp);
+bool				acl_nfs4_xattr_mode(const char *xattr, size_t size, mode_t *mode);
+
+/** Trivial ACL functions **/
+extern const struct nfs4_trivial_acl *	acl_nfs4_get_trivial(mode_t mode);
+extern struct nfs4_acl *	acl_nfs4_new_trivial_acl(mode_t mode, int is_dir);
+extern bool			acl_nfs4_append_trivial_aces(struct nfs4_acl *aclp,
+							     const struct nfs4_trivial_acl *t,
+							     u32 start, u32 end);
+extern int			acl_nfs4_xattr_is_trivial(const char *xattr, size_t size,
+							  int *trivialp);
+extern size_t			acl_nfs4_xattr_strip(const char *xattr, size_t size,
+						     char *buf, size_t bufsz);
 
 /** Get and Set ACL functions **/
 extern struct nfs4_acl * 	nfs4_acl_get_file(const char *path);
 extern struct nfs4_acl * 	nfs4_acl_get_fd(int fd);
+extern struct nfs4_acl * 	nfs4_acl_get_at(int dirfd, const char *name);
+extern ssize_t			nfs4_acl_get_xattr_file(const char *path, char *buf, size_t bufsz);
+extern ssize_t			nfs4_acl_get_xattr_fd(int fd, char *buf, size_t bufsz);
+extern ssize_t			nfs4_acl_get_xattr_at(int dirfd, const char *name, char *buf,
+						      size_t bufsz);
 extern int			nfs4_acl_set_file(struct nfs4_acl *acl, const char *path);
 extern int			nfs4_acl_set_fd(struct nfs4_acl *acl, int fd);
+extern int			nfs4_acl_set_at(struct nfs4_acl *acl, int dirfd, const char *name);
+extern int			nfs4_acl_set_xattr_file(const char *path, const char *buf, size_t size);
+extern int			nfs4_acl_set_xattr_fd(int fd, const char *buf, size_t size);
+extern int			nfs4_acl_set_xattr_at(int dirfd, const char *name, const char *buf,
+						      size_t size);
+extern int			nfs4_acl_set_trivial_file(const char *path, mode_t mode);
+extern int			nfs4_acl_set_trivial_fd(int fd, mode_t mode);
+extern int			nfs4_acl_set_file_if_changed(struct nfs4_acl *acl, const char *path,
+							     int flags, bool *writtenp);
+extern int			nfs4_acl_set_fd_if_changed(struct nfs4_acl *acl, int fd, int flags,
+							   bool *writtenp);
+extern int			nfs4_acl_set_at_if_changed(struct nfs4_acl *acl, int dirfd,
+							   const char *name, int flags,
+							   bool *writtenp);
+extern int			nfs4_acl_strip_file(const char *path, int flags, bool *writtenp);
+extern int			nfs4_acl_strip_fd(int fd, int flags, bool *writtenp);
+extern int			nfs4_acl_strip_at(int dirfd, const char *name, int flags,
+						  bool *writtenp);
+
+/* internal: (path, fd) pairs, see acl_nfs4_at.c */
+extern int			acl_nfs4_stat(const char *path, int fd, struct stat *st);
+extern ssize_t			acl_nfs4_getxattr(const char *path, int fd, const char *name,
+						  void *value, size_t size);
+extern int			acl_nfs4_setxattr(const char *path, int fd, const char *name,
+						  const void *value, size_t size, int flags);
+extern int			acl_nfs4_removexattr(const char *path, int fd, const char *name);
+#define	ACL_NFS4_NODEV			((dev_t)-1)	/* filesystem not checked */
+extern ssize_t			acl_nfs4_get_xattr(const char *path, int fd, char *buf,
+						   size_t bufsz, dev_t *devp);
+
+/** Library context functions **/
+extern struct nfs4_acl_ctx *	nfs4_acl_ctx_new(const struct nfs4_acl_allocator *alloc);
+extern void			nfs4_acl_ctx_free(struct nfs4_acl_ctx *ctx);
+extern void			nfs4_acl_ctx_set_log(struct nfs4_acl_ctx *ctx,
+						     nfs4_acl_log_fn fn, void *arg);
+extern const char *		nfs4_acl_ctx_strerror(const struct nfs4_acl_ctx *ctx);
+extern int			nfs4_acl_ctx_errno(const struct nfs4_acl_ctx *ctx);
+extern struct nfs4_acl *	nfs4_acl_ctx_get_file(struct nfs4_acl_ctx *ctx, const char *path);
+extern struct nfs4_acl *	nfs4_acl_ctx_get_fd(struct nfs4_acl_ctx *ctx, int fd);
+extern int			nfs4_acl_ctx_set_file(struct nfs4_acl_ctx *ctx,
+						      struct nfs4_acl *acl, const char *path);
+extern int			nfs4_acl_ctx_set_fd(struct nfs4_acl_ctx *ctx,
+						    struct nfs4_acl *acl, int fd);
+extern struct nfs4_acl *	nfs4_acl_ctx_from_json(struct nfs4_acl_ctx *ctx,
+						       const char *json_text, bool is_dir);
+extern struct nfs4_acl *	nfs4_acl_ctx_from_text(struct nfs4_acl_ctx *ctx,
+						       const char *acl_spec, bool is_dir);
+extern char *			nfs4_acl_ctx_to_text(struct nfs4_acl_ctx *ctx,
+						     struct nfs4_acl *acl, int flags);
+extern struct nfs4_acl *	nfs4_acl_ctx_intern(struct nfs4_acl_ctx *ctx, struct nfs4_acl *acl);
+extern struct nfs4_acl *	nfs4_acl_ctx_inherit(struct nfs4_acl_ctx *ctx,
+						     struct nfs4_acl *parent, bool is_dir);
+
+/** Batch get and set functions **/
+extern int			nfs4_acl_ctx_set_workers(struct nfs4_acl_ctx *ctx,
+							 unsigned int nworkers);
+extern ssize_t			nfs4_acl_get_many(struct nfs4_acl_ctx *ctx,
+						  const char *const paths[], size_t n,
+						  struct nfs4_acl *results[], int errors[]);
+extern ssize_t			nfs4_acl_set_many(struct nfs4_acl_ctx *ctx,
+						  struct nfs4_acl *const acls[],
+						  const char *const paths[], size_t n,
+						  int errors[]);
+extern int			nfs4_acl_ctx_set_uring(struct nfs4_acl_ctx *ctx,
+						       unsigned int depth);
+
+/** Tree walk **/
+extern int			nfs4_acl_walk(const char *path, struct nfs4_acl_walk *walk);
+extern int			nfs4_acl_walk_order_from_text(const char *str,
+							      enum nfs4_acl_walk_order *orderp);
+
+/* internal: diagnostics and identity cache of the calling thread's context */
+extern void			acl_nfs4_log(const char *fmt, ...)
+					__attribute__((format(printf, 1, 2)));
+extern bool			acl_nfs4_ctx_id_lookup(const char *name, bool is_group,
+						       nfs4_acl_id_t *idp);
+extern bool			acl_nfs4_ctx_name_lookup(nfs4_acl_id_t id, bool is_group,
+							 char *buf, size_t bufsz);
+extern void			acl_nfs4_ctx_id_store(const char *name, bool is_group,
+						      nfs4_acl_id_t id);
+extern struct nfs4_acl_ctx *	acl_nfs4_ctx_enter(struct nfs4_acl_ctx *ctx);
+extern void			acl_nfs4_ctx_leave(struct nfs4_acl_ctx *ctx,
+						   struct nfs4_acl_ctx *prev,
+						   bool failed, const char *what);
+extern struct nfs4_acl_ctx *	acl_nfs4_ctx_clone(const struct nfs4_acl_ctx *ctx);
+
+/* internal: batches for nfs4_acl_get_many() and nfs4_acl_set_many() */
+enum acl_nfs4_batch_op {
+	ACL_NFS4_BATCH_GET,
+	ACL_NFS4_BATCH_SET,
+};
+
+struct acl_nfs4_batch {
+	enum acl_nfs4_batch_op	op;
+	const char *const	*paths;
+	struct nfs4_acl		**results;	/* ACL_NFS4_BATCH_GET */
+	struct nfs4_acl *const	*acls;		/* ACL_NFS4_BATCH_SET */
+	int			*errors;
+	const ino_t		*inos;		/* GET: expected, or NULL */
+	dev_t			dev;		/* of all of inos */
+	size_t			n;
+	size_t			next;		/* next index to process */
+	size_t			nfailed;
+	u32			active;		/* workers inside the batch */
+};
+
+struct acl_nfs4_pool;
+struct acl_nfs4_uring;
+extern void			acl_nfs4_batch_complete(struct acl_nfs4_batch *b, size_t i,
+							struct nfs4_acl *acl, int error);
+extern int			acl_nfs4_get_many_ino(struct nfs4_acl_ctx *ctx,
+						      const char *const paths[],
+						      const ino_t inos[], dev_t dev,
+						      size_t n, struct nfs4_acl *results[]);
+extern struct acl_nfs4_pool **	acl_nfs4_ctx_pool(struct nfs4_acl_ctx *ctx);
+extern void			acl_nfs4_pool_destroy(struct acl_nfs4_pool *pool);
+extern struct acl_nfs4_uring **	acl_nfs4_ctx_uring(struct nfs4_acl_ctx *ctx);
+extern struct acl_nfs4_uring *	acl_nfs4_uring_new(unsigned int depth);
+extern unsigned int		acl_nfs4_uring_depth(const struct acl_nfs4_uring *ring);
+extern void			acl_nfs4_uring_free(struct acl_nfs4_uring *ring);
+extern int			acl_nfs4_uring_run(struct acl_nfs4_uring *ring,
+						   struct acl_nfs4_batch *b);
+
+#ifdef USE_SECURITY_NAMESPACE
+/** Per-filesystem xattr capability cache **/
+extern int			acl_nfs4_fs_check(const char *path, int fd,
+						  const struct stat *st, dev_t *devp);
+extern bool			acl_nfs4_fs_errno_expected(int error);
+extern void			acl_nfs4_fs_cache_invalidate(dev_t dev);
+#endif
 
 /** Conversion functions **/
 extern struct nfs4_ace *	nfs4_ace_from_text(u_int32_t is_dir, char *str);
@@ -182,6 +549,7 @@ extern struct nfs4_ace *	nfs4_get_ace_at(struct nfs4_acl *, unsigned int index);
 
 /** Display Functions **/
 extern int			nfs4_print_acl_json(char *path, int flags);
+extern int			nfs4_print_acl_json_at(int dirfd, const char *name, const char *path, int flags);
 extern void			nfs4_print_acl(FILE *fp, struct nfs4_acl *acl);
 extern int			nfs4_print_ace(FILE *fp, struct nfs4_ace *ace, u32 isdir);
 extern int			nfs4_print_ace_verbose(struct nfs4_ace * ace, u32 isdir);
@@ -194,11 +562,27 @@ extern bool			nfs4_aclflag_from_text(char *flags, nfs4_acl_aclflags_t *flags4p);
 /** misc **/
 extern bool			ace_is_equal(struct nfs4_ace *a, struct nfs4_ace *b);
 extern bool			aces_are_equal(struct nfs4_acl *a, struct nfs4_acl *b);
+extern bool			nfs4_acl_equivalent(struct nfs4_acl *a, struct nfs4_acl *b);
+extern int			nfs4_acl_canonicalize(struct nfs4_acl *acl, int flags);
+extern int			nfs4_acl_minimize(struct nfs4_acl *acl,
+						  struct nfs4_acl_minimize_report *reportp);
+
+/** Diff and patch functions **/
+extern struct nfs4_acl_diff *	nfs4_acl_diff(struct nfs4_acl *a, struct nfs4_acl *b);
+extern struct nfs4_acl_diff *	nfs4_acl_diff_new(void);
+extern int			nfs4_acl_diff_append(struct nfs4_acl_diff *d,
+						     const struct nfs4_acl_edit *e);
+extern void			nfs4_acl_diff_free(struct nfs4_acl_diff *d);
+extern int			nfs4_acl_patch(struct nfs4_acl *acl,
+					       const struct nfs4_acl_diff *d, int flags);
+extern char *			nfs4_acl_diff_to_text(const struct nfs4_acl_diff *d, int flags);
+extern struct nfs4_acl_diff *	nfs4_acl_diff_from_text(const char *text, u32 is_dir);
 extern unsigned long		strtoul_reals(char *s, int base);
 
 /** BSD NFSv4 Display Functions **/
 int	_nfs4_acl_entry_from_text(struct nfs4_acl *acl, char *, uint *index);
 char	*_nfs4_acl_to_text_np(struct nfs4_acl *acl, ssize_t *, int);
+int	_nfs4_ace_to_text(char *str, size_t size, struct nfs4_ace *entry, int flags);
 int	_nfs4_format_flags(char *str, size_t size, uint var, int verbose);
 int	_nfs4_format_access_mask(char *str, size_t size, uint var, int verbose);
 int	_nfs4_parse_flags(const char *str, uint *var);
@@ -207,6 +591,8 @@ int	_nfs4_parse_access_mask(const char *str, uint *var);
 /** JSON **/
 json_t*				_nfs4_ace_to_json(struct nfs4_ace *entry, int flags);
 json_t*				_nfs4_acl_to_json(struct nfs4_acl *aclp, int flags);
+json_t*				_nfs4_acl_diff_to_json(const struct nfs4_acl_diff *d, int flags);
+struct nfs4_acl_diff*		get_acl_diff_json(const char *json_text, bool is_dir);
 int				set_acl_path_json(const char *path, const char *json_text);
 struct nfs4_acl*		get_acl_json(const char *json_text, bool is_dir);
 
@@ -120,9 +120,15 @@ struct nfs4_ace {
 
 TAILQ_HEAD(ace_list_head, nfs4_ace);
 
+/* Entries, shared between ACL handles until one of them is modified */
+struct nfs4_ace_list {
+	struct ace_list_head	head;
+	u_int32_t		refcnt;
+};
+
 struct nfs4_acl {
 	u_int32_t		naces;
 	nfs4_acl_aclflags_t	aclflags4;
 	u_int32_t		is_directory;
-	struct ace_list_head	ace_head;
+	struct nfs4_ace_list	*entries;
 };
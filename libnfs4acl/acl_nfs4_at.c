@@ -0,0 +1,279 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "libacl_nfs4.h"
+
+/*
+ * Library functions that operate on a file take a (path, fd) pair:
+ *
+ *	path, -1	path as given, symbolic links are followed
+ *	NULL, fd	open file descriptor
+ *	name, dirfd	`name` relative to directory `dirfd` (*_at() variants)
+ *
+ * In the last form symbolic links are not followed. The tree walker
+ * only passes single path components, so nothing outside of `dirfd` is
+ * ever reached.
+ *
+ * Linux 6.13 added getxattrat(), setxattrat() and removexattrat().
+ * They are used when the kernel headers built against define them. On
+ * older kernels, or builds without them, the file is opened relative
+ * to `dirfd` with O_PATH and the path-based calls are made on its
+ * /proc/self/fd entry, which stands for the file itself, a symbolic
+ * link included. O_PATH needs no read permission and does not open
+ * FIFOs, sockets or devices. Where /proc is missing (e.g. winacl -c),
+ * regular files and directories are opened for reading instead, and
+ * the f*xattr() calls are used; other files fail with EOPNOTSUPP.
+ */
+#if defined(__NR_getxattrat) && defined(__NR_setxattrat) && \
+    defined(__NR_removexattrat)
+#define	HAVE_XATTRAT		1
+#endif
+
+#ifdef HAVE_XATTRAT
+struct acl_nfs4_xattr_args {
+	u_int64_t	value;
+	u_int32_t	size;
+	u_int32_t	flags;
+};
+
+static bool xattrat_unsupported;
+
+static bool
+at_syscall_usable(void)
+{
+	return !__atomic_load_n(&xattrat_unsupported, __ATOMIC_RELAXED);
+}
+
+/* Remembers ENOSYS so that older kernels only see one attempt */
+static bool
+at_syscall_failed(long res)
+{
+	if ((res == -1) && (errno == ENOSYS)) {
+		__atomic_store_n(&xattrat_unsupported, true, __ATOMIC_RELAXED);
+		return true;
+	}
+	return false;
+}
+#endif
+
+#define	AT_PROCPATH_SZ	32
+
+/* O_PATH descriptor of `name`, and its /proc/self/fd entry in `proc` */
+static int
+open_at(int dirfd, const char *name, char *proc)
+{
+	int fd;
+
+	fd = openat(dirfd, name, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+	if (fd != -1) {
+		snprintf(proc, AT_PROCPATH_SZ, "/proc/self/fd/%d", fd);
+	}
+	return fd;
+}
+
+/*
+ * Without /proc, the file behind O_PATH descriptor `pfd` opened for
+ * reading, if it is a regular file or directory and still `name`.
+ */
+static int
+reopen_at(int pfd, int dirfd, const char *name)
+{
+	struct stat st, xst;
+	int xfd;
+
+	if (fstat(pfd, &st) != 0) {
+		return (-1);
+	}
+	if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+		errno = EOPNOTSUPP;
+		return (-1);
+	}
+	xfd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK |
+		     O_NOCTTY | O_CLOEXEC);
+	if (xfd == -1) {
+		return (-1);
+	}
+	if ((fstat(xfd, &xst) != 0) || (xst.st_ino != st.st_ino) ||
+	    (xst.st_dev != st.st_dev)) {
+		/* replaced since it was opened with O_PATH */
+		close(xfd);
+		errno = ENOENT;
+		return (-1);
+	}
+	return xfd;
+}
+
+/* close(), keeping errno of the call before it */
+static void
+close_at(int fd)
+{
+	int error = errno;
+
+	close(fd);
+	errno = error;
+}
+
+int acl_nfs4_stat(const char *path, int fd, struct stat *st)
+{
+	if (path == NULL) {
+		return fstat(fd, st);
+	}
+	if (fd == -1) {
+		return stat(path, st);
+	}
+	return fstatat(fd, path, st, AT_SYMLINK_NOFOLLOW);
+}
+
+ssize_t acl_nfs4_getxattr(const char *path, int fd, const char *name,
+			  void *value, size_t size)
+{
+	char proc[AT_PROCPATH_SZ];
+	ssize_t res;
+	int pfd, xfd;
+
+	if (path == NULL) {
+		return fgetxattr(fd, name, value, size);
+	}
+	if (fd == -1) {
+		return getxattr(path, name, value, size);
+	}
+
+#ifdef HAVE_XATTRAT
+	if (at_syscall_usable()) {
+		struct acl_nfs4_xattr_args args = {
+			.value = (u_int64_t)(uintptr_t)value,
+			.size = size,
+		};
+
+		res = syscall(__NR_getxattrat, fd, path, AT_SYMLINK_NOFOLLOW,
+			      name, &args, sizeof(args));
+		if (!at_syscall_failed(res)) {
+			return res;
+		}
+	}
+#endif
+	pfd = open_at(fd, path, proc);
+	if (pfd == -1) {
+		return (-1);
+	}
+	res = getxattr(proc, name, value, size);
+	if ((res == -1) && (errno == ENOENT) &&
+	    ((xfd = reopen_at(pfd, fd, path)) != -1)) {
+		res = fgetxattr(xfd, name, value, size);
+		close_at(xfd);
+	}
+	close_at(pfd);
+	return res;
+}
+
+int acl_nfs4_setxattr(const char *path, int fd, const char *name,
+		      const void *value, size_t size, int flags)
+{
+	char proc[AT_PROCPATH_SZ];
+	int pfd, res, xfd;
+
+	if (path == NULL) {
+		return fsetxattr(fd, name, value, size, flags);
+	}
+	if (fd == -1) {
+		return setxattr(path, name, value, size, flags);
+	}
+
+#ifdef HAVE_XATTRAT
+	if (at_syscall_usable()) {
+		struct acl_nfs4_xattr_args args = {
+			.value = (u_int64_t)(uintptr_t)value,
+			.size = size,
+			.flags = flags,
+		};
+
+		res = syscall(__NR_setxattrat, fd, path, AT_SYMLINK_NOFOLLOW,
+			      name, &args, sizeof(args));
+		if (!at_syscall_failed(res)) {
+			return res;
+		}
+	}
+#endif
+	pfd = open_at(fd, path, proc);
+	if (pfd == -1) {
+		return (-1);
+	}
+	res = setxattr(proc, name, value, size, flags);
+	if ((res == -1) && (errno == ENOENT) &&
+	    ((xfd = reopen_at(pfd, fd, path)) != -1)) {
+		res = fsetxattr(xfd, name, value, size, flags);
+		close_at(xfd);
+	}
+	close_at(pfd);
+	return res;
+}
+
+int acl_nfs4_removexattr(const char *path, int fd, const char *name)
+{
+	char proc[AT_PROCPATH_SZ];
+	int pfd, res, xfd;
+
+	if (path == NULL) {
+		return fremovexattr(fd, name);
+	}
+	if (fd == -1) {
+		return removexattr(path, name);
+	}
+
+#ifdef HAVE_XATTRAT
+	if (at_syscall_usable()) {
+		res = syscall(__NR_removexattrat, fd, path,
+			      AT_SYMLINK_NOFOLLOW, name);
+		if (!at_syscall_failed(res)) {
+			return res;
+		}
+	}
+#endif
+	pfd = open_at(fd, path, proc);
+	if (pfd == -1) {
+		return (-1);
+	}
+	res = removexattr(proc, name);
+	if ((res == -1) && (errno == ENOENT) &&
+	    ((xfd = reopen_at(pfd, fd, path)) != -1)) {
+		res = fremovexattr(xfd, name);
+		close_at(xfd);
+	}
+	close_at(pfd);
+	return res;
+}
@@ -0,0 +1,351 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include "libacl_nfs4.h"
+
+/*
+ * Batched get and set of ACLs for many paths.
+ *
+ * A context may own a pool of worker threads, configured with
+ * nfs4_acl_ctx_set_workers(). Each worker has a private context, so
+ * workers share nothing but the batch being processed. Paths are handed
+ * out one at a time from a shared index, which keeps all workers busy
+ * even when a few files are slow. The calling thread takes part in the
+ * batch, so a pool of N workers runs N + 1 operations at once. A
+ * context with an io_uring (see nfs4_acl_ctx_set_uring()) keeps many
+ * paths in flight from each thread.
+ */
+struct pool_worker {
+	struct acl_nfs4_pool	*pool;
+	struct nfs4_acl_ctx	*ctx;
+	pthread_t		thread;
+};
+
+struct acl_nfs4_pool {
+	pthread_mutex_t		lock;
+	pthread_cond_t		work_cv;
+	pthread_cond_t		done_cv;
+	struct acl_nfs4_batch	*batch;
+	uint64_t		generation;
+	bool			shutdown;
+	u32			nworkers;
+	struct pool_worker	workers[];
+};
+
+/*
+ * Record the outcome for path `i`. For ACL_NFS4_BATCH_GET, `acl` is
+ * the ACL read, or NULL if `error` is set.
+ */
+void acl_nfs4_batch_complete(struct acl_nfs4_batch *b, size_t i,
+			     struct nfs4_acl *acl, int error)
+{
+	if (b->op == ACL_NFS4_BATCH_GET) {
+		b->results[i] = acl;
+	}
+	if (error) {
+		__atomic_add_fetch(&b->nfailed, 1, __ATOMIC_RELAXED);
+	}
+	if (b->errors != NULL) {
+		b->errors[i] = error;
+	}
+}
+
+static void
+batch_run(struct nfs4_acl_ctx *ctx, struct acl_nfs4_batch *b)
+{
+	struct acl_nfs4_uring *ring = *acl_nfs4_ctx_uring(ctx);
+	struct nfs4_acl_ctx *prev = NULL;
+	struct nfs4_acl *acl = NULL;
+	size_t i;
+	int error;
+
+	/* Keeps many paths in flight; returns early if the ring fails */
+	if (ring != NULL) {
+		prev = acl_nfs4_ctx_enter(ctx);
+		acl_nfs4_uring_run(ring, b);
+		acl_nfs4_ctx_leave(ctx, prev, false, NULL);
+	}
+
+	while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->n) {
+		error = 0;
+		acl = NULL;
+		if (b->op == ACL_NFS4_BATCH_GET) {
+			acl = nfs4_acl_ctx_get_file(ctx, b->paths[i]);
+			if (acl == NULL) {
+				error = nfs4_acl_ctx_errno(ctx);
+			}
+		}
+		else if (nfs4_acl_ctx_set_file(ctx, b->acls[i], b->paths[i]) != 0) {
+			error = nfs4_acl_ctx_errno(ctx);
+		}
+		acl_nfs4_batch_complete(b, i, acl, error);
+	}
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct pool_worker *w = arg;
+	struct acl_nfs4_pool *pool = w->pool;
+	struct acl_nfs4_batch *b = NULL;
+	uint64_t seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->shutdown &&
+		       ((pool->batch == NULL) || (pool->generation == seen))) {
+			pthread_cond_wait(&pool->work_cv, &pool->lock);
+		}
+		if (pool->shutdown) {
+			break;
+		}
+		seen = pool->generation;
+		b = pool->batch;
+		b->active++;
+		pthread_mutex_unlock(&pool->lock);
+
+		batch_run(w->ctx, b);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--b->active == 0) {
+			pthread_cond_signal(&pool->done_cv);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+void acl_nfs4_pool_destroy(struct acl_nfs4_pool *pool)
+{
+	u32 i;
+
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->work_cv);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nworkers; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+		nfs4_acl_ctx_free(pool->workers[i].ctx);
+	}
+	pthread_cond_destroy(&pool->done_cv);
+	pthread_cond_destroy(&pool->work_cv);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+/*
+ * Set the number of worker threads used by nfs4_acl_get_many() and
+ * nfs4_acl_set_many(), replacing any existing pool. With 0 workers,
+ * batches run in the calling thread. Workers take the logging
+ * callback and io_uring depth that `ctx` has at this point, and may
+ * call the callback concurrently.
+ */
+int nfs4_acl_ctx_set_workers(struct nfs4_acl_ctx *ctx, unsigned int nworkers)
+{
+	struct acl_nfs4_pool **poolp = NULL;
+	struct acl_nfs4_pool *pool = NULL;
+	int error;
+
+	if (ctx == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	poolp = acl_nfs4_ctx_pool(ctx);
+	acl_nfs4_pool_destroy(*poolp);
+	*poolp = NULL;
+	if (nworkers == 0) {
+		return 0;
+	}
+
+	pool = calloc(1, sizeof(*pool) + nworkers * sizeof(struct pool_worker));
+	if (pool == NULL) {
+		return -1;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cv, NULL);
+	pthread_cond_init(&pool->done_cv, NULL);
+
+	for (pool->nworkers = 0; pool->nworkers < nworkers; pool->nworkers++) {
+		struct pool_worker *w = &pool->workers[pool->nworkers];
+
+		w->pool = pool;
+		w->ctx = acl_nfs4_ctx_clone(ctx);
+		if (w->ctx == NULL) {
+			goto fail;
+		}
+		error = pthread_create(&w->thread, NULL, worker_main, w);
+		if (error) {
+			nfs4_acl_ctx_free(w->ctx);
+			errno = error;
+			goto fail;
+		}
+	}
+
+	*poolp = pool;
+	return 0;
+
+fail:
+	error = errno;
+	acl_nfs4_pool_destroy(pool);
+	errno = error;
+	return -1;
+}
+
+static ssize_t
+batch_dispatch(struct nfs4_acl_ctx *ctx, struct acl_nfs4_batch *b)
+{
+	struct acl_nfs4_pool *pool = *acl_nfs4_ctx_pool(ctx);
+
+	/* Not worth waking anyone up for a single path */
+	if ((pool == NULL) || (b->n < 2)) {
+		batch_run(ctx, b);
+		return b->nfailed;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->batch = b;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cv);
+	pthread_mutex_unlock(&pool->lock);
+
+	batch_run(ctx, b);
+
+	/*
+	 * Every index has been handed out. Wait for workers still
+	 * processing their last path, then retract the batch so that
+	 * late wakers do not pick it up.
+	 */
+	pthread_mutex_lock(&pool->lock);
+	while (b->active > 0) {
+		pthread_cond_wait(&pool->done_cv, &pool->lock);
+	}
+	pool->batch = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	return b->nfailed;
+}
+
+/*
+ * Read the ACLs of `n` paths. On return results[i] holds the ACL of
+ * paths[i], or NULL with errors[i] set to the errno of the failure
+ * (errors may be NULL). Latency is bounded by the slowest path rather
+ * than the sum when `ctx` has workers.
+ *
+ * Returns the number of paths that failed, or -1 if the arguments are
+ * invalid.
+ */
+ssize_t nfs4_acl_get_many(struct nfs4_acl_ctx *ctx, const char *const paths[],
+			  size_t n, struct nfs4_acl *results[], int errors[])
+{
+	struct acl_nfs4_batch b = {
+		.op = ACL_NFS4_BATCH_GET,
+		.paths = paths,
+		.results = results,
+		.errors = errors,
+		.n = n,
+	};
+
+	if ((ctx == NULL) || (paths == NULL) || (results == NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return batch_dispatch(ctx, &b);
+}
+
+/*
+ * Read ahead for nfs4_acl_walk(): read the ACLs of `n` paths through
+ * the io_uring of `ctx`, keeping only those of files that are still
+ * inode inos[i] on `dev`, so that a path leading elsewhere (through a
+ * link that replaced one of its components) is not taken for the
+ * entry. The rest are left NULL for the caller to read relative to
+ * a directory fd.
+ *
+ * Returns 0, or -1 with errno set to ENOSYS if `ctx` has no ring.
+ */
+int acl_nfs4_get_many_ino(struct nfs4_acl_ctx *ctx, const char *const paths[],
+			  const ino_t inos[], dev_t dev, size_t n,
+			  struct nfs4_acl *results[])
+{
+	struct acl_nfs4_uring *ring = *acl_nfs4_ctx_uring(ctx);
+	struct nfs4_acl_ctx *prev = NULL;
+	struct acl_nfs4_batch b = {
+		.op = ACL_NFS4_BATCH_GET,
+		.paths = paths,
+		.results = results,
+		.inos = inos,
+		.dev = dev,
+		.n = n,
+	};
+
+	memset(results, 0, n * sizeof(*results));
+	if (ring == NULL) {
+		errno = ENOSYS;
+		return -1;
+	}
+	prev = acl_nfs4_ctx_enter(ctx);
+	acl_nfs4_uring_run(ring, &b);
+	acl_nfs4_ctx_leave(ctx, prev, false, NULL);
+	return 0;
+}
+
+/*
+ * Write acls[i] to paths[i] for `n` paths. The same ACL may appear more
+ * than once; ACLs are only read. errors[i] is set as for
+ * nfs4_acl_get_many().
+ *
+ * Returns the number of paths that failed, or -1 if the arguments are
+ * invalid.
+ */
+ssize_t nfs4_acl_set_many(struct nfs4_acl_ctx *ctx,
+			  struct nfs4_acl *const acls[],
+			  const char *const paths[], size_t n, int errors[])
+{
+	struct acl_nfs4_batch b = {
+		.op = ACL_NFS4_BATCH_SET,
+		.paths = paths,
+		.acls = acls,
+		.errors = errors,
+		.n = n,
+	};
+
+	if ((ctx == NULL) || (paths == NULL) || (acls == NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return batch_dispatch(ctx, &b);
+}
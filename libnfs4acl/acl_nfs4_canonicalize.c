@@ -0,0 +1,166 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include "libacl_nfs4.h"
+
+/*
+ * Canonical ACE ordering, as used by Windows: explicit deny, explicit
+ * allow, inherited deny, inherited allow. Audit and alarm entries do
+ * not affect access and are sorted along with the allow entries of
+ * their class. Relative order within a class is preserved.
+ */
+struct canon_entry {
+	struct nfs4_ace	*ace;
+	u32		key;
+};
+
+static u32
+canon_class(const struct nfs4_ace *ace)
+{
+	u32 class = (ace->flag & NFS4_ACE_INHERITED_ACE) ? 2 : 0;
+
+	if (ace->type != NFS4_ACE_ACCESS_DENIED_ACE_TYPE) {
+		class += 1;
+	}
+	return class;
+}
+
+/*
+ * Sort by class, then by original position. Making the position part
+ * of the key turns qsort() into a stable sort.
+ */
+static int
+canon_compare(const void *a, const void *b)
+{
+	const struct canon_entry *ea = a, *eb = b;
+
+	if (ea->key < eb->key) {
+		return -1;
+	}
+	return (ea->key > eb->key);
+}
+
+static void
+canon_rebuild(struct nfs4_acl *acl, struct canon_entry *entries)
+{
+	u32 i;
+
+	TAILQ_INIT(&acl->entries->head);
+	for (i = 0; i < acl->naces; i++) {
+		TAILQ_INSERT_TAIL(&acl->entries->head, entries[i].ace, l_ace);
+	}
+}
+
+/*
+ * Reorder entries of `acl` into canonical order. With
+ * NFS4_ACL_CANON_STRICT in `flags` the ACL is left untouched, and -1 is
+ * returned with errno set to EPERM, if the new order would change the
+ * access granted by the ACL (see nfs4_acl_equivalent()).
+ *
+ * ACLs that are already in canonical order are not modified and no
+ * memory is allocated for them.
+ */
+int nfs4_acl_canonicalize(struct nfs4_acl *acl, int flags)
+{
+	struct canon_entry *entries = NULL;
+	struct nfs4_acl *orig = NULL;
+	struct nfs4_ace *ace = NULL;
+	u32 i, class, prev = 0;
+	bool sorted = true;
+
+	if (acl == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (ace = nfs4_get_first_ace(acl); ace != NULL;
+	     ace = nfs4_get_next_ace(&ace)) {
+		class = canon_class(ace);
+		if (class < prev) {
+			sorted = false;
+			break;
+		}
+		prev = class;
+	}
+	if (sorted) {
+		return 0;
+	}
+
+	if (!acl_nfs4_detach(acl, NULL)) {
+		return -1;
+	}
+
+	if (flags & NFS4_ACL_CANON_STRICT) {
+		orig = acl_nfs4_copy_acl(acl);
+		if (orig == NULL) {
+			return -1;
+		}
+		/* acl_nfs4_copy_acl() copies entries only */
+		orig->aclflags4 = acl->aclflags4;
+	}
+
+	entries = calloc(acl->naces, sizeof(struct canon_entry));
+	if (entries == NULL) {
+		nfs4_free_acl(orig);
+		return -1;
+	}
+
+	/* ACL size is limited to NFS41ACLMAXACES, so the position fits */
+	for (i = 0, ace = nfs4_get_first_ace(acl); ace != NULL;
+	     i++, ace = nfs4_get_next_ace(&ace)) {
+		entries[i].ace = ace;
+		entries[i].key = (canon_class(ace) << 24) | i;
+	}
+
+	qsort(entries, acl->naces, sizeof(struct canon_entry), canon_compare);
+	canon_rebuild(acl, entries);
+
+	if ((orig != NULL) && !nfs4_acl_equivalent(orig, acl)) {
+		/* restore original order from the positions in the keys */
+		for (i = 0; i < acl->naces; i++) {
+			entries[i].key &= 0xffffff;
+		}
+		qsort(entries, acl->naces, sizeof(struct canon_entry),
+		      canon_compare);
+		canon_rebuild(acl, entries);
+		free(entries);
+		nfs4_free_acl(orig);
+		errno = EPERM;
+		return -1;
+	}
+
+	free(entries);
+	nfs4_free_acl(orig);
+	return 0;
+}
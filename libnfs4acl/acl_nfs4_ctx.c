@@ -0,0 +1,563 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <syslog.h>
+#include <err.h>
+#include "libacl_nfs4.h"
+
+/*
+ * Library context.
+ *
+ * Functions taking a context make it the current context of the calling
+ * thread for the duration of the call. Diagnostics that the library
+ * would otherwise print with warnx() are then recorded in the context's
+ * error buffer and passed to its logging callback, and user and group
+ * name lookups go through the context's identity cache. Nothing in a
+ * context is shared with other contexts, so no locking is needed as
+ * long as each thread uses its own.
+ */
+#define	CTX_ID_CACHE_SIZE	256	/* direct-mapped, power of two */
+#define	CTX_INTERN_BUCKETS	1024	/* power of two */
+#define	CTX_INTERN_MAX		4096
+#define	CTX_INHERIT_CACHE_SIZE	64	/* direct-mapped, power of two */
+
+struct ctx_id_entry {
+	bool			valid;
+	bool			is_group;
+	nfs4_acl_id_t		id;
+	char			name[NFS4_ACL_CTX_NAME_MAX];
+};
+
+struct ctx_intern_entry {
+	struct ctx_intern_entry	*next;
+	u32			hash;
+	u32			is_directory;
+	struct nfs4_acl		*acl;
+	size_t			xdrsize;
+	char			xdr[];
+};
+
+struct ctx_inherit_entry {
+	struct nfs4_acl		*parent;	/* interned */
+	bool			is_dir;
+	struct nfs4_acl		*acl;		/* interned */
+};
+
+struct nfs4_acl_ctx {
+	struct nfs4_acl_allocator	alloc;
+	nfs4_acl_log_fn			log_fn;
+	void				*log_arg;
+	int				error;
+	char				errbuf[NFS4_ACL_CTX_ERRBUF];
+	struct ctx_id_entry		byid[CTX_ID_CACHE_SIZE];
+	struct ctx_id_entry		byname[CTX_ID_CACHE_SIZE];
+	struct ctx_intern_entry		*intern[CTX_INTERN_BUCKETS];
+	size_t				nintern;
+	struct ctx_inherit_entry	inherit[CTX_INHERIT_CACHE_SIZE];
+	struct acl_nfs4_pool		*pool;		/* see acl_nfs4_batch.c */
+	struct acl_nfs4_uring		*uring;		/* see acl_nfs4_uring.c */
+};
+
+static __thread struct nfs4_acl_ctx *cur_ctx;
+
+static u32
+fnv1a(const void *buf, size_t len, u32 hash)
+{
+	const unsigned char *p = buf;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+#define	FNV1A_INIT	2166136261u
+
+static u32
+id_hash(nfs4_acl_id_t id, bool is_group)
+{
+	return (((u32)id * 2654435761u) >> 24) ^ is_group;
+}
+
+static u32
+name_hash(const char *name, bool is_group)
+{
+	return fnv1a(name, strlen(name), FNV1A_INIT) ^ is_group;
+}
+
+/*
+ * Make `ctx` current and clear its error state. Returns the previous
+ * current context, to be restored by acl_nfs4_ctx_leave().
+ */
+struct nfs4_acl_ctx *acl_nfs4_ctx_enter(struct nfs4_acl_ctx *ctx)
+{
+	struct nfs4_acl_ctx *prev = cur_ctx;
+
+	ctx->error = 0;
+	ctx->errbuf[0] = '\0';
+	cur_ctx = ctx;
+	return prev;
+}
+
+/*
+ * Restore the previous context. If the call failed, record errno and,
+ * unless a more specific message was logged, a generic one.
+ */
+void acl_nfs4_ctx_leave(struct nfs4_acl_ctx *ctx, struct nfs4_acl_ctx *prev,
+			bool failed, const char *what)
+{
+	int saved_errno = errno;
+
+	if (failed) {
+		ctx->error = saved_errno;
+		if (ctx->errbuf[0] == '\0') {
+			snprintf(ctx->errbuf, sizeof(ctx->errbuf), "%s: %s",
+				 what ? what : "nfs4_acl", strerror(saved_errno));
+		}
+	}
+	cur_ctx = prev;
+	errno = saved_errno;
+}
+
+/*
+ * Library diagnostics. Logged to the current context if there is one,
+ * otherwise printed with warnx(). errno is preserved.
+ */
+void acl_nfs4_log(const char *fmt, ...)
+{
+	struct nfs4_acl_ctx *ctx = cur_ctx;
+	int saved_errno = errno;
+	size_t len;
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (ctx == NULL) {
+		vwarnx(fmt, ap);
+		va_end(ap);
+		errno = saved_errno;
+		return;
+	}
+	vsnprintf(ctx->errbuf, sizeof(ctx->errbuf), fmt, ap);
+	va_end(ap);
+
+	len = strlen(ctx->errbuf);
+	if ((len > 0) && (ctx->errbuf[len - 1] == '\n')) {
+		ctx->errbuf[len - 1] = '\0';
+	}
+	if (ctx->log_fn != NULL) {
+		ctx->log_fn(ctx->log_arg, LOG_WARNING, ctx->errbuf);
+	}
+	errno = saved_errno;
+}
+
+bool acl_nfs4_ctx_id_lookup(const char *name, bool is_group,
+			    nfs4_acl_id_t *idp)
+{
+	struct ctx_id_entry *e = NULL;
+
+	if (cur_ctx == NULL) {
+		return false;
+	}
+	e = &cur_ctx->byname[name_hash(name, is_group) & (CTX_ID_CACHE_SIZE - 1)];
+	if (!e->valid || (e->is_group != is_group) || strcmp(e->name, name)) {
+		return false;
+	}
+	*idp = e->id;
+	return true;
+}
+
+bool acl_nfs4_ctx_name_lookup(nfs4_acl_id_t id, bool is_group,
+			      char *buf, size_t bufsz)
+{
+	struct ctx_id_entry *e = NULL;
+
+	if (cur_ctx == NULL) {
+		return false;
+	}
+	e = &cur_ctx->byid[id_hash(id, is_group) & (CTX_ID_CACHE_SIZE - 1)];
+	if (!e->valid || (e->is_group != is_group) || (e->id != id)) {
+		return false;
+	}
+	return (strlcpy(buf, e->name, bufsz) < bufsz);
+}
+
+void acl_nfs4_ctx_id_store(const char *name, bool is_group,
+			   nfs4_acl_id_t id)
+{
+	struct ctx_id_entry entry;
+
+	if ((cur_ctx == NULL) ||
+	    (strlcpy(entry.name, name, sizeof(entry.name)) >= sizeof(entry.name))) {
+		return;
+	}
+	entry.valid = true;
+	entry.is_group = is_group;
+	entry.id = id;
+
+	cur_ctx->byid[id_hash(id, is_group) & (CTX_ID_CACHE_SIZE - 1)] = entry;
+	cur_ctx->byname[name_hash(name, is_group) & (CTX_ID_CACHE_SIZE - 1)] = entry;
+}
+
+/*
+ * Create a new context. `alloc` may be NULL to use malloc() and free().
+ *
+ * Returned context must be freed with nfs4_acl_ctx_free().
+ */
+struct nfs4_acl_ctx *nfs4_acl_ctx_new(const struct nfs4_acl_allocator *alloc)
+{
+	struct nfs4_acl_ctx *ctx = NULL;
+
+	if ((alloc != NULL) && ((alloc->malloc == NULL) || (alloc->free == NULL))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ctx = alloc ? alloc->malloc(sizeof(*ctx)) : malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+
+	if (alloc != NULL) {
+		ctx->alloc = *alloc;
+	}
+	else {
+		ctx->alloc.malloc = malloc;
+		ctx->alloc.free = free;
+	}
+	return ctx;
+}
+
+void nfs4_acl_ctx_free(struct nfs4_acl_ctx *ctx)
+{
+	struct ctx_intern_entry *e = NULL, *next = NULL;
+	size_t i;
+
+	if (ctx == NULL) {
+		return;
+	}
+
+	acl_nfs4_pool_destroy(ctx->pool);
+	acl_nfs4_uring_free(ctx->uring);
+	for (i = 0; i < CTX_INHERIT_CACHE_SIZE; i++) {
+		nfs4_acl_unref(ctx->inherit[i].parent);
+		nfs4_acl_unref(ctx->inherit[i].acl);
+	}
+	for (i = 0; i < CTX_INTERN_BUCKETS; i++) {
+		for (e = ctx->intern[i]; e != NULL; e = next) {
+			next = e->next;
+			nfs4_acl_unref(e->acl);
+			ctx->alloc.free(e);
+		}
+	}
+	ctx->alloc.free(ctx);
+}
+
+/*
+ * New context with the same allocator, logging callback and io_uring
+ * depth as `ctx`, used for worker threads.
+ */
+struct nfs4_acl_ctx *acl_nfs4_ctx_clone(const struct nfs4_acl_ctx *ctx)
+{
+	struct nfs4_acl_ctx *out = nfs4_acl_ctx_new(&ctx->alloc);
+
+	if (out != NULL) {
+		out->log_fn = ctx->log_fn;
+		out->log_arg = ctx->log_arg;
+		/* Without a ring the clone falls back to synchronous I/O */
+		if (ctx->uring != NULL) {
+			out->uring = acl_nfs4_uring_new(acl_nfs4_uring_depth(ctx->uring));
+		}
+	}
+	return out;
+}
+
+struct acl_nfs4_pool **acl_nfs4_ctx_pool(struct nfs4_acl_ctx *ctx)
+{
+	return &ctx->pool;
+}
+
+struct acl_nfs4_uring **acl_nfs4_ctx_uring(struct nfs4_acl_ctx *ctx)
+{
+	return &ctx->uring;
+}
+
+/*
+ * Set the callback that receives diagnostics. Without one, messages are
+ * only kept for nfs4_acl_ctx_strerror().
+ */
+void nfs4_acl_ctx_set_log(struct nfs4_acl_ctx *ctx, nfs4_acl_log_fn fn,
+			  void *arg)
+{
+	ctx->log_fn = fn;
+	ctx->log_arg = arg;
+}
+
+/*
+ * Message and errno of the last failed call made with `ctx`.
+ */
+const char *nfs4_acl_ctx_strerror(const struct nfs4_acl_ctx *ctx)
+{
+	return ctx->errbuf;
+}
+
+int nfs4_acl_ctx_errno(const struct nfs4_acl_ctx *ctx)
+{
+	return ctx->error;
+}
+
+struct nfs4_acl *nfs4_acl_ctx_get_file(struct nfs4_acl_ctx *ctx,
+				       const char *path)
+{
+	struct nfs4_acl_ctx *prev = acl_nfs4_ctx_enter(ctx);
+	struct nfs4_acl *acl = nfs4_acl_get_file(path);
+
+	acl_nfs4_ctx_leave(ctx, prev, acl == NULL, path);
+	return acl;
+}
+
+struct nfs4_acl *nfs4_acl_ctx_get_fd(struct nfs4_acl_ctx *ctx, int fd)
+{
+	struct nfs4_acl_ctx *prev = acl_nfs4_ctx_enter(ctx);
+	struct nfs4_acl *acl = nfs4_acl_get_fd(fd);
+
+	acl_nfs4_ctx_leave(ctx, prev, acl == NULL, NULL);
+	return acl;
+}
+
+int nfs4_acl_ctx_set_file(struct nfs4_acl_ctx *ctx, struct nfs4_acl *acl,
+			  const char *path)
+{
+	struct nfs4_acl_ctx *prev = acl_nfs4_ctx_enter(ctx);
+	int error = nfs4_acl_set_file(acl, path);
+
+	acl_nfs4_ctx_leave(ctx, prev, error != 0, path);
+	return error;
+}
+
+int nfs4_acl_ctx_set_fd(struct nfs4_acl_ctx *ctx, struct nfs4_acl *acl, int fd)
+{
+	struct nfs4_acl_ctx *prev = acl_nfs4_ctx_enter(ctx);
+	int error = nfs4_acl_set_fd(acl, fd);
+
+	acl_nfs4_ctx_leave(ctx, prev, error != 0, NULL);
+	return error;
+}
+
+/*
+ * Convert JSON text to an ACL. Validation errors are reported as JSON
+ * text through nfs4_acl_ctx_strerror() and the call fails with EINVAL.
+ */
+struct nfs4_acl *nfs4_acl_ctx_from_json(struct nfs4_acl_ctx *ctx,
+					const char *json_text, bool is_dir)
+{
+	struct nfs4_acl_ctx *prev = acl_nfs4_ctx_enter(ctx);
+	struct nfs4_acl *acl = get_acl_json(json_text, is_dir);
+
+	acl_nfs4_ctx_leave(ctx, prev, acl == NULL, "JSON");
+	return acl;
+}
+
+struct nfs4_acl *nfs4_acl_ctx_from_text(struct nfs4_acl_ctx *ctx,
+					const char *acl_spec, bool is_dir)
+{
+	struct nfs4_acl_ctx *prev = acl_nfs4_ctx_enter(ctx);
+	struct nfs4_acl *acl = nfs4_new_acl(is_dir);
+
+	if ((acl != NULL) && nfs4_insert_string_aces(acl, acl_spec, 0)) {
+		nfs4_free_acl(acl);
+		acl = NULL;
+	}
+	acl_nfs4_ctx_leave(ctx, prev, acl == NULL, "text");
+	return acl;
+}
+
+/*
+ * Returned string must be freed.
+ */
+char *nfs4_acl_ctx_to_text(struct nfs4_acl_ctx *ctx, struct nfs4_acl *acl,
+			   int flags)
+{
+	struct nfs4_acl_ctx *prev = acl_nfs4_ctx_enter(ctx);
+	char *text = _nfs4_acl_to_text_np(acl, NULL, flags);
+
+	acl_nfs4_ctx_leave(ctx, prev, text == NULL, "text");
+	return text;
+}
+
+static struct nfs4_acl *
+ctx_intern(struct nfs4_acl_ctx *ctx, struct nfs4_acl *acl)
+{
+	char xdr[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+	struct ctx_intern_entry *e = NULL;
+	size_t xdrsize;
+	u32 hash;
+
+	xdrsize = acl_nfs4_xattr_pack_buf(acl, xdr, sizeof(xdr));
+	if (xdrsize == (size_t)-1) {
+		return NULL;
+	}
+	hash = fnv1a(xdr, xdrsize, FNV1A_INIT ^ acl->is_directory);
+
+	for (e = ctx->intern[hash & (CTX_INTERN_BUCKETS - 1)]; e != NULL;
+	     e = e->next) {
+		if ((e->hash == hash) &&
+		    (e->is_directory == acl->is_directory) &&
+		    (e->xdrsize == xdrsize) &&
+		    (memcmp(e->xdr, xdr, xdrsize) == 0)) {
+			return nfs4_acl_ref(e->acl);
+		}
+	}
+
+	/* Table is full. Still correct, just not deduplicated. */
+	if (ctx->nintern >= CTX_INTERN_MAX) {
+		return nfs4_acl_ref(acl);
+	}
+
+	e = ctx->alloc.malloc(sizeof(*e) + xdrsize);
+	if (e == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	e->acl = nfs4_acl_ref(acl);
+	if (e->acl == NULL) {
+		ctx->alloc.free(e);
+		return NULL;
+	}
+	e->hash = hash;
+	e->is_directory = acl->is_directory;
+	e->xdrsize = xdrsize;
+	memcpy(e->xdr, xdr, xdrsize);
+	e->next = ctx->intern[hash & (CTX_INTERN_BUCKETS - 1)];
+	ctx->intern[hash & (CTX_INTERN_BUCKETS - 1)] = e;
+	ctx->nintern++;
+
+	return nfs4_acl_ref(acl);
+}
+
+/*
+ * Return a reference to an ACL equal to `acl` (same entries, ACL flags
+ * and directory-ness), so that identical ACLs share one copy of their
+ * entries. `acl` is not consumed; it may still be modified, which
+ * gives it a private copy of its entries if they were shared.
+ *
+ * Returned ACL must be released with nfs4_acl_unref().
+ */
+struct nfs4_acl *nfs4_acl_ctx_intern(struct nfs4_acl_ctx *ctx,
+				     struct nfs4_acl *acl)
+{
+	struct nfs4_acl_ctx *prev = NULL;
+	struct nfs4_acl *out = NULL;
+
+	if (acl == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+	prev = acl_nfs4_ctx_enter(ctx);
+	out = ctx_intern(ctx, acl);
+	acl_nfs4_ctx_leave(ctx, prev, out == NULL, "intern");
+	return out;
+}
+
+/*
+ * Return the ACL a new file (or directory if `is_dir`) would inherit
+ * from `parent`. Results are cached by parent contents, so walking a
+ * tree where most directories share an ACL computes each inherited ACL
+ * once. `parent` is interned as by nfs4_acl_ctx_intern().
+ *
+ * Returned ACL is shared and must be released with nfs4_acl_unref().
+ */
+struct nfs4_acl *nfs4_acl_ctx_inherit(struct nfs4_acl_ctx *ctx,
+				      struct nfs4_acl *parent, bool is_dir)
+{
+	struct nfs4_acl_ctx *prev = NULL;
+	struct ctx_inherit_entry *slot = NULL;
+	struct nfs4_acl *p = NULL, *child = NULL, *out = NULL;
+
+	if (parent == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+	prev = acl_nfs4_ctx_enter(ctx);
+
+	p = ctx_intern(ctx, parent);
+	if (p == NULL) {
+		goto done;
+	}
+
+	/*
+	 * Every reference to an interned ACL shares its entries, and the
+	 * inherited ACL depends on nothing else.
+	 */
+	slot = &ctx->inherit[(((uintptr_t)p->entries >> 4) ^ is_dir) &
+			     (CTX_INHERIT_CACHE_SIZE - 1)];
+	if ((slot->parent != NULL) && (slot->parent->entries == p->entries) &&
+	    (slot->is_dir == is_dir)) {
+		out = nfs4_acl_ref(slot->acl);
+		nfs4_acl_unref(p);
+		goto done;
+	}
+
+	child = nfs4_new_acl(is_dir);
+	if (child == NULL) {
+		nfs4_acl_unref(p);
+		goto done;
+	}
+	if (!acl_nfs4_inherit_entries(p, child, is_dir)) {
+		nfs4_free_acl(child);
+		nfs4_acl_unref(p);
+		goto done;
+	}
+	out = ctx_intern(ctx, child);
+	nfs4_free_acl(child);
+	if (out == NULL) {
+		nfs4_acl_unref(p);
+		goto done;
+	}
+
+	nfs4_acl_unref(slot->parent);
+	nfs4_acl_unref(slot->acl);
+	slot->is_dir = is_dir;
+	slot->acl = nfs4_acl_ref(out);
+	if (slot->acl == NULL) {
+		/* Result is still valid, only not cached */
+		nfs4_acl_unref(p);
+		p = NULL;
+	}
+	slot->parent = p;
+done:
+	acl_nfs4_ctx_leave(ctx, prev, out == NULL, "inherit");
+	return out;
+}
@@ -0,0 +1,570 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include "libacl_nfs4.h"
+
+/*
+ * ACL diff and patch.
+ *
+ * nfs4_acl_diff() computes the shortest sequence of insert, delete and
+ * modify edits that turns one ACL into another (Levenshtein distance
+ * over entries, after trimming common prefix and suffix). Edits are
+ * applied in order, and each index refers to the ACL as left by the
+ * edits before it.
+ *
+ * Delete and modify edits record the entry they expect to find, so
+ * that nfs4_acl_patch() can apply the same patch to ACLs that differ by
+ * local entries: if the expected entry is not at the recorded index,
+ * the first matching entry is used instead, and later indexes are
+ * shifted accordingly.
+ */
+
+#define	EDIT_MATCH	(-1)
+
+static void
+edit_init(struct nfs4_acl_edit *e, enum nfs4_acl_edit_op op, u32 index,
+	  const struct nfs4_ace *old_ace, const struct nfs4_ace *new_ace)
+{
+	memset(e, 0, sizeof(*e));
+	e->op = op;
+	e->index = index;
+	if (old_ace != NULL) {
+		e->old_ace = *old_ace;
+	}
+	if (new_ace != NULL) {
+		e->new_ace = *new_ace;
+	}
+}
+
+static struct nfs4_ace **
+acl_to_array(struct nfs4_acl *acl)
+{
+	struct nfs4_ace **out = NULL;
+	struct nfs4_ace *ace = NULL;
+	u32 i;
+
+	out = calloc(acl->naces + 1, sizeof(struct nfs4_ace *));
+	if (out == NULL) {
+		return NULL;
+	}
+	for (i = 0, ace = nfs4_get_first_ace(acl); ace != NULL;
+	     i++, ace = nfs4_get_next_ace(&ace)) {
+		out[i] = ace;
+	}
+	return out;
+}
+
+struct nfs4_acl_diff *nfs4_acl_diff_new(void)
+{
+	return calloc(1, sizeof(struct nfs4_acl_diff));
+}
+
+void nfs4_acl_diff_free(struct nfs4_acl_diff *d)
+{
+	if (d == NULL) {
+		return;
+	}
+	free(d->edits);
+	free(d);
+}
+
+/*
+ * Append an edit to `d`. Used by the diff itself and by parsers.
+ */
+int nfs4_acl_diff_append(struct nfs4_acl_diff *d, const struct nfs4_acl_edit *e)
+{
+	struct nfs4_acl_edit *edits = NULL;
+
+	if ((d->nedits % 16) == 0) {
+		edits = realloc(d->edits, (d->nedits + 16) *
+				sizeof(struct nfs4_acl_edit));
+		if (edits == NULL) {
+			return -1;
+		}
+		d->edits = edits;
+	}
+	d->edits[d->nedits++] = *e;
+	return 0;
+}
+
+/*
+ * Compute the edit script turning `a` into `b`. Returned diff must be
+ * freed with nfs4_acl_diff_free(). A diff with no edits and
+ * set_aclflags false means the ACLs are identical.
+ */
+struct nfs4_acl_diff *nfs4_acl_diff(struct nfs4_acl *a, struct nfs4_acl *b)
+{
+	struct nfs4_acl_diff *d = NULL;
+	struct nfs4_ace **av = NULL, **bv = NULL;
+	struct nfs4_acl_edit e;
+	uint16_t *dist = NULL;
+	int *ops = NULL;
+	u32 pre = 0, suf = 0, n, m, i, j, nops = 0, pos;
+	size_t cols;
+
+	if ((a == NULL) || (b == NULL)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	d = nfs4_acl_diff_new();
+	av = acl_to_array(a);
+	bv = acl_to_array(b);
+	if ((d == NULL) || (av == NULL) || (bv == NULL)) {
+		goto fail;
+	}
+
+	if ((a->aclflags4 & ACL_FLAGS_ALL) != (b->aclflags4 & ACL_FLAGS_ALL)) {
+		d->set_aclflags = true;
+		d->aclflags4 = b->aclflags4 & ACL_FLAGS_ALL;
+	}
+
+	while ((pre < a->naces) && (pre < b->naces) &&
+	       ace_is_equal(av[pre], bv[pre])) {
+		pre++;
+	}
+	while ((suf < a->naces - pre) && (suf < b->naces - pre) &&
+	       ace_is_equal(av[a->naces - 1 - suf], bv[b->naces - 1 - suf])) {
+		suf++;
+	}
+	n = a->naces - pre - suf;
+	m = b->naces - pre - suf;
+	if ((n == 0) && (m == 0)) {
+		goto done;
+	}
+
+	/* Both sides are bounded by NFS41ACLMAXACES, so distances fit */
+	cols = m + 1;
+	dist = calloc((size_t)(n + 1) * cols, sizeof(uint16_t));
+	ops = calloc(n + m, sizeof(int));
+	if ((dist == NULL) || (ops == NULL)) {
+		goto fail;
+	}
+
+#define	D(x, y)	dist[(size_t)(x) * cols + (y)]
+	for (i = 0; i <= n; i++) {
+		D(i, 0) = i;
+	}
+	for (j = 0; j <= m; j++) {
+		D(0, j) = j;
+	}
+	for (i = 1; i <= n; i++) {
+		for (j = 1; j <= m; j++) {
+			uint16_t best;
+
+			best = D(i - 1, j - 1) +
+			       (ace_is_equal(av[pre + i - 1], bv[pre + j - 1]) ? 0 : 1);
+			if (D(i - 1, j) + 1 < best) {
+				best = D(i - 1, j) + 1;
+			}
+			if (D(i, j - 1) + 1 < best) {
+				best = D(i, j - 1) + 1;
+			}
+			D(i, j) = best;
+		}
+	}
+
+	/*
+	 * Walk back from the end. Matches are recorded as EDIT_MATCH so
+	 * that the forward pass can track positions.
+	 */
+	i = n;
+	j = m;
+	while ((i > 0) || (j > 0)) {
+		if ((i > 0) && (j > 0) &&
+		    ace_is_equal(av[pre + i - 1], bv[pre + j - 1]) &&
+		    (D(i, j) == D(i - 1, j - 1))) {
+			ops[nops++] = EDIT_MATCH;
+			i--;
+			j--;
+		}
+		else if ((i > 0) && (j > 0) && (D(i, j) == D(i - 1, j - 1) + 1)) {
+			ops[nops++] = NFS4_ACL_EDIT_MODIFY;
+			i--;
+			j--;
+		}
+		else if ((i > 0) && (D(i, j) == D(i - 1, j) + 1)) {
+			ops[nops++] = NFS4_ACL_EDIT_DELETE;
+			i--;
+		}
+		else {
+			ops[nops++] = NFS4_ACL_EDIT_INSERT;
+			j--;
+		}
+	}
+#undef D
+
+	/* Forward pass: i indexes `a`, j indexes `b`, pos the edited ACL */
+	i = j = 0;
+	pos = pre;
+	while (nops > 0) {
+		switch (ops[--nops]) {
+		case NFS4_ACL_EDIT_MODIFY:
+			edit_init(&e, NFS4_ACL_EDIT_MODIFY, pos,
+				  av[pre + i], bv[pre + j]);
+			i++, j++, pos++;
+			break;
+		case NFS4_ACL_EDIT_DELETE:
+			edit_init(&e, NFS4_ACL_EDIT_DELETE, pos,
+				  av[pre + i], NULL);
+			i++;
+			break;
+		case NFS4_ACL_EDIT_INSERT:
+			edit_init(&e, NFS4_ACL_EDIT_INSERT, pos,
+				  NULL, bv[pre + j]);
+			j++, pos++;
+			break;
+		default:
+			i++, j++, pos++;
+			continue;
+		}
+		if (nfs4_acl_diff_append(d, &e) != 0) {
+			goto fail;
+		}
+	}
+
+done:
+	free(dist);
+	free(ops);
+	free(av);
+	free(bv);
+	return d;
+
+fail:
+	free(dist);
+	free(ops);
+	free(av);
+	free(bv);
+	nfs4_acl_diff_free(d);
+	errno = ENOMEM;
+	return NULL;
+}
+
+static int
+find_ace(struct nfs4_acl *acl, struct nfs4_ace *ace, u32 hint,
+	 bool strict, u32 *idxp)
+{
+	struct nfs4_ace *cur = NULL;
+	u32 i;
+
+	cur = (hint < acl->naces) ? nfs4_get_ace_at(acl, hint) : NULL;
+	if ((cur != NULL) && ace_is_equal(cur, ace)) {
+		*idxp = hint;
+		return 0;
+	}
+	if (!strict) {
+		for (i = 0, cur = nfs4_get_first_ace(acl); cur != NULL;
+		     i++, cur = nfs4_get_next_ace(&cur)) {
+			if (ace_is_equal(cur, ace)) {
+				*idxp = i;
+				return 0;
+			}
+		}
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+static struct nfs4_ace *
+dup_ace(struct nfs4_acl *acl, const struct nfs4_ace *ace)
+{
+	return nfs4_new_ace(acl->is_directory, ace->type, ace->flag,
+			    ace->access_mask, ace->whotype, ace->who_id);
+}
+
+/*
+ * Apply the edits in `d` to `acl`. With NFS4_ACL_PATCH_STRICT every
+ * deleted or modified entry must be found at its recorded index.
+ * Either all edits are applied or, on failure, `acl` is unchanged.
+ * Fails with ENOENT if an expected entry is missing.
+ */
+int nfs4_acl_patch(struct nfs4_acl *acl, const struct nfs4_acl_diff *d,
+		   int flags)
+{
+	struct nfs4_acl *tmp = NULL;
+	struct nfs4_ace_list *entries = NULL;
+	struct nfs4_ace *ace = NULL, *new_ace = NULL;
+	const struct nfs4_acl_edit *e = NULL;
+	bool strict = (flags & NFS4_ACL_PATCH_STRICT) != 0;
+	long shift = 0;
+	u32 i, idx, hint;
+
+	if ((acl == NULL) || (d == NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	tmp = acl_nfs4_copy_acl(acl);
+	if (tmp == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < d->nedits; i++) {
+		e = &d->edits[i];
+		hint = ((long)e->index + shift < 0) ? 0 : e->index + shift;
+
+		switch (e->op) {
+		case NFS4_ACL_EDIT_INSERT:
+			idx = (hint > tmp->naces) ? tmp->naces : hint;
+			new_ace = dup_ace(tmp, &e->new_ace);
+			if (new_ace == NULL) {
+				goto fail;
+			}
+			if (nfs4_insert_ace_at(tmp, new_ace, idx) != 0) {
+				free(new_ace);
+				goto fail;
+			}
+			break;
+
+		case NFS4_ACL_EDIT_DELETE:
+		case NFS4_ACL_EDIT_MODIFY:
+			if (find_ace(tmp, (struct nfs4_ace *)&e->old_ace, hint,
+				     strict, &idx) != 0) {
+				goto fail;
+			}
+			shift = (long)idx - e->index;
+			ace = nfs4_get_ace_at(tmp, idx);
+			if (e->op == NFS4_ACL_EDIT_DELETE) {
+				nfs4_remove_ace(tmp, ace);
+				break;
+			}
+			new_ace = dup_ace(tmp, &e->new_ace);
+			if (new_ace == NULL) {
+				goto fail;
+			}
+			if (nfs4_replace_ace_free(tmp, ace, new_ace) != 0) {
+				free(new_ace);
+				goto fail;
+			}
+			break;
+
+		default:
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+
+	/*
+	 * Hand the patched entries over to the caller's ACL. Its old
+	 * entries go with `tmp`, which also takes care of them being
+	 * shared with other handles.
+	 */
+	entries = acl->entries;
+	acl->entries = tmp->entries;
+	tmp->entries = entries;
+	acl->naces = tmp->naces;
+
+	if (d->set_aclflags) {
+		acl->aclflags4 = (acl->aclflags4 & ~ACL_FLAGS_ALL) | d->aclflags4;
+	}
+	nfs4_free_acl(tmp);
+	return 0;
+
+fail:
+	nfs4_free_acl(tmp);
+	return -1;
+}
+
+/*
+ * Text form, one edit per line, fields separated by tabs:
+ *
+ *   flags	<ACL flags>
+ *   +<index>	<entry>
+ *   -<index>	<entry>
+ *   ~<index>	<old entry>	<new entry>
+ *
+ * Entries use the same format as nfs4xdr_getfacl. Returned string must
+ * be freed.
+ */
+char *nfs4_acl_diff_to_text(const struct nfs4_acl_diff *d, int flags)
+{
+	char old_txt[NFS4_ACE_TEXT_MAX], new_txt[NFS4_ACE_TEXT_MAX];
+	const struct nfs4_acl_edit *e = NULL;
+	char *out = NULL, *aclflags = NULL;
+	size_t size;
+	FILE *fp = NULL;
+	u32 i;
+
+	fp = open_memstream(&out, &size);
+	if (fp == NULL) {
+		return NULL;
+	}
+
+	if (d->set_aclflags) {
+		if (!nfs4_aclflag_to_text(d->aclflags4, &aclflags)) {
+			goto fail;
+		}
+		fprintf(fp, "flags\t%s\n", aclflags);
+		free(aclflags);
+	}
+
+	for (i = 0; i < d->nedits; i++) {
+		e = &d->edits[i];
+		if ((e->op != NFS4_ACL_EDIT_INSERT) &&
+		    (_nfs4_ace_to_text(old_txt, sizeof(old_txt),
+				       (struct nfs4_ace *)&e->old_ace, flags) != 0)) {
+			goto fail;
+		}
+		if ((e->op != NFS4_ACL_EDIT_DELETE) &&
+		    (_nfs4_ace_to_text(new_txt, sizeof(new_txt),
+				       (struct nfs4_ace *)&e->new_ace, flags) != 0)) {
+			goto fail;
+		}
+		switch (e->op) {
+		case NFS4_ACL_EDIT_INSERT:
+			fprintf(fp, "+%u\t%s\n", e->index, new_txt);
+			break;
+		case NFS4_ACL_EDIT_DELETE:
+			fprintf(fp, "-%u\t%s\n", e->index, old_txt);
+			break;
+		case NFS4_ACL_EDIT_MODIFY:
+			fprintf(fp, "~%u\t%s\t%s\n", e->index, old_txt, new_txt);
+			break;
+		}
+	}
+
+	if (fclose(fp) != 0) {
+		free(out);
+		return NULL;
+	}
+	return out;
+
+fail:
+	fclose(fp);
+	free(out);
+	return NULL;
+}
+
+static bool
+parse_text_ace(char *str, u32 is_dir, struct nfs4_ace *out)
+{
+	struct nfs4_ace *ace = NULL;
+
+	if (str == NULL) {
+		return false;
+	}
+	ace = nfs4_ace_from_text(is_dir, str);
+	if (ace == NULL) {
+		return false;
+	}
+	*out = *ace;
+	free(ace);
+	return true;
+}
+
+/*
+ * Parse the text form produced by nfs4_acl_diff_to_text(). Empty lines
+ * and lines starting with '#' are ignored.
+ */
+struct nfs4_acl_diff *nfs4_acl_diff_from_text(const char *text, u32 is_dir)
+{
+	struct nfs4_acl_diff *d = NULL;
+	struct nfs4_acl_edit e;
+	char *buf = NULL, *line = NULL, *next = NULL, *field = NULL, *end = NULL;
+	unsigned long index;
+	bool ok;
+
+	d = nfs4_acl_diff_new();
+	buf = strdup(text);
+	if ((d == NULL) || (buf == NULL)) {
+		goto fail;
+	}
+
+	for (next = buf; (line = strsep(&next, "\n")) != NULL;) {
+		if ((*line == '\0') || (*line == '#')) {
+			continue;
+		}
+		field = strsep(&line, "\t");
+		if (*field == '\0') {
+			goto invalid;
+		}
+
+		if (strcmp(field, "flags") == 0) {
+			if ((line == NULL) ||
+			    !nfs4_aclflag_from_text(line, &d->aclflags4)) {
+				goto invalid;
+			}
+			d->aclflags4 &= ACL_FLAGS_ALL;
+			d->set_aclflags = true;
+			continue;
+		}
+
+		if (!isdigit((unsigned char)field[1])) {
+			goto invalid;
+		}
+		index = strtoul(field + 1, &end, 10);
+		if ((*end != '\0') || (index > NFS41ACLMAXACES)) {
+			goto invalid;
+		}
+
+		memset(&e, 0, sizeof(e));
+		e.index = index;
+		switch (field[0]) {
+		case '+':
+			e.op = NFS4_ACL_EDIT_INSERT;
+			ok = parse_text_ace(strsep(&line, "\t"), is_dir, &e.new_ace);
+			break;
+		case '-':
+			e.op = NFS4_ACL_EDIT_DELETE;
+			ok = parse_text_ace(strsep(&line, "\t"), is_dir, &e.old_ace);
+			break;
+		case '~':
+			e.op = NFS4_ACL_EDIT_MODIFY;
+			ok = parse_text_ace(strsep(&line, "\t"), is_dir, &e.old_ace) &&
+			     parse_text_ace(strsep(&line, "\t"), is_dir, &e.new_ace);
+			break;
+		default:
+			ok = false;
+		}
+		if (!ok) {
+			goto invalid;
+		}
+		if (nfs4_acl_diff_append(d, &e) != 0) {
+			goto fail;
+		}
+	}
+
+	free(buf);
+	return d;
+
+invalid:
+	errno = EINVAL;
+fail:
+	free(buf);
+	nfs4_acl_diff_free(d);
+	return NULL;
+}
@@ -0,0 +1,332 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include "libacl_nfs4.h"
+
+/*
+ * Semantic comparison of NFSv4 ACLs.
+ *
+ * Two ACLs are considered equivalent if every possible requester is
+ * granted the same access by both of them. A requester is described by
+ * the set of principals it matches: EVERYONE@ always, OWNER@ and at most
+ * one named user, and any combination of GROUP@ and named groups. Only
+ * principals that appear in either ACL can change the outcome, so it is
+ * sufficient to enumerate all such combinations.
+ *
+ * The same evaluation is repeated for the entries that would be
+ * inherited by file and directory children (first and further levels),
+ * and for the explicit (non-inherited) entries, which are what survives
+ * auto-inheritance.
+ */
+#define	EQUIV_MAXPRINCIPALS	32
+#define	EQUIV_MAXGROUPS		8
+
+/* Fixed principal indices */
+#define	EQUIV_OWNER		0
+#define	EQUIV_GROUP		1
+#define	EQUIV_EVERYONE		2
+#define	EQUIV_NFIXED		3
+
+enum equiv_filter {
+	EQUIV_ACCESS = 0,	/* entries that apply to this object */
+	EQUIV_EXPLICIT,		/* same, excluding inherited entries */
+	EQUIV_FILE_CHILD,	/* inherited by a file child */
+	EQUIV_DIR_CHILD,	/* inherited by a directory child */
+	EQUIV_FILE_DESC,	/* inherited by files further down */
+	EQUIV_DIR_DESC,		/* inherited by directories further down */
+	EQUIV_NFILTERS
+};
+
+struct equiv_principal {
+	nfs4_acl_id_t	who_id;
+	bool		is_group;
+};
+
+struct equiv_ctx {
+	struct equiv_principal	p[EQUIV_MAXPRINCIPALS];
+	size_t			cnt;
+	u32			users;	/* bits of named users */
+	u32			groups;	/* bits of GROUP@ and named groups */
+	size_t			ngroups;
+};
+
+/* An allow or deny entry reduced to what evaluation needs */
+struct equiv_ace {
+	nfs4_acl_type_t		type;
+	nfs4_acl_perm_t		mask;
+	u32			pbit;
+};
+
+static int
+equiv_principal(struct equiv_ctx *ctx, const struct nfs4_ace *ace)
+{
+	bool is_group = (ace->flag & NFS4_ACE_IDENTIFIER_GROUP) != 0;
+	size_t i;
+
+	switch (ace->whotype) {
+	case NFS4_ACL_WHO_OWNER:
+		return EQUIV_OWNER;
+	case NFS4_ACL_WHO_GROUP:
+		return EQUIV_GROUP;
+	case NFS4_ACL_WHO_EVERYONE:
+		return EQUIV_EVERYONE;
+	default:
+		break;
+	}
+
+	for (i = EQUIV_NFIXED; i < ctx->cnt; i++) {
+		if ((ctx->p[i].who_id == ace->who_id) &&
+		    (ctx->p[i].is_group == is_group)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool
+equiv_add_principals(struct equiv_ctx *ctx, struct nfs4_acl *acl)
+{
+	struct nfs4_ace *ace = NULL;
+	bool is_group;
+
+	for (ace = nfs4_get_first_ace(acl); ace != NULL;
+	     ace = nfs4_get_next_ace(&ace)) {
+		if (equiv_principal(ctx, ace) != -1) {
+			continue;
+		}
+		is_group = (ace->flag & NFS4_ACE_IDENTIFIER_GROUP) != 0;
+		if ((ctx->cnt == EQUIV_MAXPRINCIPALS) ||
+		    (is_group && (ctx->ngroups == EQUIV_MAXGROUPS))) {
+			return false;
+		}
+		ctx->p[ctx->cnt].who_id = ace->who_id;
+		ctx->p[ctx->cnt].is_group = is_group;
+		if (is_group) {
+			ctx->groups |= (1U << ctx->cnt);
+			ctx->ngroups++;
+		}
+		else {
+			ctx->users |= (1U << ctx->cnt);
+		}
+		ctx->cnt++;
+	}
+	return true;
+}
+
+static bool
+equiv_selected(const struct nfs4_ace *ace, enum equiv_filter filter)
+{
+	nfs4_acl_flag_t flag = ace->flag;
+
+	switch (filter) {
+	case EQUIV_ACCESS:
+		return (flag & NFS4_ACE_INHERIT_ONLY_ACE) == 0;
+	case EQUIV_EXPLICIT:
+		return (flag & (NFS4_ACE_INHERIT_ONLY_ACE |
+				NFS4_ACE_INHERITED_ACE)) == 0;
+	case EQUIV_FILE_CHILD:
+		return (flag & NFS4_ACE_FILE_INHERIT_ACE) != 0;
+	case EQUIV_DIR_CHILD:
+		return (flag & NFS4_ACE_DIRECTORY_INHERIT_ACE) != 0;
+	case EQUIV_FILE_DESC:
+		return ((flag & NFS4_ACE_FILE_INHERIT_ACE) != 0) &&
+		       ((flag & NFS4_ACE_NO_PROPAGATE_INHERIT_ACE) == 0);
+	case EQUIV_DIR_DESC:
+		return ((flag & NFS4_ACE_DIRECTORY_INHERIT_ACE) != 0) &&
+		       ((flag & NFS4_ACE_NO_PROPAGATE_INHERIT_ACE) == 0);
+	default:
+		return false;
+	}
+}
+
+static size_t
+equiv_compile(struct equiv_ctx *ctx, struct nfs4_acl *acl,
+	      enum equiv_filter filter, struct equiv_ace *out)
+{
+	struct nfs4_ace *ace = NULL;
+	size_t n = 0;
+
+	for (ace = nfs4_get_first_ace(acl); ace != NULL;
+	     ace = nfs4_get_next_ace(&ace)) {
+		if (!equiv_selected(ace, filter)) {
+			continue;
+		}
+		out[n].type = ace->type;
+		out[n].mask = ace->access_mask & NFS4_ACE_MASK_ALL;
+		out[n].pbit = 1U << equiv_principal(ctx, ace);
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Return the access mask granted to a requester matching the principals
+ * in `profile`. Bits are decided by the first matching entry that
+ * mentions them; bits never decided are denied.
+ */
+static nfs4_acl_perm_t
+equiv_evaluate(const struct equiv_ace *aces, size_t n, u32 profile)
+{
+	nfs4_acl_perm_t allowed = 0, decided = 0, bits;
+	size_t i;
+
+	for (i = 0; (i < n) && (decided != NFS4_ACE_MASK_ALL); i++) {
+		if ((aces[i].pbit & profile) == 0) {
+			continue;
+		}
+		bits = aces[i].mask & ~decided;
+		if (aces[i].type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) {
+			allowed |= bits;
+		}
+		decided |= bits;
+	}
+	return allowed;
+}
+
+/*
+ * Enumerate every requester profile and compare the outcome. Group
+ * memberships are enumerated as subsets of ctx->groups using the usual
+ * (sub - 1) & set walk.
+ */
+static bool
+equiv_compare(const struct equiv_ctx *ctx,
+	      const struct equiv_ace *a, size_t na,
+	      const struct equiv_ace *b, size_t nb)
+{
+	u32 base = (1U << EQUIV_EVERYONE);
+	u32 user, gsub, profile;
+	size_t i;
+
+	for (i = 0; i < EQUIV_MAXPRINCIPALS + 1; i++) {
+		/* i == 0: no named user, otherwise named user at index i - 1 */
+		if (i == 0) {
+			user = 0;
+		}
+		else if (ctx->users & (1U << (i - 1))) {
+			user = 1U << (i - 1);
+		}
+		else {
+			continue;
+		}
+
+		gsub = ctx->groups;
+		for (;;) {
+			profile = base | user | gsub;
+			if ((equiv_evaluate(a, na, profile) !=
+			     equiv_evaluate(b, nb, profile)) ||
+			    (equiv_evaluate(a, na, profile | (1U << EQUIV_OWNER)) !=
+			     equiv_evaluate(b, nb, profile | (1U << EQUIV_OWNER)))) {
+				return false;
+			}
+			if (gsub == 0) {
+				break;
+			}
+			gsub = (gsub - 1) & ctx->groups;
+		}
+	}
+	return true;
+}
+
+static bool
+equiv_has_audit(struct nfs4_acl *acl)
+{
+	struct nfs4_ace *ace = NULL;
+
+	for (ace = nfs4_get_first_ace(acl); ace != NULL;
+	     ace = nfs4_get_next_ace(&ace)) {
+		if ((ace->type != NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) &&
+		    (ace->type != NFS4_ACE_ACCESS_DENIED_ACE_TYPE)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Determine whether ACLs `a` and `b` grant the same access to every
+ * requester, both on the object itself and on children that would
+ * inherit from it. ACL flags must match.
+ *
+ * ACLs with audit or alarm entries, or with more principals than can
+ * be enumerated, are compared positionally with aces_are_equal(). On
+ * allocation failure false is returned, so callers that use this to
+ * skip writes stay on the safe side.
+ */
+bool nfs4_acl_equivalent(struct nfs4_acl *a, struct nfs4_acl *b)
+{
+	struct equiv_ctx ctx = { .cnt = EQUIV_NFIXED };
+	struct equiv_ace *abuf = NULL, *bbuf = NULL;
+	enum equiv_filter filter, last;
+	size_t na, nb;
+	bool ok = true;
+
+	if ((a->aclflags4 & ACL_FLAGS_ALL) != (b->aclflags4 & ACL_FLAGS_ALL)) {
+		return false;
+	}
+
+	if (aces_are_equal(a, b)) {
+		return true;
+	}
+
+	if (equiv_has_audit(a) || equiv_has_audit(b)) {
+		return false;
+	}
+
+	ctx.groups = (1U << EQUIV_GROUP);
+	if (!equiv_add_principals(&ctx, a) || !equiv_add_principals(&ctx, b)) {
+		return false;
+	}
+
+	abuf = calloc(a->naces + 1, sizeof(struct equiv_ace));
+	bbuf = calloc(b->naces + 1, sizeof(struct equiv_ace));
+	if ((abuf == NULL) || (bbuf == NULL)) {
+		free(abuf);
+		free(bbuf);
+		return false;
+	}
+
+	/* Inheritance flags are meaningless on files */
+	last = (a->is_directory || b->is_directory) ?
+	       EQUIV_NFILTERS : EQUIV_FILE_CHILD;
+
+	for (filter = EQUIV_ACCESS; ok && (filter < last); filter++) {
+		na = equiv_compile(&ctx, a, filter, abuf);
+		nb = equiv_compile(&ctx, b, filter, bbuf);
+		ok = equiv_compare(&ctx, abuf, na, bbuf, nb);
+	}
+
+	free(abuf);
+	free(bbuf);
+	return ok;
+}
@@ -0,0 +1,187 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <err.h>
+#include "libacl_nfs4.h"
+
+#ifdef USE_SECURITY_NAMESPACE
+/*
+ * Security namespace xattr must not be used on paths with native NFSv4
+ * ACLs that are exposed by system namespace. Whether a filesystem has
+ * native ACLs does not change while it is mounted, so the result of
+ * probing SYSTEM_XATTR is remembered per st_dev for the lifetime of
+ * the process. This leaves a single xattr syscall per get or set.
+ */
+#define	FS_CACHE_SIZE		64
+
+enum fs_xattr_state {
+	FS_XATTR_UNKNOWN = 0,
+	FS_XATTR_EMULATED,
+	FS_XATTR_NATIVE,
+};
+
+static struct {
+	dev_t			dev;
+	enum fs_xattr_state	state;
+} fs_cache[FS_CACHE_SIZE];
+static size_t fs_cache_cnt;
+static pthread_mutex_t fs_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static enum fs_xattr_state fs_cache_lookup(dev_t dev)
+{
+	enum fs_xattr_state state = FS_XATTR_UNKNOWN;
+	size_t i;
+
+	pthread_mutex_lock(&fs_cache_lock);
+	for (i = 0; i < fs_cache_cnt; i++) {
+		if (fs_cache[i].dev == dev) {
+			state = fs_cache[i].state;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fs_cache_lock);
+	return state;
+}
+
+static void fs_cache_store(dev_t dev, enum fs_xattr_state state)
+{
+	size_t i;
+
+	pthread_mutex_lock(&fs_cache_lock);
+	for (i = 0; i < fs_cache_cnt; i++) {
+		if (fs_cache[i].dev == dev) {
+			fs_cache[i].state = state;
+			goto out;
+		}
+	}
+	/* Cache is full. Further filesystems are probed on every call. */
+	if (fs_cache_cnt < FS_CACHE_SIZE) {
+		fs_cache[fs_cache_cnt].dev = dev;
+		fs_cache[fs_cache_cnt].state = state;
+		fs_cache_cnt++;
+	}
+out:
+	pthread_mutex_unlock(&fs_cache_lock);
+}
+
+/*
+ * Forget what we know about `dev`. Called when an xattr operation on
+ * the security namespace fails in a way that suggests the filesystem
+ * is not what we cached it as.
+ */
+void acl_nfs4_fs_cache_invalidate(dev_t dev)
+{
+	fs_cache_store(dev, FS_XATTR_UNKNOWN);
+}
+
+/*
+ * errno values that say something about the file rather than about
+ * the filesystem, and hence do not invalidate the cache.
+ */
+bool acl_nfs4_fs_errno_expected(int error)
+{
+	switch (error) {
+	case ENODATA:
+	case ERANGE:
+	case ENOENT:
+	case ENOTDIR:
+	case EACCES:
+	case EPERM:
+	case ENAMETOOLONG:
+	case ELOOP:
+	case E2BIG:
+	case EINVAL:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Check that the filesystem holding `path` / `fd` (see acl_nfs4_at.c)
+ * does not have native NFSv4 ACLs. `st` may be passed if the caller
+ * already has it, otherwise the file is stat()ed. The device is
+ * returned in `devp` so that callers can invalidate the entry later.
+ *
+ * Returns 0 if the security namespace may be used, and -1 with errno
+ * set to ENOSYS if filesystem uses native NFSv4 ACLs.
+ */
+int acl_nfs4_fs_check(const char *path, int fd, const struct stat *st,
+		      dev_t *devp)
+{
+	enum fs_xattr_state state;
+	struct stat sb;
+	int res;
+
+	if (st == NULL) {
+		res = acl_nfs4_stat(path, fd, &sb);
+		if (res != 0) {
+			return (-1);
+		}
+		st = &sb;
+	}
+	*devp = st->st_dev;
+
+	state = fs_cache_lookup(st->st_dev);
+	if (state == FS_XATTR_UNKNOWN) {
+		res = acl_nfs4_getxattr(path, fd, SYSTEM_XATTR, NULL, 0);
+		if (res != -1) {
+			state = FS_XATTR_NATIVE;
+			fs_cache_store(st->st_dev, state);
+		}
+		else if ((errno == ENODATA) || (errno == EOPNOTSUPP)) {
+			state = FS_XATTR_EMULATED;
+			fs_cache_store(st->st_dev, state);
+		}
+		else {
+			/* Unable to determine, do not cache */
+			state = FS_XATTR_EMULATED;
+		}
+	}
+
+	if (state == FS_XATTR_NATIVE) {
+		/*
+		 * Convert errno to ENOSYS so that we avoid
+		 * synthesizing a fake ACL from mode and simply
+		 * fail the nfs4_acl_get_*() / nfs4_acl_set_*() call.
+		 */
+		acl_nfs4_log("nfs4xdr-acl-tools is built with option "
+			     "to write to the 'security' xattr namespace, "
+			     "but filesystem uses native NFSv4 ACLs.");
+		errno = ENOSYS;
+		return (-1);
+	}
+	return (0);
+}
+#endif /* USE_SECURITY_NAMESPACE */
@@ -52,8 +52,16 @@ static char *_get_name(uid_t id, bool is_group) {
 	char *buf = NULL;
 	struct passwd *pwd = NULL, pw;
 	struct group *grp = NULL, gr;
+	char cached[NFS4_ACL_CTX_NAME_MAX];
 	int error;
+
+	if (acl_nfs4_ctx_name_lookup(id, is_group, cached, sizeof(cached))) {
+		return strdup(cached);
+	}
 	buf = calloc(1, NAMRBUF);
+	if (buf == NULL) {
+		return NULL;
+	}
 	if (is_group) {
 		error = getgrgid_r(id, &gr, buf, NAMRBUF, &grp);
 		if (error || (grp == NULL)) {
@@ -72,6 +80,9 @@ static char *_get_name(uid_t id, bool is_group) {
 
 	}
 	free(buf);
+	if (out != NULL) {
+		acl_nfs4_ctx_id_store(out, is_group, id);
+	}
 	return out;
 }
 
@@ -137,7 +148,7 @@ int acl_nfs4_get_who(struct nfs4_ace *ace, nfs4_acl_id_t *_who_id, char *_who_st
 	}
 	ncopied = strlcpy(_who_str, who_str, buf_size);
 	if (ncopied != wholen) {
-		fprintf(stderr, "acl_nfs4_get_who(): truncated who_str\n");
+		acl_nfs4_log("acl_nfs4_get_who(): truncated who_str");
 		errno = EINVAL;
 		rv = -1;
 	}
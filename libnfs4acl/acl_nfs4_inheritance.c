@@ -31,6 +31,7 @@
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <arpa/inet.h>
 #include "libacl_nfs4.h"
 
 static void
@@ -236,11 +237,8 @@ bool acl_nfs4_calculate_inherited_acl(struct nfs4_acl *parent_aclp,
 				      mode_t mode, bool skip_mode,
 				      int is_dir)
 {
-	nfs4_acl_perm_t user_allow_first = 0, user_deny = 0, group_deny = 0;
-	nfs4_acl_perm_t user_allow, group_allow, everyone_allow;
-	struct nfs4_ace *new_ace = NULL;
+	const struct nfs4_trivial_acl *t = NULL;
 	bool ok;
-	int ret;
 
 	if ((aclp == NULL)) {
 		errno = EINVAL;
@@ -253,78 +251,16 @@ bool acl_nfs4_calculate_inherited_acl(struct nfs4_acl *parent_aclp,
 		return false;
 	}
 
-	user_allow = group_allow = everyone_allow = NFS4_ACE_BASE_ALLOW_PSARC;
-	user_allow |= NFS4_ACE_USER_ALLOW_PSARC;
-	if (mode & S_IRUSR) {
-		user_allow |= NFS4_ACE_READ_DATA;
-	}
-	if (mode & S_IWUSR) {
-		user_allow |= NFS4_ACE_POSIX_WRITE;
-	}
-	if (mode & S_IXUSR) {
-		user_allow |= NFS4_ACE_EXECUTE;
-	}
-	if (mode & S_IRGRP) {
-		group_allow |= NFS4_ACE_READ_DATA;
-	}
-	if (mode & S_IWGRP) {
-		group_allow |= NFS4_ACE_POSIX_WRITE;
-	}
-	if (mode & S_IXGRP) {
-		group_allow |= NFS4_ACE_EXECUTE;
-	}
-	if (mode & S_IROTH) {
-		everyone_allow |= NFS4_ACE_READ_DATA;
-	}
-	if (mode & S_IWOTH) {
-		everyone_allow |= NFS4_ACE_POSIX_WRITE;
-	}
-	if (mode & S_IXOTH) {
-		everyone_allow |= NFS4_ACE_EXECUTE;
-	}
-	user_deny = ((group_allow | everyone_allow) & ~user_allow);
-	group_deny = everyone_allow & ~group_allow;
-	user_allow_first = group_deny & ~user_deny;
+	/*
+	 * Mode-derived entries come from the precomputed trivial ACL
+	 * table. Its owner@/group@ deny entries (nprefix) go before the
+	 * inherited entries and the three allow entries after them.
+	 */
+	t = acl_nfs4_get_trivial(mode);
 	if (!skip_mode) {
-		if (user_allow_first != 0) {
-			new_ace = nfs4_new_ace(
-				is_dir, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
-				0, user_allow_first, NFS4_ACL_WHO_OWNER, -1
-			);
-			if (new_ace == NULL) {
-				return false;
-			}
-			ret = nfs4_append_ace(aclp, new_ace);
-			if (ret != 0) {
-				return false;
-			}
-		}
-		if (user_deny != 0) {
-			new_ace = nfs4_new_ace(
-				is_dir, NFS4_ACE_ACCESS_DENIED_ACE_TYPE,
-				0, user_deny, NFS4_ACL_WHO_OWNER, -1
-			);
-			if (new_ace == NULL) {
-				return false;
-			}
-			ret = nfs4_append_ace(aclp, new_ace);
-			if (ret != 0) {
-				return false;
-			}
-		}
-		if (group_deny != 0) {
-			new_ace = nfs4_new_ace(
-				is_dir, NFS4_ACE_ACCESS_DENIED_ACE_TYPE,
-				NFS4_ACE_IDENTIFIER_GROUP,
-				group_deny, NFS4_ACL_WHO_GROUP, -1
-			);
-			if (new_ace == NULL) {
-				return false;
-			}
-			ret = nfs4_append_ace(aclp, new_ace);
-			if (ret != 0) {
-				return false;
-			}
+		ok = acl_nfs4_append_trivial_aces(aclp, t, 0, t->nprefix);
+		if (!ok) {
+			return false;
 		}
 	}
 	if (parent_aclp != NULL) {
@@ -334,38 +270,9 @@ bool acl_nfs4_calculate_inherited_acl(struct nfs4_acl *parent_aclp,
 		}
 	}
 	if (!skip_mode) {
-		new_ace = nfs4_new_ace(
-			is_dir, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
-			0, user_allow, NFS4_ACL_WHO_OWNER, -1
-		);
-		if (new_ace == NULL) {
-			return false;
-		}
-		ret = nfs4_append_ace(aclp, new_ace);
-		if (ret != 0) {
-			return false;
-		}
-		new_ace = nfs4_new_ace(
-			is_dir, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
-			NFS4_ACE_IDENTIFIER_GROUP,
-			group_allow, NFS4_ACL_WHO_GROUP, -1
-		);
-		if (new_ace == NULL) {
-			return false;
-		}
-		ret = nfs4_append_ace(aclp, new_ace);
-		if (ret != 0) {
-			return false;
-		}
-		new_ace = nfs4_new_ace(
-			is_dir, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
-			0, everyone_allow, NFS4_ACL_WHO_EVERYONE, -1
-		);
-		if (new_ace == NULL) {
-			return false;
-		}
-		ret = nfs4_append_ace(aclp, new_ace);
-		if (ret != 0) {
+		ok = acl_nfs4_append_trivial_aces(aclp, t, t->nprefix,
+						  t->acl.naces);
+		if (!ok) {
 			return false;
 		}
 	}
@@ -373,143 +280,111 @@ bool acl_nfs4_calculate_inherited_acl(struct nfs4_acl *parent_aclp,
 }
 
 
+/*
+ * Multiplier that spreads an rwx triplet into the mode bits affected
+ * by an entry of the given whotype. Entries for named users and groups
+ * do not contribute to the mode.
+ */
+static const mode_t whotype2spread[] = {
+	[NFS4_ACL_WHO_NAMED] = 0,
+	[NFS4_ACL_WHO_OWNER] = S_IXUSR,
+	[NFS4_ACL_WHO_GROUP] = S_IXGRP,
+	[NFS4_ACL_WHO_EVERYONE] = (S_IXUSR | S_IXGRP | S_IXOTH),
+};
+
+/*
+ * READ_DATA (0x01), WRITE_DATA (0x02) and EXECUTE (0x20) -> rwx triplet
+ */
+#define	MASK_TO_RWX(mask)	((((mask) & NFS4_ACE_READ_DATA) << 2) | \
+				 ((mask) & NFS4_ACE_WRITE_DATA) | \
+				 (((mask) & NFS4_ACE_EXECUTE) >> 5))
+
+/*
+ * Accumulate mode bits of a single ACE. Allow and deny entries land in
+ * acc[NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE] and
+ * acc[NFS4_ACE_ACCESS_DENIED_ACE_TYPE] respectively, audit and alarm
+ * entries land in slots that are never read.
+ */
+static inline void
+ace_accumulate_mode(mode_t acc[4], nfs4_acl_type_t type,
+		    nfs4_acl_perm_t mask, nfs4_acl_who_t whotype)
+{
+	acc[type & 3] |= MASK_TO_RWX(mask) * whotype2spread[whotype & 3];
+}
+
+static inline mode_t
+acc_to_mode(const mode_t acc[4])
+{
+	return (acc[NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE] &
+		~acc[NFS4_ACE_ACCESS_DENIED_ACE_TYPE]);
+}
+
 /*
  * Evaluate owner@, group@, everyone@ entries and convert into a POSIX mode.
  */
 bool acl_nfs4_sync_mode_from_acl(mode_t *_mode, struct nfs4_acl *aclp)
 {
-	mode_t old_mode = *_mode, mode = 0, deny_mode = 0;
+	mode_t acc[4] = { 0 };
 	struct nfs4_ace *ace = NULL;
 
 	for (ace = nfs4_get_first_ace(aclp); ace != NULL;
 	     ace = nfs4_get_next_ace(&ace)) {
-		if (ace->type != NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE &&
-		    ace->type != NFS4_ACE_ACCESS_DENIED_ACE_TYPE) {
-			fprintf(stderr, "Invalid ACE type: %d\n", ace->type);
+		if (ace->type > NFS4_ACE_SYSTEM_ALARM_ACE_TYPE) {
 			continue;
 		}
-
-                switch(ace->whotype) {
-		case NFS4_ACL_WHO_OWNER:
+		ace_accumulate_mode(acc, ace->type, ace->access_mask,
+				    ace->whotype);
+	}
+	*_mode |= acc_to_mode(acc);
 #ifdef NFS4_DEBUG
-			fprintf(stderr, "OWNER@: READ: %s, WRITE: %s, EXEC: %s type: 0x%08x\n",
-				ace->access_mask & NFS4_ACE_READ_DATA ? "YES" : "NO",
-				ace->access_mask & NFS4_ACE_WRITE_DATA ? "YES" : "NO",
-				ace->access_mask & NFS4_ACE_EXECUTE ? "YES" : "NO",
-				ace->type);
+	fprintf(stderr, "acl_nfs4_sync_mode_from_acl(): 0o%o\n", *_mode);
 #endif
+	return true;
+}
 
-			if (ace->access_mask & NFS4_ACE_READ_DATA) {
-				if (ace->type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) {
-					mode |= S_IRUSR;
-				}
-				else {
-					deny_mode |= S_IRUSR;
-				}
-			}
-			if (ace->access_mask & NFS4_ACE_WRITE_DATA) {
-				if (ace->type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) {
-					mode |= S_IWUSR;
-				}
-				else {
-					deny_mode |= S_IWUSR;
-				}
-			}
-			if (ace->access_mask & NFS4_ACE_EXECUTE) {
-				if (ace->type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) {
-					mode |= S_IXUSR;
-				}
-				else {
-					deny_mode |= S_IXUSR;
-				}
-			}
-                        break;
-                case NFS4_ACL_WHO_GROUP:
-#ifdef NFS4_DEBUG
-			fprintf(stderr, "GROUP@: READ: %s, WRITE: %s, EXEC: %s, TYPE: 0x%08x\n",
-				ace->access_mask & NFS4_ACE_READ_DATA ? "YES" : "NO",
-				ace->access_mask & NFS4_ACE_WRITE_DATA ? "YES" : "NO",
-				ace->access_mask & NFS4_ACE_EXECUTE ? "YES" : "NO",
-				ace->type);
-#endif
+/*
+ * Same as acl_nfs4_sync_mode_from_acl(), but evaluates the packed XDR
+ * ACL as returned by getxattr() without decoding it into an nfs4_acl.
+ */
+bool acl_nfs4_xattr_mode(const char *xattr_v, size_t xattr_size, mode_t *_mode)
+{
+	mode_t acc[4] = { 0 };
+	const u32 *p = (const u32 *)xattr_v;
+	u32 i, naces, type, iflag, mask, who;
+	nfs4_acl_who_t whotype;
 
-			if (ace->access_mask & NFS4_ACE_READ_DATA) {
-				if (ace->type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) {
-					mode |= S_IRGRP;
-				}
-				else {
-					deny_mode |= S_IRGRP;
-				}
-			}
-			if (ace->access_mask & NFS4_ACE_WRITE_DATA) {
-				if (ace->type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) {
-					mode |= S_IWGRP;
-				}
-				else {
-					deny_mode |= S_IWGRP;
-				}
-			}
-			if (ace->access_mask & NFS4_ACE_EXECUTE) {
-				if (ace->type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) {
-					mode |= S_IXGRP;
-				}
-				else {
-					deny_mode |= S_IXGRP;
-				}
-			}
-                        break;
-                case NFS4_ACL_WHO_EVERYONE:
-#ifdef NFS4_DEBUG
-			fprintf(stderr, "EVERYONE@: READ: %s, WRITE: %s, EXEC: %s, TYPE: 0x%08x\n",
-				ace->access_mask & NFS4_ACE_READ_DATA ? "YES" : "NO",
-				ace->access_mask & NFS4_ACE_WRITE_DATA ? "YES" : "NO",
-				ace->access_mask & NFS4_ACE_EXECUTE ? "YES" : "NO",
-				ace->type);
-#endif
+	if (!XDRSIZE_IS_VALID(xattr_size)) {
+		errno = EINVAL;
+		return false;
+	}
 
-			if (ace->access_mask & NFS4_ACE_READ_DATA) {
-				if (ace->type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) {
-					mode |= (S_IRUSR | S_IRGRP | S_IROTH);
-				}
-				else {
-					deny_mode |= (S_IRUSR | S_IRGRP | S_IROTH);
-				}
-			}
-			if (ace->access_mask & NFS4_ACE_WRITE_DATA) {
-				if (ace->type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) {
-					mode |= (S_IWUSR | S_IWGRP | S_IWOTH);
-				}
-				else {
-					deny_mode |= (S_IWUSR | S_IWGRP | S_IWOTH);
-				}
-			}
-			if (ace->access_mask & NFS4_ACE_EXECUTE) {
-				if (ace->type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) {
-					mode |= (S_IXUSR | S_IXGRP | S_IXOTH);
-				}
-				else {
-					deny_mode |= (S_IXUSR | S_IXGRP | S_IXOTH);
-				}
-			}
-                        break;
-
-		default:
-#ifdef NFS4_DEBUG
-			fprintf(stderr, "whotype: %d, who: %d: READ: %s, WRITE: %s, EXEC: %s\n",
-				ace->whotype, ace->who_id,
-				ace->access_mask & NFS4_ACE_READ_DATA ? "YES" : "NO",
-				ace->access_mask & NFS4_ACE_WRITE_DATA ? "YES" : "NO",
-				ace->access_mask & NFS4_ACE_EXECUTE ? "YES" : "NO");
-#endif
-			break;
+	naces = ntohl(p[1]);
+	if (naces != XDRSIZE_2_ACES(xattr_size)) {
+		errno = EINVAL;
+		return false;
+	}
+
+	for (i = 0, p += 2; i < naces; i++, p += ACE4ELEM) {
+		type = ntohl(p[0]);
+		iflag = ntohl(p[2]);
+		mask = ntohl(p[3]);
+		who = ntohl(p[4]);
 
+		if (type > NFS4_ACE_SYSTEM_ALARM_ACE_TYPE) {
+			continue;
 		}
+		/*
+		 * ACE4_SPECIAL_OWNER / GROUP / EVERYONE share their values
+		 * with the corresponding nfs4_acl_whotype.
+		 */
+		whotype = (iflag & ACEI4_SPECIAL_WHO) ? who : NFS4_ACL_WHO_NAMED;
+		if (whotype > NFS4_ACL_WHO_EVERYONE) {
+			errno = EINVAL;
+			return false;
+		}
+		ace_accumulate_mode(acc, type, mask, whotype);
 	}
-	mode &= ~deny_mode;
-	*_mode = mode | old_mode;
-#ifdef NFS4_DEBUG
-	fprintf(stderr, "acl_nfs4_sync_mode_from_acl(): 0o%o\n", *_mode);
-#endif
+	*_mode |= acc_to_mode(acc);
 	return true;
 }
 
@@ -533,18 +408,10 @@ struct nfs4_acl *acl_nfs4_strip(struct nfs4_acl *acl)
 		return NULL;
 	}
 
-	new_acl = nfs4_new_acl(acl->is_directory);
+	new_acl = acl_nfs4_new_trivial_acl(calculated_mode, acl->is_directory);
 	if (new_acl == NULL) {
-		return NULL;
-	}
-
-	ok = acl_nfs4_calculate_inherited_acl(NULL, new_acl,
-					      calculated_mode, false,
-					      acl->is_directory);
-	if (!ok) {
-		fprintf(stderr, "Failed to calculate_inherited_acl: %s\n",
-			strerror(errno));
-		nfs4_free_acl(new_acl);
+		acl_nfs4_log("Failed to create trivial ACL: %s",
+			     strerror(errno));
 		return NULL;
 	}
 
@@ -556,15 +423,48 @@ struct nfs4_acl *acl_nfs4_strip(struct nfs4_acl *acl)
  * without loss of information (is trivial). trivialp will be set to
  * 1 if the `acl` is trivial.
  *
- * This is accomplished by comparing a stripped copy of the ACL with
- * the original.
+ * If the kernel already flagged the ACL as trivial we trust it.
+ * Otherwise the ACL is compared entry by entry against the precomputed
+ * trivial ACL for the mode it evaluates to. Nothing is allocated and
+ * the comparison stops at the first mismatching entry.
  */
 int nfs4_acl_is_trivial_np(struct nfs4_acl *acl, int *trivialp)
 {
-	if (acl == NULL) {
+	const struct nfs4_trivial_acl *t = NULL;
+	struct nfs4_ace *ace = NULL;
+	mode_t mode = 0;
+	u32 i;
+
+	if (acl == NULL || trivialp == NULL) {
 		errno = EINVAL;
 		return -1;
 	}
-	*trivialp = acl->aclflags4 & ACL_IS_TRIVIAL ? 1 : 0;
+
+	*trivialp = 0;
+	if (acl->aclflags4 & ACL_IS_TRIVIAL) {
+		*trivialp = 1;
+		return 0;
+	}
+
+	/* owner@, group@, everyone@ allow plus up to three deny entries */
+	if ((acl->naces < NFS4_TRIVIAL_MAXACES / 2) ||
+	    (acl->naces > NFS4_TRIVIAL_MAXACES)) {
+		return 0;
+	}
+
+	acl_nfs4_sync_mode_from_acl(&mode, acl);
+	t = acl_nfs4_get_trivial(mode);
+	if (t->acl.naces != acl->naces) {
+		return 0;
+	}
+
+	for (ace = nfs4_get_first_ace(acl), i = 0; ace != NULL;
+	     ace = nfs4_get_next_ace(&ace), i++) {
+		if (!ace_is_equal(ace, (struct nfs4_ace *)&t->aces[i])) {
+			return 0;
+		}
+	}
+
+	*trivialp = 1;
 	return 0;
 }
@@ -0,0 +1,268 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include "libacl_nfs4.h"
+
+/*
+ * Removal of redundant ACL entries. Every step below is only taken when
+ * it provably does not change the access granted by the ACL, either on
+ * the object itself or on children inheriting from it:
+ *
+ * - entries with an empty access mask are dropped.
+ * - an entry identical to an earlier one except for its mask is merged
+ *   into the earlier one, provided no entry in between can decide any
+ *   of the moved bits differently for the same requester.
+ * - bits already decided for the same principal (or for everyone@) by
+ *   earlier entries with the same inheritance flags are dead and are
+ *   removed from later entries.
+ *
+ * A DENY entry is never removed merely because no later ALLOW entry
+ * grants its bits: the file system may grant access outside the ACL,
+ * such as the implicit READ_ACL, WRITE_ACL and WRITE_ATTRIBUTES rights
+ * of the owner on ZFS, or allows derived from the file mode.
+ *
+ * Audit and alarm entries are never touched.
+ */
+
+#define	IS_ACCESS_ACE(ace)					\
+	(((ace)->type == NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE) ||	\
+	 ((ace)->type == NFS4_ACE_ACCESS_DENIED_ACE_TYPE))
+
+static bool
+same_principal(const struct nfs4_ace *a, const struct nfs4_ace *b)
+{
+	if (a->whotype != b->whotype) {
+		return false;
+	}
+	if (a->whotype != NFS4_ACL_WHO_NAMED) {
+		return true;
+	}
+	return (a->who_id == b->who_id) &&
+	       ((a->flag & NFS4_ACE_IDENTIFIER_GROUP) ==
+		(b->flag & NFS4_ACE_IDENTIFIER_GROUP));
+}
+
+/*
+ * Whether a single requester may match both entries. Group membership
+ * and file ownership are unknown, so only two different named users
+ * are known to be disjoint.
+ */
+static bool
+may_overlap(const struct nfs4_ace *a, const struct nfs4_ace *b)
+{
+	if ((a->whotype == NFS4_ACL_WHO_NAMED) &&
+	    (b->whotype == NFS4_ACL_WHO_NAMED) &&
+	    ((a->flag & NFS4_ACE_IDENTIFIER_GROUP) == 0) &&
+	    ((b->flag & NFS4_ACE_IDENTIFIER_GROUP) == 0)) {
+		return a->who_id == b->who_id;
+	}
+	return true;
+}
+
+static bool
+prune_empty(struct nfs4_ace **aces, u32 n,
+	    struct nfs4_acl_minimize_report *r)
+{
+	bool changed = false;
+	u32 i;
+
+	for (i = 0; i < n; i++) {
+		if ((aces[i] != NULL) && IS_ACCESS_ACE(aces[i]) &&
+		    ((aces[i]->access_mask & NFS4_ACE_MASK_ALL) == 0)) {
+			free(aces[i]);
+			aces[i] = NULL;
+			r->empty++;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+static bool
+can_merge(struct nfs4_ace **aces, u32 i, u32 j)
+{
+	const struct nfs4_ace *k = NULL;
+	u32 idx;
+
+	for (idx = i + 1; idx < j; idx++) {
+		k = aces[idx];
+		if ((k == NULL) || !IS_ACCESS_ACE(k) ||
+		    (k->type == aces[j]->type)) {
+			continue;
+		}
+		if (((k->access_mask & aces[j]->access_mask) != 0) &&
+		    may_overlap(k, aces[j])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool
+merge_duplicates(struct nfs4_ace **aces, u32 n,
+		 struct nfs4_acl_minimize_report *r)
+{
+	bool changed = false;
+	u32 i, j;
+
+	for (j = 1; j < n; j++) {
+		if ((aces[j] == NULL) || !IS_ACCESS_ACE(aces[j])) {
+			continue;
+		}
+		for (i = 0; i < j; i++) {
+			if ((aces[i] == NULL) ||
+			    (aces[i]->type != aces[j]->type) ||
+			    (aces[i]->flag != aces[j]->flag) ||
+			    !same_principal(aces[i], aces[j])) {
+				continue;
+			}
+			if (!can_merge(aces, i, j)) {
+				continue;
+			}
+			aces[i]->access_mask |= aces[j]->access_mask;
+			free(aces[j]);
+			aces[j] = NULL;
+			r->merged++;
+			changed = true;
+			break;
+		}
+	}
+	return changed;
+}
+
+static bool
+prune_shadowed(struct nfs4_ace **aces, u32 n,
+	       struct nfs4_acl_minimize_report *r)
+{
+	nfs4_acl_perm_t decided, mask;
+	nfs4_acl_flag_t iflags;
+	bool changed = false;
+	u32 i, j;
+
+	for (j = 1; j < n; j++) {
+		if ((aces[j] == NULL) || !IS_ACCESS_ACE(aces[j])) {
+			continue;
+		}
+		iflags = aces[j]->flag & ~NFS4_ACE_IDENTIFIER_GROUP;
+		decided = 0;
+		for (i = 0; i < j; i++) {
+			if ((aces[i] == NULL) || !IS_ACCESS_ACE(aces[i]) ||
+			    ((aces[i]->flag & ~NFS4_ACE_IDENTIFIER_GROUP) != iflags)) {
+				continue;
+			}
+			if ((aces[i]->whotype == NFS4_ACL_WHO_EVERYONE) ||
+			    same_principal(aces[i], aces[j])) {
+				decided |= aces[i]->access_mask;
+			}
+		}
+
+		mask = aces[j]->access_mask & ~decided;
+		if (mask == aces[j]->access_mask) {
+			continue;
+		}
+		changed = true;
+		if ((mask & NFS4_ACE_MASK_ALL) == 0) {
+			free(aces[j]);
+			aces[j] = NULL;
+			r->shadowed++;
+		}
+		else {
+			aces[j]->access_mask = mask;
+			r->narrowed++;
+		}
+	}
+	return changed;
+}
+
+/*
+ * Remove redundant entries from `acl` in place. If `reportp` is not
+ * NULL, it receives counts of what was removed. Returns 0 on success
+ * and -1 on failure, in which case the ACL is unchanged.
+ */
+int nfs4_acl_minimize(struct nfs4_acl *acl,
+		      struct nfs4_acl_minimize_report *reportp)
+{
+	struct nfs4_acl_minimize_report r = { 0 };
+	struct nfs4_ace **aces = NULL;
+	struct nfs4_ace *ace = NULL;
+	bool changed;
+	u32 i, n;
+
+	if (acl == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!acl_nfs4_detach(acl, NULL)) {
+		return -1;
+	}
+
+	n = acl->naces;
+	if (n == 0) {
+		goto done;
+	}
+
+	aces = calloc(n, sizeof(struct nfs4_ace *));
+	if (aces == NULL) {
+		return -1;
+	}
+
+	for (i = 0, ace = nfs4_get_first_ace(acl); ace != NULL;
+	     i++, ace = nfs4_get_next_ace(&ace)) {
+		aces[i] = ace;
+	}
+
+	/* Each pass can expose more work for the others */
+	do {
+		changed = prune_empty(aces, n, &r);
+		changed |= merge_duplicates(aces, n, &r);
+		changed |= prune_shadowed(aces, n, &r);
+	} while (changed);
+
+	TAILQ_INIT(&acl->entries->head);
+	acl->naces = 0;
+	for (i = 0; i < n; i++) {
+		if (aces[i] != NULL) {
+			TAILQ_INSERT_TAIL(&acl->entries->head, aces[i], l_ace);
+			acl->naces++;
+		}
+	}
+	free(aces);
+
+done:
+	if (reportp != NULL) {
+		*reportp = r;
+	}
+	return 0;
+}
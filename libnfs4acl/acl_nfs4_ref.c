@@ -0,0 +1,136 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include "libacl_nfs4.h"
+
+/*
+ * An ACL handle (struct nfs4_acl) is owned by a single caller, but its
+ * entries may be shared between handles. nfs4_acl_ref() returns a new
+ * handle to the same entries, which costs a small allocation and an
+ * atomic increment instead of copying every entry.
+ *
+ * ACL flags, naces and is_directory live in the handle and may be
+ * changed freely. Functions that modify entries call acl_nfs4_detach()
+ * first, which gives the handle a private copy of them if they are
+ * shared. Other handles never see the change.
+ */
+struct nfs4_acl *nfs4_acl_ref(struct nfs4_acl *acl)
+{
+	struct nfs4_acl *out = NULL;
+
+	if (acl == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	out = malloc(sizeof(*out));
+	if (out == NULL) {
+		return NULL;
+	}
+
+	*out = *acl;
+	__atomic_add_fetch(&acl->entries->refcnt, 1, __ATOMIC_RELAXED);
+	return out;
+}
+
+void nfs4_acl_unref(struct nfs4_acl *acl)
+{
+	nfs4_free_acl(acl);
+}
+
+/*
+ * Drop a reference to `entries`, freeing them with the last one.
+ */
+void acl_nfs4_entries_unref(struct nfs4_ace_list *entries)
+{
+	struct nfs4_ace *ace = NULL;
+
+	if (__atomic_sub_fetch(&entries->refcnt, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+	while ((ace = TAILQ_FIRST(&entries->head)) != NULL) {
+		TAILQ_REMOVE(&entries->head, ace, l_ace);
+		free(ace);
+	}
+	free(entries);
+}
+
+/*
+ * Give `acl` a private copy of its entries if they are shared with
+ * another handle. If `acep` points to one of the shared entries, it is
+ * updated to point to the corresponding private one. Returns false
+ * with errno set on failure, in which case `acl` is unchanged.
+ */
+bool acl_nfs4_detach(struct nfs4_acl *acl, struct nfs4_ace **acep)
+{
+	struct nfs4_ace_list *entries = NULL;
+	struct nfs4_ace *ace = NULL, *new_ace = NULL, *found = NULL;
+
+	if (__atomic_load_n(&acl->entries->refcnt, __ATOMIC_ACQUIRE) <= 1) {
+		return true;
+	}
+
+	entries = malloc(sizeof(*entries));
+	if (entries == NULL) {
+		acl_nfs4_log("failed to copy shared ACL entries");
+		return false;
+	}
+	entries->refcnt = 1;
+	TAILQ_INIT(&entries->head);
+
+	for (ace = TAILQ_FIRST(&acl->entries->head); ace != NULL;
+	     ace = TAILQ_NEXT(ace, l_ace)) {
+		new_ace = malloc(sizeof(*new_ace));
+		if (new_ace == NULL) {
+			acl_nfs4_log("failed to copy shared ACL entries");
+			acl_nfs4_entries_unref(entries);
+			return false;
+		}
+		*new_ace = *ace;
+		TAILQ_INSERT_TAIL(&entries->head, new_ace, l_ace);
+		if ((acep != NULL) && (*acep == ace)) {
+			found = new_ace;
+		}
+	}
+
+	if ((acep != NULL) && (found == NULL)) {
+		acl_nfs4_entries_unref(entries);
+		errno = ENOENT;
+		return false;
+	}
+
+	acl_nfs4_entries_unref(acl->entries);
+	acl->entries = entries;
+	if (acep != NULL) {
+		*acep = found;
+	}
+	return true;
+}
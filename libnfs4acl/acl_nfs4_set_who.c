@@ -70,7 +70,13 @@ static nfs4_acl_id_t _get_id(const char *who, bool is_group) {
 	if (*remainder == '\0') {
 		return ((nfs4_acl_id_t)id);
 	}
+	if (acl_nfs4_ctx_id_lookup(who, is_group, &out)) {
+		return (out);
+	}
 	buf = calloc(1, NAMRBUF);
+	if (buf == NULL) {
+		return ((nfs4_acl_id_t)-1);
+	}
 	if (is_group) {
 		error = getgrnam_r(who, &gr, buf, NAMRBUF, &grp);
 		if (error || grp == NULL) {
@@ -89,6 +95,7 @@ static nfs4_acl_id_t _get_id(const char *who, bool is_group) {
 
 	}
 	free(buf);
+	acl_nfs4_ctx_id_store(who, is_group, out);
 	return (out);
 }
 
@@ -104,16 +111,16 @@ int acl_nfs4_set_who(struct nfs4_ace* ace, int type, const char *who, nfs4_acl_i
 	switch (type) {
 		case NFS4_ACL_WHO_NAMED:
 			if ((who == NULL) && (idp == NULL)) {
-				fprintf(stderr, "acl_nfs4_set_who(): "
-				    "no principal was provided\n");
+				acl_nfs4_log("acl_nfs4_set_who(): "
+				    "no principal was provided");
 				errno = EINVAL;
 				return (-1);
 			}
 			else if (who != NULL) {
 				id = _get_id(who, NFS4_IS_GROUP(ace->flag));
 				if (id == -1) {
-					fprintf(stderr, "acl_nfs4_set_who(): "
-					    "name [%s] is invalid\n", who);
+					acl_nfs4_log("acl_nfs4_set_who(): "
+					    "name [%s] is invalid", who);
 					errno = EINVAL;
 					return (-1);
 				}
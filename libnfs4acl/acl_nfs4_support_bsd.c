@@ -160,7 +160,7 @@ parse_flags_verbose(const char *strp, uint32_t *var,
 
 		if (!found) {
 			if (ever_found)
-				warnx("malformed ACL: \"%s\" field contains "
+				acl_nfs4_log("malformed ACL: \"%s\" field contains "
 				    "invalid flag \"%s\"", flags_name, flag);
 			else
 				*try_compact = 1;
@@ -200,7 +200,7 @@ parse_flags_compact(const char *str, uint32_t *var,
 		}
 
 		if (!found) {
-			warnx("malformed ACL: \"%s\" field contains "
+			acl_nfs4_log("malformed ACL: \"%s\" field contains "
 			    "invalid flag \"%c\"", flags_name, str[i]);
 			return (-1);
 		}
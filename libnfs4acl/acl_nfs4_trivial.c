@@ -0,0 +1,262 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "libacl_nfs4.h"
+
+/*
+ * Trivial ACLs depend only on the rwx bits of the mode. Setuid, setgid
+ * and sticky bits do not change the result, and neither does whether
+ * the target is a directory, so one table of ACCESSPERMS + 1 entries
+ * covers every (mode & 07777, is_dir) combination.
+ */
+static struct nfs4_trivial_acl trivial_acls[ACCESSPERMS + 1];
+static pthread_once_t trivial_acls_once = PTHREAD_ONCE_INIT;
+
+/* rwx triplet -> NFSv4 access mask */
+static const nfs4_acl_perm_t rwx2mask[8] = {
+	0,
+	NFS4_ACE_EXECUTE,
+	NFS4_ACE_POSIX_WRITE,
+	NFS4_ACE_POSIX_WRITE | NFS4_ACE_EXECUTE,
+	NFS4_ACE_READ_DATA,
+	NFS4_ACE_READ_DATA | NFS4_ACE_EXECUTE,
+	NFS4_ACE_READ_DATA | NFS4_ACE_POSIX_WRITE,
+	NFS4_ACE_READ_DATA | NFS4_ACE_POSIX_WRITE | NFS4_ACE_EXECUTE,
+};
+
+static void
+trivial_add_ace(struct nfs4_trivial_acl *t, nfs4_acl_type_t type,
+		nfs4_acl_flag_t flag, nfs4_acl_perm_t access_mask,
+		nfs4_acl_who_t whotype)
+{
+	struct nfs4_ace *ace = &t->aces[t->acl.naces];
+
+	ace->type = type;
+	ace->flag = flag;
+	ace->access_mask = access_mask & NFS4_ACE_MASK_ALL;
+	ace->whotype = whotype;
+	ace->who_id = -1;
+	TAILQ_INSERT_TAIL(&t->entries.head, ace, l_ace);
+	t->acl.naces++;
+}
+
+/*
+ * Layout matches what acl_nfs4_calculate_inherited_acl() historically
+ * generated: optional owner@ allow / owner@ deny / group@ deny entries,
+ * followed by owner@, group@ and everyone@ allow entries. Logic is
+ * derived from PSARC/2010/029 and FreeBSD's subr_acl_nfs4.c.
+ */
+static void
+trivial_acl_init_one(struct nfs4_trivial_acl *t, mode_t mode)
+{
+	nfs4_acl_perm_t user_allow_first, user_deny, group_deny;
+	nfs4_acl_perm_t user_allow, group_allow, everyone_allow;
+
+	user_allow = NFS4_ACE_BASE_ALLOW_PSARC | NFS4_ACE_USER_ALLOW_PSARC |
+		     rwx2mask[(mode >> 6) & 7];
+	group_allow = NFS4_ACE_BASE_ALLOW_PSARC | rwx2mask[(mode >> 3) & 7];
+	everyone_allow = NFS4_ACE_BASE_ALLOW_PSARC | rwx2mask[mode & 7];
+
+	user_deny = ((group_allow | everyone_allow) & ~user_allow);
+	group_deny = everyone_allow & ~group_allow;
+	user_allow_first = group_deny & ~user_deny;
+
+	t->acl.naces = 0;
+	t->acl.aclflags4 = 0;
+	t->acl.is_directory = 0;
+	t->acl.entries = &t->entries;
+	t->entries.refcnt = 1;
+	TAILQ_INIT(&t->entries.head);
+
+	if (user_allow_first != 0) {
+		trivial_add_ace(t, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+				user_allow_first, NFS4_ACL_WHO_OWNER);
+	}
+	if (user_deny != 0) {
+		trivial_add_ace(t, NFS4_ACE_ACCESS_DENIED_ACE_TYPE, 0,
+				user_deny, NFS4_ACL_WHO_OWNER);
+	}
+	if (group_deny != 0) {
+		trivial_add_ace(t, NFS4_ACE_ACCESS_DENIED_ACE_TYPE,
+				NFS4_ACE_IDENTIFIER_GROUP,
+				group_deny, NFS4_ACL_WHO_GROUP);
+	}
+	t->nprefix = t->acl.naces;
+
+	trivial_add_ace(t, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+			user_allow, NFS4_ACL_WHO_OWNER);
+	trivial_add_ace(t, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
+			NFS4_ACE_IDENTIFIER_GROUP,
+			group_allow, NFS4_ACL_WHO_GROUP);
+	trivial_add_ace(t, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+			everyone_allow, NFS4_ACL_WHO_EVERYONE);
+
+	t->xdrsize = acl_nfs4_xattr_pack_buf(&t->acl, (char *)t->xdr,
+					     sizeof (t->xdr));
+}
+
+static void
+trivial_acls_init(void)
+{
+	mode_t mode;
+
+	for (mode = 0; mode <= ACCESSPERMS; mode++) {
+		trivial_acl_init_one(&trivial_acls[mode], mode);
+	}
+}
+
+/*
+ * Return the precomputed trivial ACL for `mode`. The returned entry is
+ * shared and must be treated as read-only; in particular t->acl must
+ * never be passed to functions that modify or free an ACL.
+ */
+const struct nfs4_trivial_acl *acl_nfs4_get_trivial(mode_t mode)
+{
+	pthread_once(&trivial_acls_once, trivial_acls_init);
+	return &trivial_acls[mode & ACCESSPERMS];
+}
+
+/*
+ * Append entries [start, end) of a trivial ACL to `aclp`.
+ */
+bool acl_nfs4_append_trivial_aces(struct nfs4_acl *aclp,
+				  const struct nfs4_trivial_acl *t,
+				  u32 start, u32 end)
+{
+	const struct nfs4_ace *ace = NULL;
+	struct nfs4_ace *new_ace = NULL;
+	u32 i;
+
+	for (i = start; i < end; i++) {
+		ace = &t->aces[i];
+		new_ace = nfs4_new_ace(aclp->is_directory, ace->type, ace->flag,
+				       ace->access_mask, ace->whotype,
+				       ace->who_id);
+		if (new_ace == NULL) {
+			return false;
+		}
+		if (nfs4_append_ace(aclp, new_ace) != 0) {
+			free(new_ace);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Allocate a new trivial ACL for the given mode.
+ *
+ * Returned ACL must be freed.
+ */
+struct nfs4_acl *acl_nfs4_new_trivial_acl(mode_t mode, int is_dir)
+{
+	const struct nfs4_trivial_acl *t = acl_nfs4_get_trivial(mode);
+	struct nfs4_acl *acl = NULL;
+
+	acl = nfs4_new_acl(is_dir);
+	if (acl == NULL) {
+		return NULL;
+	}
+
+	if (!acl_nfs4_append_trivial_aces(acl, t, 0, t->acl.naces)) {
+		nfs4_free_acl(acl);
+		return NULL;
+	}
+	return acl;
+}
+
+/*
+ * XDR counterpart of nfs4_acl_is_trivial_np(). Entries of the packed
+ * ACL are compared byte-wise against the precomputed trivial ACL for
+ * the mode they evaluate to; ACL flags other than ACL_IS_TRIVIAL are
+ * not taken into account.
+ */
+int acl_nfs4_xattr_is_trivial(const char *xattr_v, size_t xattr_size,
+			      int *trivialp)
+{
+	const struct nfs4_trivial_acl *t = NULL;
+	const u32 *p = (const u32 *)xattr_v;
+	mode_t mode = 0;
+
+	if (xattr_v == NULL || trivialp == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!acl_nfs4_xattr_mode(xattr_v, xattr_size, &mode)) {
+		return -1;
+	}
+
+	if (ntohl(p[0]) & ACL_IS_TRIVIAL) {
+		*trivialp = 1;
+		return 0;
+	}
+
+	t = acl_nfs4_get_trivial(mode);
+	*trivialp = ((t->xdrsize == xattr_size) &&
+		     (memcmp(p + 1, t->xdr + 1, xattr_size - sizeof (u32)) == 0));
+	return 0;
+}
+
+/*
+ * Strip the packed XDR ACL `xattr_v` and write the resulting trivial
+ * ACL into caller-provided buffer `buf`. Neither the source nor the
+ * result is decoded into an nfs4_acl, so no memory is allocated.
+ * Returns the number of bytes written to `buf`.
+ */
+size_t acl_nfs4_xattr_strip(const char *xattr_v, size_t xattr_size,
+			    char *buf, size_t bufsz)
+{
+	const struct nfs4_trivial_acl *t = NULL;
+	mode_t mode = 0;
+
+	if (xattr_v == NULL || buf == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!acl_nfs4_xattr_mode(xattr_v, xattr_size, &mode)) {
+		return -1;
+	}
+
+	t = acl_nfs4_get_trivial(mode);
+	if (t->xdrsize > bufsz) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	memcpy(buf, t->xdr, t->xdrsize);
+	return t->xdrsize;
+}
@@ -0,0 +1,650 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "libacl_nfs4.h"
+
+/*
+ * io_uring backend for nfs4_acl_get_many() and nfs4_acl_set_many().
+ *
+ * Built only with USE_IO_URING (Linux 5.19 or later headers). Rather
+ * than blocking in one getxattr() or setxattr() at a time, each thread
+ * keeps up to `depth` paths in flight through its context's ring.
+ * Reads submit IORING_OP_STATX and IORING_OP_GETXATTR for a path
+ * together; for batches with expected inodes (walk read-ahead), a read
+ * whose statx finds another inode is dropped, and neither it nor any
+ * fallback reads it by path again. Writes submit IORING_OP_SETXATTR, after an
+ * IORING_OP_STATX in security namespace builds because the filesystem
+ * must be checked first.
+ *
+ * If the kernel lacks io_uring or one of these opcodes, or io_uring is
+ * disabled by sysctl, no ring is created and batches use synchronous
+ * syscalls. The same happens for single paths that do not fit the
+ * ring's fixed buffers (ACLs larger than URING_XATTR_BUFSZ).
+ */
+#ifdef USE_IO_URING
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#define	URING_DEPTH_MAX		4096
+#define	URING_XATTR_BUFSZ	4096	/* up to 204 entries */
+
+#define	UD_STATX		0
+#define	UD_XATTR		1
+#define	UD_MAKE(slot, which)	(((uint64_t)(slot) << 1) | (which))
+#define	UD_SLOT(ud)		((ud) >> 1)
+#define	UD_WHICH(ud)		((ud) & 1)
+
+struct uring_slot {
+	size_t			idx;		/* index into the batch */
+	u32			pending;	/* completions outstanding */
+	bool			stat_done;	/* SET: statx stage is over */
+	int			stat_res;
+	int			xattr_res;
+	struct statx		stx;
+	char			buf[URING_XATTR_BUFSZ];
+};
+
+struct acl_nfs4_uring {
+	int			fd;
+	u32			depth;
+	bool			broken;
+
+	u32			*sq_head;
+	u32			*sq_tail;
+	u32			sq_mask;
+	u32			*sq_array;
+	u32			sq_local_tail;
+	struct io_uring_sqe	*sqes;
+
+	u32			*cq_head;
+	u32			*cq_tail;
+	u32			cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void			*sq_ptr;
+	size_t			sq_sz;
+	void			*cq_ptr;
+	size_t			cq_sz;
+	size_t			sqes_sz;
+
+	struct uring_slot	*slots;
+	u32			*free_slots;
+	u32			nfree;
+};
+
+static bool
+uring_probe(int fd)
+{
+	static const uint8_t ops[] = {
+		IORING_OP_STATX,
+		IORING_OP_GETXATTR,
+		IORING_OP_SETXATTR,
+	};
+	struct io_uring_probe *probe = NULL;
+	bool ok = true;
+	size_t i;
+
+	probe = calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+	if (probe == NULL) {
+		return false;
+	}
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+		    probe, 256) != 0) {
+		free(probe);
+		return false;
+	}
+	for (i = 0; i < sizeof(ops); i++) {
+		if ((ops[i] > probe->last_op) ||
+		    !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+			ok = false;
+		}
+	}
+	free(probe);
+	return ok;
+}
+
+void acl_nfs4_uring_free(struct acl_nfs4_uring *r)
+{
+	if (r == NULL) {
+		return;
+	}
+	if (r->sqes != NULL && r->sqes != MAP_FAILED) {
+		munmap(r->sqes, r->sqes_sz);
+	}
+	if (r->cq_ptr != NULL && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr) {
+		munmap(r->cq_ptr, r->cq_sz);
+	}
+	if (r->sq_ptr != NULL && r->sq_ptr != MAP_FAILED) {
+		munmap(r->sq_ptr, r->sq_sz);
+	}
+	if (r->fd != -1) {
+		close(r->fd);
+	}
+	free(r->free_slots);
+	free(r->slots);
+	free(r);
+}
+
+/*
+ * Set up a ring for `depth` paths in flight. Returns NULL with errno
+ * set if io_uring or the required opcodes are unavailable.
+ */
+struct acl_nfs4_uring *acl_nfs4_uring_new(unsigned int depth)
+{
+	struct io_uring_params p;
+	struct acl_nfs4_uring *r = NULL;
+	void *cq = NULL;
+	u32 i;
+	int error;
+
+	if ((depth == 0) || (depth > URING_DEPTH_MAX)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL) {
+		return NULL;
+	}
+	r->fd = -1;
+	r->depth = depth;
+
+	/* A path needs at most two SQEs (statx and xattr) at a time */
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, depth * 2, &p);
+	if (r->fd == -1) {
+		goto fail;
+	}
+	if (!uring_probe(r->fd)) {
+		errno = EOPNOTSUPP;
+		goto fail;
+	}
+
+	r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(u32);
+	r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_sz > r->sq_sz) {
+			r->sq_sz = r->cq_sz;
+		}
+		r->cq_sz = r->sq_sz;
+	}
+
+	r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		goto fail;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	}
+	else {
+		r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED) {
+			goto fail;
+		}
+	}
+	r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		goto fail;
+	}
+
+	r->sq_head = (u32 *)((char *)r->sq_ptr + p.sq_off.head);
+	r->sq_tail = (u32 *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = *(u32 *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (u32 *)((char *)r->sq_ptr + p.sq_off.array);
+	r->sq_local_tail = *r->sq_tail;
+
+	cq = r->cq_ptr;
+	r->cq_head = (u32 *)((char *)cq + p.cq_off.head);
+	r->cq_tail = (u32 *)((char *)cq + p.cq_off.tail);
+	r->cq_mask = *(u32 *)((char *)cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)cq + p.cq_off.cqes);
+
+	r->slots = calloc(depth, sizeof(struct uring_slot));
+	r->free_slots = calloc(depth, sizeof(u32));
+	if ((r->slots == NULL) || (r->free_slots == NULL)) {
+		goto fail;
+	}
+	for (i = 0; i < depth; i++) {
+		r->free_slots[i] = depth - 1 - i;
+	}
+	r->nfree = depth;
+	return r;
+
+fail:
+	error = errno;
+	acl_nfs4_uring_free(r);
+	errno = error;
+	return NULL;
+}
+
+unsigned int acl_nfs4_uring_depth(const struct acl_nfs4_uring *r)
+{
+	return r->depth;
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(struct acl_nfs4_uring *r)
+{
+	struct io_uring_sqe *sqe = NULL;
+	u32 idx = r->sq_local_tail & r->sq_mask;
+
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	r->sq_local_tail++;
+	return sqe;
+}
+
+static void
+uring_prep_statx(struct acl_nfs4_uring *r, u32 slot, const char *path)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r);
+
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uint64_t)(uintptr_t)path;
+	sqe->len = STATX_TYPE | STATX_MODE | STATX_INO;
+	sqe->off = (uint64_t)(uintptr_t)&r->slots[slot].stx;
+	sqe->user_data = UD_MAKE(slot, UD_STATX);
+	r->slots[slot].pending++;
+}
+
+static void
+uring_prep_getxattr(struct acl_nfs4_uring *r, u32 slot, const char *path)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r);
+
+	sqe->opcode = IORING_OP_GETXATTR;
+	sqe->addr = (uint64_t)(uintptr_t)ACL_NFS4_XATTR;
+	sqe->off = (uint64_t)(uintptr_t)r->slots[slot].buf;
+	sqe->len = URING_XATTR_BUFSZ;
+	sqe->addr3 = (uint64_t)(uintptr_t)path;
+	sqe->user_data = UD_MAKE(slot, UD_XATTR);
+	r->slots[slot].pending++;
+}
+
+static void
+uring_prep_setxattr(struct acl_nfs4_uring *r, u32 slot, const char *path,
+		    size_t size, int flags)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r);
+
+	sqe->opcode = IORING_OP_SETXATTR;
+	sqe->addr = (uint64_t)(uintptr_t)ACL_NFS4_XATTR;
+	sqe->off = (uint64_t)(uintptr_t)r->slots[slot].buf;
+	sqe->len = size;
+	sqe->xattr_flags = flags;
+	sqe->addr3 = (uint64_t)(uintptr_t)path;
+	sqe->user_data = UD_MAKE(slot, UD_XATTR);
+	r->slots[slot].pending++;
+}
+
+/*
+ * Publish queued SQEs and wait for at least `wait` completions.
+ */
+static int
+uring_enter(struct acl_nfs4_uring *r, u32 wait)
+{
+	u32 to_submit;
+	int res;
+
+	__atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+	for (;;) {
+		to_submit = r->sq_local_tail -
+			    __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+		res = syscall(__NR_io_uring_enter, r->fd, to_submit, wait,
+			      wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (res >= 0) {
+			return 0;
+		}
+		if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+			return -1;
+		}
+	}
+}
+
+static void
+statx_to_stat(const struct statx *stx, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_mode = stx->stx_mode;
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+}
+
+/*
+ * Finish a read once both statx and getxattr completed. Mirrors
+ * nfs4_acl_get_file().
+ */
+static void
+uring_finish_get(struct acl_nfs4_batch *b, struct uring_slot *s)
+{
+	const char *path = b->paths[s->idx];
+	struct nfs4_acl *acl = NULL;
+	struct stat st;
+#ifdef USE_SECURITY_NAMESPACE
+	dev_t dev;
+#endif
+
+	if (s->stat_res < 0) {
+		acl_nfs4_log("%s: stat() failed", path);
+		acl_nfs4_batch_complete(b, s->idx, NULL, -s->stat_res);
+		return;
+	}
+	statx_to_stat(&s->stx, &st);
+	if ((b->inos != NULL) && ((s->stx.stx_ino != b->inos[s->idx]) ||
+				  (st.st_dev != b->dev))) {
+		acl_nfs4_batch_complete(b, s->idx, NULL, ESTALE);
+		return;
+	}
+
+	if (s->xattr_res == -ERANGE) {
+		/* Too big for the ring buffer; read-ahead leaves it be */
+		if (b->inos != NULL) {
+			acl_nfs4_batch_complete(b, s->idx, NULL, ERANGE);
+			return;
+		}
+		acl = nfs4_acl_get_file(path);
+		acl_nfs4_batch_complete(b, s->idx, acl, acl ? 0 : errno);
+		return;
+	}
+
+#ifdef USE_SECURITY_NAMESPACE
+	if (acl_nfs4_fs_check(path, -1, &st, &dev) != 0) {
+		acl_nfs4_batch_complete(b, s->idx, NULL, errno);
+		return;
+	}
+	if (s->xattr_res == -ENODATA) {
+		acl = acl_nfs4_new_trivial_acl(st.st_mode, S_ISDIR(st.st_mode));
+		acl_nfs4_batch_complete(b, s->idx, acl, acl ? 0 : errno);
+		return;
+	}
+	if ((s->xattr_res < 0) && !acl_nfs4_fs_errno_expected(-s->xattr_res)) {
+		acl_nfs4_fs_cache_invalidate(dev);
+	}
+#endif
+	if (s->xattr_res < 0) {
+		acl_nfs4_batch_complete(b, s->idx, NULL, -s->xattr_res);
+		return;
+	}
+
+	acl = acl_nfs4_xattr_load(s->buf, s->xattr_res, S_ISDIR(st.st_mode));
+	if (acl == NULL) {
+		acl_nfs4_log("acl_nfs4_xattr_load() failed");
+	}
+	acl_nfs4_batch_complete(b, s->idx, acl, acl ? 0 : errno);
+}
+
+/*
+ * Advance a write. Returns true if another SQE was queued for it.
+ */
+static bool
+uring_step_set(struct acl_nfs4_uring *r, struct acl_nfs4_batch *b, u32 slot)
+{
+	struct uring_slot *s = &r->slots[slot];
+	const char *path = b->paths[s->idx];
+	size_t size = ACES_2_ACLSIZE(b->acls[s->idx]->naces);
+#ifdef USE_SECURITY_NAMESPACE
+	struct stat st;
+	dev_t dev;
+
+	statx_to_stat(&s->stx, &st);
+	if (!s->stat_done) {
+		s->stat_done = true;
+		if (s->stat_res < 0) {
+			acl_nfs4_batch_complete(b, s->idx, NULL, -s->stat_res);
+			return false;
+		}
+		if (acl_nfs4_fs_check(path, -1, &st, &dev) != 0) {
+			acl_nfs4_batch_complete(b, s->idx, NULL, errno);
+			return false;
+		}
+		uring_prep_setxattr(r, slot, path, size, 0);
+		return true;
+	}
+	if ((s->xattr_res < 0) && !acl_nfs4_fs_errno_expected(-s->xattr_res)) {
+		acl_nfs4_fs_cache_invalidate(st.st_dev);
+	}
+#endif
+	(void)path;
+	(void)size;
+	acl_nfs4_batch_complete(b, s->idx, NULL,
+				(s->xattr_res < 0) ? -s->xattr_res : 0);
+	return false;
+}
+
+/*
+ * Start path `i`. Returns false if it was handled synchronously.
+ */
+static bool
+uring_start(struct acl_nfs4_uring *r, struct acl_nfs4_batch *b, size_t i,
+	    u32 slot)
+{
+	struct uring_slot *s = &r->slots[slot];
+	const char *path = b->paths[i];
+	ssize_t size;
+
+	memset(s, 0, offsetof(struct uring_slot, stx));
+	s->idx = i;
+
+	if (path == NULL) {
+		acl_nfs4_batch_complete(b, i, NULL, EINVAL);
+		return false;
+	}
+
+	if (b->op == ACL_NFS4_BATCH_GET) {
+		uring_prep_statx(r, slot, path);
+		uring_prep_getxattr(r, slot, path);
+		return true;
+	}
+
+	size = (ssize_t)acl_nfs4_xattr_pack_buf(b->acls[i], s->buf,
+						 sizeof(s->buf));
+	if ((size < (ssize_t)ACES_2_XDRSIZE(1))) {
+		/* Too big or invalid, let the synchronous path sort it out */
+		if (nfs4_acl_set_file(b->acls[i], path) != 0) {
+			acl_nfs4_batch_complete(b, i, NULL, errno);
+		}
+		else {
+			acl_nfs4_batch_complete(b, i, NULL, 0);
+		}
+		return false;
+	}
+#ifdef USE_SECURITY_NAMESPACE
+	uring_prep_statx(r, slot, path);
+#else
+	uring_prep_setxattr(r, slot, path, size, XATTR_REPLACE);
+#endif
+	return true;
+}
+
+/*
+ * Process paths of `b` until the batch is exhausted. Returns 0, or -1
+ * if the ring failed; paths in flight at that point are completed
+ * synchronously and the remaining ones are left to the caller.
+ */
+int acl_nfs4_uring_run(struct acl_nfs4_uring *r, struct acl_nfs4_batch *b)
+{
+	struct io_uring_cqe *cqe = NULL;
+	struct uring_slot *s = NULL;
+	bool more = true;
+	u32 inflight = 0, head, tail, slot;
+	size_t i;
+
+	if (r->broken) {
+		return -1;
+	}
+
+	while (more || (inflight > 0)) {
+		while (more && (r->nfree > 0)) {
+			i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+			if (i >= b->n) {
+				more = false;
+				break;
+			}
+			slot = r->free_slots[--r->nfree];
+			if (uring_start(r, b, i, slot)) {
+				inflight++;
+			}
+			else {
+				r->free_slots[r->nfree++] = slot;
+			}
+		}
+		if (inflight == 0) {
+			break;
+		}
+
+		if (uring_enter(r, 1) != 0) {
+			acl_nfs4_log("io_uring_enter() failed: %s", strerror(errno));
+			r->broken = true;
+			break;
+		}
+
+		head = *r->cq_head;
+		tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			cqe = &r->cqes[head & r->cq_mask];
+			slot = UD_SLOT(cqe->user_data);
+			s = &r->slots[slot];
+			if (UD_WHICH(cqe->user_data) == UD_STATX) {
+				s->stat_res = cqe->res;
+			}
+			else {
+				s->xattr_res = cqe->res;
+			}
+			if (--s->pending > 0) {
+				continue;
+			}
+
+			if (b->op == ACL_NFS4_BATCH_GET) {
+				uring_finish_get(b, s);
+			}
+			else if (uring_step_set(r, b, slot)) {
+				continue;
+			}
+			r->free_slots[r->nfree++] = slot;
+			inflight--;
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	if (!r->broken) {
+		return 0;
+	}
+
+	/*
+	 * Outcome of the operations in flight is unknown. Reads and
+	 * writes of a whole ACL are idempotent, so redo them.
+	 */
+	for (slot = 0; slot < r->depth; slot++) {
+		s = &r->slots[slot];
+		if (s->pending == 0) {
+			continue;
+		}
+		s->pending = 0;
+		if (b->inos != NULL) {
+			acl_nfs4_batch_complete(b, s->idx, NULL, ESTALE);
+		}
+		else if (b->op == ACL_NFS4_BATCH_GET) {
+			struct nfs4_acl *acl = nfs4_acl_get_file(b->paths[s->idx]);
+			acl_nfs4_batch_complete(b, s->idx, acl, acl ? 0 : errno);
+		}
+		else {
+			acl_nfs4_batch_complete(b, s->idx, NULL,
+				(nfs4_acl_set_file(b->acls[s->idx],
+						   b->paths[s->idx]) != 0) ? errno : 0);
+		}
+	}
+	return -1;
+}
+
+#else /* !USE_IO_URING */
+
+struct acl_nfs4_uring *acl_nfs4_uring_new(unsigned int depth)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+unsigned int acl_nfs4_uring_depth(const struct acl_nfs4_uring *r)
+{
+	return 0;
+}
+
+void acl_nfs4_uring_free(struct acl_nfs4_uring *r)
+{
+}
+
+int acl_nfs4_uring_run(struct acl_nfs4_uring *r, struct acl_nfs4_batch *b)
+{
+	return -1;
+}
+
+#endif /* USE_IO_URING */
+
+/*
+ * Use an io_uring with `depth` paths in flight for batches run by
+ * `ctx`; 0 disables it. Set before nfs4_acl_ctx_set_workers() so that
+ * workers get rings too.
+ *
+ * Returns -1 with errno set to ENOSYS or EOPNOTSUPP if io_uring cannot
+ * be used, in which case batches keep using synchronous syscalls.
+ */
+int nfs4_acl_ctx_set_uring(struct nfs4_acl_ctx *ctx, unsigned int depth)
+{
+	struct acl_nfs4_uring **ringp = NULL;
+
+	if (ctx == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ringp = acl_nfs4_ctx_uring(ctx);
+	acl_nfs4_uring_free(*ringp);
+	*ringp = NULL;
+	if (depth == 0) {
+		return 0;
+	}
+
+	*ringp = acl_nfs4_uring_new(depth);
+	return (*ringp != NULL) ? 0 : -1;
+}
@@ -0,0 +1,1782 @@
+/*
+ *  Copyright (c) 2026 iXsystems, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of the University nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ *  BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <search.h>
+#include <stdint.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "libacl_nfs4.h"
+
+/*
+ * Tree walk shared by the command line tools.
+ *
+ * Directories are opened relative to their parent with openat() and
+ * read with getdents64() into a large per-thread buffer. Entries are
+ * only stat()ed when d_type does not say enough: for DT_UNKNOWN, for
+ * directories if NFS4_ACL_WALK_XDEV or NFS4_ACL_WALK_LOGICAL need
+ * st_dev and st_ino, and for everything with NFS4_ACL_WALK_STAT. Only
+ * single path components are ever resolved relative to a directory fd,
+ * and without NFS4_ACL_WALK_LOGICAL neither those nor the ACL calls on
+ * (dirfd, accpath) follow symbolic links, so the walk cannot leave the
+ * tree. The root itself is always followed. With NFS4_ACL_WALK_LOGICAL
+ * a directory reachable through several links is walked only once, as
+ * with nftw().
+ *
+ * Every directory is a task: the thread running it reads the directory,
+ * calls `fn` for each entry and queues the subdirectories that `fn`
+ * returned 0 for as new tasks. A directory's own callback therefore
+ * runs before those of its entries. Subdirectories are queued once the
+ * whole directory has been read, in reverse, so that with one thread
+ * they are descended into in order.
+ *
+ * Each thread owns a deque of tasks. It pushes and pops at the tail
+ * (depth first, which keeps few directories open) and idle threads
+ * steal from the head of other deques, where the largest unexplored
+ * subtrees are. The calling thread is worker 0. An entry and its
+ * ancestors stay valid, and the directory fds in them open, until the
+ * callbacks of all of its descendants have returned.
+ *
+ * With more than one thread, the entries of a directory are handed
+ * out in chunks of up to WALK_CHUNK_ENTS as they are read (or, for
+ * sorted walks, once sorted), so that a directory with millions of
+ * entries is not left to a single thread. At most WALK_CHUNKS_PER_WORKER
+ * chunks per thread are queued at a time; beyond that the reading
+ * thread processes its chunks itself, which bounds memory use.
+ *
+ * If walk->max_mem is set, the walk streams: entries are visited in
+ * the order they are read, and nodes, chunks and the per-thread read
+ * buffers are accounted against max_mem. Subdirectories and chunks are
+ * only queued while there is room; otherwise a thread descends into
+ * the subdirectory right away, and resumes reading its parent from the
+ * getdents64() cookie of the entry afterwards. An open directory then
+ * costs only its fd, its node and a cookie on the thread's stack.
+ * The ceiling is soft for nodes: an entry cannot be skipped for lack
+ * of memory, so its node is charged even past max_mem. What does not
+ * fit is kept to the directories being descended into and the entries
+ * being visited, which WALK_MEM_RESERVE per thread is set aside for.
+ *
+ * With NFS4_ACL_WALK_PER_FS, tasks are queued per filesystem instead
+ * of per thread, and at most walk->fs_jobs threads work on the same
+ * filesystem at a time. Threads take tasks from the filesystems in
+ * turn, so that a slow filesystem cannot hold up the others.
+ * Filesystems are added as directories on them are met, which is why
+ * directories are always stat()ed in this mode.
+ *
+ * With NFS4_ACL_WALK_ACL, entries are visited in chunks even by a
+ * single thread, and before the callbacks of a chunk run, the ACLs of
+ * up to WALK_ACL_BATCH of its files and directories are read. With
+ * walk->uring_depth the thread's own context has an io_uring, and the
+ * reads are in flight together rather than one getxattr() at a time.
+ * Those go by path, which would follow a link that replaced an entry
+ * or one of its ancestors in the meantime, so each is checked to have
+ * reached the inode of its dirent on the directory's device, and
+ * dropped for the callback to read through (dirfd, accpath) if not.
+ * Without a ring they are read with nfs4_acl_get_at() on the
+ * directory's fd. ACLs read ahead are accounted against max_mem until
+ * their callback returns.
+ *
+ * Errors mark the directory they occur in as incomplete, and so in turn
+ * its ancestors as their nodes are released. walk->done_fn is called
+ * for directories released while still complete, which callers can use
+ * to checkpoint finished subtrees.
+ *
+ * If walk->latency_target is set, the number of callbacks running at
+ * once is adjusted to the time they take, which for the tools is
+ * dominated by getxattr() and setxattr(). It starts at one and, every
+ * WALK_ADAPT_INTERVAL, grows by one while the 99th percentile stays
+ * within the target and is halved once it does not, so that a busy
+ * server (or the clients sharing it) sets the pace rather than -j.
+ * Latencies are kept in a log2 histogram and the percentile is taken
+ * as the upper bound of its bucket, which errs on the side of fewer
+ * threads. Independently, walk->max_ops spaces out the callbacks so
+ * that no more than that many start per second.
+ */
+#define	WALK_BUFSZ		(128 * 1024)
+#define	WALK_DEQUE_INIT		64
+#define	WALK_CHUNK_ENTS		1024
+#define	WALK_CHUNK_NAMES	(32 * 1024)
+#define	WALK_CHUNKS_PER_WORKER	4
+#define	WALK_ACL_BATCH		256	/* ACLs read ahead at once */
+#define	WALK_MEM_MIN		(1024 * 1024)
+#define	WALK_MEM_PER_WORKER	(512 * 1024)	/* fits buffer and chunks */
+#define	WALK_MEM_RESERVE	(64 * 1024)	/* per worker, for descending */
+#define	WALK_ADAPT_INTERVAL	250000000ULL	/* ns between adjustments */
+#define	WALK_ADAPT_SAMPLES	32		/* fewer are not judged */
+#define	WALK_ADAPT_BUCKETS	32		/* log2 of microseconds */
+
+struct walk_dirent64 {
+	u_int64_t		d_ino;
+	int64_t			d_off;
+	unsigned short		d_reclen;
+	unsigned char		d_type;
+	char			d_name[];
+};
+
+struct walk_fs;
+
+struct walk_node {
+	struct nfs4_acl_walk_entry e;		/* must be first */
+	struct walk_node	*parent;
+	struct walk_fs		*fs;		/* NFS4_ACL_WALK_PER_FS */
+	u32			refcnt;
+	int			fd;		/* once the directory is read */
+	size_t			size;		/* accounted against max_mem */
+	size_t			acl_size;	/* of e.acl, likewise */
+	bool			visited;	/* fn has been called */
+	bool			incomplete;	/* error in the subtree */
+	char			names[];	/* name, path, accpath */
+};
+
+/* Entry of a directory read ahead so that it can be sorted */
+struct walk_dirent {
+	ino_t			ino;
+	unsigned char		type;
+	size_t			off;
+	const char		*name;
+	struct nfs4_acl		*acl;		/* read ahead, in chunks */
+};
+
+/* Entries of directory `dir` to be visited by whichever thread is free */
+struct walk_chunk {
+	struct walk_node	*dir;
+	size_t			nents;
+	size_t			names_len;
+	struct walk_dirent	ents[WALK_CHUNK_ENTS];
+	char			names[WALK_CHUNK_NAMES];
+};
+
+/* Read directory `dir`, or visit the entries of `chunk` if not NULL */
+struct walk_task {
+	struct walk_node	*dir;
+	struct walk_chunk	*chunk;
+};
+
+struct walk_deque {
+	pthread_mutex_t		lock;
+	struct walk_task	*tasks;
+	size_t			size;		/* power of two */
+	size_t			head;
+	size_t			tail;
+};
+
+struct walk_fs {
+	struct nfs4_acl_walk_fs	pub;
+	struct walk_deque	dq;
+	unsigned int		active;		/* tasks running, fs_lock */
+	bool			started;
+	struct timespec		start;
+	struct timespec		end;
+};
+
+struct walk_pool;
+
+struct walk_worker {
+	struct walk_pool	*pool;
+	unsigned int		index;
+	struct walk_deque	dq;
+	unsigned int		seed;
+	pthread_t		thread;
+	char			*buf;		/* getdents64() */
+	struct walk_dirent	*ents;		/* sorted walks */
+	size_t			ents_sz;
+	char			*names;
+	size_t			names_sz;
+	struct walk_node	**subdirs;	/* to be queued */
+	size_t			nsubdirs;
+	size_t			subdirs_sz;
+	struct walk_chunk	*chunk;		/* being filled */
+	u_int64_t		nreads;		/* getdents64() calls into buf */
+	size_t			fs_next;	/* filesystem to try first */
+	struct nfs4_acl_ctx	*ctx;		/* NFS4_ACL_WALK_ACL */
+	char			*acl_names;	/* paths of acl_paths */
+	size_t			acl_names_sz;
+	const char		*acl_paths[WALK_ACL_BATCH];
+	ino_t			acl_inos[WALK_ACL_BATCH];
+	struct nfs4_acl		*acls[WALK_ACL_BATCH];
+	size_t			acl_ents[WALK_ACL_BATCH];
+};
+
+struct walk_pool {
+	struct nfs4_acl_walk	*walk;
+	enum nfs4_acl_walk_order order;
+	dev_t			root_dev;
+	unsigned int		nworkers;
+	struct walk_worker	*workers;
+	size_t			pending;	/* tasks queued or running */
+	size_t			queued;		/* tasks in deques */
+	size_t			nchunks;	/* chunks queued or running */
+	size_t			max_chunks;
+	unsigned int		nidle;
+	pthread_mutex_t		idle_lock;
+	pthread_cond_t		idle_cv;
+	size_t			nentries;
+	size_t			nerrors;
+	bool			stop;
+	void			*visited;	/* tsearch() tree of walk_id */
+	pthread_mutex_t		visited_lock;
+	size_t			max_mem;	/* 0 if not streaming */
+	size_t			mem_reserve;
+	size_t			mem;
+	size_t			peak_mem;
+	bool			per_fs;
+	struct walk_fs		**fs;		/* fs_lock */
+	size_t			nfs;
+	size_t			fs_sz;
+	unsigned int		fs_limit;
+	pthread_mutex_t		fs_lock;
+	u_int64_t		sched_gen;	/* bumped when a task may run */
+	unsigned int		limit;		/* callbacks at once, adaptive */
+	unsigned int		running;
+	unsigned int		nwaiting;
+	pthread_mutex_t		adapt_lock;
+	pthread_cond_t		adapt_cv;
+	u_int64_t		target_ns;	/* 0 if not adaptive */
+	u_int64_t		window;		/* start of window, ns */
+	u_int64_t		hist[WALK_ADAPT_BUCKETS];
+	u_int64_t		nsamples;
+	u_int64_t		ops_ns;		/* between callbacks, max_ops */
+	u_int64_t		ops_next;	/* start of next callback, ns */
+};
+
+struct walk_id {
+	dev_t			dev;
+	ino_t			ino;
+};
+
+static void walk_dir(struct walk_worker *, struct walk_node *);
+
+static const struct {
+	const char			*str;
+	enum nfs4_acl_walk_order	order;
+} walk_orders[] = {
+	{ "name",	NFS4_ACL_WALK_ORDER_NAME },
+	{ "none",	NFS4_ACL_WALK_ORDER_NONE },
+	{ "inode",	NFS4_ACL_WALK_ORDER_INODE },
+};
+
+/*
+ * Parse the argument of the tools' --order option.
+ */
+int nfs4_acl_walk_order_from_text(const char *str,
+				  enum nfs4_acl_walk_order *orderp)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(walk_orders); i++) {
+		if (strcasecmp(walk_orders[i].str, str) == 0) {
+			*orderp = walk_orders[i].order;
+			return (0);
+		}
+	}
+	errno = EINVAL;
+	return (-1);
+}
+
+static bool
+walk_stopped(struct walk_pool *pool)
+{
+	return __atomic_load_n(&pool->stop, __ATOMIC_RELAXED);
+}
+
+/*
+ * Report an error about entry `name` of `dir`, or about `dir` itself if
+ * name is NULL. Either way the walk of `dir` is incomplete.
+ */
+static void
+walk_error(struct walk_pool *pool, struct walk_node *dir, const char *name,
+	   int error)
+{
+	struct nfs4_acl_walk *walk = pool->walk;
+	const char *path = dir->e.path;
+	char buf[PATH_MAX];
+
+	__atomic_add_fetch(&pool->nerrors, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&dir->incomplete, true, __ATOMIC_RELAXED);
+	if (walk->error_fn == NULL) {
+		return;
+	}
+	if (name != NULL) {
+		snprintf(buf, sizeof(buf), "%s/%s", path, name);
+		path = buf;
+	}
+	if (walk->error_fn(path, error, walk->arg) == NFS4_ACL_WALK_STOP) {
+		__atomic_store_n(&pool->stop, true, __ATOMIC_RELAXED);
+	}
+}
+
+static enum nfs4_acl_walk_type
+walk_type(mode_t mode)
+{
+	switch (mode & S_IFMT) {
+	case S_IFDIR:
+		return NFS4_ACL_WALK_DIR;
+	case S_IFREG:
+		return NFS4_ACL_WALK_FILE;
+	case S_IFLNK:
+		return NFS4_ACL_WALK_SYMLINK;
+	default:
+		return NFS4_ACL_WALK_OTHER;
+	}
+}
+
+/*
+ * Memory accounting, only done for streaming walks.
+ */
+static void
+walk_mem_peak(struct walk_pool *pool, size_t cur)
+{
+	size_t peak = __atomic_load_n(&pool->peak_mem, __ATOMIC_RELAXED);
+
+	while ((cur > peak) &&
+	       !__atomic_compare_exchange_n(&pool->peak_mem, &peak, cur, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		;
+	}
+}
+
+static void
+walk_mem_charge(struct walk_pool *pool, size_t size)
+{
+	if (pool->max_mem != 0) {
+		walk_mem_peak(pool, __atomic_add_fetch(&pool->mem, size,
+						       __ATOMIC_RELAXED));
+	}
+}
+
+static void
+walk_mem_uncharge(struct walk_pool *pool, size_t size)
+{
+	if (pool->max_mem != 0) {
+		__atomic_sub_fetch(&pool->mem, size, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Charge `size` only if that leaves the reserve for descending.
+ */
+static bool
+walk_mem_try(struct walk_pool *pool, size_t size)
+{
+	size_t cur;
+
+	if (pool->max_mem == 0) {
+		return true;
+	}
+	cur = __atomic_load_n(&pool->mem, __ATOMIC_RELAXED);
+	do {
+		if (cur + size + pool->mem_reserve > pool->max_mem) {
+			return false;
+		}
+	} while (!__atomic_compare_exchange_n(&pool->mem, &cur, cur + size,
+					      true, __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+	walk_mem_peak(pool, cur + size);
+	return true;
+}
+
+/* Memory accounted for an ACL read ahead */
+static size_t
+walk_acl_size(const struct nfs4_acl *acl)
+{
+	return (sizeof(struct nfs4_acl) + sizeof(struct nfs4_ace_list) +
+		acl->naces * sizeof(struct nfs4_ace));
+}
+
+static void
+walk_acl_free(struct walk_pool *pool, struct nfs4_acl **aclp)
+{
+	if (*aclp != NULL) {
+		walk_mem_uncharge(pool, walk_acl_size(*aclp));
+		nfs4_free_acl(*aclp);
+		*aclp = NULL;
+	}
+}
+
+/*
+ * Allocate a node for `name` in directory `parent` (NULL for the root).
+ * Names are stored after the structure, so the whole node is a single
+ * allocation. `accpath` is NULL if it is the same as `name`. A
+ * reference on `parent` is taken so that callbacks may walk e->parent.
+ * The node is charged against max_mem without walk_mem_try(), see the
+ * top of this file.
+ */
+static struct walk_node *
+walk_node_new(struct walk_pool *pool, struct walk_node *parent,
+	      const char *name, const char *accpath, const struct stat *st,
+	      bool have_stat)
+{
+	struct walk_node *n = NULL;
+	size_t namelen, pathlen, acclen = 0, size;
+	const char *sep = "";
+	char *path = NULL;
+
+	namelen = strlen(name);
+	pathlen = namelen;
+	if (parent != NULL) {
+		pathlen += strlen(parent->e.path);
+		if ((pathlen == namelen) ||
+		    (parent->e.path[pathlen - namelen - 1] != '/')) {
+			sep = "/";
+			pathlen++;
+		}
+	}
+	if (pathlen >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return (NULL);
+	}
+	if (accpath != NULL) {
+		acclen = strlen(accpath) + 1;
+	}
+
+	size = sizeof(struct walk_node) + namelen + pathlen + acclen + 2;
+	n = calloc(1, size);
+	if (n == NULL) {
+		return (NULL);
+	}
+	n->size = size;
+	walk_mem_charge(pool, size);
+
+	memcpy(n->names, name, namelen + 1);
+	path = n->names + namelen + 1;
+	if (parent != NULL) {
+		snprintf(path, pathlen + 1, "%s%s%s", parent->e.path, sep, name);
+		__atomic_add_fetch(&parent->refcnt, 1, __ATOMIC_RELAXED);
+		n->parent = parent;
+		n->fs = parent->fs;
+		n->e.fs = parent->e.fs;
+		n->e.parent = &parent->e;
+		n->e.dirfd = parent->fd;
+		n->e.level = parent->e.level + 1;
+	}
+	else {
+		memcpy(path, name, namelen + 1);
+		n->e.dirfd = AT_FDCWD;
+	}
+
+	n->refcnt = 1;
+	n->fd = -1;
+	n->e.name = n->names;
+	n->e.path = path;
+	if (accpath != NULL) {
+		n->e.accpath = path + pathlen + 1;
+		memcpy(path + pathlen + 1, accpath, acclen);
+	}
+	else {
+		n->e.accpath = n->e.name;
+	}
+	n->e.type = walk_type(st->st_mode);
+	n->e.have_stat = have_stat;
+	n->e.st = *st;
+	return (n);
+}
+
+static void
+walk_node_rele(struct walk_pool *pool, struct walk_node *n)
+{
+	struct walk_node *parent = NULL;
+
+	while ((n != NULL) &&
+	       (__atomic_sub_fetch(&n->refcnt, 1, __ATOMIC_ACQ_REL) == 0)) {
+		parent = n->parent;
+		if (__atomic_load_n(&n->incomplete, __ATOMIC_RELAXED)) {
+			if (parent != NULL) {
+				__atomic_store_n(&parent->incomplete, true,
+						 __ATOMIC_RELAXED);
+			}
+		}
+		else if (n->visited && (n->e.type == NFS4_ACL_WALK_DIR) &&
+			 (pool->walk->done_fn != NULL) && !walk_stopped(pool)) {
+			pool->walk->done_fn(&n->e, pool->walk->arg);
+		}
+		if ((n->e.data != NULL) && (pool->walk->free_data != NULL)) {
+			pool->walk->free_data(&n->e);
+		}
+		if (n->fd != -1) {
+			close(n->fd);
+		}
+		nfs4_free_acl(n->e.acl);
+		walk_mem_uncharge(pool, n->size + n->acl_size);
+		free(n);
+		n = parent;
+	}
+}
+
+static bool
+walk_deque_push(struct walk_deque *dq, const struct walk_task *t)
+{
+	struct walk_task *tasks = NULL;
+	size_t i, cnt;
+
+	pthread_mutex_lock(&dq->lock);
+	cnt = dq->tail - dq->head;
+	if (cnt == dq->size) {
+		tasks = calloc(dq->size * 2, sizeof(struct walk_task));
+		if (tasks == NULL) {
+			pthread_mutex_unlock(&dq->lock);
+			return false;
+		}
+		for (i = 0; i < cnt; i++) {
+			tasks[i] = dq->tasks[(dq->head + i) & (dq->size - 1)];
+		}
+		free(dq->tasks);
+		dq->tasks = tasks;
+		dq->size *= 2;
+		dq->head = 0;
+		dq->tail = cnt;
+	}
+	dq->tasks[dq->tail++ & (dq->size - 1)] = *t;
+	pthread_mutex_unlock(&dq->lock);
+	return true;
+}
+
+static bool
+walk_deque_pop(struct walk_deque *dq, bool steal, struct walk_task *t)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail != dq->head) {
+		if (steal) {
+			*t = dq->tasks[dq->head++ & (dq->size - 1)];
+		}
+		else {
+			*t = dq->tasks[--dq->tail & (dq->size - 1)];
+		}
+		found = true;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return (found);
+}
+
+/*
+ * Tell idle threads that a task may have become runnable. Pairs with
+ * the checks of `queued` and `sched_gen` in walk_get_task(). A task
+ * of a busy filesystem may not be runnable by whoever is woken, so
+ * all idle threads are woken in that case.
+ */
+static void
+walk_wakeup(struct walk_pool *pool)
+{
+	__atomic_add_fetch(&pool->sched_gen, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->nidle, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&pool->idle_lock);
+		if (pool->per_fs) {
+			pthread_cond_broadcast(&pool->idle_cv);
+		}
+		else {
+			pthread_cond_signal(&pool->idle_cv);
+		}
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+}
+
+/*
+ * Return the filesystem `dev`, adding it if it is new. `path` is the
+ * directory it was met at.
+ */
+static struct walk_fs *
+walk_fs_get(struct walk_pool *pool, dev_t dev, const char *path)
+{
+	struct walk_fs **tmp = NULL;
+	struct walk_fs *fs = NULL;
+	size_t i, sz;
+
+	pthread_mutex_lock(&pool->fs_lock);
+	for (i = 0; i < pool->nfs; i++) {
+		if (pool->fs[i]->pub.dev == dev) {
+			fs = pool->fs[i];
+			goto out;
+		}
+	}
+	if (pool->nfs == pool->fs_sz) {
+		sz = pool->fs_sz ? pool->fs_sz * 2 : 8;
+		tmp = realloc(pool->fs, sz * sizeof(struct walk_fs *));
+		if (tmp == NULL) {
+			goto out;
+		}
+		pool->fs = tmp;
+		pool->fs_sz = sz;
+	}
+	fs = calloc(1, sizeof(struct walk_fs) + strlen(path) + 1);
+	if (fs == NULL) {
+		goto out;
+	}
+	fs->dq.size = WALK_DEQUE_INIT;
+	fs->dq.tasks = calloc(fs->dq.size, sizeof(struct walk_task));
+	if (fs->dq.tasks == NULL) {
+		free(fs);
+		fs = NULL;
+		goto out;
+	}
+	pthread_mutex_init(&fs->dq.lock, NULL);
+	fs->pub.dev = dev;
+	fs->pub.path = strcpy((char *)(fs + 1), path);
+	pool->fs[pool->nfs++] = fs;
+out:
+	pthread_mutex_unlock(&pool->fs_lock);
+	return (fs);
+}
+
+/*
+ * Take the next task of the first filesystem, in turn, that has one
+ * and is below its limit of threads.
+ */
+static bool
+walk_fs_pop(struct walk_worker *wk, struct walk_task *t)
+{
+	struct walk_pool *pool = wk->pool;
+	struct walk_fs *fs = NULL;
+	bool found = false;
+	size_t i, j;
+
+	pthread_mutex_lock(&pool->fs_lock);
+	for (i = 0; (i < pool->nfs) && !found; i++) {
+		j = (wk->fs_next + i) % pool->nfs;
+		fs = pool->fs[j];
+		if ((fs->active < pool->fs_limit) &&
+		    walk_deque_pop(&fs->dq, false, t)) {
+			found = true;
+			fs->active++;
+			if (!fs->started) {
+				fs->started = true;
+				clock_gettime(CLOCK_MONOTONIC, &fs->start);
+			}
+			wk->fs_next = j + 1;
+		}
+	}
+	pthread_mutex_unlock(&pool->fs_lock);
+	return (found);
+}
+
+static void
+walk_fs_task_done(struct walk_pool *pool, struct walk_fs *fs)
+{
+	pthread_mutex_lock(&pool->fs_lock);
+	fs->active--;
+	clock_gettime(CLOCK_MONOTONIC, &fs->end);
+	pthread_mutex_unlock(&pool->fs_lock);
+	walk_wakeup(pool);
+}
+
+/*
+ * Queue a task, handing over the caller's reference on `dir`. Returns
+ * false with the reference still held by the caller if out of memory.
+ */
+static bool
+walk_push_task(struct walk_worker *wk, struct walk_node *dir,
+	       struct walk_chunk *chunk)
+{
+	struct walk_pool *pool = wk->pool;
+	struct walk_task t = { .dir = dir, .chunk = chunk };
+	struct walk_deque *dq = (dir->fs != NULL) ? &dir->fs->dq : &wk->dq;
+
+	__atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+	if (!walk_deque_push(dq, &t)) {
+		__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+		return false;
+	}
+	__atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+	walk_wakeup(pool);
+	return true;
+}
+
+static void
+walk_push(struct walk_worker *wk, struct walk_node *dir)
+{
+	if (!walk_push_task(wk, dir, NULL)) {
+		walk_error(wk->pool, dir, NULL, errno);
+		walk_node_rele(wk->pool, dir);
+	}
+}
+
+/*
+ * Take a task from our own deque, or steal one. Returns false once all
+ * work is done.
+ */
+static bool
+walk_get_task(struct walk_worker *wk, struct walk_task *t)
+{
+	struct walk_pool *pool = wk->pool;
+	unsigned int i, victim;
+	bool found = false;
+	u_int64_t gen;
+	bool wait;
+
+	for (;;) {
+		gen = __atomic_load_n(&pool->sched_gen, __ATOMIC_SEQ_CST);
+		if (pool->per_fs) {
+			if (walk_fs_pop(wk, t)) {
+				break;
+			}
+			goto idle;
+		}
+		if (walk_deque_pop(&wk->dq, false, t)) {
+			break;
+		}
+		victim = rand_r(&wk->seed) % pool->nworkers;
+		for (i = 0; (i < pool->nworkers) && !found; i++) {
+			found = walk_deque_pop(&pool->workers[(victim + i) %
+					       pool->nworkers].dq, true, t);
+		}
+		if (found) {
+			break;
+		}
+idle:
+		pthread_mutex_lock(&pool->idle_lock);
+		if (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0) {
+			pthread_mutex_unlock(&pool->idle_lock);
+			return false;
+		}
+		__atomic_add_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+		/* Queued tasks of busy filesystems are not runnable */
+		if (pool->per_fs) {
+			wait = (__atomic_load_n(&pool->sched_gen,
+						__ATOMIC_SEQ_CST) == gen);
+		}
+		else {
+			wait = (__atomic_load_n(&pool->queued,
+						__ATOMIC_SEQ_CST) == 0);
+		}
+		if (wait) {
+			pthread_cond_wait(&pool->idle_cv, &pool->idle_lock);
+		}
+		__atomic_sub_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+
+	__atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+	return true;
+}
+
+static u_int64_t
+walk_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void
+walk_sleep_until(u_int64_t t)
+{
+	struct timespec ts;
+
+	ts.tv_sec = t / 1000000000ULL;
+	ts.tv_nsec = t % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+			       NULL) == EINTR)
+		;
+}
+
+/*
+ * Wait for a callback slot under the adaptive limit, and for our turn
+ * under max_ops. Returns the time the callback starts.
+ */
+static u_int64_t
+walk_adapt_enter(struct walk_pool *pool)
+{
+	u_int64_t now, next, start;
+	unsigned int n;
+
+	if (pool->target_ns != 0) {
+		n = __atomic_load_n(&pool->running, __ATOMIC_SEQ_CST);
+		for (;;) {
+			if (n < __atomic_load_n(&pool->limit, __ATOMIC_SEQ_CST)) {
+				if (__atomic_compare_exchange_n(&pool->running,
+				    &n, n + 1, false, __ATOMIC_SEQ_CST,
+				    __ATOMIC_SEQ_CST)) {
+					break;
+				}
+				continue;
+			}
+			pthread_mutex_lock(&pool->adapt_lock);
+			__atomic_add_fetch(&pool->nwaiting, 1, __ATOMIC_SEQ_CST);
+			while (__atomic_load_n(&pool->running, __ATOMIC_SEQ_CST) >=
+			       __atomic_load_n(&pool->limit, __ATOMIC_SEQ_CST)) {
+				pthread_cond_wait(&pool->adapt_cv,
+						  &pool->adapt_lock);
+			}
+			__atomic_sub_fetch(&pool->nwaiting, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&pool->adapt_lock);
+			n = __atomic_load_n(&pool->running, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	now = walk_now();
+	if (pool->ops_ns == 0) {
+		return (now);
+	}
+	next = __atomic_load_n(&pool->ops_next, __ATOMIC_RELAXED);
+	do {
+		start = (next > now) ? next : now;
+	} while (!__atomic_compare_exchange_n(&pool->ops_next, &next,
+		 start + pool->ops_ns, false, __ATOMIC_RELAXED,
+		 __ATOMIC_RELAXED));
+	if (start > now) {
+		walk_sleep_until(start);
+	}
+	return (start);
+}
+
+/*
+ * Additive increase, multiplicative decrease of pool->limit from the
+ * 99th percentile of the window that just ended.
+ */
+static void
+walk_adapt_adjust(struct walk_pool *pool, u_int64_t now)
+{
+	u_int64_t hist[WALK_ADAPT_BUCKETS], total, seen, p99_ns;
+	unsigned int i, limit;
+
+	total = __atomic_load_n(&pool->nsamples, __ATOMIC_RELAXED);
+	if ((now - __atomic_load_n(&pool->window, __ATOMIC_RELAXED) <
+	     WALK_ADAPT_INTERVAL) ||
+	    (total < WALK_ADAPT_SAMPLES)) {
+		return;
+	}
+	total = 0;
+	for (i = 0; i < WALK_ADAPT_BUCKETS; i++) {
+		hist[i] = __atomic_exchange_n(&pool->hist[i], 0,
+					      __ATOMIC_RELAXED);
+		total += hist[i];
+	}
+	__atomic_store_n(&pool->nsamples, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&pool->window, now, __ATOMIC_RELAXED);
+
+	for (i = 0, seen = 0; i < WALK_ADAPT_BUCKETS - 1; i++) {
+		seen += hist[i];
+		if (seen * 100 >= total * 99) {
+			break;
+		}
+	}
+	p99_ns = (2ULL << i) * 1000;
+
+	limit = __atomic_load_n(&pool->limit, __ATOMIC_SEQ_CST);
+	if (p99_ns > pool->target_ns) {
+		__atomic_store_n(&pool->limit, (limit > 1) ? limit / 2 : 1,
+				 __ATOMIC_SEQ_CST);
+	}
+	else if (limit < pool->nworkers) {
+		__atomic_store_n(&pool->limit, limit + 1, __ATOMIC_SEQ_CST);
+		pthread_cond_signal(&pool->adapt_cv);
+	}
+}
+
+static void
+walk_adapt_leave(struct walk_pool *pool, u_int64_t start)
+{
+	u_int64_t now, us;
+	unsigned int b;
+
+	if (pool->target_ns == 0) {
+		return;
+	}
+	now = walk_now();
+	us = (now - start) / 1000;
+	b = (us == 0) ? 0 : 63 - __builtin_clzll(us);
+	if (b >= WALK_ADAPT_BUCKETS) {
+		b = WALK_ADAPT_BUCKETS - 1;
+	}
+	__atomic_add_fetch(&pool->hist[b], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pool->nsamples, 1, __ATOMIC_RELAXED);
+
+	__atomic_sub_fetch(&pool->running, 1, __ATOMIC_SEQ_CST);
+	if ((now - __atomic_load_n(&pool->window, __ATOMIC_RELAXED) >=
+	     WALK_ADAPT_INTERVAL) ||
+	    (__atomic_load_n(&pool->nwaiting, __ATOMIC_SEQ_CST) > 0)) {
+		pthread_mutex_lock(&pool->adapt_lock);
+		walk_adapt_adjust(pool, now);
+		pthread_cond_signal(&pool->adapt_cv);
+		pthread_mutex_unlock(&pool->adapt_lock);
+	}
+}
+
+static void
+walk_task_done(struct walk_pool *pool)
+{
+	if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+		pthread_mutex_lock(&pool->idle_lock);
+		pthread_cond_broadcast(&pool->idle_cv);
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+}
+
+/*
+ * Call `fn` on `n`. Returns true if `n` is a directory to descend into,
+ * in which case the caller's reference is handed over to the caller's
+ * queue, otherwise the reference is dropped.
+ */
+static bool
+walk_visit(struct walk_worker *wk, struct walk_node *n)
+{
+	struct walk_pool *pool = wk->pool;
+	u_int64_t start;
+	int rval;
+
+	n->e.worker = wk->index;
+	n->visited = true;
+	start = walk_adapt_enter(pool);
+	rval = pool->walk->fn(&n->e, pool->walk->arg);
+	walk_adapt_leave(pool, start);
+	nfs4_free_acl(n->e.acl);
+	n->e.acl = NULL;
+	walk_mem_uncharge(pool, n->acl_size);
+	n->acl_size = 0;
+	__atomic_add_fetch(&pool->nentries, 1, __ATOMIC_RELAXED);
+	if (n->fs != NULL) {
+		__atomic_add_fetch(&n->fs->pub.nentries, 1, __ATOMIC_RELAXED);
+	}
+
+	switch (rval) {
+	case 0:
+		if (n->e.type == NFS4_ACL_WALK_DIR) {
+			return true;
+		}
+		break;
+	case NFS4_ACL_WALK_SKIP:
+		break;
+	case NFS4_ACL_WALK_STOP:
+		__atomic_store_n(&pool->stop, true, __ATOMIC_RELAXED);
+		break;
+	default:
+		__atomic_add_fetch(&pool->nerrors, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&n->incomplete, true, __ATOMIC_RELAXED);
+		break;
+	}
+	walk_node_rele(pool, n);
+	return false;
+}
+
+static bool
+walk_is_cycle(struct walk_node *dir, const struct stat *st)
+{
+	for (; dir != NULL; dir = dir->parent) {
+		if ((dir->e.st.st_dev == st->st_dev) &&
+		    (dir->e.st.st_ino == st->st_ino)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int
+walk_id_cmp(const void *a, const void *b)
+{
+	const struct walk_id *ia = a, *ib = b;
+
+	if (ia->dev != ib->dev) {
+		return ((ia->dev < ib->dev) ? -1 : 1);
+	}
+	if (ia->ino != ib->ino) {
+		return ((ia->ino < ib->ino) ? -1 : 1);
+	}
+	return (0);
+}
+
+/*
+ * Remember directory `st` for a logical walk. Returns false if it was
+ * already visited. If memory runs out the directory is walked anyway.
+ */
+static bool
+walk_first_visit(struct walk_pool *pool, const struct stat *st)
+{
+	struct walk_id *id = NULL;
+	void *res = NULL;
+
+	id = malloc(sizeof(struct walk_id));
+	if (id == NULL) {
+		return (true);
+	}
+	walk_mem_charge(pool, sizeof(struct walk_id));
+	id->dev = st->st_dev;
+	id->ino = st->st_ino;
+
+	pthread_mutex_lock(&pool->visited_lock);
+	res = tsearch(id, &pool->visited, walk_id_cmp);
+	pthread_mutex_unlock(&pool->visited_lock);
+	if ((res != NULL) && (*(struct walk_id **)res == id)) {
+		return (true);
+	}
+	walk_mem_uncharge(pool, sizeof(struct walk_id));
+	free(id);
+	return (res == NULL);
+}
+
+/*
+ * Queue `n` once the directory being read is done, see walk_dir().
+ */
+static void
+walk_defer(struct walk_worker *wk, struct walk_node *n)
+{
+	struct walk_node **tmp = NULL;
+	size_t sz;
+
+	if (wk->nsubdirs == wk->subdirs_sz) {
+		sz = wk->subdirs_sz ? wk->subdirs_sz * 2 : 64;
+		tmp = realloc(wk->subdirs, sz * sizeof(struct walk_node *));
+		if (tmp == NULL) {
+			walk_push(wk, n);
+			return;
+		}
+		wk->subdirs = tmp;
+		wk->subdirs_sz = sz;
+	}
+	wk->subdirs[wk->nsubdirs++] = n;
+}
+
+/*
+ * Walk directory `n` right away instead of queueing it, see walk_dir().
+ * The chunk being filled for the parent is set aside meanwhile.
+ */
+static void
+walk_descend(struct walk_worker *wk, struct walk_node *n)
+{
+	struct walk_chunk *chunk = wk->chunk;
+
+	wk->chunk = NULL;
+	walk_dir(wk, n);
+	if (wk->chunk != NULL) {
+		walk_mem_uncharge(wk->pool, sizeof(struct walk_chunk));
+		free(wk->chunk);
+	}
+	wk->chunk = chunk;
+	walk_node_rele(wk->pool, n);
+}
+
+/*
+ * Visit entry `name` of `dir`. If `aclp` is not NULL, the ACL in it,
+ * read ahead, is handed to the entry's node, and *aclp set to NULL.
+ */
+static void
+walk_child(struct walk_worker *wk, struct walk_node *dir, const char *name,
+	   ino_t ino, unsigned char type, struct nfs4_acl **aclp)
+{
+	struct walk_pool *pool = wk->pool;
+	int flags = pool->walk->flags;
+	struct walk_node *n = NULL;
+	struct walk_fs *fs = NULL;
+	char *accpath = NULL;
+	struct stat st, target;
+	bool need_stat;
+
+	if (walk_stopped(pool) || ((name[0] == '.') &&
+	    ((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0'))))) {
+		return;
+	}
+
+	switch (type) {
+	case DT_UNKNOWN:
+		need_stat = true;
+		break;
+	case DT_DIR:
+		need_stat = (flags & (NFS4_ACL_WALK_STAT | NFS4_ACL_WALK_XDEV |
+				      NFS4_ACL_WALK_LOGICAL |
+				      NFS4_ACL_WALK_PER_FS)) != 0;
+		break;
+	case DT_LNK:
+		need_stat = (flags & (NFS4_ACL_WALK_STAT |
+				      NFS4_ACL_WALK_LOGICAL)) != 0;
+		break;
+	default:
+		need_stat = (flags & NFS4_ACL_WALK_STAT) != 0;
+		break;
+	}
+
+	if (need_stat) {
+		if (fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+			/* Entries removed under us are not an error */
+			if (errno != ENOENT) {
+				walk_error(pool, dir, name, errno);
+			}
+			return;
+		}
+	}
+	else {
+		memset(&st, 0, sizeof(st));
+		st.st_mode = DTTOIF(type);
+		st.st_ino = ino;
+		st.st_dev = dir->e.st.st_dev;
+	}
+
+	n = walk_node_new(pool, dir, name, NULL, &st, need_stat);
+	if (n == NULL) {
+		walk_error(pool, dir, name, errno);
+		return;
+	}
+	if ((aclp != NULL) && (*aclp != NULL)) {
+		n->e.acl = *aclp;
+		n->acl_size = walk_acl_size(*aclp);
+		*aclp = NULL;
+	}
+
+	/*
+	 * A followed link is accessed through its resolved path, since
+	 * ACL calls on (dirfd, name) would act on the link itself.
+	 * Dangling links are reported as links.
+	 */
+	if ((n->e.type == NFS4_ACL_WALK_SYMLINK) &&
+	    (flags & NFS4_ACL_WALK_LOGICAL) &&
+	    (fstatat(dir->fd, name, &target, 0) == 0) &&
+	    ((accpath = realpath(n->e.path, NULL)) != NULL)) {
+		walk_node_rele(pool, n);
+		n = walk_node_new(pool, dir, name, accpath, &target, true);
+		free(accpath);
+		if (n == NULL) {
+			walk_error(pool, dir, name, errno);
+			return;
+		}
+		n->e.dirfd = AT_FDCWD;
+	}
+
+	if ((flags & NFS4_ACL_WALK_XDEV) &&
+	    (n->e.st.st_dev != pool->root_dev)) {
+		walk_node_rele(pool, n);
+		return;
+	}
+	if ((n->fs != NULL) && (n->e.st.st_dev != n->fs->pub.dev)) {
+		fs = walk_fs_get(pool, n->e.st.st_dev, n->e.path);
+		if (fs != NULL) {
+			n->fs = fs;
+			n->e.fs = &fs->pub;
+		}
+	}
+	if ((n->e.type == NFS4_ACL_WALK_DIR) &&
+	    (flags & NFS4_ACL_WALK_LOGICAL) && walk_is_cycle(dir, &n->e.st)) {
+		walk_error(pool, n, NULL, ELOOP);
+		walk_node_rele(pool, n);
+		return;
+	}
+	if ((n->e.type == NFS4_ACL_WALK_DIR) &&
+	    (flags & NFS4_ACL_WALK_LOGICAL) && !walk_first_visit(pool, &n->e.st)) {
+		walk_node_rele(pool, n);
+		return;
+	}
+
+	if (walk_visit(wk, n)) {
+		if (walk_mem_try(pool, 0)) {
+			walk_defer(wk, n);
+		}
+		else {
+			walk_descend(wk, n);
+		}
+	}
+}
+
+static int
+walk_dirent_cmp_name(const void *a, const void *b)
+{
+	return (strcoll(((const struct walk_dirent *)a)->name,
+			((const struct walk_dirent *)b)->name));
+}
+
+/*
+ * Object numbers follow inode numbers on ZFS, so this groups accesses
+ * to a directory's entries spatially.
+ */
+static int
+walk_dirent_cmp_ino(const void *a, const void *b)
+{
+	ino_t i1 = ((const struct walk_dirent *)a)->ino;
+	ino_t i2 = ((const struct walk_dirent *)b)->ino;
+
+	return ((i1 > i2) - (i1 < i2));
+}
+
+static bool
+walk_dirent_add(struct walk_worker *wk, size_t nents, size_t *names_lenp,
+		const struct walk_dirent64 *de)
+{
+	struct walk_dirent *tmp_ents = NULL;
+	char *tmp_names = NULL;
+	size_t len = strlen(de->d_name) + 1, sz;
+
+	if (nents == wk->ents_sz) {
+		sz = wk->ents_sz ? wk->ents_sz * 2 : 256;
+		tmp_ents = realloc(wk->ents, sz * sizeof(struct walk_dirent));
+		if (tmp_ents == NULL) {
+			return false;
+		}
+		wk->ents = tmp_ents;
+		wk->ents_sz = sz;
+	}
+	if (*names_lenp + len > wk->names_sz) {
+		sz = wk->names_sz ? wk->names_sz * 2 : 8192;
+		if (sz < *names_lenp + len) {
+			sz = *names_lenp + len;
+		}
+		tmp_names = realloc(wk->names, sz);
+		if (tmp_names == NULL) {
+			return false;
+		}
+		wk->names = tmp_names;
+		wk->names_sz = sz;
+	}
+	memcpy(wk->names + *names_lenp, de->d_name, len);
+	wk->ents[nents].ino = de->d_ino;
+	wk->ents[nents].type = de->d_type;
+	wk->ents[nents].off = *names_lenp;
+	*names_lenp += len;
+	return true;
+}
+
+static void
+walk_push_subdirs(struct walk_worker *wk, size_t base)
+{
+	while (wk->nsubdirs > base) {
+		walk_push(wk, wk->subdirs[--wk->nsubdirs]);
+	}
+}
+
+/*
+ * Read the ACLs of the files and directories among entries `first` to
+ * `first` + WALK_ACL_BATCH of chunk `c`, in one batch if the thread has
+ * a ring, see NFS4_ACL_WALK_ACL. Links are not read, so as not to
+ * follow them, and entries of unknown type are left to the callback,
+ * as are failures.
+ */
+static void
+walk_acl_read(struct walk_worker *wk, struct walk_node *dir,
+	      struct walk_chunk *c, size_t first)
+{
+	struct walk_pool *pool = wk->pool;
+	struct walk_dirent *ent = NULL;
+	size_t dirlen, len, need = 0, off = 0, n = 0, i, last;
+	const char *sep = "/";
+	char *tmp = NULL;
+
+	last = first + WALK_ACL_BATCH;
+	if (last > c->nents) {
+		last = c->nents;
+	}
+	dirlen = strlen(dir->e.path);
+	if ((dirlen > 0) && (dir->e.path[dirlen - 1] == '/')) {
+		sep = "";
+	}
+
+	for (i = first; i < last; i++) {
+		ent = &c->ents[i];
+		if (((ent->type != DT_REG) && (ent->type != DT_DIR)) ||
+		    ((ent->name[0] == '.') && ((ent->name[1] == '\0') ||
+		     ((ent->name[1] == '.') && (ent->name[2] == '\0'))))) {
+			continue;
+		}
+		len = dirlen + strlen(sep) + strlen(ent->name) + 1;
+		if (len > PATH_MAX) {
+			continue;
+		}
+		wk->acl_ents[n] = i;
+		wk->acl_inos[n++] = ent->ino;
+		need += len;
+	}
+	if (n == 0) {
+		return;
+	}
+	if (*acl_nfs4_ctx_uring(wk->ctx) == NULL) {
+		for (i = 0; i < n; i++) {
+			ent = &c->ents[wk->acl_ents[i]];
+			ent->acl = nfs4_acl_get_at(dir->fd, ent->name);
+			if (ent->acl != NULL) {
+				walk_mem_charge(pool, walk_acl_size(ent->acl));
+			}
+		}
+		return;
+	}
+	if (need > wk->acl_names_sz) {
+		tmp = realloc(wk->acl_names, need);
+		if (tmp == NULL) {
+			return;
+		}
+		walk_mem_charge(pool, need - wk->acl_names_sz);
+		wk->acl_names = tmp;
+		wk->acl_names_sz = need;
+	}
+	for (i = 0; i < n; i++) {
+		wk->acl_paths[i] = wk->acl_names + off;
+		off += sprintf(wk->acl_names + off, "%s%s%s", dir->e.path, sep,
+			       c->ents[wk->acl_ents[i]].name) + 1;
+	}
+
+	acl_nfs4_get_many_ino(wk->ctx, wk->acl_paths, wk->acl_inos,
+			      dir->e.st.st_dev, n, wk->acls);
+	for (i = 0; i < n; i++) {
+		if (wk->acls[i] != NULL) {
+			walk_mem_charge(pool, walk_acl_size(wk->acls[i]));
+		}
+		c->ents[wk->acl_ents[i]].acl = wk->acls[i];
+	}
+}
+
+static void
+walk_chunk_run(struct walk_worker *wk, struct walk_node *dir,
+	       struct walk_chunk *c)
+{
+	size_t i;
+
+	for (i = 0; (i < c->nents) && !walk_stopped(wk->pool); i++) {
+		if ((wk->ctx != NULL) && (i % WALK_ACL_BATCH == 0)) {
+			walk_acl_read(wk, dir, c, i);
+		}
+		walk_child(wk, dir, c->ents[i].name, c->ents[i].ino,
+			   c->ents[i].type, &c->ents[i].acl);
+		walk_acl_free(wk->pool, &c->ents[i].acl);
+	}
+	/* Read ahead for entries not visited since the walk stopped */
+	for (; i < c->nents; i++) {
+		walk_acl_free(wk->pool, &c->ents[i].acl);
+	}
+	c->nents = 0;
+	c->names_len = 0;
+}
+
+/*
+ * Queue the chunk being filled for any thread to take, or visit its
+ * entries right away if enough chunks are queued already.
+ */
+static void
+walk_chunk_flush(struct walk_worker *wk, struct walk_node *dir)
+{
+	struct walk_pool *pool = wk->pool;
+	struct walk_chunk *c = wk->chunk;
+
+	if (__atomic_add_fetch(&pool->nchunks, 1, __ATOMIC_RELAXED) <=
+	    pool->max_chunks) {
+		__atomic_add_fetch(&dir->refcnt, 1, __ATOMIC_RELAXED);
+		c->dir = dir;
+		if (walk_push_task(wk, dir, c)) {
+			wk->chunk = NULL;
+			return;
+		}
+		__atomic_sub_fetch(&dir->refcnt, 1, __ATOMIC_RELAXED);
+	}
+	__atomic_sub_fetch(&pool->nchunks, 1, __ATOMIC_RELAXED);
+	walk_chunk_run(wk, dir, c);
+}
+
+/*
+ * Visit entry `name` of `dir`, either now or as part of a chunk.
+ */
+static void
+walk_entry(struct walk_worker *wk, struct walk_node *dir, const char *name,
+	   ino_t ino, unsigned char type)
+{
+	struct walk_chunk *c = wk->chunk;
+	char namebuf[NAME_MAX + 1];
+	size_t len;
+
+	/* One thread only needs chunks to read ACLs ahead */
+	if ((wk->pool->nworkers == 1) && (wk->ctx == NULL)) {
+		walk_child(wk, dir, name, ino, type, NULL);
+		return;
+	}
+	if (c == NULL) {
+		if (!walk_mem_try(wk->pool, sizeof(struct walk_chunk))) {
+			walk_child(wk, dir, name, ino, type, NULL);
+			return;
+		}
+		c = malloc(sizeof(struct walk_chunk));
+		if (c == NULL) {
+			walk_mem_uncharge(wk->pool, sizeof(struct walk_chunk));
+			walk_child(wk, dir, name, ino, type, NULL);
+			return;
+		}
+		c->nents = 0;
+		c->names_len = 0;
+		wk->chunk = c;
+	}
+
+	len = strlen(name) + 1;
+	if ((c->nents == WALK_CHUNK_ENTS) ||
+	    (c->names_len + len > WALK_CHUNK_NAMES)) {
+		/*
+		 * Visiting the chunk may descend into a subdirectory,
+		 * which reads it into the buffer that `name` points into.
+		 */
+		memcpy(namebuf, name, len);
+		name = namebuf;
+		walk_chunk_flush(wk, dir);
+		if (wk->chunk == NULL) {
+			walk_entry(wk, dir, name, ino, type);
+			return;
+		}
+	}
+	memcpy(c->names + c->names_len, name, len);
+	c->ents[c->nents].name = c->names + c->names_len;
+	c->ents[c->nents].ino = ino;
+	c->ents[c->nents].type = type;
+	c->ents[c->nents].acl = NULL;
+	c->nents++;
+	c->names_len += len;
+}
+
+/*
+ * Read directory `dir` and call `fn` on its entries, in the requested
+ * order. Without sorting, entries are visited (or chunked) straight
+ * from the getdents64() buffer. The last, partial chunk is always
+ * visited by the reading thread. If a streaming walk descends into a
+ * subdirectory meanwhile, the buffer is reused, and reading continues
+ * from the cookie of the entry that was being visited.
+ */
+static void
+walk_dir(struct walk_worker *wk, struct walk_node *dir)
+{
+	struct walk_pool *pool = wk->pool;
+	enum nfs4_acl_walk_order order = pool->order;
+	const struct walk_dirent64 *de = NULL;
+	size_t nents = 0, names_len = 0, i, base = wk->nsubdirs;
+	unsigned short reclen;
+	u_int64_t nreads;
+	ssize_t nread, off;
+	off_t cookie;
+	int oflags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+
+	if (!(pool->walk->flags & NFS4_ACL_WALK_LOGICAL)) {
+		oflags |= O_NOFOLLOW;
+	}
+	dir->fd = openat(dir->e.dirfd, dir->e.accpath, oflags);
+	if (dir->fd == -1) {
+		walk_error(pool, dir, NULL, errno);
+		return;
+	}
+
+	while (!walk_stopped(pool)) {
+		nread = syscall(SYS_getdents64, dir->fd, wk->buf, WALK_BUFSZ);
+		if (nread <= 0) {
+			if (nread < 0) {
+				walk_error(pool, dir, NULL, errno);
+			}
+			break;
+		}
+		nreads = ++wk->nreads;
+		for (off = 0; off < nread; off += reclen) {
+			de = (const struct walk_dirent64 *)(wk->buf + off);
+			reclen = de->d_reclen;
+			if (order == NFS4_ACL_WALK_ORDER_NONE) {
+				cookie = de->d_off;
+				walk_entry(wk, dir, de->d_name, de->d_ino,
+					   de->d_type);
+				if (wk->nreads == nreads) {
+					continue;
+				}
+				if (lseek(dir->fd, cookie, SEEK_SET) == -1) {
+					walk_error(pool, dir, NULL,
+						   errno);
+					goto out;
+				}
+				break;
+			}
+			else if (walk_dirent_add(wk, nents, &names_len, de)) {
+				nents++;
+			}
+			else {
+				walk_error(pool, dir, de->d_name,
+					   errno);
+			}
+		}
+	}
+
+	if (nents > 0) {
+		for (i = 0; i < nents; i++) {
+			wk->ents[i].name = wk->names + wk->ents[i].off;
+		}
+		qsort(wk->ents, nents, sizeof(struct walk_dirent),
+		      (order == NFS4_ACL_WALK_ORDER_INODE) ?
+		      walk_dirent_cmp_ino : walk_dirent_cmp_name);
+		for (i = 0; (i < nents) && !walk_stopped(pool); i++) {
+			walk_entry(wk, dir, wk->ents[i].name, wk->ents[i].ino,
+				   wk->ents[i].type);
+		}
+	}
+out:
+	if (wk->chunk != NULL) {
+		walk_chunk_run(wk, dir, wk->chunk);
+	}
+
+	walk_push_subdirs(wk, base);
+}
+
+static void *
+walk_worker_main(void *arg)
+{
+	struct walk_worker *wk = arg;
+	struct walk_pool *pool = wk->pool;
+	struct walk_fs *fs = NULL;
+	struct walk_task t;
+
+	while (walk_get_task(wk, &t)) {
+		fs = t.dir->fs;
+		if (t.chunk != NULL) {
+			walk_chunk_run(wk, t.dir, t.chunk);
+			walk_push_subdirs(wk, 0);
+			walk_mem_uncharge(pool, sizeof(struct walk_chunk));
+			free(t.chunk);
+			__atomic_sub_fetch(&pool->nchunks, 1, __ATOMIC_RELAXED);
+		}
+		else if (!walk_stopped(pool)) {
+			walk_dir(wk, t.dir);
+		}
+		if (fs != NULL) {
+			walk_fs_task_done(pool, fs);
+		}
+		walk_node_rele(pool, t.dir);
+		walk_task_done(pool);
+	}
+	return (NULL);
+}
+
+/*
+ * The root is always followed. If it is a symbolic link, it is
+ * accessed through its resolved path.
+ */
+static struct walk_node *
+walk_root(struct walk_pool *pool, const char *path)
+{
+	struct walk_node *n = NULL;
+	char *accpath = NULL;
+	struct stat st;
+
+	if (lstat(path, &st) != 0) {
+		return (NULL);
+	}
+	if (!S_ISLNK(st.st_mode)) {
+		return (walk_node_new(pool, NULL, path, NULL, &st, true));
+	}
+
+	accpath = realpath(path, NULL);
+	if (accpath == NULL) {
+		return (NULL);
+	}
+	if (stat(accpath, &st) == 0) {
+		n = walk_node_new(pool, NULL, path, accpath, &st, true);
+	}
+	free(accpath);
+	return (n);
+}
+
+static void
+walk_worker_fini(struct walk_worker *wk)
+{
+	free(wk->dq.tasks);
+	free(wk->buf);
+	free(wk->ents);
+	free(wk->names);
+	free(wk->subdirs);
+	free(wk->chunk);
+	free(wk->acl_names);
+	nfs4_acl_ctx_free(wk->ctx);
+	pthread_mutex_destroy(&wk->dq.lock);
+}
+
+/*
+ * Walk the tree at `path`, calling walk->fn for every entry including
+ * `path` itself. Returns 0 if the whole tree was walked without errors,
+ * otherwise -1; walk->nerrors and walk->stopped tell what happened. If
+ * the root cannot be reached, -1 is returned with errno set and
+ * walk->nerrors left at 0.
+ */
+int nfs4_acl_walk(const char *path, struct nfs4_acl_walk *walk)
+{
+	struct walk_pool pool;
+	struct walk_worker *wk = NULL;
+	struct walk_node *root = NULL;
+	struct walk_fs *fs = NULL;
+	unsigned int i, started;
+	int error = 0;
+
+	if ((path == NULL) || (walk == NULL) || (walk->fn == NULL)) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if ((walk->max_mem != 0) && (walk->max_mem < WALK_MEM_MIN)) {
+		errno = EINVAL;
+		return (-1);
+	}
+	walk->nentries = 0;
+	walk->nerrors = 0;
+	walk->stopped = false;
+	walk->peak_mem = 0;
+	walk->final_jobs = 0;
+
+	memset(&pool, 0, sizeof(pool));
+	pool.walk = walk;
+	pool.order = walk->order;
+	pool.nworkers = (walk->jobs > 1) ? walk->jobs : 1;
+	if (walk->max_mem != 0) {
+		/* Each thread needs room for its buffer, chunks and reserve */
+		pool.order = NFS4_ACL_WALK_ORDER_NONE;
+		pool.max_mem = walk->max_mem;
+		if (pool.nworkers > walk->max_mem / WALK_MEM_PER_WORKER) {
+			pool.nworkers = walk->max_mem / WALK_MEM_PER_WORKER;
+		}
+		pool.mem_reserve = pool.nworkers * WALK_MEM_RESERVE;
+	}
+	/* A single thread visits its chunks itself */
+	pool.max_chunks = (pool.nworkers > 1) ?
+			  pool.nworkers * WALK_CHUNKS_PER_WORKER : 0;
+	pool.limit = pool.nworkers;
+	pthread_mutex_init(&pool.adapt_lock, NULL);
+	pthread_cond_init(&pool.adapt_cv, NULL);
+	if (walk->latency_target != 0) {
+		pool.target_ns = (u_int64_t)walk->latency_target * 1000;
+		pool.limit = 1;
+		pool.window = walk_now();
+	}
+	if (walk->max_ops != 0) {
+		pool.ops_ns = 1000000000ULL / walk->max_ops;
+		if (pool.ops_ns == 0) {
+			pool.ops_ns = 1;
+		}
+	}
+	pthread_mutex_init(&pool.idle_lock, NULL);
+	pthread_cond_init(&pool.idle_cv, NULL);
+	pthread_mutex_init(&pool.visited_lock, NULL);
+	pthread_mutex_init(&pool.fs_lock, NULL);
+	pool.per_fs = (walk->flags & NFS4_ACL_WALK_PER_FS) != 0;
+	pool.fs_limit = pool.nworkers;
+	if ((walk->fs_jobs > 0) && (walk->fs_jobs < pool.nworkers)) {
+		pool.fs_limit = walk->fs_jobs;
+	}
+
+	pool.workers = calloc(pool.nworkers, sizeof(struct walk_worker));
+	if (pool.workers == NULL) {
+		error = errno;
+		goto out;
+	}
+	for (i = 0; i < pool.nworkers; i++) {
+		wk = &pool.workers[i];
+		wk->pool = &pool;
+		wk->index = i;
+		wk->seed = i;
+		wk->dq.size = WALK_DEQUE_INIT;
+		pthread_mutex_init(&wk->dq.lock, NULL);
+		wk->dq.tasks = calloc(wk->dq.size, sizeof(struct walk_task));
+		wk->buf = malloc(WALK_BUFSZ);
+		if (walk->flags & NFS4_ACL_WALK_ACL) {
+			wk->ctx = nfs4_acl_ctx_new(NULL);
+		}
+		if ((wk->dq.tasks == NULL) || (wk->buf == NULL) ||
+		    ((walk->flags & NFS4_ACL_WALK_ACL) && (wk->ctx == NULL))) {
+			error = errno;
+			pool.nworkers = i + 1;
+			goto out;
+		}
+		/* Without a ring, ACLs are read ahead synchronously */
+		if ((wk->ctx != NULL) && (walk->uring_depth != 0)) {
+			nfs4_acl_ctx_set_uring(wk->ctx, walk->uring_depth);
+		}
+		walk_mem_charge(&pool, WALK_BUFSZ);
+	}
+
+	root = walk_root(&pool, path);
+	if (root == NULL) {
+		error = errno;
+		goto out;
+	}
+	pool.root_dev = root->e.st.st_dev;
+	if (pool.per_fs) {
+		root->fs = walk_fs_get(&pool, root->e.st.st_dev, root->e.path);
+		if (root->fs == NULL) {
+			error = errno;
+			walk_node_rele(&pool, root);
+			goto out;
+		}
+		root->e.fs = &root->fs->pub;
+	}
+	if ((walk->flags & NFS4_ACL_WALK_LOGICAL) &&
+	    (root->e.type == NFS4_ACL_WALK_DIR)) {
+		walk_first_visit(&pool, &root->e.st);
+	}
+	if (walk_visit(&pool.workers[0], root)) {
+		walk_push(&pool.workers[0], root);
+	}
+
+	for (started = 1; started < pool.nworkers; started++) {
+		wk = &pool.workers[started];
+		error = pthread_create(&wk->thread, NULL, walk_worker_main, wk);
+		if (error) {
+			acl_nfs4_log("pthread_create() failed: %s. Continuing "
+				     "with %u threads", strerror(error), started);
+			error = 0;
+			break;
+		}
+	}
+	walk_worker_main(&pool.workers[0]);
+	for (i = 1; i < started; i++) {
+		pthread_join(pool.workers[i].thread, NULL);
+	}
+
+	walk->nentries = pool.nentries;
+	walk->nerrors = pool.nerrors;
+	walk->stopped = pool.stop;
+	walk->peak_mem = pool.peak_mem;
+	walk->final_jobs = pool.limit;
+	for (i = 0; i < pool.nfs; i++) {
+		fs = pool.fs[i];
+		fs->pub.elapsed = (fs->end.tv_sec - fs->start.tv_sec) +
+				  (fs->end.tv_nsec - fs->start.tv_nsec) / 1e9;
+		if (walk->fs_fn != NULL) {
+			walk->fs_fn(&fs->pub, walk->arg);
+		}
+	}
+
+out:
+	if (pool.workers != NULL) {
+		for (i = 0; i < pool.nworkers; i++) {
+			walk_worker_fini(&pool.workers[i]);
+		}
+		free(pool.workers);
+	}
+	pthread_mutex_destroy(&pool.idle_lock);
+	pthread_cond_destroy(&pool.idle_cv);
+	pthread_mutex_destroy(&pool.adapt_lock);
+	pthread_cond_destroy(&pool.adapt_cv);
+	tdestroy(pool.visited, free);
+	pthread_mutex_destroy(&pool.visited_lock);
+	for (i = 0; i < pool.nfs; i++) {
+		pthread_mutex_destroy(&pool.fs[i]->dq.lock);
+		free(pool.fs[i]->dq.tasks);
+		free(pool.fs[i]);
+	}
+	free(pool.fs);
+	pthread_mutex_destroy(&pool.fs_lock);
+	if (error) {
+		errno = error;
+		return (-1);
+	}
+	return (((walk->nerrors > 0) || walk->stopped) ? -1 : 0);
+}
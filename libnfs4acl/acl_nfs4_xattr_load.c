@@ -66,7 +66,7 @@ static struct nfs4_ace
 			id = -1;
 			break;
 		default:
-			fprintf(stderr, "Unknown id: 0x%08x\n", ae_id);
+			acl_nfs4_log("Unknown id: 0x%08x", ae_id);
 			errno = EINVAL;
 			return NULL;
 		}
@@ -111,7 +111,7 @@ struct nfs4_acl * acl_nfs4_xattr_load(char *xattr_v, int xattr_size, u32 is_dir)
 	}
 
 	if (!XDRSIZE_IS_VALID(xattr_size)) {
-		fprintf(stderr, "xattr size: %d is invalid\n", xattr_size);
+		acl_nfs4_log("xattr size: %d is invalid", xattr_size);
 		errno = EINVAL;
 		return NULL;
 	}
@@ -122,7 +122,7 @@ struct nfs4_acl * acl_nfs4_xattr_load(char *xattr_v, int xattr_size, u32 is_dir)
 	}
 
 	if (!native_to_nfs4acl((u32 *)xattr_v, xattr_size, acl)) {
-		free(acl);
+		nfs4_free_acl(acl);
 		return NULL;
 	}
 
@@ -88,6 +88,32 @@ nfs4acl_to_buf(u32 *xattrbuf, struct nfs4_acl *acl)
 	return true;
 }
 
+/*
+ * Pack `acl` into caller-provided buffer `buf` of `bufsz` bytes.
+ * Returns the number of bytes used.
+ */
+size_t acl_nfs4_xattr_pack_buf(struct nfs4_acl *acl, char *buf, size_t bufsz)
+{
+	size_t acl_size = 0;
+
+	if (acl == NULL || buf == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	acl_size = ACES_2_ACLSIZE(acl->naces);
+	if (acl_size > bufsz) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	if (!nfs4acl_to_buf((u32 *)buf, acl)) {
+		return -1;
+	}
+
+	return acl_size;
+}
+
 size_t acl_nfs4_xattr_pack(struct nfs4_acl * acl, char** bufp)
 {
 	char *buf = NULL;
@@ -104,7 +130,7 @@ size_t acl_nfs4_xattr_pack(struct nfs4_acl * acl, char** bufp)
 		return -1;
 	}
 
-	if (!nfs4acl_to_buf((u32 *)buf, acl)) {
+	if (acl_nfs4_xattr_pack_buf(acl, buf, acl_size) != acl_size) {
 		free(buf);
 		return -1;
 	}
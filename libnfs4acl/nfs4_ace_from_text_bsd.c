@@ -98,7 +98,7 @@ parse_tag(const char *str, struct nfs4_ace *entry, int *need_qualifier)
 		return (0);
 	}
 
-	warnx("malformed ACL: invalid \"tag\" field");
+	acl_nfs4_log("malformed ACL: invalid \"tag\" field");
 	return (-1);
 }
 
@@ -119,7 +119,7 @@ parse_qualifier(char *str, struct nfs4_ace *entry, int *need_qualifier)
 	qualifier_length = strlen(str);
 
 	if (qualifier_length == 0) {
-		warnx("malformed ACL: empty \"qualifier\" field");
+		acl_nfs4_log("malformed ACL: empty \"qualifier\" field");
 		return (-1);
 	}
 
@@ -167,7 +167,7 @@ parse_entry_type(const char *str, struct nfs4_ace *entry)
 	else if (strcmp(str, "alarm") == 0)
 		entry->type = NFS4_ACE_SYSTEM_ALARM_ACE_TYPE;
 	else {
-		warnx("malformed ACL: invalid \"type\" field");
+		acl_nfs4_log("malformed ACL: invalid \"type\" field");
 		return (-1);
 	}
 	return (0);
@@ -180,7 +180,7 @@ parse_appended_id(char *str, struct nfs4_ace *entry)
 
 	qualifier_length = strlen(str);
 	if (qualifier_length == 0) {
-		warnx("malformed ACL: \"appended id\" field present, "
+		acl_nfs4_log("malformed ACL: \"appended id\" field present, "
 	           "but empty");
 		return (-1);
 	}
@@ -217,7 +217,7 @@ struct nfs4_ace
 			     -1);
 
 	if (entry == NULL) {
-		fprintf(stderr, "Failed to create new entry\n");
+		acl_nfs4_log("Failed to create new entry");
 		return (NULL);
 	}
 
@@ -275,7 +275,7 @@ struct nfs4_ace
 
 	if (need_qualifier) {
 		if (str == NULL) {
-			warnx("malformed ACL: unknown user or group name "
+			acl_nfs4_log("malformed ACL: unknown user or group name "
 			    "\"%s\"", qualifier_field);
 			goto truncated_entry;
 		}
@@ -306,7 +306,7 @@ _nfs4_acl_entry_from_text(struct nfs4_acl *aclp, char *str, uint *index)
 	int error;
 	entry = nfs4_ace_from_text(aclp->is_directory, str);
 	if (entry == NULL) {
-		fprintf(stderr, "failed to generate ACL entry\n");
+		acl_nfs4_log("failed to generate ACL entry");
 		return (-1);
 	}
 
@@ -317,7 +317,7 @@ _nfs4_acl_entry_from_text(struct nfs4_acl *aclp, char *str, uint *index)
 		error = nfs4_insert_ace_at(aclp, entry, *index);
 	}
 	if (error) {
-		fprintf(stderr, "ACL action failed\n");
+		acl_nfs4_log("ACL action failed");
 		free(entry);
 		return (error);
 	}
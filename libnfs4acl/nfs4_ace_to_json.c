@@ -30,8 +30,6 @@
 #include <ctype.h>
 #include <assert.h>
 #include <jansson.h>
-#include <sysexits.h>
-#include <err.h>
 #include "nfs4_json.h"
 #include "libacl_nfs4.h"
 
@@ -105,8 +103,8 @@ perms_to_json(json_t *_parent, nfs4_acl_perm_t access_mask, bool verbose)
 			if (basicperms2txt[i].perm == access_mask) {
 				basic = json_string(basicperms2txt[i].name);
 				if (basic == NULL) {
-					errx(EX_OSERR, "json_string() failed for %s",
-					    basicperms2txt[i].name);
+					json_decref(perms);
+					return (-1);
 				}
 				break;
 			}
@@ -150,8 +148,8 @@ flags_to_json(json_t *_parent, nfs4_acl_flag_t flagset, bool verbose)
 			if (basicflags2txt[i].flag == flagset) {
 				basic = json_string(basicflags2txt[i].name);
 				if (basic == NULL) {
-					errx(EX_OSERR, "json_string() failed for %s",
-					    basicflags2txt[i].name);
+					json_decref(flags);
+					return (-1);
 				}
 				break;
 			}
@@ -336,3 +334,110 @@ json_t
 
 	return jsout;
 }
+
+static const char *edit_op2txt[] = {
+	[NFS4_ACL_EDIT_INSERT] = "insert",
+	[NFS4_ACL_EDIT_DELETE] = "delete",
+	[NFS4_ACL_EDIT_MODIFY] = "modify",
+};
+
+static json_t
+*edit_to_json(const struct nfs4_acl_edit *e, int flags)
+{
+	int error = 0;
+	json_t *jsout = NULL, *js_ace = NULL;
+
+	jsout = json_object();
+	if (jsout == NULL) {
+		return (NULL);
+	}
+
+	error = json_object_set_new(jsout, "op", json_string(edit_op2txt[e->op]));
+	if (error) {
+		json_decref(jsout);
+		return (NULL);
+	}
+
+	error = json_object_set_new(jsout, "index", json_integer(e->index));
+	if (error) {
+		json_decref(jsout);
+		return (NULL);
+	}
+
+	if (e->op != NFS4_ACL_EDIT_INSERT) {
+		js_ace = _nfs4_ace_to_json((struct nfs4_ace *)&e->old_ace, flags);
+		if ((js_ace == NULL) ||
+		    json_object_set_new(jsout, "old", js_ace)) {
+			json_decref(jsout);
+			return (NULL);
+		}
+	}
+
+	if (e->op != NFS4_ACL_EDIT_DELETE) {
+		js_ace = _nfs4_ace_to_json((struct nfs4_ace *)&e->new_ace, flags);
+		if ((js_ace == NULL) ||
+		    json_object_set_new(jsout, "new", js_ace)) {
+			json_decref(jsout);
+			return (NULL);
+		}
+	}
+
+	return (jsout);
+}
+
+/*
+ * JSON form of an ACL diff:
+ * {"edits": [{"op": "modify", "index": 0, "old": {...}, "new": {...}}, ...],
+ *  "nfs41_flags": {...}}
+ * where "nfs41_flags" is only present if the diff changes ACL flags.
+ */
+json_t
+*_nfs4_acl_diff_to_json(const struct nfs4_acl_diff *d, int flags)
+{
+	int error;
+	u32 i;
+	json_t *jsout = NULL, *edits = NULL;
+
+	jsout = json_object();
+	if (jsout == NULL) {
+		return (NULL);
+	}
+
+	edits = json_array();
+	if (edits == NULL) {
+		json_decref(jsout);
+		return (NULL);
+	}
+
+	for (i = 0; i < d->nedits; i++) {
+		json_t *js_edit = NULL;
+		js_edit = edit_to_json(&d->edits[i], flags);
+		if (js_edit == NULL) {
+			json_decref(edits);
+			json_decref(jsout);
+			return (NULL);
+		}
+		error = json_array_append_new(edits, js_edit);
+		if (error) {
+			json_decref(edits);
+			json_decref(jsout);
+			return (NULL);
+		}
+	}
+
+	error = json_object_set_new(jsout, "edits", edits);
+	if (error) {
+		json_decref(jsout);
+		return (NULL);
+	}
+
+	if (d->set_aclflags) {
+		error = aclflags_to_json(jsout, d->aclflags4);
+		if (error) {
+			json_decref(jsout);
+			return (NULL);
+		}
+	}
+
+	return (jsout);
+}
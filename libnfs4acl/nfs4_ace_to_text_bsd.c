@@ -33,7 +33,7 @@
 #include "libacl_nfs4.h"
 
 
-#define MAX_ENTRY_LENGTH 512
+#define MAX_ENTRY_LENGTH NFS4_ACE_TEXT_MAX
 
 static int
 format_who(char *str, size_t size, struct nfs4_ace *entry, bool numeric)
@@ -121,9 +121,10 @@ format_additional_id(char *str, size_t size, struct nfs4_ace *entry)
 }
 
 static int
-format_entry(char *str, size_t size, struct nfs4_ace *entry, int flags)
+format_entry(char *str, size_t size, struct nfs4_ace *entry, int flags,
+	     bool compact)
 {
-	size_t off = 0, min_who_field_length = 18;
+	size_t off = 0, min_who_field_length = compact ? 0 : 18;
 	int error, len, flagset;
 	char buf[MAX_ENTRY_LENGTH + 1];
 	error = format_who(buf, sizeof(buf), entry,
@@ -175,13 +176,29 @@ format_entry(char *str, size_t size, struct nfs4_ace *entry, int flags)
 		}
 		off += snprintf(str + off, size - off, "%s", buf);
 	}
-	off += snprintf(str + off, size - off, "\n");
+	if (!compact) {
+		off += snprintf(str + off, size - off, "\n");
+	}
 
 	assert (off < size);
 
 	return(0);
 }
 
+/*
+ * Format a single entry without column padding or trailing newline.
+ * `size` should be at least NFS4_ACE_TEXT_MAX.
+ */
+int
+_nfs4_ace_to_text(char *str, size_t size, struct nfs4_ace *entry, int flags)
+{
+	if (format_entry(str, size, entry, flags, true) != 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	return (0);
+}
+
 char *
 _nfs4_acl_to_text_np(struct nfs4_acl *aclp, ssize_t *len_p, int flags)
 {
@@ -203,7 +220,7 @@ _nfs4_acl_to_text_np(struct nfs4_acl *aclp, ssize_t *len_p, int flags)
 	     ace = nfs4_get_next_ace(&ace)) {
 		assert(off < size);
 
-		error = format_entry(str + off, size - off, ace, flags);
+		error = format_entry(str + off, size - off, ace, flags, false);
 		if (error) {
 			free(str);
 			errno = EINVAL;
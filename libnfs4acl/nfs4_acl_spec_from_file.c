@@ -52,8 +52,8 @@ char * nfs4_acl_spec_from_file(FILE *f)
 			*c = '\0';
 		consumed += strlen(ace_buf);
 		if (consumed > NFS4_MAX_ACLSIZE) {
-			fprintf(stderr, "ERROR: maximum ACL buffer size exceeded (%d > %d).\n",
-					NFS4_MAX_ACLSIZE, consumed);
+			acl_nfs4_log("maximum ACL buffer size exceeded (%d > %d)",
+				     consumed, NFS4_MAX_ACLSIZE);
 			free(acl_spec);
 			return NULL;
 		}
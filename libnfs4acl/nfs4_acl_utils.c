@@ -45,7 +45,7 @@ inline struct nfs4_ace* nfs4_get_first_ace(struct nfs4_acl *acl)
         if (acl == NULL)
                 return NULL;
 
-        return acl->ace_head.tqh_first;
+        return acl->entries->head.tqh_first;
 }
 
 inline struct nfs4_ace* nfs4_get_next_ace(struct nfs4_ace **ace)
@@ -81,21 +81,25 @@ int nfs4_insert_ace_at(struct nfs4_acl *acl, struct nfs4_ace *ace, unsigned int
 
 	if (acl == NULL || ace == NULL || index > acl->naces) {
 		errno = E2BIG;
-		warnx("insert ace at acl; %p, ace: %p, index: [%d], naces: [%d]\n",
+		acl_nfs4_log("insert ace at acl; %p, ace: %p, index: [%d], naces: [%d]\n",
 		      acl, ace, index, acl ? acl->naces : 0);
 		return -1;
 	}
 
+	if (!acl_nfs4_detach(acl, NULL)) {
+		return -1;
+	}
+
 	if (index == 0) {
-		TAILQ_INSERT_HEAD(&acl->ace_head, ace, l_ace);
+		TAILQ_INSERT_HEAD(&acl->entries->head, ace, l_ace);
 	} else if (index == acl->naces) {
-		TAILQ_INSERT_TAIL(&acl->ace_head, ace, l_ace);
+		TAILQ_INSERT_TAIL(&acl->entries->head, ace, l_ace);
 	} else {
 		if ((ap = nfs4_get_ace_at(acl, index - 1)) == NULL) {
 			return -1;
 		}
 
-		TAILQ_INSERT_AFTER(&acl->ace_head, ap, ace, l_ace);
+		TAILQ_INSERT_AFTER(&acl->entries->head, ap, ace, l_ace);
 	}
 	acl->naces++;
 
@@ -107,7 +111,10 @@ int nfs4_remove_ace(struct nfs4_acl *acl, struct nfs4_ace *ace)
 	if (acl == NULL || ace == NULL)
 		return -1;
 
-	TAILQ_REMOVE(&acl->ace_head, ace, l_ace);
+	if (!acl_nfs4_detach(acl, &ace))
+		return -1;
+
+	TAILQ_REMOVE(&acl->entries->head, ace, l_ace);
 	free(ace);
 	acl->naces--;
 
@@ -119,13 +126,43 @@ int nfs4_remove_ace_at(struct nfs4_acl *acl, unsigned int index)
 	return nfs4_remove_ace(acl, nfs4_get_ace_at(acl, index));
 }
 
+/*
+ * Replace `old_ace` with `new_ace`. The caller frees `old_ace`, which
+ * it may only do if no other handle shares it, so this fails with
+ * EBUSY if the entries of `acl` are shared; see nfs4_replace_ace_free().
+ */
 int nfs4_replace_ace(struct nfs4_acl *acl, struct nfs4_ace *old_ace, struct nfs4_ace *new_ace)
 {
 	if (acl == NULL || old_ace == NULL || new_ace == NULL)
 		return -1;
 
-	TAILQ_INSERT_AFTER(&acl->ace_head, old_ace, new_ace, l_ace);
-	TAILQ_REMOVE(&acl->ace_head, old_ace, l_ace);
+	if (__atomic_load_n(&acl->entries->refcnt, __ATOMIC_ACQUIRE) > 1) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	TAILQ_INSERT_AFTER(&acl->entries->head, old_ace, new_ace, l_ace);
+	TAILQ_REMOVE(&acl->entries->head, old_ace, l_ace);
+
+	return 0;
+}
+
+/*
+ * Replace `old_ace` with `new_ace` and free `old_ace`. If the entries
+ * of `acl` are shared, `old_ace` itself stays with the other handles
+ * and only this handle's copy of it is freed.
+ */
+int nfs4_replace_ace_free(struct nfs4_acl *acl, struct nfs4_ace *old_ace, struct nfs4_ace *new_ace)
+{
+	if (acl == NULL || old_ace == NULL || new_ace == NULL)
+		return -1;
+
+	if (!acl_nfs4_detach(acl, &old_ace))
+		return -1;
+
+	TAILQ_INSERT_AFTER(&acl->entries->head, old_ace, new_ace, l_ace);
+	TAILQ_REMOVE(&acl->entries->head, old_ace, l_ace);
+	free(old_ace);
 
 	return 0;
 }
@@ -161,8 +198,12 @@ int nfs4_replace_ace_spec(struct nfs4_acl *acl, char *from_ace_spec, char *to_ac
 				free(to_ace);
 				return (-1);
 			}
-			nfs4_replace_ace(acl, orig_ace, new_ace);
-			free(orig_ace);
+			if (nfs4_replace_ace_free(acl, orig_ace, new_ace)) {
+				free(new_ace);
+				free(from_ace);
+				free(to_ace);
+				return (-1);
+			}
 			orig_ace = new_ace; /* so the for-loop turns over right */
 		}
 	}
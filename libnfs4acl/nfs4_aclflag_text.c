@@ -32,7 +32,6 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
-#include <err.h>
 #include <sys/types.h>
 
 #include "libacl_nfs4.h"
@@ -55,9 +54,18 @@ nfs4_aclflag_from_text(char *flags, nfs4_acl_aclflags_t *_flags4p)
 {
 	int flags4p = 0, i, mapped;
 	char *field = NULL;
+	size_t len;
 	bool found;
 
 	while ((field = strsep(&flags, ",")) != NULL) {
+		/* accept what nfs4_aclflag_to_text() produces */
+		len = strlen(field);
+		if ((len > 0) && (field[len - 1] == ':')) {
+			field[len - 1] = '\0';
+		}
+		if (strcmp(field, "none") == 0) {
+			continue;
+		}
 		found = false;
 		mapped = 0;
 		for (i = 0; acl_flag_str[i].flagstr != NULL; i++) {
@@ -68,7 +76,7 @@ nfs4_aclflag_from_text(char *flags, nfs4_acl_aclflags_t *_flags4p)
 			}
 		}
 		if (!found) {
-			warnx("%s: invalid aclflag", field);
+			acl_nfs4_log("%s: invalid aclflag", field);
 			errno = EINVAL;
 			return (false);
 		}
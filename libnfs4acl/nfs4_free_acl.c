@@ -41,15 +41,11 @@
 void
 nfs4_free_acl(struct nfs4_acl *acl)
 {
-	struct nfs4_ace *ace;
-
 	if (!acl)
 		return;
 
-	while (!TAILQ_IS_EMPTY(acl->ace_head)) {
-		ace = (acl)->ace_head.tqh_first;
-		nfs4_remove_ace(acl, ace);
-	}
+	/* Entries are freed with the last handle sharing them */
+	acl_nfs4_entries_unref(acl->entries);
 	free(acl);
 
 	return;
@@ -41,209 +41,169 @@
 #include "libacl_nfs4.h"
 
 
-static int nfs4_getxattr(const char *, const int, void *, size_t);
+static int nfs4_getxattr(const char *, const int, const struct stat *,
+			 void *, size_t, dev_t *);
 
 
-#ifdef USE_SECURITY_NAMESPACE
 /*
- * Non-native NFSv4 ACLs may not exist on file when we try to read
- * them. In this case, synthesize a new NFSv4 ACL from the POSIX
- * mode of the file.
+ * The xattr is read in one call into a buffer of the largest valid
+ * size rather than asking for its size first, which for *_at() on
+ * kernels without getxattrat() would open the file twice.
  */
-static struct nfs4_acl *synthesize_acl_from_mode(const char *path, int fd)
+static struct nfs4_acl *nfs4_acl_get(const char *path, int fd)
 {
 	struct stat st;
+	int result;
 	struct nfs4_acl *acl = NULL;
-	int error;
-	bool ok;
-
-	if (path != NULL) {
-		error = stat(path, &st);
-		if (error) {
-			warnx("%s: stat() failed", path);
-			return NULL;
+	char xattr[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+
+	result = acl_nfs4_stat(path, fd, &st);
+	if (result) {
+		if (path != NULL) {
+			acl_nfs4_log("%s: stat() failed", path);
 		}
-	}
-	else {
-		error = fstat(fd, &st);
-		if (error) {
-			warnx("fstat() failed");
-			return NULL;
+		else {
+			acl_nfs4_log("fstat() failed");
 		}
-	}
-
-	acl = nfs4_new_acl(S_ISDIR(st.st_mode));
-	if (acl == NULL) {
-		return NULL;
-	}
-	ok = acl_nfs4_calculate_inherited_acl(NULL, acl,
-					      st.st_mode,
-					      false,
-					      S_ISDIR(st.st_mode));
-	if (!ok) {
-		nfs4_free_acl(acl);
 		return NULL;
 	}
 
-	return acl;
-}
-#endif
+	result = nfs4_getxattr(path, fd, &st, xattr, sizeof(xattr), NULL);
 
-struct nfs4_acl *do_xattr_load(const char *path, int fd,
-			       char *xattr, int size)
-{
-	struct stat st;
-	int error;
-	struct nfs4_acl *acl = NULL;
-
-	if (path != NULL) {
-		error = stat(path, &st);
-		if (error) {
-			warnx("%s: stat() failed", path);
-			free(xattr);
-			return NULL;
-		}
+#ifdef USE_SECURITY_NAMESPACE
+	/*
+	 * Non-native NFSv4 ACLs may not exist on file when we try to read
+	 * them. In this case, synthesize a new NFSv4 ACL from the POSIX
+	 * mode of the file.
+	 */
+	if ((result < 0) && (errno == ENODATA)) {
+		return acl_nfs4_new_trivial_acl(st.st_mode, S_ISDIR(st.st_mode));
 	}
-	else {
-		error = fstat(fd, &st);
-		if (error) {
-			warnx("fstat() failed");
-			free(xattr);
-			return NULL;
+#endif
+	if (result < 0) {
+		/* more than NFS41ACLMAXACES */
+		if (errno == ERANGE) {
+			errno = E2BIG;
 		}
+		return NULL;
 	}
 
-	acl = acl_nfs4_xattr_load(xattr, size, S_ISDIR(st.st_mode));
+	/* reconstruct the ACL */
+	acl = acl_nfs4_xattr_load(xattr, result, S_ISDIR(st.st_mode));
 	if (acl == NULL)
-		warnx("acl_nfs4_xattr_load() failed");
+		acl_nfs4_log("acl_nfs4_xattr_load() failed");
+
 	return acl;
 }
 
 struct nfs4_acl* nfs4_acl_get_file(const char *path)
 {
-	int result;
-	struct nfs4_acl *acl = NULL;
-	char *xattr = NULL;
-
 	if (path == NULL) {
 		errno = EINVAL;
 		return NULL;
 	}
-
-	/* find necessary buffer size */
-	result = nfs4_getxattr(path, -1, NULL, 0);
-
-#ifdef USE_SECURITY_NAMESPACE
-	if ((result < 0) && (errno == ENODATA)) {
-		return synthesize_acl_from_mode(path, -1);
-	}
-#else
-	if (result < 0)
-		return NULL;
-#endif
+	return nfs4_acl_get(path, -1);
+}
 
 
-	xattr = malloc(result);
-	if (xattr == NULL) {
-		warnx("Failed to allocate memory");
-		return NULL;
-	}
+struct nfs4_acl* nfs4_acl_get_fd(int fd)
+{
+	return nfs4_acl_get(NULL, fd);
+}
 
-	/* reconstruct the ACL */
-	result = nfs4_getxattr(path, -1, xattr, result);
-	if (result < 0) {
-		free(xattr);
+/*
+ * Get the ACL of `name` in directory `dirfd`. Symbolic links are not
+ * followed.
+ */
+struct nfs4_acl* nfs4_acl_get_at(int dirfd, const char *name)
+{
+	if (name == NULL) {
+		errno = EINVAL;
 		return NULL;
 	}
-
-	acl = do_xattr_load(path, -1, xattr, result);
-
-	free(xattr);
-	return acl;
+	return nfs4_acl_get(name, dirfd);
 }
 
-
-struct nfs4_acl* nfs4_acl_get_fd(int fd)
+/*
+ * Read the packed XDR ACL into caller-provided buffer `buf` without
+ * decoding it. Unlike nfs4_acl_get_file(), an ACL is never synthesized
+ * from the mode; callers of the security namespace build see ENODATA.
+ */
+ssize_t nfs4_acl_get_xattr_file(const char *path, char *buf, size_t bufsz)
 {
-	int result;
-	struct nfs4_acl *acl = NULL;
-	char *xattr = NULL;
-
-	/* find necessary buffer size */
-	fprintf(stderr, "namespace: %s\n", ACL_NFS4_XATTR);
-	result = nfs4_getxattr(NULL, fd, NULL, 0);
-
-#ifdef USE_SECURITY_NAMESPACE
-	if ((result < 0) && (errno == ENODATA)) {
-		return synthesize_acl_from_mode(NULL, fd);
-	}
-	else if (result < 0) {
-		return NULL;
+	if (path == NULL || buf == NULL) {
+		errno = EINVAL;
+		return (-1);
 	}
-#else
-	if (result < 0)
-		return NULL;
-#endif
+	return nfs4_getxattr(path, -1, NULL, buf, bufsz, NULL);
+}
 
-	xattr = malloc(result);
-	if (xattr == NULL) {
-		warnx("Failed to allocate memory");
-		return NULL;
+ssize_t nfs4_acl_get_xattr_fd(int fd, char *buf, size_t bufsz)
+{
+	if (buf == NULL) {
+		errno = EINVAL;
+		return (-1);
 	}
+	return nfs4_getxattr(NULL, fd, NULL, buf, bufsz, NULL);
+}
 
-	/* reconstruct the ACL */
-	result = nfs4_getxattr(NULL, fd, xattr, result);
-	if (result < 0) {
-		free(xattr);
-		return NULL;
+ssize_t nfs4_acl_get_xattr_at(int dirfd, const char *name, char *buf,
+			      size_t bufsz)
+{
+	if (name == NULL || buf == NULL) {
+		errno = EINVAL;
+		return (-1);
 	}
-	acl = do_xattr_load(NULL, fd, xattr, result);
+	return nfs4_getxattr(name, dirfd, NULL, buf, bufsz, NULL);
+}
 
-	free(xattr);
-	return acl;
+/*
+ * Library-internal counterpart of the functions above taking a
+ * (path, fd) pair, see acl_nfs4_at.c. `devp` is set to the device
+ * of the file once its filesystem has been checked, and otherwise to
+ * ACL_NFS4_NODEV, so that a write following the read can skip the
+ * check (and its stat()).
+ */
+ssize_t acl_nfs4_get_xattr(const char *path, int fd, char *buf, size_t bufsz,
+			   dev_t *devp)
+{
+	return nfs4_getxattr(path, fd, NULL, buf, bufsz, devp);
 }
 
-static int nfs4_getxattr(const char *path, int fd, void *value, size_t size)
+static int nfs4_getxattr(const char *path, int fd, const struct stat *st,
+			 void *value, size_t size, dev_t *devp)
 {
 	int res;
+#ifdef USE_SECURITY_NAMESPACE
+	dev_t dev;
+#endif
+
+	if (devp != NULL) {
+		*devp = ACL_NFS4_NODEV;
+	}
 	if ((path == NULL) && (fd == -1)) {
 		errno = EINVAL;
 		return (-1);
 	}
 
 #ifdef USE_SECURITY_NAMESPACE
-	/*
-	 * Security namespace xattr must not be used on paths with
-	 * native NFSv4 ACLs that are exposed by system namespace.
-	 */
-	if (path != NULL) {
-		res = getxattr(path, SYSTEM_XATTR, value, size);
-	}
-	if (fd) {
-		res = fgetxattr(fd, SYSTEM_XATTR, value, size);
-	}
-	if (res != -1) {
-		/*
-		 * Convert errno to ENOSYS so that we avoid
-		 * synthesizing a fake ACL from mode and simply
-		 * fail the nfs4_acl_get_*() call.
-		 */
-		warnx("nfs4xdr-acl-tools is built with option "
-		      "to write to the 'security' xattr namespace, "
-		      "but filesystem uses native NFSv4 ACLs.");
-		errno = ENOSYS;
+	res = acl_nfs4_fs_check(path, fd, st, &dev);
+	if (res != 0) {
 		return (-1);
 	}
+	if (devp != NULL) {
+		*devp = dev;
+	}
 #endif
 
-	if (path != NULL) {
-		res = getxattr(path, ACL_NFS4_XATTR, value, size);
-	}
-	else {
-		res = fgetxattr(fd, ACL_NFS4_XATTR, value, size);
-	}
+	res = acl_nfs4_getxattr(path, fd, ACL_NFS4_XATTR, value, size);
 	if ((res < 0) && (errno != ENODATA)) {
-		warnx("Failed to get NFSv4 ACL");
+		acl_nfs4_log("Failed to get NFSv4 ACL");
+#ifdef USE_SECURITY_NAMESPACE
+		if (!acl_nfs4_fs_errno_expected(errno)) {
+			acl_nfs4_fs_cache_invalidate(dev);
+		}
+#endif
 	}
 	return res;
 }
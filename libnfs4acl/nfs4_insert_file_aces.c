@@ -50,7 +50,7 @@ int nfs4_insert_file_aces(struct nfs4_acl *acl, FILE* fp, unsigned int index)
 	int rv;
 
 	if ((acl_spec = nfs4_acl_spec_from_file(fp)) == NULL) {
-		fprintf(stderr, "Failed to spec_from_file\n");
+		acl_nfs4_log("Failed to spec_from_file");
 		return -1;
 	}
 	rv = nfs4_insert_string_aces(acl, acl_spec, index);
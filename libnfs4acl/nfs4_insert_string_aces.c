@@ -67,7 +67,7 @@ int nfs4_insert_string_aces(struct nfs4_acl *acl, const char *acl_spec, unsigned
 			index++;
 		}
 		if (res != 0) {
-			fprintf(stderr, "failed to get entry from text: %s\n", strerror(errno));
+			acl_nfs4_log("failed to get entry from text: %s", strerror(errno));
 			goto out_failed;
 		}
 	}
@@ -28,9 +28,6 @@
 
 #include <stdio.h>
 #include <ctype.h>
-#include <assert.h>
-#include <sysexits.h>
-#include <err.h>
 #include <sys/stat.h>
 #include <jansson.h>
 #include "nfs4_json.h"
@@ -47,12 +44,33 @@ static json_t
 
 	root = json_loads(text, 0, &error);
 	if (root == NULL) {
-		errx(EX_DATAERR, "JSON error on line %d: %s",
-		     error.line, error.text);
+		acl_nfs4_log("JSON error on line %d: %s",
+			     error.line, error.text);
+		errno = EINVAL;
 	}
 	return root;
 }
 
+/*
+ * Report accumulated validation errors as JSON text and fail with
+ * EINVAL. The invalid ACL will not be applied.
+ */
+static void
+json_verrors_report(json_t *verrors)
+{
+	char *err_txt = NULL;
+
+	err_txt = json_dumps(verrors, 0);
+	if (err_txt == NULL) {
+		acl_nfs4_log("Failed to convert verrors to JSON text");
+	}
+	else {
+		acl_nfs4_log("%s", err_txt);
+		free(err_txt);
+	}
+	errno = EINVAL;
+}
+
 static int
 json_verrors_append(json_t *verrors, char *err_field, char *err_txt)
 {
@@ -60,21 +78,21 @@ json_verrors_append(json_t *verrors, char *err_field, char *err_txt)
 	json_t *verr = NULL;
 
 	if (!json_is_array(verrors)) {
-		warnx("verrors is not an array. Cannot append "
+		acl_nfs4_log("verrors is not an array. Cannot append "
 		      "error: %s for field: %s", err_txt, err_field);
 		return (-1);
 	}
 
 	verr = json_object();
 	if (verr == NULL) {
-		warnx("json_verrors_append(): "
+		acl_nfs4_log("json_verrors_append(): "
 		      "Failed to generate JSON object.");
 		return (-1);
 	}
 
 	error = json_object_set_new(verr, err_field, json_string(err_txt));
 	if (error) {
-		warnx("json_verrors_append(): "
+		acl_nfs4_log("json_verrors_append(): "
 		      "Failed to generate JSON error message for [%s]",
 		      err_txt);
 		json_decref(verr);
@@ -83,7 +101,7 @@ json_verrors_append(json_t *verrors, char *err_field, char *err_txt)
 
 	error = json_array_append_new(verrors, verr);
 	if (error) {
-		warnx("json_verrors_append(): "
+		acl_nfs4_log("json_verrors_append(): "
 		      "Failed to append error message [%s] "
 		      "to JSON error array.",
 		      err_txt);
@@ -120,12 +138,13 @@ json_ace_get_type(json_t *_jsace, int idx, nfs4_acl_type_t *_typep, json_t *_ver
 			error = asprintf(&err_str, "ACE type must be a string.");
 		}
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			return (-1);
 		}
 
 		error = asprintf(&err_field, "acl.%d.type", idx);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			free(err_str);
+			return (-1);
 		}
 
 		error = json_verrors_append(_verrors, err_field, err_str);
@@ -147,12 +166,13 @@ json_ace_get_type(json_t *_jsace, int idx, nfs4_acl_type_t *_typep, json_t *_ver
 	if (!found_type) {
 		error = asprintf(&err_str, "Invalid ACE type: %s", type_str);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			return (-1);
 		}
 
 		error = asprintf(&err_field, "acl.%d.type", idx);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			free(err_str);
+			return (-1);
 		}
 
 		error = json_verrors_append(_verrors, err_field, err_str);
@@ -185,17 +205,18 @@ json_ace_get_perm(json_t *_jsace, int idx, nfs4_acl_perm_t *_perms, json_t *_ver
 			error = asprintf(&err_str, "ACE perms is not a JSON object.");
 		}
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			return (-1);
 		}
 
 		error = asprintf(&err_field, "acl.%d.perms", idx);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			free(err_str);
+			return (-1);
 		}
 
 		error = json_verrors_append(_verrors, err_field, err_str);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			return (-1);
 		}
 
 		return (-EINVAL);
@@ -213,17 +234,18 @@ json_ace_get_perm(json_t *_jsace, int idx, nfs4_acl_perm_t *_perms, json_t *_ver
 		if (!json_is_string(basic)) {
 			error = asprintf(&err_str, "BASIC ACE permset is not a string.");
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				return (-1);
 			}
 
 			error = asprintf(&err_field, "acl.%d.perms", idx);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				free(err_str);
+				return (-1);
 			}
 
 			error = json_verrors_append(_verrors, err_field, err_str);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				return (-1);
 			}
 
 			return (-EINVAL);
@@ -274,12 +296,13 @@ json_ace_get_perm(json_t *_jsace, int idx, nfs4_acl_perm_t *_perms, json_t *_ver
 		if (!json_is_boolean(value)) {
 			error = asprintf(&err_str, "ACE perm [%s] is not boolean.", key);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				return (-1);
 			}
 
 			error = asprintf(&err_field, "acl.%d.perms", idx);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				free(err_str);
+				return (-1);
 			}
 
 			error = json_verrors_append(_verrors, err_field, err_str);
@@ -300,12 +323,13 @@ json_ace_get_perm(json_t *_jsace, int idx, nfs4_acl_perm_t *_perms, json_t *_ver
 		if (!found_key) {
 			error = asprintf(&err_str, "Invalid ACE perm: %s", key);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				return (-1);
 			}
 
 			error = asprintf(&err_field, "acl.%d.perms", idx);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				free(err_str);
+				return (-1);
 			}
 
 			error = json_verrors_append(_verrors, err_field, err_str);
@@ -342,12 +366,13 @@ json_ace_get_flag(json_t *_jsace, int idx, nfs4_acl_flag_t *_flags, json_t *_ver
 			error = asprintf(&err_str, "ACE flags is not a JSON object.");
 		}
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			return (-1);
 		}
 
 		error = asprintf(&err_field, "acl.%d.flags", idx);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			free(err_str);
+			return (-1);
 		}
 
 		error = json_verrors_append(_verrors, err_field, err_str);
@@ -369,12 +394,13 @@ json_ace_get_flag(json_t *_jsace, int idx, nfs4_acl_flag_t *_flags, json_t *_ver
 		if (!json_is_string(basic)) {
 			error = asprintf(&err_str, "BASIC ACE flagset is not a string.");
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				return (-1);
 			}
 
 			error = asprintf(&err_field, "acl.%d.flags", idx);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				free(err_str);
+				return (-1);
 			}
 
 			error = json_verrors_append(_verrors, err_field, err_str);
@@ -395,11 +421,12 @@ json_ace_get_flag(json_t *_jsace, int idx, nfs4_acl_flag_t *_flags, json_t *_ver
 			error = asprintf(&err_str, "Invalid BASIC ACE flag type: %s",
 					 basic_str);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				return (-1);
 			}
 			error = asprintf(&err_field, "acl.%d.flags", idx);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				free(err_str);
+				return (-1);
 			}
 
 			error = json_verrors_append(_verrors, err_field, err_str);
@@ -429,12 +456,13 @@ json_ace_get_flag(json_t *_jsace, int idx, nfs4_acl_flag_t *_flags, json_t *_ver
 		if (!json_is_boolean(value)) {
 			error = asprintf(&err_str, "ACE flag [%s] is not boolean.", key);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				return (-1);
 			}
 
 			error = asprintf(&err_field, "acl.%d.flags", idx);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				free(err_str);
+				return (-1);
 			}
 
 			error = json_verrors_append(_verrors, err_field, err_str);
@@ -454,12 +482,13 @@ json_ace_get_flag(json_t *_jsace, int idx, nfs4_acl_flag_t *_flags, json_t *_ver
 		if (!found_key) {
 			error = asprintf(&err_str, "Invalid ACE flag: %s", key);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				return (-1);
 			}
 
 			error = asprintf(&err_field, "acl.%d.flags", idx);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				free(err_str);
+				return (-1);
 			}
 
 			error = json_verrors_append(_verrors, err_field, err_str);
@@ -483,12 +512,13 @@ json_ace_get_flag(json_t *_jsace, int idx, nfs4_acl_flag_t *_flags, json_t *_ver
 		err_str = strdup("INHERIT_ONLY flag requires additional "
 				 "DIRECTORY_INHERIT or FILE_INHERIT flag.");
 		if (err_str == NULL) {
-			err(EX_OSERR, "strdup() failed");
+			return (-1);
 		}
 
 		error = asprintf(&err_field, "acl.%d.flags", idx);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			free(err_str);
+			return (-1);
 		}
 
 		error = json_verrors_append(_verrors, err_field, err_str);
@@ -525,12 +555,13 @@ json_ace_get_who(json_t *_jsace, int idx, struct nfs4_ace *entry, json_t *_verro
 			error = asprintf(&err_str, "ACE tag is not a string.");
 		}
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			return (-1);
 		}
 
 		error = asprintf(&err_field, "acl.%d.tag", idx);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			free(err_str);
+			return (-1);
 		}
 
 		error = json_verrors_append(_verrors, err_field, err_str);
@@ -571,12 +602,13 @@ json_ace_get_who(json_t *_jsace, int idx, struct nfs4_ace *entry, json_t *_verro
 	else {
 		error = asprintf(&err_str, "ACE tag [%s] is invalid.", tag);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			return (-1);
 		}
 
 		error = asprintf(&err_field, "acl.%d.tag", idx);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			free(err_str);
+			return (-1);
 		}
 
 		error = json_verrors_append(_verrors, err_field, err_str);
@@ -596,12 +628,13 @@ json_ace_get_who(json_t *_jsace, int idx, struct nfs4_ace *entry, json_t *_verro
 	if (jsid && (!json_is_integer(jsid))) {
 		error = asprintf(&err_str, "ACE id is not an integer.");
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			return (-1);
 		}
 
 		error = asprintf(&err_field, "acl.%d.id", idx);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			free(err_str);
+			return (-1);
 		}
 
 		error = json_verrors_append(_verrors, err_field, err_str);
@@ -620,12 +653,13 @@ json_ace_get_who(json_t *_jsace, int idx, struct nfs4_ace *entry, json_t *_verro
 	if (jswho && (!json_is_string(jswho))) {
 		error = asprintf(&err_str, "ACE who is not a string.");
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			return (-1);
 		}
 
 		error = asprintf(&err_field, "acl.%d.who", idx);
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			free(err_str);
+			return (-1);
 		}
 
 		error = json_verrors_append(_verrors, err_field, err_str);
@@ -642,12 +676,13 @@ json_ace_get_who(json_t *_jsace, int idx, struct nfs4_ace *entry, json_t *_verro
 	/* Neither a numerical ID nor name was specified. Return failure. */
 	error = asprintf(&err_str, "ACE principal for [%s] is unspecified.", tag);
 	if (error == -1) {
-		err(EX_OSERR, "asprintf() failed");
+		return (-1);
 	}
 
 	error = asprintf(&err_field, "acl.%d.id", idx);
 	if (error == -1) {
-		err(EX_OSERR, "asprintf() failed");
+		free(err_str);
+		return (-1);
 	}
 
 	error = json_verrors_append(_verrors, err_field, err_str);
@@ -681,12 +716,13 @@ get_aclflags_from_json(json_t *_jsacl, nfs4_acl_aclflags_t *_aclflags, json_t *_
 		}
 		error = asprintf(&err_str, "'nfs41_flags' field must be JSON object.");
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			return (-1);
 		}
 
 		error = asprintf(&err_field, "acl.nfs41_flags");
 		if (error == -1) {
-			err(EX_OSERR, "asprintf() failed");
+			free(err_str);
+			return (-1);
 		}
 
 		error = json_verrors_append(_verrors, err_field, err_str);
@@ -709,12 +745,13 @@ get_aclflags_from_json(json_t *_jsacl, nfs4_acl_aclflags_t *_aclflags, json_t *_
 		if (!json_is_boolean(value)) {
 			error = asprintf(&err_str, "ACL flag [%s] is not boolean.", key);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				return (-1);
 			}
 
 			error = asprintf(&err_field, "acl.nfs41_flags");
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				free(err_str);
+				return (-1);
 			}
 
 			error = json_verrors_append(_verrors, err_field, err_str);
@@ -735,12 +772,13 @@ get_aclflags_from_json(json_t *_jsacl, nfs4_acl_aclflags_t *_aclflags, json_t *_
 		if (!found_key) {
 			error = asprintf(&err_str, "Invalid ACL flag: %s", key);
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				return (-1);
 			}
 
 			error = asprintf(&err_field, "acl.nfs41_flags");
 			if (error == -1) {
-				err(EX_OSERR, "asprintf() failed");
+				free(err_str);
+				return (-1);
 			}
 
 			error = json_verrors_append(_verrors, err_field, err_str);
@@ -769,7 +807,9 @@ struct nfs4_ace
 	    NFS4_ACL_WHO_OWNER,
 	    -1);
 
-	assert(out != NULL);
+	if (out == NULL) {
+		return (NULL);
+	}
 
 	error = json_ace_get_type(_jsace, idx, &out->type, _verrors);
 	if (error && (error != -EINVAL)) {
@@ -816,63 +856,66 @@ struct nfs4_acl
 	size_t nsaces;
 	int i, error;
 
+	js_aces = json_object_get(json_acl, "acl");
+	if (!json_is_array(js_aces)) {
+		acl_nfs4_log("{\"acl\": \"ACES array not found\"}");
+		errno = EINVAL;
+		return (NULL);
+	}
+
 	out = nfs4_new_acl(is_dir);
 	if (out == NULL) {
-		errx(EX_OSERR, "nfs4_new_acl() failed");
+		acl_nfs4_log("nfs4_new_acl() failed");
+		return (NULL);
 	}
 
 	verrors = json_array();
-	if (!json_is_array(verrors)) {
-		err(EX_OSERR, "Failed to generate JSON array for verrors");
-	}
-
-	js_aces = json_object_get(json_acl, "acl");
-	if (!json_is_array(js_aces)) {
-		warnx("{\"acl\": \"ACES array not found\"}");
-		return (NULL);
+	if (verrors == NULL) {
+		acl_nfs4_log("Failed to generate JSON array for verrors");
+		goto fail;
 	}
 
 	nsaces = json_array_size(js_aces);
 	for (i = 0; i < nsaces; i++) {
 		json_t *jsace = json_array_get(js_aces, i);
 		if (!json_is_object(jsace)) {
-			errx(EX_OSERR, "json_array_get() failed for idx %d", i);
+			acl_nfs4_log("json_array_get() failed for idx %d", i);
+			errno = EINVAL;
+			goto fail;
 		}
 		ace = convert_json_to_ace(jsace, is_dir, i, verrors);
 		if (ace == NULL) {
 			if (json_array_size(verrors) != 0) {
 				continue;
 			}
-			return (NULL);
+			goto fail;
 		}
 		error = nfs4_append_ace(out, ace);
 		if (error) {
-			errx(EX_OSERR, "Failed to add entry %d to ACL", i);
+			acl_nfs4_log("Failed to add entry %d to ACL", i);
+			free(ace);
+			goto fail;
 		}
 	}
 
 	error = get_aclflags_from_json(json_acl, &out->aclflags4, verrors);
 	if (error && (error != -EINVAL)) {
-		errx(EX_OSERR, "(get_aclflags_from_json() failed.");
+		acl_nfs4_log("get_aclflags_from_json() failed.");
+		goto fail;
 	}
 
 	if (json_array_size(verrors) > 0) {
-		/*
-		 * We have some validation errors.
-		 * Print them to stderr as JSON and exit.
-		 * Invalid ACL will not be applied.
-		 */
-		char *err_txt = NULL;
-		err_txt = json_dumps(verrors, 0);
-		if (err_txt == NULL) {
-			json_decref(json_acl);
-			warnx("Failed to convert verrors to JSON text");
-			return (NULL);
-		}
-		errx(EX_DATAERR, "%s", err_txt);
+		json_verrors_report(verrors);
+		goto fail;
 	}
 
+	json_decref(verrors);
 	return out;
+
+fail:
+	json_decref(verrors);
+	nfs4_free_acl(out);
+	return (NULL);
 }
 
 struct nfs4_acl
@@ -882,12 +925,206 @@ struct nfs4_acl
 	json_t *json_acl = NULL;
 
 	json_acl = load_json(json_text);
+	if (json_acl == NULL) {
+		return (NULL);
+	}
 	newacl = convert_json_to_acl(json_acl, is_dir);
 	json_decref(json_acl);
 
 	return (newacl);
 }
 
+static int
+json_edit_get_ace(json_t *_jsedit, const char *key, bool is_dir, int idx,
+		  struct nfs4_ace *out, json_t *_verrors)
+{
+	struct nfs4_ace *ace = NULL;
+	json_t *jsace = NULL;
+	char *err_str = NULL, *err_field = NULL;
+	int error;
+
+	jsace = json_object_get(_jsedit, key);
+	if (!json_is_object(jsace)) {
+		error = asprintf(&err_str, "Entry [%s] is missing or not an object.", key);
+		if (error == -1) {
+			return (-1);
+		}
+
+		error = asprintf(&err_field, "edits.%d.%s", idx, key);
+		if (error == -1) {
+			free(err_str);
+			return (-1);
+		}
+
+		error = json_verrors_append(_verrors, err_field, err_str);
+		if (error) {
+			return (error);
+		}
+		return (-EINVAL);
+	}
+
+	ace = convert_json_to_ace(jsace, is_dir, idx, _verrors);
+	if (ace == NULL) {
+		return (json_array_size(_verrors) != 0) ? -EINVAL : -1;
+	}
+	*out = *ace;
+	free(ace);
+	return (0);
+}
+
+static int
+json_edit_get_op(json_t *_jsedit, int idx, struct nfs4_acl_edit *e,
+		 json_t *_verrors)
+{
+	json_t *jsop = NULL, *jsindex = NULL;
+	char *err_str = NULL, *err_field = NULL;
+	const char *op = NULL;
+	int error;
+
+	jsop = json_object_get(_jsedit, "op");
+	jsindex = json_object_get(_jsedit, "index");
+	op = json_string_value(jsop);
+
+	if (op != NULL && strcmp(op, "insert") == 0) {
+		e->op = NFS4_ACL_EDIT_INSERT;
+	} else if (op != NULL && strcmp(op, "delete") == 0) {
+		e->op = NFS4_ACL_EDIT_DELETE;
+	} else if (op != NULL && strcmp(op, "modify") == 0) {
+		e->op = NFS4_ACL_EDIT_MODIFY;
+	} else {
+		error = asprintf(&err_str, "Invalid edit operation.");
+		if (error == -1) {
+			return (-1);
+		}
+		error = asprintf(&err_field, "edits.%d.op", idx);
+		if (error == -1) {
+			free(err_str);
+			return (-1);
+		}
+		error = json_verrors_append(_verrors, err_field, err_str);
+		if (error) {
+			return (error);
+		}
+		return (-EINVAL);
+	}
+
+	if (!json_is_integer(jsindex) ||
+	    (json_integer_value(jsindex) < 0) ||
+	    (json_integer_value(jsindex) > NFS41ACLMAXACES)) {
+		error = asprintf(&err_str, "Index must be an integer between 0 and %d.",
+				 NFS41ACLMAXACES);
+		if (error == -1) {
+			return (-1);
+		}
+		error = asprintf(&err_field, "edits.%d.index", idx);
+		if (error == -1) {
+			free(err_str);
+			return (-1);
+		}
+		error = json_verrors_append(_verrors, err_field, err_str);
+		if (error) {
+			return (error);
+		}
+		return (-EINVAL);
+	}
+	e->index = json_integer_value(jsindex);
+	return (0);
+}
+
+/*
+ * Parse the JSON form produced by _nfs4_acl_diff_to_json().
+ */
+struct nfs4_acl_diff
+*get_acl_diff_json(const char *json_text, bool is_dir)
+{
+	struct nfs4_acl_diff *out = NULL;
+	struct nfs4_acl_edit e;
+	json_t *json_diff = NULL, *js_edits = NULL, *verrors = NULL;
+	size_t nedits;
+	int i, error;
+
+	json_diff = load_json(json_text);
+	if (json_diff == NULL) {
+		return (NULL);
+	}
+
+	js_edits = json_object_get(json_diff, "edits");
+	if (!json_is_array(js_edits)) {
+		acl_nfs4_log("{\"edits\": \"edits array not found\"}");
+		json_decref(json_diff);
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	out = nfs4_acl_diff_new();
+	if (out == NULL) {
+		acl_nfs4_log("nfs4_acl_diff_new() failed");
+		json_decref(json_diff);
+		return (NULL);
+	}
+
+	verrors = json_array();
+	if (verrors == NULL) {
+		acl_nfs4_log("Failed to generate JSON array for verrors");
+		goto fail;
+	}
+
+	nedits = json_array_size(js_edits);
+	for (i = 0; i < nedits; i++) {
+		json_t *jsedit = json_array_get(js_edits, i);
+		if (!json_is_object(jsedit)) {
+			acl_nfs4_log("json_array_get() failed for idx %d", i);
+			errno = EINVAL;
+			goto fail;
+		}
+		memset(&e, 0, sizeof(e));
+		error = json_edit_get_op(jsedit, i, &e, verrors);
+		if (!error && (e.op != NFS4_ACL_EDIT_INSERT)) {
+			error = json_edit_get_ace(jsedit, "old", is_dir, i,
+						  &e.old_ace, verrors);
+		}
+		if (!error && (e.op != NFS4_ACL_EDIT_DELETE)) {
+			error = json_edit_get_ace(jsedit, "new", is_dir, i,
+						  &e.new_ace, verrors);
+		}
+		if (error == -EINVAL) {
+			continue;
+		}
+		if (error) {
+			goto fail;
+		}
+		error = nfs4_acl_diff_append(out, &e);
+		if (error) {
+			acl_nfs4_log("Failed to add edit %d to ACL diff", i);
+			goto fail;
+		}
+	}
+
+	if (json_object_get(json_diff, "nfs41_flags") != NULL) {
+		error = get_aclflags_from_json(json_diff, &out->aclflags4, verrors);
+		if (error && (error != -EINVAL)) {
+			acl_nfs4_log("get_aclflags_from_json() failed.");
+			goto fail;
+		}
+		out->set_aclflags = true;
+	}
+
+	if (json_array_size(verrors) > 0) {
+		json_verrors_report(verrors);
+		goto fail;
+	}
+
+	json_decref(verrors);
+	json_decref(json_diff);
+	return (out);
+
+fail:
+	json_decref(verrors);
+	json_decref(json_diff);
+	nfs4_acl_diff_free(out);
+	return (NULL);
+}
+
 int
 set_acl_path_json(const char *path, const char *json_text)
 {
@@ -897,7 +1134,8 @@ set_acl_path_json(const char *path, const char *json_text)
 
 	error = stat(path, &st);
 	if (error) {
-		errx(EX_OSERR, "%s: stat() failed: %s", path, strerror(errno));
+		acl_nfs4_log("%s: stat() failed: %s", path, strerror(errno));
+		return (-1);
 	}
 
 	newacl = get_acl_json(json_text, S_ISDIR(st.st_mode));
@@ -906,5 +1144,6 @@ set_acl_path_json(const char *path, const char *json_text)
 	}
 
 	error = nfs4_acl_set_file(newacl, path);
+	nfs4_free_acl(newacl);
 	return (error);
 }
@@ -48,11 +48,17 @@ nfs4_new_acl(u32 is_dir)
 	if ((acl = malloc(sizeof(*acl))) == NULL)
 		return NULL;
 
+	if ((acl->entries = malloc(sizeof(*acl->entries))) == NULL) {
+		free(acl);
+		return NULL;
+	}
+
 	acl->naces = 0;
 	acl->aclflags4 = 0;
 	acl->is_directory = is_dir;
+	acl->entries->refcnt = 1;
 
-	TAILQ_INIT(&acl->ace_head);
+	TAILQ_INIT(&acl->entries->head);
 
 	return acl;
 }
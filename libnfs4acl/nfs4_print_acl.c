@@ -63,7 +63,7 @@ void nfs4_print_acl(FILE *fp, struct nfs4_acl *acl)
 	char *acl_text = NULL;
 	acl_text = _nfs4_acl_to_text_np(acl, 0, 0);
 	if (!acl_text) {
-		fprintf(stderr, "Failed to convert ACL to text\n");
+		acl_nfs4_log("Failed to convert ACL to text");
 		return;
 	}
 	fprintf(fp, "%s\n", acl_text);
@@ -28,12 +28,17 @@
 
 #include <stdio.h>
 #include <sys/stat.h>
-#include <err.h>
+#include <fcntl.h>
 #include <jansson.h>
 #include "libacl_nfs4.h"
 
-int
-nfs4_print_acl_json(char *path, int flags)
+/*
+ * `path` is printed. The file is accessed through `path` if `dirfd`
+ * is -1, and otherwise through `name` relative to `dirfd` without
+ * following symbolic links.
+ */
+static int
+print_acl_json(int dirfd, const char *name, const char *path, int flags)
 {
 	struct nfs4_acl *acl = NULL;
 	char *acl_text = NULL;
@@ -41,18 +46,28 @@ nfs4_print_acl_json(char *path, int flags)
 	json_t *json_acl = NULL;
 	int error, is_trivial;
 
-	acl = nfs4_acl_get_file(path);
+	if (dirfd == -1) {
+		acl = nfs4_acl_get_file(path);
+	}
+	else {
+		acl = nfs4_acl_get_at(dirfd, name);
+	}
 	if (acl == NULL) {
 		return (-1);
 	}
 	error = nfs4_acl_is_trivial_np(acl, &is_trivial);
 	if (error) {
 		nfs4_free_acl(acl);
-		warnx("acl_is_trivial() failed\n");
+		acl_nfs4_log("acl_is_trivial() failed");
 		return (-1);
 	}
 
-	error = stat(path, &st);
+	if (dirfd == -1) {
+		error = stat(path, &st);
+	}
+	else {
+		error = fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW);
+	}
 	if (error) {
 		nfs4_free_acl(acl);
 		return (-1);
@@ -60,8 +75,8 @@ nfs4_print_acl_json(char *path, int flags)
 
 	json_acl = _nfs4_acl_to_json(acl, flags);
 	if (json_acl == NULL) {
-		warnx("Failed to convert NFSv4 ACL to JSON: %s",
-		      strerror(errno));
+		acl_nfs4_log("Failed to convert NFSv4 ACL to JSON: %s",
+			     strerror(errno));
 		nfs4_free_acl(acl);
 		return (-1);
 	}
@@ -72,7 +87,7 @@ nfs4_print_acl_json(char *path, int flags)
 	    json_boolean(is_trivial ? true : false));
 	if (error) {
 		json_decref(json_acl);
-		warnx("acl_is_trivial() failed");
+		acl_nfs4_log("failed to add trivial to JSON output");
 		return (error);
 	}
 
@@ -81,7 +96,7 @@ nfs4_print_acl_json(char *path, int flags)
 	    json_integer(st.st_uid));
 	if (error) {
 		json_decref(json_acl);
-		warnx("failed to add uid to JSON output");
+		acl_nfs4_log("failed to add uid to JSON output");
 		return (error);
 	}
 
@@ -90,7 +105,7 @@ nfs4_print_acl_json(char *path, int flags)
 	    json_integer(st.st_gid));
 	if (error) {
 		json_decref(json_acl);
-		warnx("failed to add gid to JSON output");
+		acl_nfs4_log("failed to add gid to JSON output");
 		return (error);
 	}
 
@@ -99,14 +114,14 @@ nfs4_print_acl_json(char *path, int flags)
 	    json_string(path));
 	if (error) {
 		json_decref(json_acl);
-		warnx("failed to add path to JSON output");
+		acl_nfs4_log("failed to add path to JSON output");
 		return (error);
 	}
 
 	acl_text = json_dumps(json_acl, 0);
 	if (acl_text == NULL) {
 		json_decref(json_acl);
-		warnx("Failed to convert ACL to JSON text");
+		acl_nfs4_log("Failed to convert ACL to JSON text");
 		return (error);
 	}
 
@@ -115,3 +130,24 @@ nfs4_print_acl_json(char *path, int flags)
 	free(acl_text);
 	return (0);
 }
+
+int
+nfs4_print_acl_json(char *path, int flags)
+{
+	return (print_acl_json(-1, NULL, path, flags));
+}
+
+/*
+ * Print the ACL of `name` in directory `dirfd` as JSON, reporting it
+ * as `path`. Symbolic links are not followed.
+ */
+int
+nfs4_print_acl_json_at(int dirfd, const char *name, const char *path,
+		       int flags)
+{
+	if ((name == NULL) || (path == NULL)) {
+		errno = EINVAL;
+		return (-1);
+	}
+	return (print_acl_json(dirfd, name, path, flags));
+}
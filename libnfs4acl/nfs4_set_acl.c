@@ -36,46 +36,54 @@
 #include <err.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <arpa/inet.h>
 #include "libacl_nfs4.h"
 
 
-int nfs4_acl_set_file(struct nfs4_acl *acl, const char *path)
+/*
+ * `dev` is ACL_NFS4_NODEV, or the device of the file if the caller
+ * just read its ACL with acl_nfs4_get_xattr(), which already checked
+ * the filesystem.
+ */
+static int nfs4_setxattr(const char *path, int fd, dev_t dev,
+			 const void *value, size_t size)
 {
-	size_t acl_size = 0;
-	char *xdrbuf = NULL;
 	int res;
 
-	acl_size = acl_nfs4_xattr_pack(acl, &xdrbuf);
-	if (acl_size < ACES_2_XDRSIZE(1)) {
-		free(xdrbuf);
+	if ((path == NULL) && (fd == -1)) {
+		errno = EINVAL;
 		return (-1);
 	}
 
 #ifdef USE_SECURITY_NAMESPACE
 	/*
-	 * Check for system ACL and fail hard if
-	 * it exists.
+	 * Fail hard if filesystem has native NFSv4 ACLs. The answer is
+	 * cached per filesystem, see acl_nfs4_fs_check().
 	 */
-	res = getxattr(path, SYSTEM_XATTR, NULL, 0);
-	if (res != -1) {
-		warnx("nfs4xdr-acl-tools is built with option "
-		      "to write to the 'security' xattr namespace, "
-		      "but filesystem uses native NFSv4 ACLs.");
-		free(xdrbuf);
-		errno = ENOSYS;
-		return (-1);
+	if (dev == ACL_NFS4_NODEV) {
+		res = acl_nfs4_fs_check(path, fd, NULL, &dev);
+		if (res != 0) {
+			return (-1);
+		}
 	}
 
-	res = setxattr(path, ACL_NFS4_XATTR, xdrbuf, acl_size, 0);
+	res = acl_nfs4_setxattr(path, fd, ACL_NFS4_XATTR, value, size, 0);
+	if ((res != 0) && !acl_nfs4_fs_errno_expected(errno)) {
+		acl_nfs4_fs_cache_invalidate(dev);
+	}
 #else
-	res = setxattr(path, ACL_NFS4_XATTR, xdrbuf, acl_size, XATTR_REPLACE);
+	/*
+	 * If system namespace is used and filesystem supports native
+	 * NFSv4 ACLs, then absence of xattr is significant error
+	 * condition and we should fail with ENODATA.
+	 */
+	res = acl_nfs4_setxattr(path, fd, ACL_NFS4_XATTR, value, size,
+				XATTR_REPLACE);
 #endif
-	free(xdrbuf);
 	return (res);
 }
 
-
-int nfs4_acl_set_fd(struct nfs4_acl *acl, int fd)
+static int nfs4_acl_set(struct nfs4_acl *acl, const char *path, int fd)
 {
 	size_t acl_size = 0;
 	char *xdrbuf = NULL;
@@ -87,30 +95,312 @@ int nfs4_acl_set_fd(struct nfs4_acl *acl, int fd)
 		return (-1);
 	}
 
+	res = nfs4_setxattr(path, fd, ACL_NFS4_NODEV, xdrbuf, acl_size);
+	free(xdrbuf);
+	return (res);
+}
+
+int nfs4_acl_set_file(struct nfs4_acl *acl, const char *path)
+{
+	return nfs4_acl_set(acl, path, -1);
+}
+
+int nfs4_acl_set_fd(struct nfs4_acl *acl, int fd)
+{
+	return nfs4_acl_set(acl, NULL, fd);
+}
+
+/*
+ * Set the ACL of `name` in directory `dirfd`. Symbolic links are not
+ * followed.
+ */
+int nfs4_acl_set_at(struct nfs4_acl *acl, int dirfd, const char *name)
+{
+	if (name == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	return nfs4_acl_set(acl, name, dirfd);
+}
+
+static int nfs4_acl_set_xattr(const char *path, int fd, const char *buf,
+			      size_t size)
+{
+	if ((buf == NULL) || !XDRSIZE_IS_VALID(size) ||
+	    (size > ACES_2_XDRSIZE(NFS41ACLMAXACES))) {
+		errno = EINVAL;
+		return (-1);
+	}
+	return nfs4_setxattr(path, fd, ACL_NFS4_NODEV, buf, size);
+}
+
+/*
+ * Write a packed XDR ACL, for instance one read with
+ * nfs4_acl_get_xattr_file(), without decoding it first. Only the size
+ * of `buf` is checked.
+ */
+int nfs4_acl_set_xattr_file(const char *path, const char *buf, size_t size)
+{
+	if (path == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	return nfs4_acl_set_xattr(path, -1, buf, size);
+}
+
+int nfs4_acl_set_xattr_fd(int fd, const char *buf, size_t size)
+{
+	return nfs4_acl_set_xattr(NULL, fd, buf, size);
+}
+
+int nfs4_acl_set_xattr_at(int dirfd, const char *name, const char *buf,
+			  size_t size)
+{
+	if (name == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	return nfs4_acl_set_xattr(name, dirfd, buf, size);
+}
+
+/*
+ * Compare two packed ACLs. Kernel-maintained ACL flags such as
+ * ACL_IS_TRIVIAL are ignored, since they are not part of what we write.
+ */
+static bool xdr_acl_is_equal(const char *a, size_t a_size,
+			     const char *b, size_t b_size)
+{
+	if ((a_size != b_size) || !XDRSIZE_IS_VALID(a_size)) {
+		return false;
+	}
+	if ((ntohl(*(u32 *)a) & ACL_FLAGS_ALL) !=
+	    (ntohl(*(u32 *)b) & ACL_FLAGS_ALL)) {
+		return false;
+	}
+	return (memcmp(a + sizeof (u32), b + sizeof (u32),
+		       a_size - sizeof (u32)) == 0);
+}
+
+/*
+ * Decode the current ACL and compare it semantically with `acl`.
+ */
+static bool xdr_acl_is_equivalent(struct nfs4_acl *acl, char *cur,
+				  size_t cur_size)
+{
+	struct nfs4_acl *cur_acl = NULL;
+	bool ok;
+
+	cur_acl = acl_nfs4_xattr_load(cur, cur_size, acl->is_directory);
+	if (cur_acl == NULL) {
+		return false;
+	}
+	ok = nfs4_acl_equivalent(acl, cur_acl);
+	nfs4_free_acl(cur_acl);
+	return ok;
+}
+
+static int nfs4_acl_set_if_changed(struct nfs4_acl *acl, const char *path,
+				   int fd, int flags, bool *writtenp)
+{
+	char new[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+	char cur[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+	size_t new_size;
+	ssize_t cur_size;
+	dev_t dev;
+	int res;
+
+	if (writtenp != NULL) {
+		*writtenp = false;
+	}
+
+	new_size = acl_nfs4_xattr_pack_buf(acl, new, sizeof(new));
+	if ((new_size == (size_t)-1) || (new_size < ACES_2_XDRSIZE(1))) {
+		if (errno == ERANGE) {
+			errno = E2BIG;
+		}
+		return (-1);
+	}
+
+	/*
+	 * Any failure to read the current ACL (for instance ENODATA in
+	 * the security namespace build) simply means we write.
+	 */
+	cur_size = acl_nfs4_get_xattr(path, fd, cur, sizeof(cur), &dev);
+	if ((cur_size > 0) && xdr_acl_is_equal(cur, cur_size, new, new_size)) {
+		return (0);
+	}
+	if ((cur_size > 0) && (flags & NFS4_ACL_SET_EQUIVALENT) &&
+	    xdr_acl_is_equivalent(acl, cur, cur_size)) {
+		return (0);
+	}
+
+	if (flags & NFS4_ACL_SET_DRY_RUN) {
+		if (writtenp != NULL) {
+			*writtenp = true;
+		}
+		return (0);
+	}
+	res = nfs4_setxattr(path, fd, dev, new, new_size);
+	if ((res == 0) && (writtenp != NULL)) {
+		*writtenp = true;
+	}
+	return (res);
+}
+
+/*
+ * Same as nfs4_acl_set_file(), but first reads the ACL currently on
+ * `path` and skips the setxattr() if it already matches `acl`. With
+ * NFS4_ACL_SET_EQUIVALENT in `flags`, an ACL that differs but grants the
+ * same access (see nfs4_acl_equivalent()) is also left alone. If
+ * `writtenp` is not NULL, it is set to whether the ACL was written.
+ * With NFS4_ACL_SET_DRY_RUN nothing is written, and `writtenp` tells
+ * whether it would have been.
+ */
+int nfs4_acl_set_file_if_changed(struct nfs4_acl *acl, const char *path,
+				 int flags, bool *writtenp)
+{
+	if (path == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	return nfs4_acl_set_if_changed(acl, path, -1, flags, writtenp);
+}
+
+int nfs4_acl_set_fd_if_changed(struct nfs4_acl *acl, int fd, int flags,
+			       bool *writtenp)
+{
+	return nfs4_acl_set_if_changed(acl, NULL, fd, flags, writtenp);
+}
+
+int nfs4_acl_set_at_if_changed(struct nfs4_acl *acl, int dirfd,
+			       const char *name, int flags, bool *writtenp)
+{
+	if (name == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	return nfs4_acl_set_if_changed(acl, name, dirfd, flags, writtenp);
+}
+
+static int nfs4_acl_set_trivial(const char *path, int fd, mode_t mode)
+{
+	const struct nfs4_trivial_acl *t = acl_nfs4_get_trivial(mode);
+
+	return nfs4_setxattr(path, fd, ACL_NFS4_NODEV, t->xdr, t->xdrsize);
+}
+
+/*
+ * Replace the ACL with the trivial ACL for `mode`. The XDR blob comes
+ * straight from the precomputed table, so this costs a single
+ * setxattr() and no allocations.
+ */
+int nfs4_acl_set_trivial_file(const char *path, mode_t mode)
+{
+	return nfs4_acl_set_trivial(path, -1, mode);
+}
+
+int nfs4_acl_set_trivial_fd(int fd, mode_t mode)
+{
+	return nfs4_acl_set_trivial(NULL, fd, mode);
+}
+
+static int nfs4_acl_strip(const char *path, int fd, int flags,
+			  bool *writtenp)
+{
+	char xattr[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+	const struct nfs4_trivial_acl *t = NULL;
+	mode_t mode = 0;
+	ssize_t size;
+	dev_t dev;
+	int error;
+#ifdef USE_SECURITY_NAMESPACE
+	struct stat st;
+#endif
+
+	if (writtenp != NULL) {
+		*writtenp = false;
+	}
+
+	size = acl_nfs4_get_xattr(path, fd, xattr, sizeof(xattr), &dev);
+
 #ifdef USE_SECURITY_NAMESPACE
 	/*
-	 * Check for system ACL and fail hard if
-	 * it exists.
+	 * No ACL has been written yet. The ACL that would be synthesized
+	 * from the mode is already trivial, so write that one.
 	 */
-	res = fgetxattr(fd, SYSTEM_XATTR, NULL, 0);
-	if (res != -1) {
-		warnx("nfs4xdr-acl-tools is built with option "
-		      "to write to the 'security' xattr namespace, "
-		      "but filesystem uses native NFSv4 ACLs.");
-		free(xdrbuf);
-		errno = ENOSYS;
+	if ((size < 0) && (errno == ENODATA)) {
+		error = acl_nfs4_stat(path, fd, &st);
+		if (error) {
+			return (-1);
+		}
+		t = acl_nfs4_get_trivial(st.st_mode);
+		goto write;
+	}
+#endif
+	if (size < 0) {
+		if (errno == ERANGE) {
+			errno = E2BIG;
+		}
 		return (-1);
 	}
-	res = fsetxattr(fd, ACL_NFS4_XATTR, xdrbuf, acl_size, 0);
-#else
+
+	if (!acl_nfs4_xattr_mode(xattr, size, &mode)) {
+		return (-1);
+	}
+
 	/*
-	 * If system namespace is used and filesystem supports native
-	 * NFSv4 ACLs, then absence of xattr is significant error
-	 * condition and we should fail with ENODATA.
+	 * Skip the write if the ACL is already in stripped form and
+	 * carries no ACL flags that stripping would clear.
 	 */
-	res = fsetxattr(fd, ACL_NFS4_XATTR, xdrbuf, acl_size, XATTR_REPLACE);
+	t = acl_nfs4_get_trivial(mode);
+	if (xdr_acl_is_equal(xattr, size, (const char *)t->xdr, t->xdrsize)) {
+		return (0);
+	}
+
+#ifdef USE_SECURITY_NAMESPACE
+write:
 #endif
+	if (flags & NFS4_ACL_SET_DRY_RUN) {
+		if (writtenp != NULL) {
+			*writtenp = true;
+		}
+		return (0);
+	}
+	error = nfs4_setxattr(path, fd, dev, t->xdr, t->xdrsize);
+	if ((error == 0) && (writtenp != NULL)) {
+		*writtenp = true;
+	}
+	return (error);
+}
 
-	free(xdrbuf);
-	return res;
+/*
+ * Replace the ACL on `path` with its stripped (trivial) form. The
+ * current ACL is read into a stack buffer and evaluated in its packed
+ * form, so the whole operation runs without heap allocations. Nothing
+ * is written if the ACL is already stripped. If `writtenp` is not
+ * NULL, it is set to whether the ACL was written, or with
+ * NFS4_ACL_SET_DRY_RUN in `flags`, whether it would have been.
+ */
+int nfs4_acl_strip_file(const char *path, int flags, bool *writtenp)
+{
+	if (path == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	return nfs4_acl_strip(path, -1, flags, writtenp);
+}
+
+int nfs4_acl_strip_fd(int fd, int flags, bool *writtenp)
+{
+	return nfs4_acl_strip(NULL, fd, flags, writtenp);
+}
+
+int nfs4_acl_strip_at(int dirfd, const char *name, int flags,
+		      bool *writtenp)
+{
+	if (name == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	return nfs4_acl_strip(name, dirfd, flags, writtenp);
 }
@@ -38,10 +38,15 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <getopt.h>
+#include <limits.h>
 #include "libacl_nfs4.h"
 
+#define	GETFACL_JOBS_MAX	256
+#define	GETFACL_URING_DEPTH	64
+
 static void usage(int);
 static void more_help();
 static char *execname;
@@ -52,25 +57,42 @@ static struct option long_options[] = {
         { "verbose",            0, 0, 'v' },
         { "quiet",              0, 0, 'q' },
         { "json",               0, 0, 'j' },
+        { "diff",               0, 0, 'd' },
+        { "recursive",          0, 0, 'R' },
+        { "order",              1, 0, 'o' },
+        { "max-ops",            1, 0, 'O' },
+        { "jobs",               1, 0, 'J' },
         { NULL,                 0, 0, 0,  },
 };
 
-static int print_acl_path(char *path, int flags, bool quiet)
+struct getfacl_args {
+	int	flags;
+	bool	quiet;
+	bool	json;
+	int	error;
+};
+
+/*
+ * Print `acl`, read from `path`. If `dirfd` is not -1 the file is
+ * accessed as `name` relative to `dirfd` without following symbolic
+ * links. `acl` is freed.
+ */
+static int print_acl(struct nfs4_acl *acl, int dirfd, const char *name,
+		     const char *path, int flags, bool quiet)
 {
-	struct nfs4_acl *acl = NULL;
 	char *acl_text = NULL;
 	struct stat st;
 	int error, trivial;
 	bool ok;
 	char *aclflags = NULL;
 
-	acl = nfs4_acl_get_file(path);
-	if (acl == NULL) {
-		return (-1);
-	}
-
 	if (!quiet) {
-		error = stat(path, &st);
+		if (dirfd == -1) {
+			error = stat(path, &st);
+		}
+		else {
+			error = fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW);
+		}
 		if (error) {
 			nfs4_free_acl(acl);
 			return (-1);
@@ -109,16 +131,219 @@ static int print_acl_path(char *path, int flags, bool quiet)
 	return (0);
 }
 
+/*
+ * Print the ACL of `path`. If `dirfd` is not -1 the file is accessed
+ * as `name` relative to `dirfd` without following symbolic links.
+ */
+static int print_acl_path(int dirfd, const char *name, const char *path,
+			  int flags, bool quiet)
+{
+	struct nfs4_acl *acl = NULL;
+
+	if (dirfd == -1) {
+		acl = nfs4_acl_get_file(path);
+	}
+	else {
+		acl = nfs4_acl_get_at(dirfd, name);
+	}
+	if (acl == NULL) {
+		return (-1);
+	}
+	return print_acl(acl, dirfd, name, path, flags, quiet);
+}
+
+/*
+ * Print the ACLs of `n` paths in order. They are read in one batch,
+ * by `jobs` threads at once, so that the latency of a remote or busy
+ * file system is paid once per batch rather than once per path. Each
+ * thread keeps GETFACL_URING_DEPTH reads in flight where io_uring is
+ * available.
+ */
+static int print_acl_paths(char **paths, int n, unsigned int jobs,
+			   int flags, bool quiet)
+{
+	struct nfs4_acl_ctx *ctx = NULL;
+	struct nfs4_acl **acls = NULL;
+	int *errors = NULL;
+	int i, error, carried_error = 0;
+
+	ctx = nfs4_acl_ctx_new(NULL);
+	acls = calloc(n, sizeof(struct nfs4_acl *));
+	errors = calloc(n, sizeof(int));
+	if ((ctx == NULL) || (acls == NULL) || (errors == NULL)) {
+		fprintf(stderr, "%s: %s\n", execname, strerror(errno));
+		carried_error = -1;
+		goto out;
+	}
+
+	/* Without io_uring the batch is read with synchronous syscalls */
+	nfs4_acl_ctx_set_uring(ctx, GETFACL_URING_DEPTH);
+
+	/* The calling thread takes part in the batch */
+	if (jobs > n) {
+		jobs = n;
+	}
+	if ((jobs > 1) && nfs4_acl_ctx_set_workers(ctx, jobs - 1) != 0) {
+		fprintf(stderr, "%s: failed to start %u threads: %s\n",
+			execname, jobs, strerror(errno));
+		carried_error = -1;
+		goto out;
+	}
+
+	nfs4_acl_get_many(ctx, (const char *const *)paths, n, acls, errors);
+	for (i = 0; i < n; i++) {
+		if (acls[i] == NULL) {
+			fprintf(stderr, "%s: failed to get ACL: %s\n", paths[i],
+				strerror(errors[i]));
+			carried_error = -1;
+			continue;
+		}
+		error = print_acl(acls[i], -1, NULL, paths[i], flags, quiet);
+		if (error) {
+			carried_error = error;
+		}
+	}
+out:
+	nfs4_acl_ctx_free(ctx);
+	free(acls);
+	free(errors);
+	return (carried_error);
+}
+
+/*
+ * Symbolic links below the root are not followed. Outside of JSON
+ * output the walk reads the ACLs ahead; an entry whose ACL could not
+ * be read that way is read again here so that the error is reported.
+ */
+static int print_acl_entry(struct nfs4_acl_walk_entry *e, void *arg)
+{
+	struct getfacl_args *args = arg;
+	int error;
+
+	if (e->type == NFS4_ACL_WALK_SYMLINK) {
+		return (0);
+	}
+	if (args->json) {
+		error = nfs4_print_acl_json_at(e->dirfd, e->accpath, e->path,
+					       args->flags);
+	}
+	else if (e->acl != NULL) {
+		error = print_acl(e->acl, e->dirfd, e->accpath, e->path,
+				  args->flags, args->quiet);
+		e->acl = NULL;
+	}
+	else {
+		error = print_acl_path(e->dirfd, e->accpath, e->path,
+				       args->flags, args->quiet);
+	}
+	if (error) {
+		fprintf(stderr, "%s: failed to get ACL: %s\n", e->path,
+			strerror(errno));
+		args->error = error;
+	}
+	return (0);
+}
+
+static int print_acl_walk_error(const char *path, int error, void *arg)
+{
+	fprintf(stderr, "%s: %s\n", path, strerror(error));
+	return (0);
+}
+
+static int print_acl_tree(char *path, enum nfs4_acl_walk_order order,
+			  unsigned int max_ops, struct getfacl_args *args)
+{
+	struct nfs4_acl_walk walk = {
+		.order = order,
+		.max_ops = max_ops,
+		.fn = print_acl_entry,
+		.error_fn = print_acl_walk_error,
+		.arg = args,
+	};
+
+	if (!args->json) {
+		walk.flags = NFS4_ACL_WALK_ACL;
+		walk.uring_depth = GETFACL_URING_DEPTH;
+	}
+	args->error = 0;
+	if (nfs4_acl_walk(path, &walk) != 0) {
+		if (walk.nerrors == 0) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		}
+		return (-1);
+	}
+	return (args->error);
+}
+
+/*
+ * Print the edits that turn the ACL of `from` into the ACL of `to`.
+ */
+static int print_acl_diff(char *from, char *to, int flags, bool json)
+{
+	struct nfs4_acl *a = NULL, *b = NULL;
+	struct nfs4_acl_diff *d = NULL;
+	json_t *js_diff = NULL;
+	char *text = NULL;
+	int error = -1;
+
+	a = nfs4_acl_get_file(from);
+	if (a == NULL) {
+		fprintf(stderr, "%s: failed to get ACL: %s\n", from, strerror(errno));
+		goto out;
+	}
+	b = nfs4_acl_get_file(to);
+	if (b == NULL) {
+		fprintf(stderr, "%s: failed to get ACL: %s\n", to, strerror(errno));
+		goto out;
+	}
+
+	d = nfs4_acl_diff(a, b);
+	if (d == NULL) {
+		fprintf(stderr, "acl_diff() failed: %s\n", strerror(errno));
+		goto out;
+	}
+
+	if (json) {
+		js_diff = _nfs4_acl_diff_to_json(d, flags);
+		if (js_diff != NULL) {
+			text = json_dumps(js_diff, 0);
+			json_decref(js_diff);
+		}
+	}
+	else {
+		text = nfs4_acl_diff_to_text(d, flags);
+	}
+	if (text == NULL) {
+		fprintf(stderr, "failed to format ACL diff\n");
+		goto out;
+	}
+	printf(json ? "%s\n" : "%s", text);
+	free(text);
+	error = 0;
+out:
+	nfs4_acl_diff_free(d);
+	nfs4_free_acl(a);
+	nfs4_free_acl(b);
+	return error;
+}
+
 int main(int argc, char **argv)
 {
 	int flags = 0, i, error, opt;
 	int carried_error = 0;
 	bool quiet = false;
 	bool json = false;
+	bool diff = false;
+	bool recursive = false;
+	enum nfs4_acl_walk_order order = NFS4_ACL_WALK_ORDER_NAME;
+	unsigned long max_ops = 0;
+	unsigned long jobs = 1;
+	struct getfacl_args args;
+	char *ep = NULL;
 
 	execname = basename(argv[0]);
 
-        while ((opt = getopt_long(argc, argv, "qijnvHh?", long_options, NULL)) != -1) {
+        while ((opt = getopt_long(argc, argv, "qijdRnvHh?", long_options, NULL)) != -1) {
                 switch (opt) {
 		case 'i':
 			flags |= ACL_TEXT_APPEND_ID;
@@ -135,6 +360,42 @@ int main(int argc, char **argv)
 		case 'j':
 			json = true;
 			break;
+		case 'd':
+			diff = true;
+			break;
+		case 'R':
+			recursive = true;
+			break;
+		case 'o':
+			if (nfs4_acl_walk_order_from_text(optarg, &order)) {
+				fprintf(stderr, "%s: invalid order \"%s\".\n",
+					execname, optarg);
+				usage(0);
+				return (1);
+			}
+			break;
+		case 'O':
+			errno = 0;
+			max_ops = strtoul(optarg, &ep, 10);
+			if (errno || ep == optarg || *ep != '\0' ||
+			    max_ops == 0 || max_ops > UINT_MAX) {
+				fprintf(stderr, "%s: invalid number of operations \"%s\".\n",
+					execname, optarg);
+				usage(0);
+				return (1);
+			}
+			break;
+		case 'J':
+			errno = 0;
+			jobs = strtoul(optarg, &ep, 10);
+			if (errno || ep == optarg || *ep != '\0' ||
+			    jobs == 0 || jobs > GETFACL_JOBS_MAX) {
+				fprintf(stderr, "%s: invalid number of jobs \"%s\".\n",
+					execname, optarg);
+				usage(0);
+				return (1);
+			}
+			break;
 		case 'H':
 			more_help();
 			return 0;
@@ -154,12 +415,29 @@ int main(int argc, char **argv)
 		return (1);
 	}
 
+	if (diff) {
+		if (argc != 2) {
+			fprintf(stderr, "%s: --diff requires exactly two paths.\n", execname);
+			usage(0);
+			return (1);
+		}
+		return print_acl_diff(argv[0], argv[1], flags, json) ? 1 : 0;
+	}
+
+	args.flags = flags;
+	args.quiet = quiet;
+	args.json = json;
+
+	if (!recursive && !json) {
+		return print_acl_paths(argv, argc, jobs, flags, quiet);
+	}
+
 	for (i = 0; i < argc; i++) {
-		if (json) {
-			error = nfs4_print_acl_json(argv[i], flags);
+		if (recursive) {
+			error = print_acl_tree(argv[i], order, max_ops, &args);
 		}
 		else {
-			error = print_acl_path(argv[i], flags, quiet);
+			error = nfs4_print_acl_json(argv[i], flags);
 		}
 		if (error) {
 			carried_error = error;
@@ -179,6 +457,14 @@ static void usage(int label)
 	"    -n, --numeric       display user and group IDs rather than user or group name\n"
 	"    -v, --verbose       display access mask and flags in a verbose form\n"
 	"    -q, --quiet         do not write commented information about file name and ownersip.\n"
+	"    -d, --diff          print edits turning the ACL of the first path into that of the second\n"
+	"                        (in JSON format with -j)\n"
+	"    -R, --recursive     print ACLs of all files and directories below each path,\n"
+	"                        symbolic links below the path are not followed\n"
+	"    --order=name|none|inode\n"
+	"                        order of entries within a directory with -R (DEFAULT: name)\n"
+	"    --max-ops=<n>       with -R, read at most <n> ACLs per second\n"
+	"    --jobs=<n>          read the ACLs of the given files with <n> threads (DEFAULT: 1)\n"
 	"    -H,                 display more help\n";
 
 	fprintf(stderr, _usage, execname);
@@ -33,7 +33,6 @@
  *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#define _XOPEN_SOURCE 500
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
@@ -47,8 +46,7 @@
 #include <stdio.h>
 #include <libgen.h>
 #include <getopt.h>
-#include <dirent.h>
-#include <ftw.h>
+#include <fcntl.h>
 #include "libacl_nfs4.h"
 
 /* Actions */
@@ -61,6 +59,9 @@
 #define STRIP_ACTION		6
 #define SET_FLAGS_ACTION	7
 #define APPLY_JSON_ACTION	8
+#define CANONICALIZE_ACTION	9
+#define MINIMIZE_ACTION		10
+#define PATCH_ACTION		11
 
 /* Walks */
 #define DEFAULT_WALK		0	/* Follow symbolic link args, Skip links in subdirectories */
@@ -75,8 +76,9 @@
 #define EDITOR  		"vi"  /* <- evangelism! */
 #define u32 u_int32_t
 
-static int apply_action(const char *, const struct stat *, int, struct FTW *);
-static int do_apply_action(const char *, const struct stat *);
+static int apply_action(struct nfs4_acl_walk_entry *, void *);
+static int walk_error(const char *, int, void *);
+static int do_apply_action(int, const char *, const char *, const struct stat *);
 static int open_editor(const char *);
 static struct nfs4_acl* edit_ACL(struct nfs4_acl *, const char *, const struct stat *);
 static void __usage(const char *, int);
@@ -100,6 +102,9 @@ static struct option long_options[] = {
 	{ "modify",		1, 0, 'm' },
 	{ "strip",		0, 0, 's' },
 	{ "apply-json",		0, 0, 'j' },
+	{ "canonicalize",	0, 0, 'c' },
+	{ "minimize",		0, 0, 'M' },
+	{ "patch",		1, 0, 'D' },
 	{ "edit",		0, 0, 'e' },
 	{ "test",		0, 0, 't' },
 	{ "help",		0, 0, 'h' },
@@ -108,19 +113,26 @@ static struct option long_options[] = {
 	{ "recursive",		0, 0, 'R' },
 	{ "physical",		0, 0, 'P' },
 	{ "logical",		0, 0, 'L' },
+	{ "order",		1, 0, 'o' },
+	{ "max-ops",		1, 0, 'O' },
 	{ NULL,			0, 0, 0,  },
 };
 
-/* need these global so the nftw() callback can use them */
+/* need these global so the nfs4_acl_walk() callback can use them */
 static int action = NO_ACTION;
 static int do_recursive = NO_RECURSIVE;
 static int walk_type = DEFAULT_WALK;
+static enum nfs4_acl_walk_order walk_order = NFS4_ACL_WALK_ORDER_NAME;
+static unsigned int walk_max_ops;
 static int is_editfacl;
 static int is_test;
 static int ace_index = -1;
 static char *mod_string;
 static char *from_ace;
 static char *to_ace;
+static struct nfs4_acl_diff *patch;
+static size_t nwritten;
+static size_t nskipped;
 
 /* XXX: things we need to handle:
  *
@@ -135,6 +147,10 @@ int main(int argc, char **argv)
 	int numpaths = 0, curpath = 0;
 	char *tmp, **paths = NULL, *path = NULL, *spec_file = NULL;
 	FILE *s_fp = NULL;
+	struct nfs4_acl_walk walk;
+	unsigned long max_ops;
+	char *ep = NULL;
+	struct stat st;
 
 	if (!strcmp(basename(argv[0]), "nfs4_editfacl")) {
 		action = EDIT_ACTION;
@@ -146,7 +162,7 @@ int main(int argc, char **argv)
 		return err;
 	}
 
-	while ((opt = getopt_long(argc, argv, "-:a:A:s:S:x:X:j:m:p:bethvHRPL", long_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "-:a:A:s:S:x:X:j:m:p:D:bcMethvHRPL", long_options, NULL)) != -1) {
 		switch (opt) {
 			case 'a':
 				mod_string = optarg;
@@ -181,6 +197,19 @@ int main(int argc, char **argv)
 				assert_wu_wei(action);
 				action = STRIP_ACTION;
 				break;
+			case 'c':
+				assert_wu_wei(action);
+				action = CANONICALIZE_ACTION;
+				break;
+			case 'M':
+				assert_wu_wei(action);
+				action = MINIMIZE_ACTION;
+				break;
+			case 'D':
+				assert_wu_wei(action);
+				action = PATCH_ACTION;
+				spec_file = optarg;
+				break;
 			case 'j':
 				assert_wu_wei(action);
 				action = APPLY_JSON_ACTION;
@@ -245,6 +274,26 @@ int main(int argc, char **argv)
 				walk_type = LOGICAL_WALK;
 				break;
 
+			case 'o':
+				if (nfs4_acl_walk_order_from_text(optarg, &walk_order)) {
+					fprintf(stderr, "Invalid order \"%s\".\n", optarg);
+					usage();
+					goto out;
+				}
+				break;
+
+			case 'O':
+				errno = 0;
+				max_ops = strtoul(optarg, &ep, 10);
+				if (errno || ep == optarg || *ep != '\0' ||
+				    max_ops == 0 || max_ops > UINT_MAX) {
+					fprintf(stderr, "Invalid number of operations \"%s\".\n", optarg);
+					usage();
+					goto out;
+				}
+				walk_max_ops = max_ops;
+				break;
+
 			case 'v':
 				printf("%s %s\n", basename(argv[0]), VERSION);
 				return 0;
@@ -271,6 +320,9 @@ int main(int argc, char **argv)
 					case 'm':
 						fprintf(stderr, "Sorry, -m requires 'from_ace' and 'to_ace' arguments.\n");
 						goto out;
+					case 'D':
+						fprintf(stderr, "Sorry, --patch requires a 'patch_file'.\n");
+						goto out;
 					goto out;
 				}
 
@@ -314,8 +366,28 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (action == PATCH_ACTION) {
+		/* parse as directory so that inheritance flags are accepted */
+		tmp = mod_string + strspn(mod_string, " \t\n");
+		if (*tmp == '{')
+			patch = get_acl_diff_json(mod_string, true);
+		else
+			patch = nfs4_acl_diff_from_text(mod_string, 1);
+		if (patch == NULL) {
+			fprintf(stderr, "Failed to parse patch file %s.\n", spec_file);
+			goto out;
+		}
+	}
+
 	while (numpaths > curpath) {
 		path = paths[curpath++];
+		/*
+		 * The walk follows its root, so physical walks skip links
+		 * here, before realpath() fails on a dangling one.
+		 */
+		if (do_recursive && walk_type == PHYSICAL_WALK &&
+		    lstat(path, &st) == 0 && S_ISLNK(st.st_mode))
+			continue;
 		if ((tmp = realpath(path, NULL)) == NULL) {
 			fprintf(stderr, "File/directory \"%s\" could not be identified\n", path);
 			goto out;
@@ -324,71 +396,99 @@ int main(int argc, char **argv)
 			path = tmp;
 
 		if (do_recursive) {
-			err = nftw(path, apply_action, 0, (walk_type == LOGICAL_WALK) ? 0 : FTW_PHYS);
+			memset(&walk, 0, sizeof(walk));
+			walk.flags = (walk_type == LOGICAL_WALK) ? NFS4_ACL_WALK_LOGICAL : 0;
+			walk.order = walk_order;
+			walk.max_ops = walk_max_ops;
+			walk.fn = apply_action;
+			walk.error_fn = walk_error;
+			err = nfs4_acl_walk(path, &walk);
 			if (err) {
+				if (walk.nerrors == 0 && !walk.stopped)
+					fprintf(stderr, "An error occurred with stat(2) on %s.\n", path);
 				fprintf(stderr, "An error occurred during recursive file tree walk.\n");
+				err = 1;
 				goto out;
 			}
 		} else {
-			err = do_apply_action(path, NULL);
+			/* tmp is resolved, so this acts on the target of a link */
+			err = do_apply_action(AT_FDCWD, tmp, path, NULL);
 			if (err)
 				goto out;
 		}
 		free(tmp);
 	}
+	if (do_recursive && !is_test)
+		fprintf(stderr, "%zu ACLs written, %zu unchanged.\n", nwritten, nskipped);
 out:
 	if (paths)
 		free(paths);
+	nfs4_acl_diff_free(patch);
 	return err;
 }
 
-/* returns 0 on success, nonzero on failure */
-static int apply_action(const char *_path, const struct stat *stat, int flag, struct FTW *ftw)
+/* symbolic links below the root are never followed into, see main() */
+static int apply_action(struct nfs4_acl_walk_entry *e, void *arg)
 {
-	int err;
-	char *path = (char *)_path;
-
-	if ((flag & FTW_SL) && (walk_type == PHYSICAL_WALK || ftw->level > 0))
+	if (e->type == NFS4_ACL_WALK_SYMLINK)
 		return 0;
 
-	if (flag == FTW_NS) {
-		fprintf(stderr, "An error occurred with stat(2) on %s.\n", path);
-		return 1;
-	}
-	if ((path = realpath(path, NULL)) == NULL) {
-		perror(strerror(errno));
-		return 1;
-	}
-
-	err = do_apply_action(path, stat);
-	if (do_recursive && flag == FTW_DNR)
-		err = 1; 
-	free(path);
+	if (do_apply_action(e->dirfd, e->accpath, e->path, &e->st))
+		return NFS4_ACL_WALK_STOP;
+	return 0;
+}
 
-	return err;
+static int walk_error(const char *path, int error, void *arg)
+{
+	fprintf(stderr, "%s: %s\n", path, strerror(error));
+	return NFS4_ACL_WALK_STOP;
 }
 
-/* returns 0 on success, nonzero on failure */
-static int do_apply_action(const char *path, const struct stat *_st)
+/*
+ * Acts on `name` relative to `dirfd`, `path` is used in messages.
+ * Returns 0 on success, nonzero on failure.
+ */
+static int do_apply_action(int dirfd, const char *name, const char *path,
+			   const struct stat *_st)
 {
 	int err = 0;
 	struct nfs4_acl *acl = NULL, *newacl;
 	struct stat stats, *st = (struct stat *)_st;
 	nfs4_acl_aclflags_t aclflags = 0;
-	bool ok;
+	bool ok, written = false;
+	struct nfs4_acl_minimize_report report;
+	u32 removed;
 
 	if (st == NULL) {
-		if (stat(path, &stats)) {
+		if (fstatat(dirfd, name, &stats, AT_SYMLINK_NOFOLLOW)) {
 			fprintf(stderr, "An error occurred with stat(2) on %s.\n", path);
 			goto failed;
 		}
 		st = &stats;
 	}
 
+	/*
+	 * Stripping does not need the decoded ACL. Let the library
+	 * evaluate the packed ACL in place and write the trivial one.
+	 */
+	if ((action == STRIP_ACTION) && !is_test) {
+		err = nfs4_acl_strip_at(dirfd, name, 0, &written);
+		if (err) {
+			fprintf(stderr, "Failed to strip acl on path [%s]: %s\n",
+				path, strerror(errno));
+			return err;
+		}
+		if (written)
+			nwritten++;
+		else
+			nskipped++;
+		return err;
+	}
+
 	if (action == SUBSTITUTE_ACTION)
 		acl = nfs4_new_acl(S_ISDIR(st->st_mode));
 	else
-		acl = nfs4_acl_get_file(path);
+		acl = nfs4_acl_get_at(dirfd, name);
 
 	if (acl == NULL) {
 		fprintf(stderr, "Failed to instantiate ACL.\n");
@@ -452,6 +552,7 @@ static int do_apply_action(const char *path, const struct stat *_st)
 				path, strerror(errno));
 			goto failed;
 		}
+		nfs4_free_acl(acl);
 		acl = newacl;
 		break;
 
@@ -464,6 +565,40 @@ static int do_apply_action(const char *path, const struct stat *_st)
 		acl = newacl;
 		break;
 
+	case CANONICALIZE_ACTION:
+		if (nfs4_acl_canonicalize(acl, NFS4_ACL_CANON_STRICT)) {
+			fprintf(stderr, "Failed to canonicalize acl on path [%s]: %s\n",
+				path, (errno == EPERM) ?
+				"reordering would change effective access" :
+				strerror(errno));
+			goto failed;
+		}
+		break;
+
+	case MINIMIZE_ACTION:
+		if (nfs4_acl_minimize(acl, &report)) {
+			fprintf(stderr, "Failed to minimize acl on path [%s]: %s\n",
+				path, strerror(errno));
+			goto failed;
+		}
+		removed = report.empty + report.merged + report.shadowed;
+		if (removed || report.narrowed)
+			printf("%s: removed %u entries (%u empty, %u merged, "
+			       "%u shadowed), narrowed %u\n",
+			       path, removed, report.empty, report.merged,
+			       report.shadowed, report.narrowed);
+		break;
+
+	case PATCH_ACTION:
+		if (nfs4_acl_patch(acl, patch, 0)) {
+			fprintf(stderr, "Failed to apply patch on path [%s]: %s\n",
+				path, (errno == ENOENT) ?
+				"entry to delete or modify not found" :
+				strerror(errno));
+			goto failed;
+		}
+		break;
+
 	case SET_FLAGS_ACTION:
 		ok = nfs4_aclflag_from_text(mod_string, &aclflags);
 		if (!ok) {
@@ -477,8 +612,13 @@ static int do_apply_action(const char *path, const struct stat *_st)
 	if (is_test) {
 		fprintf(stderr, "## Test mode only - the resulting ACL for \"%s\": \n", path);
 		nfs4_print_acl(stdout, acl);
-	} else
-		err = nfs4_acl_set_file(acl, path);
+	} else {
+		err = nfs4_acl_set_at_if_changed(acl, dirfd, name, 0, &written);
+		if (err == 0 && written)
+			nwritten++;
+		else if (err == 0)
+			nskipped++;
+	}
 
 out:
 	nfs4_free_acl(acl);
@@ -594,6 +734,9 @@ static void __usage(const char *name, int is_ef)
 	"   -b file		 strip ACL entry from the file\n"
 	"   -j <json>		 replace ACL with one represented in JSON\n"
 	"   -p aclflags file	 set specified ACL flags on file\n"
+	"   -c, --canonicalize	 reorder ACL entries into canonical order\n"
+	"   -M, --minimize	 remove redundant ACL entries\n"
+	"   -D, --patch file	 apply ACL patch from file (see nfs4xdr_getfacl --diff)\n"
 	"   -e, --edit 		 edit ACL in $EDITOR (DEFAULT: " EDITOR "); save on clean exit\n"
 	"   -m from_ace to_ace	 modify in-place: replace 'from_ace' with 'to_ace'\n"
 	"   --version		 print version and exit\n"
@@ -603,6 +746,8 @@ static void __usage(const char *name, int is_ef)
 	"   -R, --recursive	 recursively apply to all files and directories\n"
 	"   -L, --logical	 logical walk, follow symbolic links\n"
 	"   -P, --physical	 physical walk, do not follow symbolic links\n"
+	"   --order=name|none|inode  order of entries within a directory (DEFAULT: name)\n"
+	"   --max-ops=n		 with -R, change at most n ACLs per second\n"
 	"   --test	 	 print resulting ACL, do not save changes\n"
 	"\n"
 	"     NOTE: if \"-\" is given with -A/-X/-S, entries will be read from stdin.\n\n";
@@ -614,6 +759,8 @@ static void __usage(const char *name, int is_ef)
 	"   -R, --recursive	 recursively apply to all files and directories\n"
 	"   -L, --logical	 logical walk, follow symbolic links\n"
 	"   -P, --physical	 physical walk, do not follow symbolic links\n"
+	"   --order=name|none|inode  order of entries within a directory (DEFAULT: name)\n"
+	"   --max-ops=n		 with -R, change at most n ACLs per second\n"
 	"   --test	 	 print resulting ACL, do not save changes\n";
 
 	fprintf(stderr, is_ef ? efusage : sfusage, name, VERSION, name);
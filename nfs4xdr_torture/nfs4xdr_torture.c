@@ -37,7 +37,15 @@
 #include <unistd.h>
 #include <sys/random.h>
 #include <sys/xattr.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <time.h>
+#include <ftw.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "torture.h"
 
 static void usage(int);
@@ -103,6 +111,20 @@ static struct nfs4_acl *generate_acl_with_entries(uint entries)
 	return out;
 }
 
+static void add_ace(struct nfs4_acl *acl, u32 type, u32 flag, u32 mask,
+		    int whotype, uid_t who_id)
+{
+	struct nfs4_ace *ace = NULL;
+
+	ace = nfs4_new_ace(acl->is_directory, type, flag, mask, whotype, who_id);
+	if (ace == NULL) {
+		errx(EX_OSERR, "nfs4_new_ace() failed.");
+	}
+	if (nfs4_append_ace(acl, ace)) {
+		errx(EX_OSERR, "nfs4_append_ace() failed");
+	}
+}
+
 /*
  * Push upper limit of number of ACEs allowed in ACL.
  */
@@ -392,7 +414,7 @@ static int json_set_and_verify(const char *path)
 		}
 
 		json_decref(jsacl);
-		free(new_acl);
+		nfs4_free_acl(new_acl);
 		error = nfs4_acl_set_file(old_acl, path);
 		if (error) {
 			errx(EX_OSERR, "%s: failed to restore original acl.", path);
@@ -495,6 +517,1329 @@ static int random_test_2(const char *path)
 	return (0);
 }
 
+/*
+ * nfs4_acl_minimize() may only drop DENY entries whose bits an earlier
+ * entry for the same principal already decided. A DENY with no later
+ * ALLOW still matters, e.g. against the implicit rights of the owner.
+ */
+static int minimize_keeps_denies(const char *path)
+{
+	struct nfs4_acl_minimize_report r;
+	struct nfs4_acl *acl = NULL;
+	struct nfs4_ace *ace = NULL;
+	int carried_error = 0;
+
+	acl = nfs4_new_acl(false);
+	if (acl == NULL) {
+		errx(EX_OSERR, "nfs4_new_acl() failed: %s", strerror(errno));
+	}
+	add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+		NFS4_ACE_READ_DATA, NFS4_ACL_WHO_OWNER, -1);
+	add_ace(acl, NFS4_ACE_ACCESS_DENIED_ACE_TYPE, 0,
+		NFS4_ACE_READ_DATA, NFS4_ACL_WHO_OWNER, -1);
+	add_ace(acl, NFS4_ACE_ACCESS_DENIED_ACE_TYPE, 0,
+		NFS4_ACE_WRITE_ACL | NFS4_ACE_READ_ACL, NFS4_ACL_WHO_OWNER, -1);
+	add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+		NFS4_ACE_READ_DATA, NFS4_ACL_WHO_EVERYONE, -1);
+
+	printf("Testing DENY without a later ALLOW is kept\n");
+	if (nfs4_acl_minimize(acl, &r)) {
+		errx(EX_OSERR, "nfs4_acl_minimize() failed: %s", strerror(errno));
+	}
+	if (acl->naces != 3) {
+		fprintf(stderr, "%s: expected 3 entries, got %u\n", path, acl->naces);
+		carried_error = -1;
+	}
+	for (ace = nfs4_get_first_ace(acl); ace != NULL; ace = nfs4_get_next_ace(&ace)) {
+		if ((ace->type == NFS4_ACE_ACCESS_DENIED_ACE_TYPE) &&
+		    (ace->access_mask == (NFS4_ACE_WRITE_ACL | NFS4_ACE_READ_ACL))) {
+			break;
+		}
+	}
+	if (ace == NULL) {
+		fprintf(stderr, "%s: owner@ DENY of READ_ACL/WRITE_ACL was removed\n", path);
+		carried_error = -1;
+	}
+	nfs4_free_acl(acl);
+	return carried_error;
+}
+
+/*
+ * Handles returned by nfs4_acl_ref() share entries until one of them
+ * is modified, and each keeps its own ACL flags. A child ACL sharing
+ * its parent's entries must not pick up the parent's ACL flags.
+ */
+static const nfs4_acl_who_t acl_ref_whotypes[] = {
+	NFS4_ACL_WHO_OWNER, NFS4_ACL_WHO_GROUP, NFS4_ACL_WHO_EVERYONE,
+};
+
+static int acl_ref_cow(const char *path)
+{
+	struct nfs4_acl *parent = NULL, *child = NULL, *ret_acl = NULL;
+	struct nfs4_ace *ace = NULL;
+	int carried_error = 0, i;
+
+	parent = nfs4_new_acl(true);
+	if (parent == NULL) {
+		errx(EX_OSERR, "nfs4_new_acl() failed: %s", strerror(errno));
+	}
+	add_ace(parent, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+		NFS4_ACE_FULL_SET, NFS4_ACL_WHO_OWNER, -1);
+	add_ace(parent, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, NFS4_ACE_IDENTIFIER_GROUP,
+		NFS4_ACE_FULL_SET, NFS4_ACL_WHO_GROUP, -1);
+	add_ace(parent, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+		NFS4_ACE_FULL_SET, NFS4_ACL_WHO_EVERYONE, -1);
+	parent->aclflags4 = ACL_PROTECTED | ACL_IS_DIR;
+
+	printf("Testing modifying a shared ACL\n");
+	child = nfs4_acl_ref(parent);
+	if (child == NULL) {
+		errx(EX_OSERR, "nfs4_acl_ref() failed: %s", strerror(errno));
+	}
+	child->aclflags4 &= ACL_IS_TRIVIAL;
+	/* Entry from the shared list, removed from the private copy */
+	if (nfs4_remove_ace(child, nfs4_get_first_ace(parent))) {
+		errx(EX_OSERR, "nfs4_remove_ace() failed: %s", strerror(errno));
+	}
+	add_ace(child, NFS4_ACE_ACCESS_DENIED_ACE_TYPE, 0,
+		NFS4_ACE_WRITE_DATA, NFS4_ACL_WHO_EVERYONE, -1);
+	if ((parent->naces != 3) || (child->naces != 3) ||
+	    (nfs4_get_first_ace(parent) == nfs4_get_first_ace(child)) ||
+	    (parent->aclflags4 != (ACL_PROTECTED | ACL_IS_DIR))) {
+		fprintf(stderr, "%s: modifying a shared ACL changed the other handle\n",
+			path);
+		carried_error = -1;
+	}
+	nfs4_free_acl(child);
+
+	printf("Testing replacing an entry of a shared ACL\n");
+	child = nfs4_acl_ref(parent);
+	ace = nfs4_new_ace(true, NFS4_ACE_ACCESS_DENIED_ACE_TYPE, 0,
+			   NFS4_ACE_WRITE_DATA, NFS4_ACL_WHO_EVERYONE, -1);
+	if ((child == NULL) || (ace == NULL)) {
+		errx(EX_OSERR, "nfs4_acl_ref() failed: %s", strerror(errno));
+	}
+	/* The caller of nfs4_replace_ace() would free a shared entry */
+	if ((nfs4_replace_ace(child, nfs4_get_first_ace(child), ace) == 0) ||
+	    (errno != EBUSY)) {
+		fprintf(stderr, "%s: nfs4_replace_ace() replaced a shared entry\n",
+			path);
+		carried_error = -1;
+	}
+	else if (nfs4_replace_ace_free(child, nfs4_get_first_ace(parent), ace)) {
+		errx(EX_OSERR, "nfs4_replace_ace_free() failed: %s",
+		     strerror(errno));
+	}
+	else if ((nfs4_get_first_ace(child) != ace) ||
+		 (nfs4_get_first_ace(parent)->whotype != NFS4_ACL_WHO_OWNER)) {
+		fprintf(stderr, "%s: replacing a shared entry changed the other handle\n",
+			path);
+		carried_error = -1;
+	}
+	nfs4_free_acl(child);
+
+	printf("Testing ACL flags of a shared ACL\n");
+	child = nfs4_acl_ref(parent);
+	if (child == NULL) {
+		errx(EX_OSERR, "nfs4_acl_ref() failed: %s", strerror(errno));
+	}
+	child->aclflags4 &= ACL_IS_TRIVIAL;
+	child->is_directory = false;
+	if (nfs4_acl_set_file(child, path)) {
+		errx(EX_OSERR, "%s: nfs4_acl_set_file() failed: %s", path, strerror(errno));
+	}
+	ret_acl = nfs4_acl_get_file(path);
+	if (ret_acl == NULL) {
+		errx(EX_OSERR, "%s: nfs4_acl_get_file() failed: %s", path, strerror(errno));
+	}
+	if ((ret_acl->aclflags4 & ACL_FLAGS_ALL) != 0) {
+		fprintf(stderr, "%s: ACL flags 0x%08x leaked from parent\n",
+			path, ret_acl->aclflags4);
+		carried_error = -1;
+	}
+	nfs4_free_acl(ret_acl);
+	nfs4_free_acl(parent);
+
+	/* Entries must outlive the handle they were shared from */
+	for (i = 0, ace = nfs4_get_first_ace(child); ace != NULL;
+	     i++, ace = nfs4_get_next_ace(&ace)) {
+		if (ace->whotype != acl_ref_whotypes[i]) {
+			fprintf(stderr, "%s: shared entries changed\n", path);
+			carried_error = -1;
+		}
+	}
+	nfs4_free_acl(child);
+	return carried_error;
+}
+
+static void ctx_log_count(void *arg, int priority, const char *msg)
+{
+	(*(int *)arg)++;
+}
+
+/*
+ * Library diagnostics must go to the context's log callback rather
+ * than to stderr when a context is current.
+ */
+static int ctx_log_routing(const char *path)
+{
+	struct nfs4_acl_ctx *ctx = NULL, *prev = NULL;
+	nfs4_acl_aclflags_t flags4 = 0;
+	char flags[] = "bogus";
+	int nlogged = 0, carried_error = 0;
+	bool ok;
+
+	ctx = nfs4_acl_ctx_new(NULL);
+	if (ctx == NULL) {
+		errx(EX_OSERR, "nfs4_acl_ctx_new() failed: %s", strerror(errno));
+	}
+	nfs4_acl_ctx_set_log(ctx, ctx_log_count, &nlogged);
+
+	printf("Testing invalid ACL flags are logged to the context\n");
+	prev = acl_nfs4_ctx_enter(ctx);
+	ok = nfs4_aclflag_from_text(flags, &flags4);
+	acl_nfs4_ctx_leave(ctx, prev, !ok, "aclflag");
+	if (ok || (nlogged != 1) ||
+	    (strstr(nfs4_acl_ctx_strerror(ctx), "invalid aclflag") == NULL)) {
+		fprintf(stderr, "%s: expected one logged error, got %d [%s]\n",
+			path, nlogged, nfs4_acl_ctx_strerror(ctx));
+		carried_error = -1;
+	}
+	nfs4_acl_ctx_free(ctx);
+	return carried_error;
+}
+
+#define	BATCH_NFILES	64
+#define	BATCH_JOBS	4
+#define	BATCH_URING_DEPTH	16
+
+/*
+ * Create a directory next to `path` holding `n` empty files, and
+ * return their paths. The directory name is written to `dir`.
+ */
+static char **make_files(const char *path, char *dir, size_t dirsz, size_t n)
+{
+	char **paths = NULL;
+	size_t i;
+	int fd;
+
+	snprintf(dir, dirsz, "%s.torture.XXXXXX", path);
+	if (mkdtemp(dir) == NULL) {
+		errx(EX_OSERR, "%s: mkdtemp() failed: %s", dir, strerror(errno));
+	}
+	paths = calloc(n, sizeof(char *));
+	if (paths == NULL) {
+		errx(EX_OSERR, "calloc() failed");
+	}
+	for (i = 0; i < n; i++) {
+		if (asprintf(&paths[i], "%s/f%zu", dir, i) == -1) {
+			errx(EX_OSERR, "asprintf() failed");
+		}
+		fd = open(paths[i], O_CREAT | O_WRONLY, 0644);
+		if (fd == -1) {
+			errx(EX_OSERR, "%s: open() failed: %s", paths[i], strerror(errno));
+		}
+		close(fd);
+	}
+	return paths;
+}
+
+static void remove_files(char *dir, char **paths, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		unlink(paths[i]);
+		free(paths[i]);
+	}
+	free(paths);
+	rmdir(dir);
+}
+
+static bool acl_xdr_equal(struct nfs4_acl *a, struct nfs4_acl *b)
+{
+	char xa[ACES_2_XDRSIZE(8)], xb[ACES_2_XDRSIZE(8)];
+	size_t na, nb;
+
+	na = acl_nfs4_xattr_pack_buf(a, xa, sizeof(xa));
+	nb = acl_nfs4_xattr_pack_buf(b, xb, sizeof(xb));
+	return (na != (size_t)-1) && (na == nb) && (memcmp(xa, xb, na) == 0);
+}
+
+static struct nfs4_acl *acl_with_named_entries(u32 n, uid_t first)
+{
+	struct nfs4_acl *acl = NULL;
+	u32 i;
+
+	acl = nfs4_new_acl(false);
+	if (acl == NULL) {
+		errx(EX_OSERR, "nfs4_new_acl() failed: %s", strerror(errno));
+	}
+	for (i = 0; i < n; i++) {
+		add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+			NFS4_ACE_READ_DATA, NFS4_ACL_WHO_NAMED, first + i);
+	}
+	return acl;
+}
+
+/*
+ * The *_at() calls act on a name relative to a directory without
+ * following a symbolic link, and agree with the path-based calls,
+ * including for the largest ACL the filesystem takes, up to
+ * NFS41ACLMAXACES entries, which is read in a single call.
+ */
+static int at_calls_match_path(const char *path)
+{
+	struct nfs4_acl *big = NULL, *small = NULL, *acl = NULL;
+	char dir[PATH_MAX], link[PATH_MAX + 8];
+	char **paths = NULL;
+	int carried_error = 0, dirfd;
+	u32 n;
+
+	paths = make_files(path, dir, sizeof(dir), 1);
+	snprintf(link, sizeof(link), "%s/l", dir);
+	if (symlink("f0", link) != 0) {
+		errx(EX_OSERR, "%s: symlink() failed: %s", link, strerror(errno));
+	}
+	dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (dirfd == -1) {
+		errx(EX_OSERR, "%s: open() failed: %s", dir, strerror(errno));
+	}
+	small = acl_with_named_entries(2, 1000);
+	for (n = NFS41ACLMAXACES; ; n /= 2) {
+		big = acl_with_named_entries(n, 1000);
+		if (nfs4_acl_set_at(big, dirfd, "f0") == 0) {
+			break;
+		}
+		if (((errno != ENOSPC) && (errno != E2BIG)) || (n <= 2)) {
+			errx(EX_OSERR, "%s: nfs4_acl_set_at() failed: %s",
+			     paths[0], strerror(errno));
+		}
+		nfs4_free_acl(big);
+	}
+
+	printf("Testing nfs4_acl_set_at() and nfs4_acl_get_at() with %u "
+	       "entries\n", n);
+	acl = nfs4_acl_get_at(dirfd, "f0");
+	if ((acl == NULL) || (acl->naces != n)) {
+		fprintf(stderr, "%s: nfs4_acl_get_at() returned %d entries\n",
+			paths[0], (acl == NULL) ? -1 : (int)acl->naces);
+		carried_error = -1;
+	}
+	nfs4_free_acl(acl);
+	acl = nfs4_acl_get_file(paths[0]);
+	if ((acl == NULL) || (acl->naces != n)) {
+		fprintf(stderr, "%s: nfs4_acl_get_file() returned %d entries\n",
+			paths[0], (acl == NULL) ? -1 : (int)acl->naces);
+		carried_error = -1;
+	}
+	nfs4_free_acl(acl);
+
+	printf("Testing the *_at() calls do not follow symbolic links\n");
+	/* These may fail, or act on the link itself */
+	nfs4_acl_set_at(small, dirfd, "l");
+	nfs4_acl_strip_at(dirfd, "l", 0, NULL);
+	acl = nfs4_acl_get_at(dirfd, "l");
+	if ((acl != NULL) && (acl->naces == n)) {
+		fprintf(stderr, "%s: nfs4_acl_get_at() followed the link\n",
+			link);
+		carried_error = -1;
+	}
+	nfs4_free_acl(acl);
+	acl = nfs4_acl_get_file(paths[0]);
+	if ((acl == NULL) || (acl->naces != n)) {
+		fprintf(stderr, "%s: changed through link %s\n", paths[0],
+			link);
+		carried_error = -1;
+	}
+	nfs4_free_acl(acl);
+
+	nfs4_free_acl(big);
+	nfs4_free_acl(small);
+	close(dirfd);
+	unlink(link);
+	remove_files(dir, paths, 1);
+	return carried_error;
+}
+
+struct at_special_counts {
+	size_t	nother;
+	size_t	nfailed;
+};
+
+static int set_and_get_at(struct nfs4_acl_walk_entry *e, void *arg)
+{
+	struct at_special_counts *c = arg;
+	struct nfs4_acl *acl = NULL, *got = NULL;
+
+	if (e->parent == NULL) {
+		return 0;
+	}
+	if (e->type == NFS4_ACL_WALK_OTHER) {
+		c->nother++;
+	}
+	acl = acl_with_named_entries(2, 2000);
+	if ((nfs4_acl_set_at(acl, e->dirfd, e->accpath) != 0) ||
+	    ((got = nfs4_acl_get_at(e->dirfd, e->accpath)) == NULL) ||
+	    !acl_xdr_equal(acl, got)) {
+		fprintf(stderr, "%s: *_at() failed: %s\n", e->path,
+			strerror(errno));
+		c->nfailed++;
+	}
+	nfs4_free_acl(got);
+	nfs4_free_acl(acl);
+	return 0;
+}
+
+/*
+ * The *_at() calls reach FIFOs and sockets met by a walk, as the
+ * path-based calls do, without opening them (a socket cannot be
+ * opened, and opening a FIFO may block or wake up its reader), and
+ * files without read permission.
+ */
+static int at_calls_reach_special_files(const char *path)
+{
+	struct at_special_counts counts = { 0 };
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	struct nfs4_acl_walk walk;
+	char dir[PATH_MAX], fifo[PATH_MAX + 8];
+	char **paths = NULL;
+	int carried_error = 0, sock;
+
+	paths = make_files(path, dir, sizeof(dir), 1);
+	chmod(paths[0], 0);
+	snprintf(fifo, sizeof(fifo), "%s/p", dir);
+	if (mkfifo(fifo, 0644) != 0) {
+		errx(EX_OSERR, "%s: mkfifo() failed: %s", fifo, strerror(errno));
+	}
+	if (snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/s", dir) >=
+	    sizeof(sun.sun_path)) {
+		errx(EX_USAGE, "%s: path too long for a socket", dir);
+	}
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((sock == -1) ||
+	    (bind(sock, (struct sockaddr *)&sun, sizeof(sun)) != 0)) {
+		errx(EX_OSERR, "%s: bind() failed: %s", sun.sun_path,
+		     strerror(errno));
+	}
+	close(sock);
+
+	printf("Testing the *_at() calls on a FIFO and a socket\n");
+	memset(&walk, 0, sizeof(walk));
+	walk.fn = set_and_get_at;
+	walk.arg = &counts;
+	if (nfs4_acl_walk(dir, &walk) != 0) {
+		fprintf(stderr, "%s: walk failed: %zu errors\n", dir,
+			walk.nerrors);
+		carried_error = -1;
+	}
+	if ((counts.nother != 2) || (counts.nfailed != 0)) {
+		fprintf(stderr, "%s: %zu of 3 entries failed, %zu special\n",
+			dir, counts.nfailed, counts.nother);
+		carried_error = -1;
+	}
+
+	unlink(fifo);
+	unlink(sun.sun_path);
+	remove_files(dir, paths, 1);
+	return carried_error;
+}
+
+/*
+ * nfs4_acl_set_many() and nfs4_acl_get_many() with worker threads must
+ * give the same results as nfs4_acl_set_file() and nfs4_acl_get_file()
+ * called for one path at a time, including per-path errors. With
+ * `uring_depth`, each thread keeps that many paths in flight through
+ * io_uring; the test is skipped if the library or kernel lacks it.
+ */
+static int batch_compare(const char *path, unsigned int uring_depth)
+{
+	struct nfs4_acl *acls[BATCH_NFILES + 1] = { NULL };
+	struct nfs4_acl *results[BATCH_NFILES + 1] = { NULL };
+	int errors[BATCH_NFILES + 1];
+	struct nfs4_acl_ctx *ctx = NULL;
+	struct nfs4_acl *acl = NULL;
+	char dir[PATH_MAX];
+	char **paths = NULL;
+	int carried_error = 0;
+	ssize_t nfailed;
+	size_t i;
+
+	paths = make_files(path, dir, sizeof(dir), BATCH_NFILES + 1);
+	/* The last path does not exist */
+	unlink(paths[BATCH_NFILES]);
+
+	for (i = 0; i <= BATCH_NFILES; i++) {
+		acls[i] = nfs4_new_acl(false);
+		if (acls[i] == NULL) {
+			errx(EX_OSERR, "nfs4_new_acl() failed: %s", strerror(errno));
+		}
+		add_ace(acls[i], NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+			NFS4_ACE_FULL_SET, NFS4_ACL_WHO_OWNER, -1);
+		add_ace(acls[i], NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+			NFS4_ACE_READ_DATA, NFS4_ACL_WHO_NAMED, 1000 + i);
+	}
+
+	ctx = nfs4_acl_ctx_new(NULL);
+	if (ctx == NULL) {
+		errx(EX_OSERR, "failed to create context: %s", strerror(errno));
+	}
+	if ((uring_depth != 0) &&
+	    nfs4_acl_ctx_set_uring(ctx, uring_depth) != 0) {
+		if ((errno != ENOSYS) && (errno != EOPNOTSUPP)) {
+			errx(EX_OSERR, "failed to create io_uring: %s",
+			     strerror(errno));
+		}
+		printf("Skipping io_uring batches: %s\n", strerror(errno));
+		goto out;
+	}
+	if (nfs4_acl_ctx_set_workers(ctx, BATCH_JOBS)) {
+		errx(EX_OSERR, "failed to start threads: %s", strerror(errno));
+	}
+
+	printf("Testing nfs4_acl_set_many() against nfs4_acl_get_file()\n");
+	nfailed = nfs4_acl_set_many(ctx, acls, (const char *const *)paths,
+				    BATCH_NFILES + 1, errors);
+	if ((nfailed != 1) || (errors[BATCH_NFILES] != ENOENT)) {
+		fprintf(stderr, "%s: expected 1 failure with ENOENT, got %zd (%s)\n",
+			dir, nfailed, strerror(errors[BATCH_NFILES]));
+		carried_error = -1;
+	}
+	for (i = 0; i < BATCH_NFILES; i++) {
+		acl = nfs4_acl_get_file(paths[i]);
+		if ((errors[i] != 0) || (acl == NULL) || !acl_xdr_equal(acl, acls[i])) {
+			fprintf(stderr, "%s: batch set differs from serial get\n",
+				paths[i]);
+			carried_error = -1;
+		}
+		nfs4_free_acl(acl);
+	}
+
+	printf("Testing nfs4_acl_get_many() against nfs4_acl_get_file()\n");
+	/* Serial writes, so that the batch reads what they wrote */
+	for (i = 0; i < BATCH_NFILES; i++) {
+		if (nfs4_acl_set_file(acls[BATCH_NFILES - 1 - i], paths[i])) {
+			errx(EX_OSERR, "%s: nfs4_acl_set_file() failed: %s",
+			     paths[i], strerror(errno));
+		}
+	}
+	nfailed = nfs4_acl_get_many(ctx, (const char *const *)paths,
+				    BATCH_NFILES + 1, results, errors);
+	if ((nfailed != 1) || (results[BATCH_NFILES] != NULL) ||
+	    (errors[BATCH_NFILES] != ENOENT)) {
+		fprintf(stderr, "%s: expected 1 failure with ENOENT, got %zd (%s)\n",
+			dir, nfailed, strerror(errors[BATCH_NFILES]));
+		carried_error = -1;
+	}
+	for (i = 0; i < BATCH_NFILES; i++) {
+		acl = nfs4_acl_get_file(paths[i]);
+		if ((errors[i] != 0) || (results[i] == NULL) || (acl == NULL) ||
+		    !acl_xdr_equal(acl, results[i])) {
+			fprintf(stderr, "%s: batch get differs from serial get\n",
+				paths[i]);
+			carried_error = -1;
+		}
+		nfs4_free_acl(acl);
+		nfs4_free_acl(results[i]);
+	}
+
+out:
+	for (i = 0; i <= BATCH_NFILES; i++) {
+		nfs4_free_acl(acls[i]);
+	}
+	nfs4_acl_ctx_free(ctx);
+	remove_files(dir, paths, BATCH_NFILES + 1);
+	return carried_error;
+}
+
+static int batch_matches_serial(const char *path)
+{
+	return batch_compare(path, 0);
+}
+
+static int batch_uring_matches_serial(const char *path)
+{
+	return batch_compare(path, BATCH_URING_DEPTH);
+}
+
+#define	WALK_NBIG	2
+#define	WALK_NENTS	16384
+#define	WALK_JOBS	8
+#define	WALK_MAX_MEM	(1024 * 1024)
+
+/*
+ * Tree of WALK_NBIG directories in a new directory next to `path`,
+ * each with WALK_NENTS entries of which every tenth is an empty
+ * subdirectory. Names are 8 characters, so that getdents64() fills
+ * the walk's buffer with exactly four chunks of entries. Returns the
+ * number of entries below the new directory.
+ */
+static size_t make_tree(const char *path, char *dir, size_t dirsz)
+{
+	char name[PATH_MAX];
+	size_t b, i;
+	int fd;
+
+	snprintf(dir, dirsz, "%s.torture.XXXXXX", path);
+	if (mkdtemp(dir) == NULL) {
+		errx(EX_OSERR, "%s: mkdtemp() failed: %s", dir, strerror(errno));
+	}
+	for (b = 0; b < WALK_NBIG; b++) {
+		snprintf(name, sizeof(name), "%s/b%zu", dir, b);
+		if (mkdir(name, 0755) != 0) {
+			errx(EX_OSERR, "%s: mkdir() failed: %s", name, strerror(errno));
+		}
+		for (i = 0; i < WALK_NENTS; i++) {
+			snprintf(name, sizeof(name), "%s/b%zu/%c%07zu", dir, b,
+				 (i % 10 == 0) ? 'd' : 'f', i);
+			if (i % 10 == 0) {
+				if (mkdir(name, 0755) != 0) {
+					errx(EX_OSERR, "%s: mkdir() failed: %s",
+					     name, strerror(errno));
+				}
+				continue;
+			}
+			fd = open(name, O_CREAT | O_WRONLY, 0644);
+			if (fd == -1) {
+				errx(EX_OSERR, "%s: open() failed: %s", name,
+				     strerror(errno));
+			}
+			close(fd);
+		}
+	}
+	return WALK_NBIG * (1 + WALK_NENTS);
+}
+
+static int remove_tree_entry(const char *fpath, const struct stat *sb,
+			     int typeflag, struct FTW *ftwbuf)
+{
+	remove(fpath);
+	return 0;
+}
+
+static void remove_tree(const char *dir)
+{
+	nftw(dir, remove_tree_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int count_entry(struct nfs4_acl_walk_entry *e, void *arg)
+{
+	__atomic_add_fetch((size_t *)arg, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/*
+ * A streaming walk within the smallest memory ceiling, by several
+ * threads, must visit every entry. The root is reached through a long
+ * run of "/." so that every node is large and memory runs short: full
+ * chunks are then visited by the reading thread, which descends into
+ * the subdirectories among them and so reuses the buffer that the next
+ * entry was read into.
+ */
+static int walk_streaming_complete(const char *path)
+{
+	struct nfs4_acl_walk walk;
+	char dir[PATH_MAX], root[PATH_MAX];
+	size_t nexpected, nvisited = 0, len;
+	int carried_error = 0;
+
+	nexpected = make_tree(path, dir, sizeof(dir)) + 1;
+	len = snprintf(root, sizeof(root), "%s", dir);
+	while (len + 2 < PATH_MAX - 256) {
+		root[len++] = '/';
+		root[len++] = '.';
+	}
+	root[len] = '\0';
+
+	printf("Testing nfs4_acl_walk() with max_mem\n");
+	memset(&walk, 0, sizeof(walk));
+	walk.order = NFS4_ACL_WALK_ORDER_NONE;
+	walk.jobs = WALK_JOBS;
+	walk.max_mem = WALK_MAX_MEM;
+	walk.fn = count_entry;
+	walk.arg = &nvisited;
+	if (nfs4_acl_walk(root, &walk) != 0) {
+		fprintf(stderr, "%s: walk failed: %zu errors\n", dir, walk.nerrors);
+		carried_error = -1;
+	}
+	if (nvisited != nexpected) {
+		fprintf(stderr, "%s: visited %zu of %zu entries\n", dir,
+			nvisited, nexpected);
+		carried_error = -1;
+	}
+
+	remove_tree(dir);
+	return carried_error;
+}
+
+static void count_done(struct nfs4_acl_walk_entry *e, void *arg)
+{
+	__atomic_add_fetch((size_t *)arg + 1, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Every way of walking, one thread or several, chunked, per filesystem,
+ * adapting to latency or streaming, visits each entry once and reports
+ * each directory done once.
+ */
+static int walk_modes_complete(const char *path)
+{
+	static const struct {
+		const char	*name;
+		int		flags;
+		unsigned int	jobs;
+		unsigned int	latency_target;
+		size_t		max_mem;
+	} modes[] = {
+		{ "one thread", 0, 1, 0, 0 },
+		{ "chunks", 0, WALK_JOBS, 0, 0 },
+		{ "per filesystem", NFS4_ACL_WALK_PER_FS, WALK_JOBS, 0, 0 },
+		{ "latency target", 0, WALK_JOBS, 1000000, 0 },
+		{ "streaming", NFS4_ACL_WALK_STAT, WALK_JOBS, 0, WALK_MAX_MEM },
+	};
+	struct nfs4_acl_walk walk;
+	char dir[PATH_MAX];
+	size_t nexpected, ndirs, counts[2];
+	int carried_error = 0;
+	size_t i;
+
+	nexpected = make_tree(path, dir, sizeof(dir)) + 1;
+	ndirs = 1 + WALK_NBIG + WALK_NBIG * ((WALK_NENTS + 9) / 10);
+
+	for (i = 0; i < ARRAY_SIZE(modes); i++) {
+		printf("Testing nfs4_acl_walk() with %s\n", modes[i].name);
+		memset(&walk, 0, sizeof(walk));
+		memset(counts, 0, sizeof(counts));
+		walk.flags = modes[i].flags;
+		walk.jobs = modes[i].jobs;
+		walk.latency_target = modes[i].latency_target;
+		walk.max_mem = modes[i].max_mem;
+		walk.fn = count_entry;
+		walk.done_fn = count_done;
+		walk.arg = counts;
+		if (nfs4_acl_walk(dir, &walk) != 0) {
+			fprintf(stderr, "%s: walk failed: %zu errors\n", dir,
+				walk.nerrors);
+			carried_error = -1;
+		}
+		if ((counts[0] != nexpected) || (walk.nentries != nexpected)) {
+			fprintf(stderr, "%s: visited %zu of %zu entries\n", dir,
+				counts[0], nexpected);
+			carried_error = -1;
+		}
+		if (counts[1] != ndirs) {
+			fprintf(stderr, "%s: %zu of %zu directories done\n", dir,
+				counts[1], ndirs);
+			carried_error = -1;
+		}
+	}
+
+	remove_tree(dir);
+	return carried_error;
+}
+
+#define	WALK_ACL_NFILES	600
+
+struct walk_acl_counts {
+	size_t	nvisited;
+	size_t	nread;
+	size_t	nwrong;
+};
+
+static int compare_read_ahead(struct nfs4_acl_walk_entry *e, void *arg)
+{
+	struct walk_acl_counts *c = arg;
+	struct nfs4_acl *acl = NULL;
+
+	__atomic_add_fetch(&c->nvisited, 1, __ATOMIC_RELAXED);
+	if (e->acl == NULL) {
+		return 0;
+	}
+	__atomic_add_fetch(&c->nread, 1, __ATOMIC_RELAXED);
+	acl = nfs4_acl_get_at(e->dirfd, e->accpath);
+	if ((acl == NULL) || !acl_xdr_equal(acl, e->acl)) {
+		fprintf(stderr, "%s: ACL read ahead differs\n", e->path);
+		__atomic_add_fetch(&c->nwrong, 1, __ATOMIC_RELAXED);
+	}
+	nfs4_free_acl(acl);
+	return 0;
+}
+
+/*
+ * With NFS4_ACL_WALK_ACL, by one thread or several, every file and
+ * directory below the root is handed to the callback with the ACL
+ * that a serial read gives, in batches larger than the io_uring depth.
+ */
+static int walk_acl_read_ahead(const char *path)
+{
+	static const unsigned int jobs[] = { 1, WALK_JOBS };
+	struct walk_acl_counts counts;
+	struct nfs4_acl_walk walk;
+	struct nfs4_acl *acl = NULL;
+	char dir[PATH_MAX], sub[PATH_MAX + 8];
+	char **paths = NULL;
+	int carried_error = 0;
+	size_t i;
+
+	paths = make_files(path, dir, sizeof(dir), WALK_ACL_NFILES);
+	snprintf(sub, sizeof(sub), "%s/d", dir);
+	if (mkdir(sub, 0755) != 0) {
+		errx(EX_OSERR, "%s: mkdir() failed: %s", sub, strerror(errno));
+	}
+	for (i = 0; i <= WALK_ACL_NFILES; i++) {
+		acl = nfs4_new_acl(i == WALK_ACL_NFILES);
+		if (acl == NULL) {
+			errx(EX_OSERR, "nfs4_new_acl() failed: %s", strerror(errno));
+		}
+		add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+			NFS4_ACE_FULL_SET, NFS4_ACL_WHO_OWNER, -1);
+		add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE, 0,
+			NFS4_ACE_READ_DATA, NFS4_ACL_WHO_NAMED, 1000 + i);
+		if (nfs4_acl_set_file(acl, (i < WALK_ACL_NFILES) ? paths[i] : sub)) {
+			errx(EX_OSERR, "nfs4_acl_set_file() failed: %s",
+			     strerror(errno));
+		}
+		nfs4_free_acl(acl);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(jobs); i++) {
+		printf("Testing nfs4_acl_walk() reading ACLs ahead with %u "
+		       "threads\n", jobs[i]);
+		memset(&walk, 0, sizeof(walk));
+		memset(&counts, 0, sizeof(counts));
+		walk.flags = NFS4_ACL_WALK_ACL;
+		walk.jobs = jobs[i];
+		walk.uring_depth = BATCH_URING_DEPTH;
+		walk.fn = compare_read_ahead;
+		walk.arg = &counts;
+		if (nfs4_acl_walk(dir, &walk) != 0) {
+			fprintf(stderr, "%s: walk failed: %zu errors\n", dir,
+				walk.nerrors);
+			carried_error = -1;
+		}
+		if ((counts.nvisited != WALK_ACL_NFILES + 2) ||
+		    (counts.nread != WALK_ACL_NFILES + 1) ||
+		    (counts.nwrong != 0)) {
+			fprintf(stderr, "%s: %zu of %d entries read ahead, "
+				"%zu wrong\n", dir, counts.nread,
+				WALK_ACL_NFILES + 1, counts.nwrong);
+			carried_error = -1;
+		}
+	}
+
+	rmdir(sub);
+	remove_files(dir, paths, WALK_ACL_NFILES);
+	return carried_error;
+}
+
+#define	WINACL		"nfs4xdr_winacl"
+#define	WINACL_ARGS_MAX	16
+
+/*
+ * Run WINACL, found in PATH, with `args` after the command name. Its
+ * output goes to file `out`, or is discarded if NULL; its diagnostics
+ * are not. Returns its exit status, or -1 with errno set if it could
+ * not be run.
+ */
+static int run_winacl(const char *const args[], const char *out)
+{
+	const char *argv[WINACL_ARGS_MAX + 2] = { WINACL };
+	posix_spawn_file_actions_t fa;
+	int error, status;
+	size_t i;
+	pid_t pid;
+
+	for (i = 0; (args[i] != NULL) && (i < WINACL_ARGS_MAX); i++) {
+		argv[i + 1] = args[i];
+	}
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO,
+					 (out != NULL) ? out : "/dev/null",
+					 O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	error = posix_spawnp(&pid, WINACL, &fa, NULL, (char *const *)argv,
+			     environ);
+	posix_spawn_file_actions_destroy(&fa);
+	if (error) {
+		errno = error;
+		return (-1);
+	}
+	if (waitpid(pid, &status, 0) == -1) {
+		return (-1);
+	}
+	return (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+/*
+ * nfs4xdr_winacl --resume only continues a journal written with the
+ * same operation, flags, owner and walk. The journal is left as it was
+ * by a run that refuses it. Skipped if WINACL is not in PATH.
+ */
+static int winacl_resume_checks_options(const char *path)
+{
+	static const struct {
+		const char	*action;
+		const char	*opt;
+		const char	*arg;
+	} changed[] = {
+		{ "minimize", NULL, NULL },	/* operation */
+		{ "inherit", "-e", NULL },	/* flag */
+		{ "inherit", "-O", "1234" },	/* owner */
+		{ "inherit", "-G", "1234" },	/* group */
+		{ "inherit", "-x", NULL },	/* walk flags */
+	};
+	const char *args[WINACL_ARGS_MAX + 1] = { NULL };
+	char dir[PATH_MAX], sub[PATH_MAX + 8], journal[PATH_MAX + 32];
+	struct nfs4_acl *acl = NULL;
+	char **paths = NULL;
+	struct stat st;
+	off_t size;
+	int carried_error = 0, res;
+	size_t i, n;
+
+	paths = make_files(path, dir, sizeof(dir), 4);
+	snprintf(sub, sizeof(sub), "%s/d", dir);
+	if (mkdir(sub, 0755) != 0) {
+		errx(EX_OSERR, "%s: mkdir() failed: %s", sub, strerror(errno));
+	}
+	acl = nfs4_new_acl(true);
+	if (acl == NULL) {
+		errx(EX_OSERR, "nfs4_new_acl() failed: %s", strerror(errno));
+	}
+	add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
+		NFS4_ACE_FILE_INHERIT_ACE | NFS4_ACE_DIRECTORY_INHERIT_ACE,
+		NFS4_ACE_FULL_SET, NFS4_ACL_WHO_OWNER, -1);
+	if (nfs4_acl_set_file(acl, dir)) {
+		errx(EX_OSERR, "%s: nfs4_acl_set_file() failed: %s", dir,
+		     strerror(errno));
+	}
+	nfs4_free_acl(acl);
+	snprintf(journal, sizeof(journal), "--journal=%s.journal", dir);
+
+	n = 0;
+	args[n++] = "-r";
+	args[n++] = "-p";
+	args[n++] = dir;
+	args[n++] = journal;
+
+	printf("Testing %s --journal\n", WINACL);
+	args[n] = "-a";
+	args[n + 1] = "inherit";
+	res = run_winacl(args, NULL);
+	if ((res == -1) && (errno == ENOENT)) {
+		printf("Skipping: %s not found in PATH\n", WINACL);
+		goto out;
+	}
+	if (res != 0) {
+		fprintf(stderr, "%s: %s --journal failed: %d\n", dir, WINACL, res);
+		carried_error = -1;
+		goto out;
+	}
+
+	printf("Testing %s --journal with -t\n", WINACL);
+	if (stat(journal + strlen("--journal="), &st) != 0) {
+		errx(EX_OSERR, "%s: stat() failed: %s", journal, strerror(errno));
+	}
+	size = st.st_size;
+	args[n + 2] = "-t";
+	res = run_winacl(args, NULL);
+	args[n + 2] = NULL;
+	if ((res == 0) ||
+	    (stat(journal + strlen("--journal="), &st) != 0) ||
+	    (st.st_size != size)) {
+		fprintf(stderr, "%s: --journal with -t accepted or journal "
+			"changed\n", dir);
+		carried_error = -1;
+	}
+
+	args[n++] = "--resume";
+	for (i = 0; i < ARRAY_SIZE(changed); i++) {
+		printf("Testing %s --resume with -a %s %s\n", WINACL,
+		       changed[i].action, changed[i].opt ? changed[i].opt : "");
+		args[n] = "-a";
+		args[n + 1] = changed[i].action;
+		args[n + 2] = changed[i].opt;
+		args[n + 3] = changed[i].arg;
+		res = run_winacl(args, NULL);
+		if (res == 0) {
+			fprintf(stderr, "%s: --resume with -a %s %s accepted\n",
+				dir, changed[i].action,
+				changed[i].opt ? changed[i].opt : "");
+			carried_error = -1;
+		}
+	}
+
+	printf("Testing %s --resume with the same options\n", WINACL);
+	args[n] = "-a";
+	args[n + 1] = "inherit";
+	args[n + 2] = NULL;
+	res = run_winacl(args, NULL);
+	if (res != 0) {
+		fprintf(stderr, "%s: --resume with the same options failed: %d\n",
+			dir, res);
+		carried_error = -1;
+	}
+
+out:
+	unlink(journal + strlen("--journal="));
+	rmdir(sub);
+	remove_files(dir, paths, 4);
+	return carried_error;
+}
+
+#define	DRY_RUN_NFILES	4
+
+/* user::rwx user:1000:r-- group::r-x mask::r-x other::--- */
+static const unsigned char posix_default[] = {
+	0x02, 0x00, 0x00, 0x00,
+	0x01, 0x00, 0x07, 0x00, 0xff, 0xff, 0xff, 0xff,
+	0x02, 0x00, 0x04, 0x00, 0xe8, 0x03, 0x00, 0x00,
+	0x04, 0x00, 0x05, 0x00, 0xff, 0xff, 0xff, 0xff,
+	0x10, 0x00, 0x05, 0x00, 0xff, 0xff, 0xff, 0xff,
+	0x20, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+};
+
+/* The xattrs of `n` paths, ENODATA included, are what they were */
+static int xattrs_match(char **paths, size_t n, ssize_t *sizes, char **bufs,
+			bool save)
+{
+	char buf[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+	int carried_error = 0;
+	ssize_t size;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		size = nfs4_acl_get_xattr_file(paths[i], buf, sizeof(buf));
+		if ((size == -1) && (errno != ENODATA)) {
+			errx(EX_OSERR, "%s: nfs4_acl_get_xattr_file() failed: %s",
+			     paths[i], strerror(errno));
+		}
+		if (save) {
+			sizes[i] = size;
+			bufs[i] = malloc(sizeof(buf));
+			if (bufs[i] == NULL) {
+				errx(EX_OSERR, "malloc() failed");
+			}
+			memcpy(bufs[i], buf, (size > 0) ? size : 0);
+		}
+		else if ((size != sizes[i]) ||
+			 ((size > 0) && (memcmp(buf, bufs[i], size) != 0))) {
+			fprintf(stderr, "%s: ACL changed\n", paths[i]);
+			carried_error = -1;
+		}
+	}
+	return carried_error;
+}
+
+/* The number after `prefix` on the line of file `out` naming `what` */
+static size_t winacl_count(const char *out, const char *prefix,
+			   const char *what)
+{
+	char line[256];
+	size_t count = (size_t)-1;
+	FILE *fp = NULL;
+
+	fp = fopen(out, "r");
+	if (fp == NULL) {
+		errx(EX_OSERR, "%s: fopen() failed: %s", out, strerror(errno));
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if ((strncmp(line, prefix, strlen(prefix)) == 0) &&
+		    (strstr(line, what) != NULL)) {
+			count = strtoul(line + strlen(prefix), NULL, 10);
+			break;
+		}
+	}
+	fclose(fp);
+	return count;
+}
+
+/*
+ * nfs4xdr_winacl -t changes no ACL, and reports as many changes as a
+ * run without it then makes. Skipped if WINACL is not in PATH.
+ */
+static int winacl_dry_run_changes_nothing(const char *path)
+{
+	const char *args[WINACL_ARGS_MAX + 1] = { NULL };
+	char *all[DRY_RUN_NFILES + 2], *bufs[DRY_RUN_NFILES + 2];
+	ssize_t sizes[DRY_RUN_NFILES + 2];
+	char dir[PATH_MAX], sub[PATH_MAX + 8], out[PATH_MAX + 8];
+	struct nfs4_acl *acl = NULL;
+	char **paths = NULL;
+	size_t i, nwould, nwritten, nagain;
+	int carried_error = 0, res;
+
+	paths = make_files(path, dir, sizeof(dir), DRY_RUN_NFILES);
+	snprintf(sub, sizeof(sub), "%s/d", dir);
+	if (mkdir(sub, 0755) != 0) {
+		errx(EX_OSERR, "%s: mkdir() failed: %s", sub, strerror(errno));
+	}
+	acl = nfs4_new_acl(true);
+	if (acl == NULL) {
+		errx(EX_OSERR, "nfs4_new_acl() failed: %s", strerror(errno));
+	}
+	add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
+		NFS4_ACE_FILE_INHERIT_ACE | NFS4_ACE_DIRECTORY_INHERIT_ACE,
+		NFS4_ACE_FULL_SET, NFS4_ACL_WHO_OWNER, -1);
+	add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
+		NFS4_ACE_FILE_INHERIT_ACE | NFS4_ACE_DIRECTORY_INHERIT_ACE,
+		NFS4_ACE_READ_DATA, NFS4_ACL_WHO_NAMED, 1000);
+	if (nfs4_acl_set_file(acl, dir)) {
+		errx(EX_OSERR, "%s: nfs4_acl_set_file() failed: %s", dir,
+		     strerror(errno));
+	}
+	nfs4_free_acl(acl);
+	snprintf(out, sizeof(out), "%s.out", dir);
+	all[0] = dir;
+	all[1] = sub;
+	for (i = 0; i < DRY_RUN_NFILES; i++) {
+		all[i + 2] = paths[i];
+	}
+	xattrs_match(all, DRY_RUN_NFILES + 2, sizes, bufs, true);
+
+	printf("Testing %s -t\n", WINACL);
+	args[0] = "-a";
+	args[1] = "inherit";
+	args[2] = "-r";
+	args[3] = "-v";
+	args[4] = "-p";
+	args[5] = dir;
+	args[6] = "-t";
+	res = run_winacl(args, out);
+	if ((res == -1) && (errno == ENOENT)) {
+		printf("Skipping: %s not found in PATH\n", WINACL);
+		goto out;
+	}
+	if (res != 0) {
+		fprintf(stderr, "%s: %s -t failed: %d\n", dir, WINACL, res);
+		carried_error = -1;
+		goto out;
+	}
+	if (xattrs_match(all, DRY_RUN_NFILES + 2, sizes, bufs, false) != 0) {
+		carried_error = -1;
+	}
+	nwould = winacl_count(out, "dry run: ", " would change");
+
+	printf("Testing %s without -t writes what -t reported\n", WINACL);
+	args[6] = NULL;
+	res = run_winacl(args, out);
+	nwritten = winacl_count(out, "", " ACLs written");
+	if ((res != 0) || (nwould == (size_t)-1) || (nwould == 0) ||
+	    (nwritten != nwould)) {
+		fprintf(stderr, "%s: -t reported %zd changes, %zd written "
+			"(exit %d)\n", dir, (ssize_t)nwould, (ssize_t)nwritten,
+			res);
+		carried_error = -1;
+	}
+
+	/*
+	 * POSIX ACLs: -t must count only entries whose ACLs differ from
+	 * the default ACL cloned, so that a second dry run finds none.
+	 */
+	printf("Testing %s -P -t counts what a run writes\n", WINACL);
+	if (setxattr(dir, "system.posix_acl_default", posix_default,
+		     sizeof(posix_default), 0) != 0) {
+		printf("Skipping: no POSIX ACLs on %s: %s\n", dir,
+		       strerror(errno));
+		goto out;
+	}
+	args[0] = "-a";
+	args[1] = "clone";
+	args[2] = "-P";
+	args[3] = "-r";
+	args[4] = "-v";
+	args[5] = "-s";
+	args[6] = dir;
+	args[7] = "-p";
+	args[8] = dir;
+	args[9] = "-t";
+	res = run_winacl(args, out);
+	nwould = winacl_count(out, "dry run: ", " would change");
+	args[9] = NULL;
+	res |= run_winacl(args, out);
+	nwritten = winacl_count(out, "", " ACLs written");
+	args[9] = "-t";
+	res |= run_winacl(args, out);
+	nagain = winacl_count(out, "dry run: ", " would change");
+	if ((res != 0) || (nwould != DRY_RUN_NFILES + 1) ||
+	    (nwritten != nwould) || (nagain != 0)) {
+		fprintf(stderr, "%s: -P -t reported %zd changes, %zd "
+			"written, then %zd (exit %d)\n", dir, (ssize_t)nwould,
+			(ssize_t)nwritten, (ssize_t)nagain, res);
+		carried_error = -1;
+	}
+
+out:
+	for (i = 0; i < DRY_RUN_NFILES + 2; i++) {
+		free(bufs[i]);
+	}
+	unlink(out);
+	rmdir(sub);
+	remove_files(dir, paths, DRY_RUN_NFILES);
+	return carried_error;
+}
+
+#define	PAR_NDIRS	4
+#define	PAR_NFILES	64
+
+/*
+ * Tree next to `path` for inherit: PAR_NDIRS directories of PAR_NFILES
+ * files and a subdirectory each, under a root with inheritable entries.
+ * The second directory has a PROTECTED ACL, so inherit leaves it alone.
+ */
+static void make_inherit_tree(const char *path, char *dir, size_t dirsz)
+{
+	struct nfs4_acl *acl = NULL;
+	char name[PATH_MAX];
+	size_t d, i;
+	int fd;
+
+	snprintf(dir, dirsz, "%s.torture.XXXXXX", path);
+	if (mkdtemp(dir) == NULL) {
+		errx(EX_OSERR, "%s: mkdtemp() failed: %s", dir, strerror(errno));
+	}
+	for (d = 0; d < PAR_NDIRS; d++) {
+		snprintf(name, sizeof(name), "%s/d%zu", dir, d);
+		if (mkdir(name, 0755) != 0) {
+			errx(EX_OSERR, "%s: mkdir() failed: %s", name, strerror(errno));
+		}
+		snprintf(name, sizeof(name), "%s/d%zu/s", dir, d);
+		if (mkdir(name, 0755) != 0) {
+			errx(EX_OSERR, "%s: mkdir() failed: %s", name, strerror(errno));
+		}
+		for (i = 0; i < PAR_NFILES; i++) {
+			snprintf(name, sizeof(name), "%s/d%zu/%sf%zu", dir, d,
+				 (i % 8 == 0) ? "s/" : "", i);
+			fd = open(name, O_CREAT | O_WRONLY, 0644);
+			if (fd == -1) {
+				errx(EX_OSERR, "%s: open() failed: %s", name,
+				     strerror(errno));
+			}
+			close(fd);
+		}
+	}
+
+	acl = nfs4_new_acl(true);
+	if (acl == NULL) {
+		errx(EX_OSERR, "nfs4_new_acl() failed: %s", strerror(errno));
+	}
+	add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
+		NFS4_ACE_FILE_INHERIT_ACE | NFS4_ACE_DIRECTORY_INHERIT_ACE,
+		NFS4_ACE_FULL_SET, NFS4_ACL_WHO_OWNER, -1);
+	add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
+		NFS4_ACE_FILE_INHERIT_ACE | NFS4_ACE_DIRECTORY_INHERIT_ACE,
+		NFS4_ACE_READ_DATA, NFS4_ACL_WHO_NAMED, 1000);
+	if (nfs4_acl_set_file(acl, dir)) {
+		errx(EX_OSERR, "%s: nfs4_acl_set_file() failed: %s", dir,
+		     strerror(errno));
+	}
+	nfs4_free_acl(acl);
+
+	acl = nfs4_new_acl(true);
+	if (acl == NULL) {
+		errx(EX_OSERR, "nfs4_new_acl() failed: %s", strerror(errno));
+	}
+	add_ace(acl, NFS4_ACE_ACCESS_ALLOWED_ACE_TYPE,
+		NFS4_ACE_FILE_INHERIT_ACE | NFS4_ACE_DIRECTORY_INHERIT_ACE,
+		NFS4_ACE_FULL_SET, NFS4_ACL_WHO_OWNER, -1);
+	acl->aclflags4 = ACL_PROTECTED;
+	snprintf(name, sizeof(name), "%s/d1", dir);
+	if (nfs4_acl_set_file(acl, name)) {
+		errx(EX_OSERR, "%s: nfs4_acl_set_file() failed: %s", name,
+		     strerror(errno));
+	}
+	nfs4_free_acl(acl);
+}
+
+/* nftw() has no argument for its callback */
+static const char *cmp_from, *cmp_to;
+static size_t cmp_ndiffer;
+
+static int compare_tree_entry(const char *fpath, const struct stat *sb,
+			      int typeflag, struct FTW *ftwbuf)
+{
+	char a[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+	char b[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+	char other[PATH_MAX];
+	ssize_t na, nb;
+
+	snprintf(other, sizeof(other), "%s%s", cmp_to,
+		 fpath + strlen(cmp_from));
+	na = nfs4_acl_get_xattr_file(fpath, a, sizeof(a));
+	nb = nfs4_acl_get_xattr_file(other, b, sizeof(b));
+	if ((na != nb) || ((na > 0) && (memcmp(a, b, na) != 0))) {
+		fprintf(stderr, "%s: ACL differs from %s\n", other, fpath);
+		cmp_ndiffer++;
+	}
+	return 0;
+}
+
+/*
+ * nfs4xdr_winacl -a inherit -r writes the same ACLs with -j as with
+ * one thread, parent before child, and leaves a PROTECTED subtree
+ * alone. Skipped if WINACL is not in PATH.
+ */
+static int winacl_parallel_matches_serial(const char *path)
+{
+	const char *args[WINACL_ARGS_MAX + 1] = {
+		"-a", "inherit", "-r", "-j", "1", "-p", NULL, NULL
+	};
+	char serial[PATH_MAX], parallel[PATH_MAX], jobs[16];
+	char file[PATH_MAX + 16], xattr[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+	int carried_error = 0, res;
+
+	make_inherit_tree(path, serial, sizeof(serial));
+	make_inherit_tree(path, parallel, sizeof(parallel));
+
+	printf("Testing %s -a inherit -r with one thread\n", WINACL);
+	args[6] = serial;
+	res = run_winacl(args, NULL);
+	if ((res == -1) && (errno == ENOENT)) {
+		printf("Skipping: %s not found in PATH\n", WINACL);
+		goto out;
+	}
+	if (res != 0) {
+		fprintf(stderr, "%s: %s failed: %d\n", serial, WINACL, res);
+		carried_error = -1;
+		goto out;
+	}
+
+	printf("Testing %s -a inherit -r -j %d\n", WINACL, WALK_JOBS);
+	snprintf(jobs, sizeof(jobs), "%d", WALK_JOBS);
+	args[4] = jobs;
+	args[6] = parallel;
+	res = run_winacl(args, NULL);
+	if (res != 0) {
+		fprintf(stderr, "%s: %s -j failed: %d\n", parallel, WINACL, res);
+		carried_error = -1;
+		goto out;
+	}
+
+	cmp_from = serial;
+	cmp_to = parallel;
+	cmp_ndiffer = 0;
+	nftw(serial, compare_tree_entry, 16, FTW_PHYS);
+	if (cmp_ndiffer != 0) {
+		carried_error = -1;
+	}
+
+	/* files had no ACL xattr, so only those inherited into have one */
+	snprintf(file, sizeof(file), "%s/d0/s/f0", serial);
+	if (nfs4_acl_get_xattr_file(file, xattr, sizeof(xattr)) == -1) {
+		fprintf(stderr, "%s: nothing inherited\n", file);
+		carried_error = -1;
+	}
+	snprintf(file, sizeof(file), "%s/d1/s/f0", serial);
+	if (nfs4_acl_get_xattr_file(file, xattr, sizeof(xattr)) != -1) {
+		fprintf(stderr, "%s: inherited below a PROTECTED ACL\n", file);
+		carried_error = -1;
+	}
+
+out:
+	remove_tree(serial);
+	remove_tree(parallel);
+	return carried_error;
+}
+
 const struct {
 	const char *name;
 	int (*test_acl_fn)(const char *path);
@@ -508,6 +1853,19 @@ const struct {
 #endif
 	{ "random1", random_test_1 },				/* set an array of different xattr size. check errno */
 	{ "random2", random_test_2 },				/* stress test with randomized xattr buffers */
+	{ "minimize_denies", minimize_keeps_denies },		/* DENY entries not shadowed survive minimize */
+	{ "acl_ref_cow", acl_ref_cow },				/* shared ACLs are copied on write, flags stay per handle */
+	{ "ctx_log", ctx_log_routing },				/* library diagnostics go to the context log */
+	{ "at_calls", at_calls_match_path },			/* *_at() calls do not follow links */
+	{ "at_special", at_calls_reach_special_files },		/* *_at() calls reach FIFOs and sockets */
+	{ "batch", batch_matches_serial },			/* get/set_many() agree with serial get/set */
+	{ "batch_uring", batch_uring_matches_serial },		/* the same through io_uring, if built with it */
+	{ "walk_stream", walk_streaming_complete },		/* streaming walk visits every entry */
+	{ "walk_modes", walk_modes_complete },			/* every walk mode visits every entry once */
+	{ "walk_acl", walk_acl_read_ahead },			/* ACLs read ahead by the walk match serial reads */
+	{ "winacl_resume", winacl_resume_checks_options },	/* --resume refuses a journal of other options */
+	{ "winacl_dry_run", winacl_dry_run_changes_nothing },	/* -t changes nothing, reports what a run writes */
+	{ "winacl_parallel", winacl_parallel_matches_serial },	/* -j writes what one thread writes */
 };
 
 int run_tests(const char *path)
@@ -30,15 +30,20 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <err.h>
-#include <fts.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <grp.h>
 #include <pwd.h>
+#include <search.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sysexits.h>
+#include <time.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/xattr.h>
 #include "libacl_nfs4.h"
 
@@ -57,14 +62,21 @@
 #define	WA_INHERIT		0x00000800	/* do nfs41-style auto-inheritance */
 #define	WA_POSIXACL		0x00001000	/* clone POSIXACL */
 #define	WA_MAYCHMOD		0x00002000	/* strip POSIXACL and chmod */
+#define	WA_EQUIVALENT		0x00004000	/* skip semantically equivalent ACLs */
+#define	WA_MINIMIZE		0x00008000	/* remove redundant ACEs */
+#define	WA_RESUME		0x00010000	/* skip subtrees done in the journal */
 
-#define	WA_OP_SET	(WA_CLONE|WA_STRIP|WA_CHOWN|WA_RESTORE|WA_INHERIT)
+#define	WA_OP_SET	(WA_CLONE|WA_STRIP|WA_CHOWN|WA_RESTORE|WA_INHERIT|WA_MINIMIZE)
 #define	WA_OP_CHECK(flags, bit) ((flags & ~bit) & WA_OP_SET)
 #define IS_RECURSIVE(x) (x & WA_RECURSIVE)
 #define IS_VERBOSE(x) (x & WA_VERBOSE)
 #define IS_POSIXACL(x) (x & WA_POSIXACL)
 #define MAY_CHMOD(x) (x & WA_MAYCHMOD)
 #define MAY_XDEV(x) (x & WA_TRAVERSE)
+#define IS_TRIAL(x) (x & WA_TRIAL)
+#define SET_FLAGS(x) (((x & WA_EQUIVALENT) ? NFS4_ACL_SET_EQUIVALENT : 0) | \
+		      (IS_TRIAL(x) ? NFS4_ACL_SET_DRY_RUN : 0))
+#define IS_PARALLEL(w) (((w)->njobs > 1) && IS_RECURSIVE((w)->flags))
 
 #define	MAX_ACL_DEPTH		2
 
@@ -84,6 +96,23 @@ struct windows_acl_info {
 	uid_t uid;
 	gid_t gid;
 	int	flags;
+	unsigned int njobs;	/* worker threads for recursive runs */
+	enum nfs4_acl_walk_order order;	/* order of entries within a directory */
+	size_t	max_mem;	/* stream the walk within this many bytes */
+	unsigned int fs_jobs;	/* threads per filesystem with -x */
+	size_t	peak_mem;
+	unsigned int latency_target;	/* usec, adapt threads to ACL latency */
+	unsigned int max_ops;	/* ACL operations per second */
+	unsigned int final_jobs;
+	size_t	nentries;	/* visited by the walk */
+	double	elapsed;	/* seconds the walk took */
+	size_t	nwritten;	/* ACLs written */
+	size_t	nskipped;	/* ACLs already matching, not written */
+	size_t	nbytes;		/* of ACLs written */
+	size_t	nmissing;	/* restore: entries not in the snapshot */
+	size_t	nresumed;	/* subtrees skipped with --resume */
+	char	*journal;	/* --journal */
+	int	journal_fd;
 };
 
 char *posixacl = NULL;
@@ -98,11 +127,36 @@ struct {
 	{	"strip",	WA_STRIP	},
 	{	"chown",	WA_CHOWN	},
 	{	"inherit",	WA_INHERIT	},
-	{	"restore",	WA_RESTORE	}
+	{	"restore",	WA_RESTORE	},
+	{	"minimize",	WA_MINIMIZE	}
 };
 
 size_t actions_size = sizeof(actions) / sizeof(actions[0]);
 
+/*
+ * A dry run (-t) reads every ACL and computes what would be written,
+ * but writes nothing. The changes to the first WA_SAMPLES entries that
+ * would change are kept to be shown with the summary.
+ */
+#define	WA_SAMPLES		10
+
+static struct {
+	pthread_mutex_t	lock;
+	size_t		n;
+	char		*text[WA_SAMPLES];
+} samples = { PTHREAD_MUTEX_INITIALIZER };
+
+static struct option long_options[] = {
+	{ "order",		1, 0, 'o' },
+	{ "max-mem",		1, 0, 'M' },
+	{ "fs-jobs",		1, 0, 'F' },
+	{ "journal",		1, 0, 'J' },
+	{ "resume",		0, 0, 'R' },
+	{ "latency-target",	1, 0, 'T' },
+	{ "max-ops",		1, 0, 'Q' },
+	{ NULL,			0, 0, 0,  },
+};
+
 static int
 get_action(const char *str)
 {
@@ -131,6 +185,8 @@ new_windows_acl_info(void)
 
 	w->uid = -1;
 	w->gid = -1;
+	w->njobs = 1;
+	w->journal_fd = -1;
 	return (w);
 }
 
@@ -143,6 +199,7 @@ free_windows_acl_info(struct windows_acl_info *w)
 
 	free(w->path);
 	free(w->chroot);
+	free(w->journal);
 	nfs4_free_acl(w->source_acl);
 	free(w);
 }
@@ -164,7 +221,7 @@ usage(char *path)
 	fprintf(stderr,
 		"Usage: %s [OPTIONS] ...\n"
 		"Where option is:\n"
-		"    -a <clone|strip|chown|restore|inherit> # action to perform <restore> is experimental!\n"
+		"    -a <clone|strip|chown|restore|inherit|minimize> # action to perform <restore> is experimental!\n"
 		"    -O <owner>                     # change owner\n"
 		"    -G <group>                     # change group\n"
 		"    -c <path>                      # chroot path\n"
@@ -173,10 +230,19 @@ usage(char *path)
 		"    -P                             # perform actions on POSIX1e ACL\n"
 		"    -C                             # may strip and chmod() in POSIX1e ACL clone if no default ACL on path.\n"
 		"    -r                             # recursive\n"
+		"    -j <jobs>                      # number of threads for recursive actions\n"
+		"    -o, --order=<name|none|inode>  # order of entries in a directory (default: name)\n"
+		"    --max-mem=<size>[K|M|G]        # stream the walk in readdir order within <size> bytes (minimum 1M)\n"
 		"    -v                             # verbose\n"
-		"    -t                             # trial run - makes no changes\n"
+		"    -t                             # dry run - report what would change, makes no changes\n"
 		"    -x                             # traverse filesystem mountpoints\n"
-		"    -f                             # force acl inheritance\n",
+		"    --fs-jobs=<jobs>               # threads working on one filesystem with -x (default: half of -j)\n"
+		"    --latency-target=<ms>          # use up to -j threads while 99%% of ACL operations take at most <ms>\n"
+		"    --max-ops=<n>                  # start at most <n> ACL operations per second\n"
+		"    --journal=<file>               # record finished directories of a recursive run in <file>\n"
+		"    --resume                       # skip directories recorded in the journal by an earlier run\n"
+		"    -f                             # force acl inheritance\n"
+		"    -e                             # leave ACLs that grant the same access unchanged\n",
 		path
 	);
 	}
@@ -184,8 +250,121 @@ usage(char *path)
 	exit(0);
 }
 
+/*
+ * `size` is the length of the XDR ACL written. With -x it is added to
+ * the total of the filesystem the entry is on, for the summary.
+ */
+static void
+count_write(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry,
+	    bool written, size_t size)
+{
+	if (!written) {
+		w->nskipped++;
+		return;
+	}
+	w->nwritten++;
+	w->nbytes += size;
+	if (entry->fs != NULL) {
+		__atomic_add_fetch(&entry->fs->counter, size, __ATOMIC_RELAXED);
+	}
+}
+
+static bool
+sample_wanted(struct windows_acl_info *w)
+{
+	return (IS_TRIAL(w->flags) &&
+		(__atomic_load_n(&samples.n, __ATOMIC_RELAXED) < WA_SAMPLES));
+}
+
+/*
+ * Keep the edits that turn the ACL on `entry` into `acl_new`, if this
+ * is a dry run and there is room for another sample.
+ */
+static void
+sample_diff(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry,
+	    struct nfs4_acl *acl_new)
+{
+	struct nfs4_acl *acl_old = NULL;
+	struct nfs4_acl_diff *d = NULL;
+	char *text = NULL, *sample = NULL;
+
+	if (!sample_wanted(w)) {
+		return;
+	}
+	acl_old = nfs4_acl_get_at(entry->dirfd, entry->accpath);
+	if (acl_old == NULL) {
+		return;
+	}
+	d = nfs4_acl_diff(acl_old, acl_new);
+	if ((d != NULL) && ((d->nedits > 0) || d->set_aclflags)) {
+		text = nfs4_acl_diff_to_text(d, 0);
+	}
+	if ((text != NULL) &&
+	    (asprintf(&sample, "%s:\n%s", entry->path, text) != -1)) {
+		pthread_mutex_lock(&samples.lock);
+		if (samples.n < WA_SAMPLES) {
+			samples.text[samples.n++] = sample;
+			sample = NULL;
+		}
+		pthread_mutex_unlock(&samples.lock);
+	}
+	free(sample);
+	free(text);
+	nfs4_acl_diff_free(d);
+	nfs4_free_acl(acl_old);
+}
+
+static void
+print_samples(void)
+{
+	size_t i;
+
+	for (i = 0; i < samples.n; i++) {
+		fprintf(stdout, "%s", samples.text[i]);
+		free(samples.text[i]);
+	}
+	samples.n = 0;
+}
+
+/*
+ * The runtime of the real run is projected from the rate at which the
+ * dry run read and compared entries, taking a write to cost as much.
+ */
+static void
+print_dry_run(struct windows_acl_info *w)
+{
+	double rate = (w->elapsed > 0) ? w->nentries / w->elapsed : 0;
+
+	print_samples();
+	fprintf(stdout, "dry run: %zu files would change (%zu bytes of ACL), "
+		"%zu unchanged", w->nwritten, w->nbytes, w->nskipped);
+	if ((w->flags & WA_OP_SET) == WA_RESTORE) {
+		fprintf(stdout, ", %zu missing in snapshot", w->nmissing);
+	}
+	fprintf(stdout, "\ndry run: %zu entries read in %.3f s (%.0f/s), "
+		"projected runtime %.3f s\n", w->nentries, w->elapsed, rate,
+		(rate > 0) ? w->elapsed + w->nwritten / rate : w->elapsed);
+}
+
+static int
+chown_entry(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry)
+{
+	if (w->uid == -1 && w->gid == -1)
+		return (0);
+
+	if (IS_TRIAL(w->flags))
+		return (0);
+
+	if (fchownat(entry->dirfd, entry->accpath, w->uid, w->gid,
+		     AT_SYMLINK_NOFOLLOW) < 0) {
+		warn("%s: chown() failed", entry->path);
+		return (-1);
+	}
+	return (0);
+}
+
 static int
-strip_acl(struct windows_acl_info *w, FTSENT *fts_entry)
+strip_acl(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry)
 {
 	/*
 	 * Convert non-trivial ACL to trivial ACL.
@@ -197,54 +376,110 @@ strip_acl(struct windows_acl_info *w, FTSENT *fts_entry)
 	 * from the root directory and then use the 'clone'
 	 * action to set the ACL recursively.
 	 */
-	char *path = NULL;
-	struct nfs4_acl *acl_tmp = NULL;
 	struct nfs4_acl *acl_new = NULL;
+	struct stat st;
+	size_t size = 0;
+	bool written;
 	int error;
 
-	if (fts_entry == NULL)
-		path = w->path;
-	else
-		path = fts_entry->fts_accpath;
-
 	if (IS_VERBOSE(w->flags))
-		fprintf(stdout, "%s\n", path);
-	acl_tmp = nfs4_acl_get_file(path);
-	if (acl_tmp == NULL) {
-		warn("%s: acl_get_file() failed", path);
+		fprintf(stdout, "%s\n", entry->path);
+
+	/* strip is evaluated on the packed ACL and does not allocate */
+	error = nfs4_acl_strip_at(entry->dirfd, entry->accpath,
+				  SET_FLAGS(w->flags), &written);
+	if (error) {
+		warn("%s: acl_strip_np() failed", entry->path);
 		return (-1);
 	}
-	acl_new = acl_nfs4_strip(acl_tmp);
-	if (acl_new == NULL) {
-		warn("%s: acl_strip_np() failed", path);
-		nfs4_free_acl(acl_tmp);
+	/* the stripped ACL is the trivial one for the file's mode */
+	if (written && ((entry->fs != NULL) || IS_TRIAL(w->flags))) {
+		if (entry->have_stat) {
+			st = entry->st;
+		}
+		else if (fstatat(entry->dirfd, entry->accpath, &st,
+				 AT_SYMLINK_NOFOLLOW) != 0) {
+			st.st_mode = 0;
+		}
+		size = acl_nfs4_get_trivial(st.st_mode)->xdrsize;
+		if (sample_wanted(w)) {
+			acl_new = acl_nfs4_new_trivial_acl(st.st_mode,
+				entry->type == NFS4_ACL_WALK_DIR);
+			if (acl_new != NULL) {
+				sample_diff(w, entry, acl_new);
+				nfs4_free_acl(acl_new);
+			}
+		}
+	}
+	count_write(w, entry, written, size);
+
+	return (chown_entry(w, entry));
+}
+
+static int
+minimize_acl(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry)
+{
+	struct nfs4_acl_minimize_report r;
+	struct nfs4_acl *aclp = NULL;
+	bool written = false;
+	u32 removed;
+	int error;
+
+	if (entry->acl != NULL) {
+		aclp = entry->acl;
+		entry->acl = NULL;
+	}
+	else {
+		aclp = nfs4_acl_get_at(entry->dirfd, entry->accpath);
+	}
+	if (aclp == NULL) {
+		warn("%s: nfs4_acl_get_file() failed", entry->path);
 		return (-1);
 	}
 
-	error = nfs4_acl_set_file(acl_new, path);
+	error = nfs4_acl_minimize(aclp, &r);
 	if (error) {
-		warn("%s: acl_set_file() failed", path);
-		nfs4_free_acl(acl_tmp);
-		nfs4_free_acl(acl_new);
+		warn("%s: nfs4_acl_minimize() failed", entry->path);
+		nfs4_free_acl(aclp);
 		return (-1);
 	}
-	nfs4_free_acl(acl_tmp);
-	nfs4_free_acl(acl_new);
 
-	if (w->uid != -1 || w->gid != -1) {
-		error = chown(path, w->uid, w->gid);
-		if (error) {
-			warn("%s: chown() failed", path);
-			return (-1);
-		}
+	removed = r.empty + r.merged + r.shadowed;
+	if ((removed == 0) && (r.narrowed == 0)) {
+		count_write(w, entry, false, 0);
+		nfs4_free_acl(aclp);
+		return (0);
+	}
+
+	if (IS_VERBOSE(w->flags) || (w->flags & WA_TRIAL)) {
+		fprintf(stdout, "%s: removed %u entries (%u empty, %u merged, "
+			"%u shadowed), narrowed %u\n",
+			entry->path, removed, r.empty, r.merged,
+			r.shadowed, r.narrowed);
+	}
+
+	error = nfs4_acl_set_at_if_changed(aclp, entry->dirfd, entry->accpath,
+					   SET_FLAGS(w->flags) &
+					   NFS4_ACL_SET_DRY_RUN, &written);
+	if (error) {
+		warn("%s: acl_set_file() failed", entry->path);
+		nfs4_free_acl(aclp);
+		return (-1);
+	}
+	if (written) {
+		sample_diff(w, entry, aclp);
 	}
+	count_write(w, entry, written, ACES_2_XDRSIZE(aclp->naces));
+
+	nfs4_free_acl(aclp);
 	return (0);
 }
 
-static inline char *get_relative_path(FTSENT *entry, size_t plen)
+static inline const char *get_relative_path(struct nfs4_acl_walk_entry *entry,
+					    size_t plen)
 {
-	char *relpath = NULL;
-	relpath = entry->fts_path + plen;
+	const char *relpath = NULL;
+	relpath = entry->path + plen;
 	if (relpath[0] == '/') {
 		relpath++;
 	}
@@ -252,129 +487,187 @@ static inline char *get_relative_path(FTSENT *entry, size_t plen)
 }
 
 /*
- * Iterate through linked list of parent directories until we are able
- * to find one that exists in the snapshot directory. Use this ACL
- * to calculate an inherited acl.
+ * Restore walks the live tree and keeps, in the walk entry of every
+ * directory, an fd of the matching directory in the snapshot. Entries
+ * are looked up by name relative to that fd instead of by their full
+ * path below the snapshot, and the packed ACLs of both sides are
+ * compared byte-wise, so that only ACLs that differ are written. A
+ * directory without a frame, or with a frame without fd, has no
+ * counterpart in the snapshot, and neither has anything below it.
+ *
+ * With -f, entries missing in the snapshot get the ACL they would
+ * inherit from their nearest ancestor in it. The inheritable entries
+ * are calculated once per snapshot directory, on first use, and frames
+ * of missing directories share those of their parent.
  */
-static int get_acl_parent(struct windows_acl_info *w, FTSENT *fts_entry)
+struct restore_frame {
+	int		fd;	/* directory in the snapshot, or -1 */
+	pthread_mutex_t	lock;	/* for the calculation of dacl and facl */
+	struct nfs4_acl	*dacl;	/* entries inherited by subdirectories */
+	struct nfs4_acl	*facl;	/* entries inherited by files */
+};
+
+static void
+free_restore_frame(struct nfs4_acl_walk_entry *entry)
 {
-	bool ok;
-	FTSENT *p = NULL;
-#if 0
-	char *path = NULL;
-	char *relpath = NULL;
-#endif
-	char shadow_path[PATH_MAX] = {0};
-	struct nfs4_acl *parent_acl = NULL;
+	struct restore_frame *f = entry->data;
 
-	if (fts_entry->fts_parent == NULL) {
-		/*
-		 * No parent node indicates we're at fts root level.
-		 */
-		parent_acl = nfs4_acl_get_file(w->source);
-		if (parent_acl == NULL) {
-			return (-1);
-		}
-		ok = acl_nfs4_inherit_entries(parent_acl, theacls[0].dacl, true);
-		if (!ok) {
-			warn("%s: acl_get_file() failed", w->source);
-			return (-1);
-		}
-		ok = acl_nfs4_inherit_entries(parent_acl, theacls[0].facl, false);
-		if (!ok) {
-			warn("%s: acl_get_file() failed", w->source);
-			return (-1);
-		}
-		nfs4_free_acl(parent_acl);
-		return (0);
+	if (f == NULL) {
+		return;
 	}
+	if (f->fd != -1) {
+		close(f->fd);
+	}
+	nfs4_free_acl(f->dacl);
+	nfs4_free_acl(f->facl);
+	pthread_mutex_destroy(&f->lock);
+	free(f);
+	entry->data = NULL;
+}
 
-	for (p=fts_entry->fts_parent; p; p=p->fts_parent) {
-		snprintf(shadow_path, sizeof(shadow_path),
-			  "%s/%s", w->source, p->fts_accpath);
-		parent_acl = nfs4_acl_get_file(shadow_path);
-		if (parent_acl == NULL) {
-			if (errno == ENOENT) {
-				continue;
-			}
-			else {
-				warn("%s: acl_get_file() failed", shadow_path);
-				return -1;
-
-			}
-		}
+static struct restore_frame *
+new_restore_frame(struct nfs4_acl_walk_entry *entry, int fd)
+{
+	struct restore_frame *f = NULL;
 
-		ok = acl_nfs4_inherit_entries(parent_acl, theacls[0].dacl, true);
-		if (!ok) {
-			warn("%s: acl_get_file() failed", w->source);
-			return (-1);
-		}
+	f = calloc(1, sizeof(struct restore_frame));
+	if (f == NULL) {
+		return (NULL);
+	}
+	f->fd = fd;
+	pthread_mutex_init(&f->lock, NULL);
+	entry->data = f;
+	return (f);
+}
 
-		ok = acl_nfs4_inherit_entries(parent_acl, theacls[0].facl, false);
-		if (ok) {
-			nfs4_free_acl(parent_acl);
-			return (0);
+/*
+ * Return a reference to the ACL that a missing subdirectory (`is_dir`)
+ * or file of directory `dir` inherits, or NULL with errno set.
+ */
+static struct nfs4_acl *
+restore_inherited(struct nfs4_acl_walk_entry *dir, bool is_dir)
+{
+	struct restore_frame *f = dir->data;
+	struct nfs4_acl *aclp = NULL;
+	struct nfs4_acl *out = NULL;
+
+	pthread_mutex_lock(&f->lock);
+	if ((f->dacl == NULL) && (f->fd != -1)) {
+		aclp = nfs4_acl_get_fd(f->fd);
+		if (aclp != NULL) {
+			f->dacl = nfs4_new_acl(true);
+			f->facl = nfs4_new_acl(false);
+			if ((f->dacl == NULL) || (f->facl == NULL) ||
+			    !acl_nfs4_inherit_entries(aclp, f->dacl, true) ||
+			    !acl_nfs4_inherit_entries(aclp, f->facl, false)) {
+				nfs4_free_acl(f->dacl);
+				nfs4_free_acl(f->facl);
+				f->dacl = f->facl = NULL;
+			}
+			nfs4_free_acl(aclp);
 		}
-		warn("%s: acl_get_file() failed", shadow_path);
-		nfs4_free_acl(parent_acl);
 	}
-	return -1;
+	if (f->dacl != NULL) {
+		out = nfs4_acl_ref(is_dir ? f->dacl : f->facl);
+	}
+	pthread_mutex_unlock(&f->lock);
+	return (out);
 }
 
+/*
+ * Directory `entry` is missing in the snapshot. With -f its children
+ * inherit from the same ancestor as itself.
+ */
 static int
-restore_acl(struct windows_acl_info *w, char *relpath, FTSENT *fts_entry, size_t slen)
+push_missing_frame(struct windows_acl_info *w,
+		   struct nfs4_acl_walk_entry *entry)
 {
-	int rval;
-	bool is_equal;
-	struct nfs4_acl *acl_new = NULL;
-	struct nfs4_acl *acl_old = NULL;
-	char shadow_path[PATH_MAX] = {0};
+	struct restore_frame *f = NULL;
+	struct nfs4_acl_walk_entry *parent = entry->parent;
 
-	if ((strlen(relpath) + strlen(w->source)) > PATH_MAX) {
-		warn("%s: path in snapshot directory is too long", relpath);
-		return -1;
+	if (((w->flags & WA_FORCE) == 0) ||
+	    (entry->type != NFS4_ACL_WALK_DIR) ||
+	    (parent == NULL) || (parent->data == NULL)) {
+		return (0);
 	}
 
-	rval = snprintf(shadow_path, sizeof(shadow_path), "%s/%s", w->source, relpath);
-	if (rval < 0) {
-		warn("%s: snprintf failed", relpath);
-		return -1;
+	f = new_restore_frame(entry, -1);
+	if (f == NULL) {
+		return (-1);
 	}
+	f->dacl = restore_inherited(parent, true);
+	f->facl = restore_inherited(parent, false);
+	if ((f->dacl == NULL) || (f->facl == NULL)) {
+		return (-1);
+	}
+	return (0);
+}
 
-	acl_new = nfs4_acl_get_file(shadow_path);
-	if (acl_new == NULL) {
-		if (errno == ENOENT) {
-			if (w->flags & WA_FORCE) {
-				rval = get_acl_parent(w, fts_entry);
-				if (rval != 0) {
-					fprintf(stdout, "! %s\n", shadow_path);
-					return 0;
-				}
-				acl_new = acl_nfs4_copy_acl(((fts_entry->fts_statp->st_mode & S_IFDIR) == 0) ? theacls[0].facl : theacls[0].dacl);
-				if (acl_new == NULL) {
-					warn("%s: acl_dup() failed", shadow_path);
-					return -1;
-				}
-			}
-			else {
-				fprintf(stdout, "! %s\n", shadow_path);
-				return 0;
-			}
-		}
-		else {
-			warn("%s: acl_get_file() failed", shadow_path);
-			return (-1);
+/*
+ * Open the snapshot counterpart of directory `entry`, `name` relative
+ * to `dirfd` (or a path if dirfd is -1). A missing counterpart is not
+ * an error.
+ */
+static int
+push_restore_frame(struct windows_acl_info *w,
+		   struct nfs4_acl_walk_entry *entry, int dirfd,
+		   const char *name)
+{
+	int fd;
+
+	fd = openat((dirfd == -1) ? AT_FDCWD : dirfd, name,
+		    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		if ((errno == ENOENT) || (errno == ENOTDIR) ||
+		    (errno == ELOOP)) {
+			return (push_missing_frame(w, entry));
 		}
+		return (-1);
+	}
+
+	if (new_restore_frame(entry, fd) == NULL) {
+		close(fd);
+		return (-1);
 	}
+	return (0);
+}
+
+static const char *
+get_shadow_path(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry,
+		char *buf, size_t bufsz)
+{
+	snprintf(buf, bufsz, "%s/%s", w->source,
+		 get_relative_path(entry, strlen(w->path)));
+	return (buf);
+}
+
+/*
+ * Decoded counterpart of restore_acl() for ACLs that do not exist as
+ * such in either tree: those calculated for entries missing in the
+ * snapshot with -f, and in the security namespace build those that
+ * are synthesized from the mode. Consumes `acl_new`.
+ */
+static int
+restore_acl_decoded(struct windows_acl_info *w,
+		    struct nfs4_acl_walk_entry *entry,
+		    struct nfs4_acl *acl_new, const char *shadow_path)
+{
+	int rval;
+	bool is_equal;
+	struct nfs4_acl *acl_old = NULL;
 
-	acl_old = nfs4_acl_get_file(fts_entry->fts_path);
+	acl_old = nfs4_acl_get_at(entry->dirfd, entry->accpath);
 	if (acl_old == NULL) {
-		warn("%s: acl_get_file() failed", fts_entry->fts_path);
+		warn("%s: acl_get_file() failed", entry->path);
+		nfs4_free_acl(acl_new);
 		return (-1);
 	}
 
-	is_equal = aces_are_equal(acl_new, acl_old);
+	is_equal = (w->flags & WA_EQUIVALENT) ?
+		   nfs4_acl_equivalent(acl_new, acl_old) :
+		   aces_are_equal(acl_new, acl_old);
 	if (is_equal) {
+		count_write(w, entry, false, 0);
 		nfs4_free_acl(acl_old);
 		nfs4_free_acl(acl_new);
 		return 0;
@@ -383,17 +676,21 @@ restore_acl(struct windows_acl_info *w, char *relpath, FTSENT *fts_entry, size_t
 	if (IS_VERBOSE(w->flags)) {
 		fprintf(stdout, "%s -> %s\n",
 			shadow_path,
-			fts_entry->fts_path);
+			entry->path);
+	}
+	if (IS_TRIAL(w->flags)) {
+		sample_diff(w, entry, acl_new);
 	}
-	if ((w->flags & WA_TRIAL) == 0) {
-		rval = nfs4_acl_set_file(acl_new, fts_entry->fts_accpath);
+	else {
+		rval = nfs4_acl_set_at(acl_new, entry->dirfd, entry->accpath);
 		if (rval < 0) {
-			warn("%s: acl_set_file() failed", fts_entry->fts_accpath);
+			warn("%s: acl_set_file() failed", entry->path);
 			nfs4_free_acl(acl_old);
 			nfs4_free_acl(acl_new);
 			return -1;
 		}
 	}
+	count_write(w, entry, true, ACES_2_XDRSIZE(acl_new->naces));
 
 	nfs4_free_acl(acl_old);
 	nfs4_free_acl(acl_new);
@@ -401,325 +698,548 @@ restore_acl(struct windows_acl_info *w, char *relpath, FTSENT *fts_entry, size_t
 }
 
 static int
-remove_acl_posix(struct windows_acl_info *w, FTSENT *file)
+restore_missing(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry,
+		const char *shadow_path)
 {
-	int error;
+	struct nfs4_acl *acl_new = NULL;
+
+	if (((w->flags & WA_FORCE) == 0) || (entry->parent == NULL) ||
+	    (entry->parent->data == NULL)) {
+		fprintf(stdout, "! %s\n", shadow_path);
+		w->nmissing++;
+		return 0;
+	}
+
+	acl_new = restore_inherited(entry->parent,
+				    entry->type == NFS4_ACL_WALK_DIR);
+	if (acl_new == NULL) {
+		warn("%s: failed to get inherited entries", shadow_path);
+		return -1;
+	}
+	/* nothing inheritable in the ancestor */
+	if (acl_new->naces == 0) {
+		nfs4_free_acl(acl_new);
+		fprintf(stdout, "! %s\n", shadow_path);
+		w->nmissing++;
+		return 0;
+	}
+	return (restore_acl_decoded(w, entry, acl_new, shadow_path));
+}
+
+/*
+ * The first word of a packed ACL holds ACL flags, which restore has
+ * never compared; the entry count and entries follow.
+ */
+static bool
+xdr_aces_are_equal(const char *a, ssize_t a_size, const char *b, ssize_t b_size)
+{
+	return ((a_size == b_size) &&
+		(memcmp(a + sizeof (u32), b + sizeof (u32),
+			a_size - sizeof (u32)) == 0));
+}
+
+static int
+restore_acl(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry)
+{
+	char snap[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+	char live[ACES_2_XDRSIZE(NFS41ACLMAXACES)];
+	char shadow_path[PATH_MAX] = {0};
+	struct restore_frame *f = NULL;
+	struct nfs4_acl *acl_new = NULL;
+	struct nfs4_acl *acl_old = NULL;
+	ssize_t snap_size, live_size;
+	const char *name = NULL;
+	bool is_equal;
+	int snapfd;
+
+	if (entry->parent == NULL) {
+		snapfd = -1;
+		name = w->source;
+	}
+	else {
+		f = entry->parent->data;
+		if ((f == NULL) || (f->fd == -1)) {
+			get_shadow_path(w, entry, shadow_path, sizeof(shadow_path));
+			if (push_missing_frame(w, entry) != 0) {
+				warn("%s: failed to get inherited entries",
+				     shadow_path);
+				return (-1);
+			}
+			return (restore_missing(w, entry, shadow_path));
+		}
+		snapfd = f->fd;
+		name = entry->name;
+	}
+
+	if ((entry->type == NFS4_ACL_WALK_DIR) &&
+	    (push_restore_frame(w, entry, snapfd, name) != 0)) {
+		warn("%s: open() failed",
+		     get_shadow_path(w, entry, shadow_path, sizeof(shadow_path)));
+		return (-1);
+	}
+
+	snap_size = (snapfd == -1) ?
+		    nfs4_acl_get_xattr_file(name, snap, sizeof(snap)) :
+		    nfs4_acl_get_xattr_at(snapfd, name, snap, sizeof(snap));
+	if (snap_size < 0) {
+		get_shadow_path(w, entry, shadow_path, sizeof(shadow_path));
+		if (errno == ENOENT) {
+			return (restore_missing(w, entry, shadow_path));
+		}
+		if (errno != ENODATA) {
+			warn("%s: acl_get_file() failed", shadow_path);
+			return (-1);
+		}
+		/* no ACL written in the snapshot, use the one of its mode */
+		acl_new = (snapfd == -1) ? nfs4_acl_get_file(name) :
+			  nfs4_acl_get_at(snapfd, name);
+		if (acl_new == NULL) {
+			warn("%s: acl_get_file() failed", shadow_path);
+			return (-1);
+		}
+		return (restore_acl_decoded(w, entry, acl_new, shadow_path));
+	}
+
+	live_size = nfs4_acl_get_xattr_at(entry->dirfd, entry->accpath,
+					  live, sizeof(live));
+	if ((live_size < 0) && (errno != ENODATA)) {
+		warn("%s: acl_get_file() failed", entry->path);
+		return (-1);
+	}
+	if (xdr_aces_are_equal(snap, snap_size, live, live_size)) {
+		count_write(w, entry, false, 0);
+		return (0);
+	}
+
+	if ((w->flags & WA_EQUIVALENT) || (live_size < 0)) {
+		/* decode both, or let the mode stand in for a missing ACL */
+		acl_new = acl_nfs4_xattr_load(snap, snap_size,
+					      entry->type == NFS4_ACL_WALK_DIR);
+		if (acl_new == NULL) {
+			warn("%s: acl_get_file() failed",
+			     get_shadow_path(w, entry, shadow_path,
+					     sizeof(shadow_path)));
+			return (-1);
+		}
+		if (live_size < 0) {
+			return (restore_acl_decoded(w, entry, acl_new,
+				get_shadow_path(w, entry, shadow_path,
+						sizeof(shadow_path))));
+		}
+		acl_old = acl_nfs4_xattr_load(live, live_size,
+					      entry->type == NFS4_ACL_WALK_DIR);
+		if (acl_old == NULL) {
+			warn("%s: acl_get_file() failed", entry->path);
+			nfs4_free_acl(acl_new);
+			return (-1);
+		}
+		is_equal = nfs4_acl_equivalent(acl_new, acl_old);
+		nfs4_free_acl(acl_old);
+		nfs4_free_acl(acl_new);
+		if (is_equal) {
+			count_write(w, entry, false, 0);
+			return (0);
+		}
+	}
 
 	if (IS_VERBOSE(w->flags)) {
-		fprintf(stdout, "%s\n", file->fts_path);
+		fprintf(stdout, "%s -> %s\n",
+			get_shadow_path(w, entry, shadow_path,
+					sizeof(shadow_path)),
+			entry->path);
+	}
+	if (IS_TRIAL(w->flags)) {
+		if (sample_wanted(w)) {
+			acl_new = acl_nfs4_xattr_load(snap, snap_size,
+				entry->type == NFS4_ACL_WALK_DIR);
+			if (acl_new != NULL) {
+				sample_diff(w, entry, acl_new);
+				nfs4_free_acl(acl_new);
+			}
+		}
+	}
+	else if (nfs4_acl_set_xattr_at(entry->dirfd, entry->accpath,
+				       snap, snap_size) < 0) {
+		warn("%s: acl_set_file() failed", entry->path);
+		return (-1);
+	}
+	count_write(w, entry, true, snap_size);
+	return (0);
+}
+
+/*
+ * Make POSIX ACL xattr `name` of `file` hold the `size` bytes at
+ * `value`, or remove it if `value` is NULL, unless it already does.
+ * `*written` tells whether it did not; with -t nothing is written, so
+ * that a dry run counts what a run would write.
+ */
+static int
+posix_xattr_set_if_changed(struct windows_acl_info *w,
+			   struct nfs4_acl_walk_entry *file, const char *name,
+			   const char *value, size_t size, bool *written)
+{
+	char *cur = NULL;
+	ssize_t res;
+	int error;
+
+	*written = false;
+	/* a byte more than `value` tells a longer ACL from an equal one */
+	cur = malloc(size + 1);
+	if (cur == NULL) {
+		return (-1);
+	}
+	res = acl_nfs4_getxattr(file->accpath, file->dirfd, name, cur,
+				size + 1);
+	if (value == NULL) {
+		*written = (res != -1) ||
+			   ((errno != ENODATA) && (errno != EOPNOTSUPP));
+	}
+	else {
+		*written = (res != size) || (memcmp(cur, value, size) != 0);
 	}
+	free(cur);
+	if (!*written || IS_TRIAL(w->flags)) {
+		return (0);
+	}
+
+	if (value != NULL) {
+		return (acl_nfs4_setxattr(file->accpath, file->dirfd, name,
+					  value, size, 0));
+	}
+	error = acl_nfs4_removexattr(file->accpath, file->dirfd, name);
+	if (error && ((errno == ENODATA) || (errno == EOPNOTSUPP))) {
+		*written = false;
+		error = 0;
+	}
+	return (error);
+}
 
+/*
+ * Remove the POSIX ACLs of `file`. `*written` tells whether it had any.
+ */
+static int
+remove_posix_xattrs(struct windows_acl_info *w,
+		    struct nfs4_acl_walk_entry *file, bool *written)
+{
+	bool removed = false;
+	int error;
 
-	if (S_ISDIR(file->fts_statp->st_mode)) {
-		error = removexattr(file->fts_accpath,
-				    "system.posix_acl_default");
-		if (error && ((errno != ENODATA) && (errno != EOPNOTSUPP))) {
+	if (file->type == NFS4_ACL_WALK_DIR) {
+		error = posix_xattr_set_if_changed(w, file,
+						   "system.posix_acl_default",
+						   NULL, 0, &removed);
+		if (error) {
 			warnx("%s: removexattr() for default ACL "
-			      "failed: %s", file->fts_accpath, strerror(errno));
+			      "failed: %s", file->path, strerror(errno));
 			return (error);
 		}
 	}
 
-	error = removexattr(file->fts_accpath,
-			    "system.posix_acl_access");
-	if (error && ((errno != ENODATA) && (errno != EOPNOTSUPP))) {
+	error = posix_xattr_set_if_changed(w, file, "system.posix_acl_access",
+					   NULL, 0, written);
+	if (error) {
 		warnx("%s: removexattr() for access ACL "
-		      "failed: %s", file->fts_accpath, strerror(errno));
+		      "failed: %s", file->path, strerror(errno));
 		return (error);
 	}
+	*written |= removed;
+	return (0);
+}
 
-	if (w->uid != -1 || w->gid != -1) {
-		error = chown(file->fts_accpath, w->uid, w->gid);
-		if (error) {
-			warn("%s: chown() failed", file->fts_accpath);
-			return (-1);
-		}
+static int
+remove_acl_posix(struct windows_acl_info *w, struct nfs4_acl_walk_entry *file)
+{
+	bool written;
+	int error;
+
+	if (IS_VERBOSE(w->flags)) {
+		fprintf(stdout, "%s\n", file->path);
 	}
 
-	return (0);
+	error = remove_posix_xattrs(w, file, &written);
+	if (error) {
+		return (error);
+	}
+	count_write(w, file, written, 0);
+	return (chown_entry(w, file));
 }
 
 static int
-set_acl_posix(struct windows_acl_info *w, FTSENT *file)
+set_acl_posix(struct windows_acl_info *w, struct nfs4_acl_walk_entry *file)
 {
-	size_t nwritten;
+	size_t nbytes = 0;
+	bool written, changed = false;
 	int error;
 
 	if (IS_VERBOSE(w->flags)) {
-		fprintf(stdout, "%s\n", file->fts_path);
+		fprintf(stdout, "%s\n", file->path);
 	}
 
-	if (file->fts_level == FTS_ROOTLEVEL) {
-		if (w->uid != -1 || w->gid != -1) {
-			error = chown(file->fts_accpath, w->uid, w->gid);
-			if (error) {
-				warn("%s: chown() failed", file->fts_accpath);
-				return (-1);
-			}
-		}
-		return (0);
+	if (file->level == 0) {
+		return (chown_entry(w, file));
 	}
 
 	if (!posixacl && MAY_CHMOD(w->flags)) {
-		error = remove_acl_posix(w, file);
+		error = remove_posix_xattrs(w, file, &changed);
 		if (error) {
 			return (error);
 		}
-		if ((file->fts_statp->st_mode & ALLPERMS) == posixacl_mode) {
-			/* mode is already correct */
-			return (0);
-		}
-		error = chmod(file->fts_accpath, posixacl_mode);
-		if (error) {
-			warnx("%s: chmod() to [0o%o] failed: %s\n",
-			      file->fts_accpath, posixacl_mode,
-			      strerror(errno));
-			return (-1);
+		if ((file->st.st_mode & ALLPERMS) != posixacl_mode) {
+			changed = true;
+			if (!IS_TRIAL(w->flags) &&
+			    (fchmodat(file->dirfd, file->accpath,
+				      posixacl_mode, 0) != 0)) {
+				warnx("%s: chmod() to [0o%o] failed: %s\n",
+				      file->path, posixacl_mode,
+				      strerror(errno));
+				return (-1);
+			}
 		}
-		return (0);
+		count_write(w, file, changed, 0);
+		return (chown_entry(w, file));
 	}
 
-	if (S_ISDIR(file->fts_statp->st_mode)) {
-		nwritten = setxattr(file->fts_accpath,
-				    "system.posix_acl_default",
-				    posixacl, posixacl_size, 0);
-
-		if (nwritten == -1) {
+	if (file->type == NFS4_ACL_WALK_DIR) {
+		error = posix_xattr_set_if_changed(w, file,
+						   "system.posix_acl_default",
+						   posixacl, posixacl_size,
+						   &written);
+		if (error) {
 			warnx("Failed to set default ACL on [%s]: %s\n",
-			      file->fts_accpath, strerror(errno));
+			      file->path, strerror(errno));
 			return (-1);
 		}
+		if (written) {
+			changed = true;
+			nbytes += posixacl_size;
+		}
 	}
 
-	nwritten = setxattr(file->fts_accpath, "system.posix_acl_access",
-			    posixacl, posixacl_size, 0);
-	if (nwritten == -1) {
+	error = posix_xattr_set_if_changed(w, file, "system.posix_acl_access",
+					   posixacl, posixacl_size, &written);
+	if (error) {
 		warnx("Failed to set access ACL on [%s]: %s\n",
-		      file->fts_accpath, strerror(errno));
+		      file->path, strerror(errno));
 		return (-1);
 	}
-
-	if (w->uid != -1 || w->gid != -1) {
-		error = chown(file->fts_accpath, w->uid, w->gid);
-		if (error) {
-			warn("%s: chown() failed", file->fts_accpath);
-			return (-1);
-		}
+	if (written) {
+		changed = true;
+		nbytes += posixacl_size;
 	}
-	return (0);
+	count_write(w, file, changed, nbytes);
+
+	return (chown_entry(w, file));
 }
 
 static int
-set_acl(struct windows_acl_info *w, FTSENT *fts_entry)
+set_acl(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry)
 {
 	struct nfs4_acl *acl_new = NULL;
 	int acl_depth = 0;
+	bool written;
 
 	if (IS_VERBOSE(w->flags)) {
-		fprintf(stdout, "%s\n", fts_entry->fts_path);
+		fprintf(stdout, "%s\n", entry->path);
 	}
 
 	/* don't set inherited flag on root dir. This is required for zfsacl:map_dacl_protected */
-	if (fts_entry->fts_level == FTS_ROOTLEVEL) {
+	if (entry->level == 0) {
 		acl_new = w->source_acl;
 	}
 	else {
-		if ((fts_entry->fts_level -1) >= MAX_ACL_DEPTH) {
+		if ((entry->level -1) >= MAX_ACL_DEPTH) {
 			acl_depth = MAX_ACL_DEPTH-1;
 		}
 		else {
-			acl_depth = fts_entry->fts_level -1;
+			acl_depth = entry->level -1;
 		}
-		acl_new = ((fts_entry->fts_statp->st_mode & S_IFDIR) == 0) ? theacls[acl_depth].facl : theacls[acl_depth].dacl;
+		acl_new = (entry->type != NFS4_ACL_WALK_DIR) ? theacls[acl_depth].facl : theacls[acl_depth].dacl;
 	}
 
-	/* write out the acl to the file */
-	if (nfs4_acl_set_file(acl_new, fts_entry->fts_accpath) < 0) {
-		warn("%s: acl_set_file() failed", fts_entry->fts_accpath);
+	/* write out the acl to the file, unless it is already there */
+	if (nfs4_acl_set_at_if_changed(acl_new, entry->dirfd, entry->accpath,
+				       SET_FLAGS(w->flags), &written) < 0) {
+		warn("%s: acl_set_file() failed", entry->path);
 		return (-1);
 	}
-
-	if (w->uid != -1 || w->gid != -1) {
-		if (chown(fts_entry->fts_accpath, w->uid, w->gid) < 0) {
-			warn("%s: chown() failed", fts_entry->fts_accpath);
-			return (-1);
-		}
+	if (written) {
+		sample_diff(w, entry, acl_new);
 	}
+	count_write(w, entry, written, ACES_2_XDRSIZE(acl_new->naces));
 
-	return (0);
+	return (chown_entry(w, entry));
 }
 
-static int
-fts_compare(const FTSENT **s1, const FTSENT **s2)
+/*
+ * Inheritable entries of a directory whose ACL has been set, kept in
+ * the directory's walk entry while its children are visited, so that
+ * children do not need to read the parent ACL again.
+ */
+struct inherit_frame {
+	struct nfs4_acl *dacl;	/* entries inherited by subdirectories */
+	struct nfs4_acl *facl;	/* entries inherited by files */
+};
+
+static void
+free_inherit_frame(struct nfs4_acl_walk_entry *entry)
 {
-	return (strcoll((*s1)->fts_name, (*s2)->fts_name));
+	struct inherit_frame *f = entry->data;
+
+	if (f == NULL) {
+		return;
+	}
+	nfs4_free_acl(f->dacl);
+	nfs4_free_acl(f->facl);
+	free(f);
+	entry->data = NULL;
 }
 
 static int
-auto_inherit_acl(FTSENT *entry, struct nfs4_acl *cur_acl, int flags)
+push_inherit_frame(struct nfs4_acl_walk_entry *entry, struct nfs4_acl *acl)
 {
-	struct nfs4_acl *new_acl = NULL;
-	struct nfs4_acl *parent_acl = NULL;
-	struct nfs4_acl *to_inherit = NULL;
-	struct nfs4_ace *ace = NULL;
-	struct nfs4_ace *new_ace = NULL;
-	char parent[PATH_MAX] = {0};
+	struct inherit_frame *f = NULL;
 
-	int is_dir, error;
-	bool ok;
+	if (entry->type != NFS4_ACL_WALK_DIR) {
+		return (0);
+	}
 
-	if (entry->fts_parent == NULL) {
-		warnx("fts_parent for [%s] is NULL\n", entry->fts_accpath);
+	f = calloc(1, sizeof(struct inherit_frame));
+	if (f == NULL) {
+		warn("%s: calloc() failed", entry->path);
 		return (-1);
 	}
+	entry->data = f;
 
-	if (IS_VERBOSE(flags)) {
-		fprintf(stdout, "%s\n", entry->fts_path);
+	f->dacl = nfs4_new_acl(true);
+	f->facl = nfs4_new_acl(false);
+	if ((f->dacl == NULL) || (f->facl == NULL) ||
+	    !acl_nfs4_inherit_entries(acl, f->dacl, true) ||
+	    !acl_nfs4_inherit_entries(acl, f->facl, false)) {
+		warnx("%s: failed to get inherited entries", entry->path);
+		free_inherit_frame(entry);
+		return (-1);
 	}
+	return (0);
+}
 
-	is_dir = S_ISDIR(entry->fts_statp->st_mode);
-	/*
-	 * fts(3) will chdir into the parent directory of the current FTSENT
-	 * unless FTS_NOCHDIR is set. Hence, retrieving parent directory is
-	 * simply a matter of calling getcwd(3). This reliance on getcwd(3) is
-	 * not symlink safe (it is possible for end-user to create to auto-
-	 * inherit heads for the same path through symlink-following). At
-	 * present this safety net is removed, but in the future a call to
-	 * realpath(3) for file->fts_accpath may warranted in order to ensure
-	 * that inherited ACL is always calculated based on the actual parent
-	 * directory.
-	 */
-	if (getcwd(parent, sizeof(parent)) == NULL) {
-		err(1, "%s: getcwd() failed.", entry->fts_accpath);
-	}
+static bool
+append_aces(struct nfs4_acl *acl, struct nfs4_acl *from, int is_dir,
+	    bool skip_inherited)
+{
+	struct nfs4_ace *ace = NULL;
+	struct nfs4_ace *new_ace = NULL;
 
-	parent_acl = nfs4_acl_get_file(parent);
-	if (parent_acl == NULL) {
-		warnx("%s: nfs4_acl_get_file() failed.", parent);
-		return (-1);
+	for(ace = nfs4_get_first_ace(from); ace != NULL;
+	    ace = nfs4_get_next_ace(&ace)) {
+		if (skip_inherited && (ace->flag & NFS4_ACE_INHERITED_ACE)) {
+			continue;
+		}
+		new_ace = nfs4_new_ace(is_dir, ace->type, ace->flag,
+				       ace->access_mask, ace->whotype,
+				       ace->who_id);
+		if (new_ace == NULL) {
+			return (false);
+		}
+		if (nfs4_append_ace(acl, new_ace) != 0) {
+			free(new_ace);
+			return (false);
+		}
 	}
+	return (true);
+}
 
-	to_inherit = nfs4_new_acl(is_dir);
-	if (to_inherit == NULL) {
-		nfs4_free_acl(parent_acl);
-		warnx("%s: nfs4_new_acl() failed.", entry->fts_accpath);
+static int
+auto_inherit_acl(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry,
+		 struct nfs4_acl *cur_acl)
+{
+	struct nfs4_acl *new_acl = NULL;
+	struct nfs4_acl *disk_acl = NULL;
+	struct inherit_frame *f = NULL;
+	int is_dir, error;
+	bool written;
+
+	if ((entry->parent == NULL) || (entry->parent->data == NULL)) {
+		warnx("%s: inheritable entries of parent are unknown\n",
+		      entry->path);
 		return (-1);
 	}
+	f = entry->parent->data;
 
-	/*
-	 * Get inheritable entries from parent that we will use to replace
-	 * our current inherited ones.
-	 */
-	ok = acl_nfs4_inherit_entries(parent_acl, to_inherit, is_dir);
-	if (!ok) {
-		nfs4_free_acl(parent_acl);
-		nfs4_free_acl(to_inherit);
+	if (IS_VERBOSE(w->flags)) {
+		fprintf(stdout, "%s\n", entry->path);
 	}
 
-	nfs4_free_acl(parent_acl);
-
+	is_dir = (entry->type == NFS4_ACL_WALK_DIR);
 	new_acl = nfs4_new_acl(is_dir);
 	if (new_acl == NULL) {
-		nfs4_free_acl(to_inherit);
-		warnx("%s: nfs4_new_acl() failed.", entry->fts_accpath);
+		warnx("%s: nfs4_new_acl() failed.", entry->path);
 		return (-1);
 	}
 
 	/*
-	 * First populate new ACL non-inherited entries from
-	 * original ACL.
+	 * Non-inherited entries of the original ACL come first, followed by
+	 * the inheritable entries of the parent directory. These replace
+	 * our current inherited ones.
 	 */
-	for(ace = nfs4_get_first_ace(cur_acl); ace != NULL;
-	    ace = nfs4_get_next_ace(&ace)) {
-		/* Prune any inherited entries */
-		if (ace->flag & NFS4_ACE_INHERITED_ACE) {
-			continue;
-		}
-		new_ace = nfs4_new_ace(is_dir, ace->type, ace->flag,
-				       ace->access_mask, ace->whotype,
-				       ace->who_id);
-		if (new_ace == NULL) {
-			nfs4_free_acl(to_inherit);
-			nfs4_free_acl(new_acl);
-			warnx("%s: nfs4_new_ace() failed.",
-			      entry->fts_accpath);
-			return (-1);
-		}
-
-		error = nfs4_append_ace(new_acl, new_ace);
-		if (error) {
-			nfs4_free_acl(to_inherit);
-			nfs4_free_acl(new_acl);
-			warnx("%s: nfs4_append_ace() failed.",
-			      entry->fts_accpath);
-			return (-1);
-		}
+	if (!append_aces(new_acl, cur_acl, is_dir, true) ||
+	    !append_aces(new_acl, is_dir ? f->dacl : f->facl, is_dir, false)) {
+		nfs4_free_acl(new_acl);
+		warnx("%s: nfs4_append_ace() failed.", entry->path);
+		return (-1);
+	}
+
+	error = nfs4_acl_set_at_if_changed(new_acl, entry->dirfd,
+					   entry->accpath, SET_FLAGS(w->flags),
+					   &written);
+	if (error) {
+		warnx("%s: nfs4_acl_set_file() failed.",
+		      entry->path);
+		nfs4_free_acl(new_acl);
+		return (error);
 	}
+	if (written) {
+		sample_diff(w, entry, new_acl);
+	}
+	count_write(w, entry, written, ACES_2_XDRSIZE(new_acl->naces));
 
 	/*
-	 * Now append inheritable entries from parent dir.
+	 * An equivalent ACL that was left in place may still differ in
+	 * what it passes down, so children inherit from what is on disk.
 	 */
-	for(ace = nfs4_get_first_ace(to_inherit); ace != NULL;
-	    ace = nfs4_get_next_ace(&ace)) {
-		new_ace = nfs4_new_ace(is_dir, ace->type, ace->flag,
-				       ace->access_mask, ace->whotype,
-				       ace->who_id);
-		if (new_ace == NULL) {
-			nfs4_free_acl(to_inherit);
-			nfs4_free_acl(new_acl);
-			warnx("%s: nfs4_new_ace() failed.",
-			      entry->fts_accpath);
-			return (-1);
-		}
-
-		error = nfs4_append_ace(new_acl, new_ace);
-		if (error) {
-			nfs4_free_acl(to_inherit);
+	if (is_dir && !written && (w->flags & WA_EQUIVALENT)) {
+		disk_acl = nfs4_acl_get_at(entry->dirfd, entry->accpath);
+		if (disk_acl == NULL) {
+			warn("%s: nfs4_acl_get_file() failed", entry->path);
 			nfs4_free_acl(new_acl);
-			warnx("%s: nfs4_append_ace() failed.",
-			      entry->fts_accpath);
 			return (-1);
 		}
+		nfs4_free_acl(new_acl);
+		new_acl = disk_acl;
 	}
-	error = nfs4_acl_set_file(new_acl, entry->fts_path);
-	if (error) {
-		warnx("%s: nfs4_acl_set_file() failed.",
-		      entry->fts_path);
-	}
+
+	error = push_inherit_frame(entry, new_acl);
+	nfs4_free_acl(new_acl);
 	return (error);
 }
 
+/*
+ * Returns 0 on success, NFS4_ACL_WALK_SKIP if the walk must not descend
+ * into `entry`, and -1 on failure.
+ */
 static int
-do_action(struct windows_acl_info *w, FTS *ftsp, FTSENT *entry, int action)
+do_action(struct windows_acl_info *w, struct nfs4_acl_walk_entry *entry,
+	  int action)
 {
 	int rval;
-	char *relpath = NULL;
 	struct nfs4_acl *aclp = NULL;
-	size_t slen, plen;
+	bool written;
 
 	switch(action){
 	/*
 	 * Restores ACL from source path.
 	 */
 	case WA_RESTORE:
-		slen = strlen(w->source);
-		plen = strlen(w->path);
-		relpath = get_relative_path(entry, plen);
-
-		if (strlen(entry->fts_path) > PATH_MAX) {
-			warnx("%s: PATH TOO LONG", entry->fts_path);
-			return -1;
-		}
-		rval = restore_acl(w, relpath, entry, slen);
-		break;
-
-	/*
-	 * Trial run. Just prints out basic information about FTS tree.
-	 */
-	case WA_TRIAL:
-		fprintf(stdout, "depth: %d, name: %s, full_path: %s\n",
-			entry->fts_level, entry->fts_name, entry->fts_path);
-		rval = 0;
+		rval = restore_acl(w, entry);
 		break;
 
 	/*
@@ -732,9 +1252,8 @@ do_action(struct windows_acl_info *w, FTS *ftsp, FTSENT *entry, int action)
 		       strip_acl(w, entry);
 
 		if ((rval != 0) && (errno == EOPNOTSUPP) &&
-		    (strcmp(entry->fts_accpath, ".zfs") == 0)) {
-			fts_set(ftsp, entry, FTS_SKIP);
-			rval = 0;
+		    (strcmp(entry->name, ".zfs") == 0)) {
+			rval = NFS4_ACL_WALK_SKIP;
 		}
 		else if ((rval != 0) && (errno == EOPNOTSUPP) && MAY_XDEV(w->flags)) {
 			rval = IS_POSIXACL(w->flags) ?
@@ -747,18 +1266,19 @@ do_action(struct windows_acl_info *w, FTS *ftsp, FTSENT *entry, int action)
 	 * Legacy chown() that has advantage of not crossing (or changing) mountpoints.
 	 */
 	case WA_CHOWN:
-		if ((w->uid == (uid_t)-1 || w->uid == entry->fts_statp->st_uid) &&
-		    (w->gid == (gid_t)-1 || w->gid == entry->fts_statp->st_gid)){
+		if ((w->uid == (uid_t)-1 || w->uid == entry->st.st_uid) &&
+		    (w->gid == (gid_t)-1 || w->gid == entry->st.st_gid)){
 			/* Nothing to do */
+			count_write(w, entry, false, 0);
 			rval = 0;
 			break;
 		}
 		if (IS_VERBOSE(w->flags))
-			fprintf(stdout, "%s\n", entry->fts_accpath);
+			fprintf(stdout, "%s\n", entry->path);
 
-		rval = chown(entry->fts_accpath, w->uid, w->gid);
-		if (rval < 0) {
-			warn("%s: chown() failed", entry->fts_accpath);
+		rval = chown_entry(w, entry);
+		if (rval == 0) {
+			count_write(w, entry, true, 0);
 		}
 		break;
 
@@ -772,15 +1292,29 @@ do_action(struct windows_acl_info *w, FTS *ftsp, FTSENT *entry, int action)
 		       set_acl_posix(w, entry) :
 		       set_acl(w, entry);
 		if ((rval != 0) && (errno == EOPNOTSUPP) &&
-		    (strcmp(entry->fts_accpath, ".zfs") == 0)) {
-			fts_set(ftsp, entry, FTS_SKIP);
-			rval = 0;
+		    (strcmp(entry->name, ".zfs") == 0)) {
+			rval = NFS4_ACL_WALK_SKIP;
 		}
 		else if ((rval != 0) && (errno == EOPNOTSUPP) && !IS_POSIXACL(w->flags)) {
-			fts_set(ftsp, entry, FTS_SKIP);
 			warnx("%s: path does not support NFSv4 ACLs. Skipping.",
-			      entry->fts_path);
-			rval = 0;
+			      entry->path);
+			rval = NFS4_ACL_WALK_SKIP;
+		}
+		break;
+
+	/*
+	 * Removes redundant entries from the ACL
+	 */
+	case WA_MINIMIZE:
+		if (IS_POSIXACL(w->flags)) {
+			warnx("%s: minimize is not supported for POSIX1E ACL type",
+			      entry->path);
+			return (-1);
+		}
+		rval = minimize_acl(w, entry);
+		if ((rval != 0) && (errno == EOPNOTSUPP) &&
+		    (strcmp(entry->name, ".zfs") == 0)) {
+			rval = NFS4_ACL_WALK_SKIP;
 		}
 		break;
 
@@ -791,16 +1325,22 @@ do_action(struct windows_acl_info *w, FTS *ftsp, FTSENT *entry, int action)
 		if (IS_POSIXACL(w->flags)) {
 			warnx("%s: NFSv41 auto-inheritance is not "
 			      "possible for POSIX1E ACL type\n",
-			      entry->fts_path);
+			      entry->path);
 			return (-1);
 		}
-		aclp = nfs4_acl_get_file(entry->fts_path);
+		if (entry->acl != NULL) {
+			aclp = entry->acl;
+			entry->acl = NULL;
+		}
+		else {
+			aclp = nfs4_acl_get_at(entry->dirfd, entry->accpath);
+		}
 		if (aclp == NULL) {
 			warnx("%s: nfs4_acl_get_file() failed",
-			      entry->fts_path);
+			      entry->path);
 			return (-1);
 		}
-		if (entry->fts_level == FTS_ROOTLEVEL){
+		if (entry->level == 0){
 			/*
 			 * We set ACL_PROTECTED on rootlevel of
 			 * our changes because we're de-facto breaking
@@ -808,24 +1348,35 @@ do_action(struct windows_acl_info *w, FTS *ftsp, FTSENT *entry, int action)
 			 * path.
 			 */
 			aclp->aclflags4 = ACL_PROTECTED;
-			rval = nfs4_acl_set_file(aclp, entry->fts_path);
+			rval = nfs4_acl_set_at_if_changed(aclp, entry->dirfd,
+							  entry->accpath,
+							  SET_FLAGS(w->flags) &
+							  NFS4_ACL_SET_DRY_RUN,
+							  &written);
 			if (rval) {
 				warnx("%s: Failed to set PROTECTED on root",
-				      entry->fts_path);
+				      entry->path);
+			}
+			else {
+				if (written) {
+					sample_diff(w, entry, aclp);
+				}
+				count_write(w, entry, written,
+					    ACES_2_XDRSIZE(aclp->naces));
+				rval = push_inherit_frame(entry, aclp);
 			}
 			nfs4_free_acl(aclp);
 			return rval;
 		}
 		/*
 		 * If PROTECTED flag is set, we should skip this entry
-		 * and prune from our FTS tree.
+		 * and prune it from the walk.
 		 */
 		if (aclp->aclflags4 & ACL_PROTECTED) {
-			fts_set(ftsp, entry, FTS_SKIP);
 			nfs4_free_acl(aclp);
-			return (0);
+			return (NFS4_ACL_WALK_SKIP);
 		}
-		rval = auto_inherit_acl(entry, aclp, w->flags);
+		rval = auto_inherit_acl(w, entry, aclp);
 		nfs4_free_acl(aclp);
 		break;
 
@@ -837,74 +1388,411 @@ do_action(struct windows_acl_info *w, FTS *ftsp, FTSENT *entry, int action)
 	return (rval);
 }
 
+/*
+ * The tree is walked with nfs4_acl_walk(). With -j, entries are handled
+ * by several threads at once, each with a private copy of the
+ * windows_acl_info for counters. A directory's action completes before
+ * any of its entries are visited, so inherit always sees the updated
+ * parent ACL, and directories skipped by an action (PROTECTED, .zfs)
+ * are not descended into.
+ */
+#define	WA_JOBS_MAX		256
+#define	WA_URING_DEPTH		64		/* reads in flight per thread */
+#define	WA_LATENCY_MAX		60000		/* ms */
+#define	WA_OPS_MAX		10000000
+#define	WA_ERRORS_MAX		32
+
+/*
+ * With --journal, the path (relative to -p) of every directory whose
+ * subtree has been done without errors is appended to a journal file,
+ * which is synced at most every WA_JOURNAL_SYNC seconds. A run that
+ * was interrupted, or that had errors, is continued with --resume,
+ * which skips the subtrees recorded so far. Records are NUL-terminated.
+ * The first one names the operation with every option that changes
+ * what it writes or which entries it reaches (WA_JOURNAL_FLAGS, owner,
+ * group and walk flags), so that a journal is not resumed by a
+ * different one, and a record torn by a crash is dropped.
+ */
+#define	WA_JOURNAL_SYNC		5	/* seconds */
+#define	WA_JOURNAL_VERSION	2
+#define	WA_JOURNAL_FLAGS	(~(WA_VERBOSE | WA_RESUME))
+
+struct wa_journal {
+	const char		*path;
+	FILE			*fp;
+	pthread_mutex_t		lock;
+	time_t			synced;
+	bool			failed;		/* warned about a write error */
+	void			*done;		/* tsearch() tree of records read */
+	size_t			ndone;
+};
+
 static int
-set_acls(struct windows_acl_info *w)
+journal_cmp(const void *a, const void *b)
 {
-	FTS *tree = NULL;
-	FTSENT *entry = NULL;
-	int options = 0;
-	char *paths[4];
-	int rval;
-	struct stat ftsroot_st;
+	return (strcmp(a, b));
+}
 
-	if (w == NULL)
+static int
+journal_open(struct wa_journal *j, struct windows_acl_info *w, int walk_flags)
+{
+	char hdr[(2 * PATH_MAX) + 64];
+	char *rec = NULL, *dup = NULL;
+	size_t recsz = 0;
+	ssize_t len;
+	off_t valid = 0;
+
+	j->path = w->journal;
+	j->fp = fdopen(w->journal_fd, "r+");
+	if (j->fp == NULL) {
+		warn("%s: fdopen() failed", j->path);
 		return (-1);
+	}
+	w->journal_fd = -1;
+	pthread_mutex_init(&j->lock, NULL);
+	j->synced = time(NULL);
 
-	if (stat(w->path, &ftsroot_st) < 0) {
-		err(EX_OSERR, "%s: stat() failed", w->path);
+	snprintf(hdr, sizeof(hdr),
+		 "nfs4xdr_winacl journal %d %08x %u %u %08x %s %s",
+		 WA_JOURNAL_VERSION, w->flags & WA_JOURNAL_FLAGS, w->uid,
+		 w->gid, walk_flags, w->path, w->source);
+
+	while ((len = getdelim(&rec, &recsz, '\0', j->fp)) > 0) {
+		if (rec[len - 1] != '\0') {
+			break;
+		}
+		if (valid == 0) {
+			if (strcmp(rec, hdr) != 0) {
+				warnx("%s: journal is for another operation "
+				      "or other options", j->path);
+				free(rec);
+				return (-1);
+			}
+		}
+		else if ((dup = strdup(rec)) == NULL) {
+			warn("%s: strdup() failed", j->path);
+			free(rec);
+			return (-1);
+		}
+		else if (tsearch(dup, &j->done, journal_cmp) == NULL) {
+			warn("%s: tsearch() failed", j->path);
+			free(dup);
+			free(rec);
+			return (-1);
+		}
+		else {
+			j->ndone++;
+		}
+		valid += len;
+	}
+	free(rec);
+	if (ferror(j->fp)) {
+		warn("%s: read failed", j->path);
+		return (-1);
 	}
 
-	paths[0] = w->path;
-	paths[1] = NULL;
+	/* appending after a torn record would garble the next one */
+	if ((ftruncate(fileno(j->fp), valid) != 0) ||
+	    (fseeko(j->fp, valid, SEEK_SET) != 0)) {
+		warn("%s: truncate failed", j->path);
+		return (-1);
+	}
+	if ((valid == 0) && (fwrite(hdr, strlen(hdr) + 1, 1, j->fp) != 1)) {
+		warn("%s: write failed", j->path);
+		return (-1);
+	}
+	return (0);
+}
 
-	if ((w->flags & WA_TRAVERSE) == 0 || (w->flags & WA_RESTORE)) {
-		options |= FTS_XDEV;
+static void
+journal_sync(struct wa_journal *j)
+{
+	if (((fflush(j->fp) != 0) || (fdatasync(fileno(j->fp)) != 0)) &&
+	    !j->failed) {
+		warn("%s: write failed", j->path);
+		j->failed = true;
 	}
+	j->synced = time(NULL);
+}
+
+static bool
+journal_done(struct wa_journal *j, const char *relpath)
+{
+	return ((j->done != NULL) &&
+		(tfind(relpath, &j->done, journal_cmp) != NULL));
+}
 
-	if ((tree = fts_open(paths, options, fts_compare)) == NULL)
-		err(EX_OSERR, "fts_open");
+static void
+journal_record(struct wa_journal *j, const char *relpath)
+{
+	pthread_mutex_lock(&j->lock);
+	fwrite(relpath, strlen(relpath) + 1, 1, j->fp);
+	if ((time(NULL) - j->synced) >= WA_JOURNAL_SYNC) {
+		journal_sync(j);
+	}
+	pthread_mutex_unlock(&j->lock);
+}
 
-	/* traverse directory hierarchy */
-	for (rval = 0; (entry = fts_read(tree)) != NULL;) {
-		if ((w->flags & WA_RECURSIVE) == 0) {
-			if (entry->fts_level == FTS_ROOTLEVEL){
-				rval = IS_POSIXACL(w->flags) ?
-				       set_acl_posix(w, entry) :
-				       set_acl(w, entry);
-				break;
-			}
+static void
+journal_close(struct wa_journal *j)
+{
+	if (j->fp == NULL) {
+		return;
+	}
+	journal_sync(j);
+	fclose(j->fp);
+	tdestroy(j->done, free);
+	pthread_mutex_destroy(&j->lock);
+}
+
+struct wa_walk {
+	int			action;
+	struct windows_acl_info	*w;		/* one per job */
+	unsigned int		njobs;
+	struct wa_journal	*journal;	/* NULL without --journal */
+	size_t			plen;		/* strlen(-p) */
+	pthread_mutex_t		err_lock;
+	size_t			nerrors;
+	struct {
+		char		*path;
+		int		error;
+	} errors[WA_ERRORS_MAX];
+};
+
+static void
+wa_error(struct wa_walk *wa, const char *path, int error)
+{
+	size_t i;
+
+	pthread_mutex_lock(&wa->err_lock);
+	i = wa->nerrors++;
+	if (i < WA_ERRORS_MAX) {
+		wa->errors[i].path = strdup(path);
+		wa->errors[i].error = error;
+	}
+	pthread_mutex_unlock(&wa->err_lock);
+}
+
+static int
+wa_walk_error(const char *path, int error, void *arg)
+{
+	warnx("%s: %s", path, strerror(error));
+	wa_error(arg, path, error);
+	return (0);
+}
+
+static const char *
+wa_relpath(struct wa_walk *wa, struct nfs4_acl_walk_entry *entry)
+{
+	return ((entry->parent == NULL) ? "." :
+		get_relative_path(entry, wa->plen));
+}
+
+/* A subtree has been done without errors */
+static void
+wa_walk_done(struct nfs4_acl_walk_entry *entry, void *arg)
+{
+	struct wa_walk *wa = arg;
+	const char *relpath = NULL;
+
+	if (wa->journal == NULL) {
+		return;
+	}
+	relpath = wa_relpath(wa, entry);
+	if (!journal_done(wa->journal, relpath)) {
+		journal_record(wa->journal, relpath);
+	}
+}
+
+static int
+wa_walk_fn(struct nfs4_acl_walk_entry *entry, void *arg)
+{
+	struct wa_walk *wa = arg;
+	struct windows_acl_info *w = &wa->w[entry->worker];
+	int rval;
+
+	if ((w->flags & WA_RECURSIVE) == 0) {
+		if (w->flags & WA_MINIMIZE) {
+			rval = do_action(w, entry, WA_MINIMIZE);
+		}
+		else {
+			rval = IS_POSIXACL(w->flags) ?
+			       set_acl_posix(w, entry) :
+			       set_acl(w, entry);
 		}
+		return ((rval < 0) ? -1 : NFS4_ACL_WALK_SKIP);
+	}
+
+	if ((entry->type != NFS4_ACL_WALK_DIR) &&
+	    (entry->type != NFS4_ACL_WALK_FILE)) {
+		return (0);
+	}
+
+	if ((wa->journal != NULL) && (entry->type == NFS4_ACL_WALK_DIR) &&
+	    journal_done(wa->journal, wa_relpath(wa, entry))) {
+		w->nresumed++;
+		return (NFS4_ACL_WALK_SKIP);
+	}
 
+	errno = 0;
+	rval = do_action(w, entry, wa->action);
+	if (rval < 0) {
 		/*
-		 * Recursively set permissions for the target path.
-		 * In case FTS_XDEV is set, we still need to check st_dev to avoid
-		 * resetting permissions on subdatasets (FTS_XDEV will only prevent us
-		 * from recursing into directories inside the subdataset.
+		 * Children of a directory that failed are left alone, and
+		 * neither it nor its ancestors are recorded as done.
 		 */
+		wa_error(wa, entry->path, errno);
+		return (-1);
+	}
+	return (rval);
+}
 
-		if ( (options & FTS_XDEV) && (ftsroot_st.st_dev != entry->fts_statp->st_dev) ){
-			continue;
-		}
+/*
+ * With -x every filesystem met is walked from a queue of its own, so
+ * that a slow dataset holds at most --fs-jobs threads while others
+ * progress. Reported with -v once the walk is done.
+ */
+static void
+wa_walk_fs(const struct nfs4_acl_walk_fs *fs, void *arg)
+{
+	struct wa_walk *wa = arg;
 
-		switch (entry->fts_info) {
-		case FTS_D:
-		case FTS_F:
-			rval = do_action(w, tree, entry, (w->flags & WA_OP_SET));
-			break;
+	if (!IS_VERBOSE(wa->w[0].flags))
+		return;
 
-		case FTS_ERR:
-			warnx("%s: %s", entry->fts_path, strerror(entry->fts_errno));
-			rval = -2;
-			continue;
-		}
+	fprintf(stdout, "%s: %zu files, %llu bytes of ACL %s, %.3f s\n",
+		fs->path, fs->nentries, (unsigned long long)fs->counter,
+		IS_TRIAL(wa->w[0].flags) ? "to write" : "written", fs->elapsed);
+}
 
-		if (rval < 0) {
-			err(EX_OSERR, "%s: set_acl() failed", entry->fts_accpath);
-			continue;
-		}
+static int
+set_acls(struct windows_acl_info *w)
+{
+	struct nfs4_acl_walk walk;
+	struct wa_journal journal;
+	struct timespec start, end;
+	struct wa_walk wa;
+	unsigned int i;
+	size_t nerrors;
+	int rval;
+
+	if (w == NULL)
+		return (-1);
+
+	memset(&wa, 0, sizeof(wa));
+	memset(&journal, 0, sizeof(journal));
+	wa.action = w->flags & WA_OP_SET;
+	wa.njobs = IS_PARALLEL(w) ? w->njobs : 1;
+	wa.plen = strlen(w->path);
+
+	memset(&walk, 0, sizeof(walk));
+	/*
+	 * Unless traversing mountpoints, entries on other filesystems
+	 * (subdatasets) are neither changed nor descended into.
+	 */
+	if ((w->flags & WA_TRAVERSE) == 0 || (w->flags & WA_RESTORE)) {
+		walk.flags |= NFS4_ACL_WALK_XDEV;
+	}
+	else if (IS_RECURSIVE(w->flags)) {
+		walk.flags |= NFS4_ACL_WALK_PER_FS;
+		/* by default, half of the threads may stall on one dataset */
+		walk.fs_jobs = (w->fs_jobs != 0) ? w->fs_jobs :
+			       (wa.njobs + 1) / 2;
+		walk.fs_fn = wa_walk_fs;
+	}
+	/* chown and chmod compare against the current owner and mode */
+	if ((w->flags & WA_CHOWN) || IS_POSIXACL(w->flags)) {
+		walk.flags |= NFS4_ACL_WALK_STAT;
+	}
+	/*
+	 * Inherit and minimize read every ACL before writing it, so the
+	 * walk reads them ahead in batches. Writes stay one per entry and
+	 * relative to the parent directory.
+	 */
+	if ((wa.action & (WA_INHERIT|WA_MINIMIZE)) &&
+	    IS_RECURSIVE(w->flags) && !IS_POSIXACL(w->flags)) {
+		walk.flags |= NFS4_ACL_WALK_ACL;
+		walk.uring_depth = WA_URING_DEPTH;
+	}
 
+	/* the journal records which walk this is, see journal_open() */
+	if (w->journal_fd != -1) {
+		if (journal_open(&journal, w, walk.flags) != 0) {
+			journal_close(&journal);
+			return (-1);
+		}
+		wa.journal = &journal;
+		if (IS_VERBOSE(w->flags) && (journal.ndone > 0)) {
+			fprintf(stdout, "%s: %zu directories done by an "
+				"earlier run\n", journal.path, journal.ndone);
+		}
 	}
 
+	pthread_mutex_init(&wa.err_lock, NULL);
+	wa.w = calloc(wa.njobs, sizeof(struct windows_acl_info));
+	if (wa.w == NULL) {
+		err(EX_OSERR, "calloc() failed");
+	}
+	for (i = 0; i < wa.njobs; i++) {
+		wa.w[i] = *w;
+		wa.w[i].nwritten = 0;
+		wa.w[i].nskipped = 0;
+		wa.w[i].nbytes = 0;
+		wa.w[i].nmissing = 0;
+		wa.w[i].nresumed = 0;
+	}
+
+	walk.order = w->order;
+	walk.max_mem = w->max_mem;
+	walk.jobs = wa.njobs;
+	walk.latency_target = w->latency_target;
+	walk.max_ops = w->max_ops;
+	walk.fn = wa_walk_fn;
+	walk.error_fn = wa_walk_error;
+	walk.done_fn = wa_walk_done;
+	walk.free_data = (wa.action == WA_RESTORE) ?
+			 free_restore_frame : free_inherit_frame;
+	walk.arg = &wa;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rval = nfs4_acl_walk(w->path, &walk);
+	if ((rval != 0) && (walk.nerrors == 0) && !walk.stopped) {
+		err(EX_OSERR, "%s: stat() failed", w->path);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	w->elapsed = (end.tv_sec - start.tv_sec) +
+		     (end.tv_nsec - start.tv_nsec) / 1e9;
+	w->nentries = walk.nentries;
+	w->peak_mem = walk.peak_mem;
+	w->final_jobs = walk.final_jobs;
+	for (i = 0; i < wa.njobs; i++) {
+		w->nwritten += wa.w[i].nwritten;
+		w->nskipped += wa.w[i].nskipped;
+		w->nbytes += wa.w[i].nbytes;
+		w->nmissing += wa.w[i].nmissing;
+		w->nresumed += wa.w[i].nresumed;
+	}
+	free(wa.w);
+	journal_close(&journal);
+
+	nerrors = wa.nerrors;
+	if (nerrors > 0) {
+		warnx("%zu errors:", nerrors);
+		for (i = 0; (i < nerrors) && (i < WA_ERRORS_MAX); i++) {
+			warnx("  %s: %s",
+			      wa.errors[i].path ? wa.errors[i].path : "?",
+			      strerror(wa.errors[i].error));
+			free(wa.errors[i].path);
+		}
+		if (nerrors > WA_ERRORS_MAX) {
+			warnx("  ... and %zu more", nerrors - WA_ERRORS_MAX);
+		}
+		if (wa.journal != NULL) {
+			warnx("run again with --resume to retry what failed");
+		}
+	}
+	pthread_mutex_destroy(&wa.err_lock);
 	return (rval);
 }
 
@@ -927,16 +1815,19 @@ usage_check(struct windows_acl_info *w)
 static int
 copy_parent_entries(struct nfs4_acl *parent_acl, int level)
 {
-	theacls[level].dacl = acl_nfs4_copy_acl(parent_acl);
-	if (theacls[level].dacl == NULL) {
-		warnx("Failed to copy parent NFSv4 ACL");
-		return (-1);
-	}
-	theacls[level].facl = acl_nfs4_copy_acl(parent_acl);
-	if (theacls[level].facl == NULL) {
+	/*
+	 * Children share the parent's entries, but not its ACL flags
+	 * (e.g. protected) or those the kernel reports (ACL_IS_DIR).
+	 * Keep the same flags as acl_nfs4_copy_acl() would.
+	 */
+	theacls[level].dacl = nfs4_acl_ref(parent_acl);
+	theacls[level].facl = nfs4_acl_ref(parent_acl);
+	if ((theacls[level].dacl == NULL) || (theacls[level].facl == NULL)) {
 		warnx("Failed to copy parent NFSv4 ACL");
 		return (-1);
 	}
+	theacls[level].dacl->aclflags4 &= ACL_IS_TRIVIAL;
+	theacls[level].facl->aclflags4 &= ACL_IS_TRIVIAL;
 	return (0);
 }
 
@@ -954,11 +1845,13 @@ calculate_inherited_acl(struct windows_acl_info *w, struct nfs4_acl *parent_acl,
 	}
 	error = nfs4_acl_is_trivial_np(parent_acl, &trivial);
 	if (error) {
+		nfs4_free_acl(d_acl);
 		warnx("acl_is_trivial() failed\n");
 		return (-1);
 	}
 	if (trivial) {
 		/* If Parent ACL is trivial, then simply copy it to child */
+		nfs4_free_acl(d_acl);
 		return (copy_parent_entries(parent_acl, level));
 	}
 
@@ -1004,6 +1897,85 @@ id(const char *name, const char *type)
 	return (val);
 }
 
+/*
+ * Parse a size with an optional K, M or G suffix. Returns 0 if invalid.
+ */
+static size_t
+get_size(const char *s)
+{
+	unsigned long long val;
+	char *ep = NULL;
+	int shift = 0;
+
+	errno = 0;
+	val = strtoull(s, &ep, 10);
+	if (errno || ep == s)
+		return (0);
+	switch (*ep) {
+	case 'k':
+	case 'K':
+		shift = 10;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		break;
+	case 'g':
+	case 'G':
+		shift = 30;
+		break;
+	}
+	if (shift != 0)
+		ep++;
+	if (*ep != '\0' || val > (SIZE_MAX >> shift))
+		return (0);
+	return ((size_t)val << shift);
+}
+
+static unsigned int
+get_jobs(const char *s)
+{
+	char *ep = NULL;
+	unsigned long njobs;
+
+	errno = 0;
+	njobs = strtoul(s, &ep, 10);
+	if (errno || *ep != '\0' || njobs == 0 || njobs > WA_JOBS_MAX)
+		errx(EX_USAGE, "%s: invalid number of jobs", s);
+	return (njobs);
+}
+
+/*
+ * Parse a latency in milliseconds, fractions allowed. Returns it in
+ * microseconds.
+ */
+static unsigned int
+get_latency(const char *s)
+{
+	char *ep = NULL;
+	double ms;
+
+	errno = 0;
+	ms = strtod(s, &ep);
+	if (errno || ep == s || *ep != '\0' || !(ms >= 0.001) ||
+	    ms > WA_LATENCY_MAX)
+		errx(EX_USAGE, "%s: invalid latency target", s);
+	return ((unsigned int)(ms * 1000));
+}
+
+static unsigned int
+get_ops(const char *s)
+{
+	char *ep = NULL;
+	unsigned long ops;
+
+	errno = 0;
+	ops = strtoul(s, &ep, 10);
+	if (errno || ep == s || *ep != '\0' || ops == 0 || ops > WA_OPS_MAX)
+		errx(EX_USAGE, "%s: invalid number of operations", s);
+	return (ops);
+}
+
 static gid_t
 a_gid(const char *s)
 {
@@ -1078,7 +2050,7 @@ prepare_clone(struct windows_acl_info *w)
 		return (-1);
 	}
 
-	w->source_acl = acl_nfs4_copy_acl(source_acl);
+	w->source_acl = source_acl;
 	if (calculate_inherited_acl(w, w->source_acl, 0) != 0) {
 		free_windows_acl_info(w);
 		return (-1);
@@ -1103,7 +2075,8 @@ main(int argc, char **argv)
 	}
 
 	w = new_windows_acl_info();
-	while ((ch = getopt(argc, argv, "a:O:G:c:s:p:CPrftvx")) != -1) {
+	while ((ch = getopt_long(argc, argv, "a:O:G:c:s:p:j:o:CPefrtvx",
+				 long_options, NULL)) != -1) {
 		switch (ch) {
 			case 'a': {
 				int action = get_action(optarg);
@@ -1137,6 +2110,34 @@ main(int argc, char **argv)
 				w->path = get_path(optarg);
 				break;
 
+			case 'j':
+				w->njobs = get_jobs(optarg);
+				break;
+
+			case 'F':
+				w->fs_jobs = get_jobs(optarg);
+				break;
+
+			case 'o':
+				if (nfs4_acl_walk_order_from_text(optarg, &w->order) != 0)
+					errx(EX_USAGE, "%s: invalid order", optarg);
+				break;
+
+			case 'T':
+				w->latency_target = get_latency(optarg);
+				break;
+
+			case 'Q':
+				w->max_ops = get_ops(optarg);
+				break;
+
+			case 'M':
+				w->max_mem = get_size(optarg);
+				if (w->max_mem < (1024 * 1024))
+					errx(EX_USAGE, "%s: invalid memory limit "
+					     "(minimum 1M)", optarg);
+				break;
+
 			case 'P':
 				w->flags |= WA_POSIXACL;
 				break;
@@ -1165,12 +2166,43 @@ main(int argc, char **argv)
 				w->flags |= WA_FORCE;
 				break;
 
+			case 'e':
+				w->flags |= WA_EQUIVALENT;
+				break;
+
+			case 'J':
+				free(w->journal);
+				w->journal = strdup(optarg);
+				if (w->journal == NULL)
+					err(EX_OSERR, "strdup() failed");
+				break;
+
+			case 'R':
+				w->flags |= WA_RESUME;
+				break;
+
 			case '?':
 			default:
 				usage(argv[0]);
 			}
 	}
 
+	if ((w->flags & WA_RESUME) && (w->journal == NULL))
+		errx(EX_USAGE, "--resume requires --journal");
+	/* opened before any chroot, the records are relative to -p */
+	if (w->journal != NULL) {
+		if (!IS_RECURSIVE(w->flags))
+			errx(EX_USAGE, "--journal requires recursive flag");
+		/* a dry run writes nothing, the journal included */
+		if (IS_TRIAL(w->flags))
+			errx(EX_USAGE, "--journal cannot be used with -t");
+		w->journal_fd = open(w->journal, O_RDWR | O_CREAT | O_CLOEXEC |
+				     ((w->flags & WA_RESUME) ? 0 : O_TRUNC),
+				     0600);
+		if (w->journal_fd == -1)
+			err(EX_CANTCREAT, "%s: open() failed", w->journal);
+	}
+
 	/* set the source to the destination if we lack -s */
 	if (w->source == NULL) {
 		if (w->flags & WA_RESTORE) {
@@ -1252,6 +2284,32 @@ main(int argc, char **argv)
 		ret = 1;
 	}
 
+	if (IS_TRIAL(w->flags)) {
+		print_dry_run(w);
+	}
+	else if ((w->flags & WA_OP_SET) == WA_RESTORE) {
+		fprintf(stdout, "%zu ACLs restored, %zu identical, "
+			"%zu missing in snapshot\n",
+			w->nwritten, w->nskipped, w->nmissing);
+	}
+	else if (IS_VERBOSE(w->flags) && ((w->flags & WA_OP_SET) != WA_CHOWN)) {
+		fprintf(stdout, "%zu ACLs written, %zu unchanged\n",
+			w->nwritten, w->nskipped);
+	}
+	if (IS_VERBOSE(w->flags) && (w->nresumed > 0)) {
+		fprintf(stdout, "%zu directories skipped, done by an earlier "
+			"run\n", w->nresumed);
+	}
+	if (IS_VERBOSE(w->flags) && (w->latency_target != 0) &&
+	    IS_RECURSIVE(w->flags)) {
+		fprintf(stdout, "%u of %u threads in use at the end\n",
+			w->final_jobs, w->njobs);
+	}
+	if (w->max_mem != 0 && IS_RECURSIVE(w->flags)) {
+		fprintf(stdout, "walk memory: %zu KiB peak, limit %zu KiB\n",
+			w->peak_mem / 1024, w->max_mem / 1024);
+	}
+
 	free_windows_acl_info(w);
 	return (ret);
 }